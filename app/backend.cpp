@@ -3,6 +3,7 @@
 #include <QBuffer>
 #include <QCoreApplication>
 #include <QDir>
+#include <QFile>
 #include <QMessageBox>
 #include <QNetworkDatagram>
 #include <QtConcurrent/QtConcurrent>
@@ -26,7 +27,7 @@ void vanillaEventHandler(void *context, int type, const char *data, size_t dataL
         emit backend->audioAvailable(QByteArray(data, dataLength));
         break;
     case VANILLA_EVENT_VIBRATE:
-        emit backend->vibrate(*data);
+        emit backend->vibrate(reinterpret_cast<const VanillaVibrateEvent *>(data)->on);
         break;
     }
 }
@@ -100,8 +101,12 @@ void BackendViaLocalRoot::syncFutureCompleted()
 BackendPipe::BackendPipe(const QString &wirelessInterface, QObject *parent) : QObject(parent)
 {
     m_process = nullptr;
+    m_daemon = nullptr;
     m_wirelessInterface = wirelessInterface;
 
+    // Created by a `vanilla-pipe <interface> -daemon` (usually started by systemd)
+    m_socketFilename = QStringLiteral("/run/vanilla-pipe/%1.sock").arg(wirelessInterface);
+
     m_process = new QProcess(this);
     m_process->setReadChannel(QProcess::StandardError);
     connect(m_process, &QProcess::readyReadStandardError, this, &BackendPipe::receivedData);
@@ -113,13 +118,49 @@ BackendPipe::~BackendPipe()
     quit();
 }
 
+bool BackendPipe::openDaemon()
+{
+    if (m_daemon) {
+        return true;
+    }
+
+    if (!QFile::exists(m_socketFilename)) {
+        return false;
+    }
+
+    m_daemon = new QLocalSocket(this);
+    m_daemon->connectToServer(m_socketFilename);
+    if (!m_daemon->waitForConnected(1000)) {
+        printf("Failed to connect to vanilla-pipe daemon: %s\n", qPrintable(m_daemon->errorString()));
+        delete m_daemon;
+        m_daemon = nullptr;
+        return false;
+    }
+
+    connect(m_daemon, &QLocalSocket::readyRead, this, &BackendPipe::receivedDaemonData);
+    connect(m_daemon, &QLocalSocket::disconnected, this, &BackendPipe::closed);
+    return true;
+}
+
 void BackendPipe::sync(uint16_t code)
 {
+    if (openDaemon()) {
+        m_daemon->write(QStringLiteral("SYNC %1\n").arg(code).toUtf8());
+        return;
+    }
+
     m_process->start(QStringLiteral("pkexec"), {pipeProcessFilename(), m_wirelessInterface, QStringLiteral("-sync"), QString::number(code)});
 }
 
 void BackendPipe::connectToConsole()
 {
+    // A running daemon is already associated with the console, so this skips starting
+    // wpa_supplicant (and the password prompt)
+    if (openDaemon()) {
+        m_daemon->write(QByteArrayLiteral("CONNECT\n"));
+        return;
+    }
+
     m_process->start(QStringLiteral("pkexec"), {pipeProcessFilename(), m_wirelessInterface, QStringLiteral("-connect")});
 }
 
@@ -140,8 +181,31 @@ void BackendPipe::receivedData()
     }
 }
 
+void BackendPipe::receivedDaemonData()
+{
+    while (m_daemon->canReadLine()) {
+        QByteArray a = m_daemon->readLine().trimmed();
+        if (a == QByteArrayLiteral("READY")) {
+            emit pipeAvailable();
+        } else {
+            printf("vanilla-pipe: %s\n", a.constData());
+            if (a == QByteArrayLiteral("SYNCED") || a == QByteArrayLiteral("FAILED")) {
+                emit closed();
+            }
+        }
+    }
+}
+
 void BackendPipe::quit()
 {
+    // The daemon stays connected to the console for next time, just let it know we're gone
+    if (m_daemon) {
+        disconnect(m_daemon, nullptr, this, nullptr);
+        m_daemon->disconnectFromServer();
+        m_daemon->deleteLater();
+        m_daemon = nullptr;
+    }
+
     if (m_process) {
         m_process->write(QByteArrayLiteral("QUIT\n"));
         m_process->waitForFinished();
@@ -2,6 +2,7 @@
 #define BACKEND_H
 
 #include <QBuffer>
+#include <QLocalSocket>
 #include <QMutex>
 #include <QObject>
 #include <QProcess>
@@ -28,11 +29,14 @@ signals:
 
 private slots:
     void receivedData();
+    void receivedDaemonData();
 
 private:
     static QString pipeProcessFilename();
+    bool openDaemon();
 
     QProcess *m_process;
+    QLocalSocket *m_daemon;
     QString m_socketFilename;
     QString m_wirelessInterface;
 
@@ -8,12 +8,31 @@
 static int g_buttonMap[SDL_CONTROLLER_BUTTON_MAX] = {-1};
 static int g_axisMap[SDL_CONTROLLER_AXIS_MAX] = {-1};
 
+// Sensor timestamps further apart than this are treated as a restart rather than one long sample
+static const uint64_t MAX_SENSOR_GAP_US = 100000;
+
+// Motion is forwarded at the HID rate (200Hz, for reference the Wii U gamepad is 180Hz)
+static const uint64_t SENSOR_PUBLISH_INTERVAL_MS = 5;
+
+// Upper bound on how long the SDL thread sleeps when nothing is happening
+static const int IDLE_WAIT_MS = 250;
+
+static Uint32 g_wakeEventType = (Uint32) -1;
+
 GamepadHandler::GamepadHandler(QObject *parent) : QObject(parent)
 {
     m_closed = false;
     m_controller = nullptr;
     m_nextGamepad = -2;
     m_vibrate = false;
+    m_wakePending = true;
+
+    if (g_wakeEventType == (Uint32) -1) {
+        g_wakeEventType = SDL_RegisterEvents(1);
+    }
+
+    memset(&m_accel, 0, sizeof(m_accel));
+    memset(&m_gyro, 0, sizeof(m_gyro));
 
     g_buttonMap[SDL_CONTROLLER_BUTTON_A] = VANILLA_BTN_A;
     g_buttonMap[SDL_CONTROLLER_BUTTON_B] = VANILLA_BTN_B;
@@ -43,6 +62,7 @@ void GamepadHandler::close()
     m_mutex.lock();
     m_closed = true;
     m_mutex.unlock();
+    wake();
 }
 
 void GamepadHandler::setController(int index)
@@ -50,6 +70,7 @@ void GamepadHandler::setController(int index)
     m_mutex.lock();
     m_nextGamepad = index;
     m_mutex.unlock();
+    wake();
 }
 
 void EnableSensorIfAvailable(SDL_GameController *controller, SDL_SensorType sensor)
@@ -66,87 +87,174 @@ int32_t packFloat(float f)
     return x;
 }
 
-void GamepadHandler::run()
+uint64_t sensorTimestamp(const SDL_ControllerSensorEvent &event)
 {
-    m_mutex.lock();
+#if SDL_VERSION_ATLEAST(2, 26, 0)
+    if (event.timestamp_us) {
+        return event.timestamp_us;
+    }
+#endif
+    return uint64_t(event.timestamp) * 1000;
+}
 
-    while (!m_closed) {// See status of rumble
-        if (m_nextGamepad != -2) {
-            if (m_controller) {
-                SDL_GameControllerClose(m_controller);
-            }
-            if (m_nextGamepad != -1) {
-                m_controller = SDL_GameControllerOpen(m_nextGamepad);
-                EnableSensorIfAvailable(m_controller, SDL_SENSOR_ACCEL);
-                EnableSensorIfAvailable(m_controller, SDL_SENSOR_GYRO);
-            } else {
-                m_controller = nullptr;
-            }
-            m_nextGamepad = -2;
-        }
-    
-        if (m_controller) {
-            uint16_t amount = m_vibrate ? 0xFFFF : 0;
-            SDL_GameControllerRumble(m_controller, amount, amount, 0);
-        }
+void GamepadHandler::accumulateSensor(SensorAccumulator *acc, const float *data, uint64_t timestamp)
+{
+    // Weight each sample by the time it covers so the average stays correct
+    // even if the controller reports at an uneven rate
+    uint64_t weight = 1;
+    if (acc->lastTimestamp && timestamp > acc->lastTimestamp && timestamp - acc->lastTimestamp < MAX_SENSOR_GAP_US) {
+        weight = timestamp - acc->lastTimestamp;
+    }
+    acc->lastTimestamp = timestamp;
 
-        m_mutex.unlock();
+    for (int i = 0; i < 3; i++) {
+        acc->sum[i] += data[i] * weight;
+    }
+    acc->weight += weight;
+}
 
-        SDL_Event event;
-        while (SDL_PollEvent(&event)) {
-            switch (event.type) {
-            case SDL_CONTROLLERDEVICEADDED:
-                emit gamepadsChanged();
+void GamepadHandler::publishSensors()
+{
+    // Controllers can report motion at up to 1kHz, but the console only sees one
+    // sample per HID packet, so send the average of everything since the last one
+    if (m_accel.weight) {
+        emit buttonStateChanged(VANILLA_SENSOR_ACCEL_X, packFloat(m_accel.sum[0] / m_accel.weight));
+        emit buttonStateChanged(VANILLA_SENSOR_ACCEL_Y, packFloat(m_accel.sum[1] / m_accel.weight));
+        emit buttonStateChanged(VANILLA_SENSOR_ACCEL_Z, packFloat(m_accel.sum[2] / m_accel.weight));
+        memset(m_accel.sum, 0, sizeof(m_accel.sum));
+        m_accel.weight = 0;
+    }
+
+    if (m_gyro.weight) {
+        emit buttonStateChanged(VANILLA_SENSOR_GYRO_PITCH, packFloat(m_gyro.sum[0] / m_gyro.weight));
+        emit buttonStateChanged(VANILLA_SENSOR_GYRO_YAW, packFloat(m_gyro.sum[1] / m_gyro.weight));
+        emit buttonStateChanged(VANILLA_SENSOR_GYRO_ROLL, packFloat(m_gyro.sum[2] / m_gyro.weight));
+        memset(m_gyro.sum, 0, sizeof(m_gyro.sum));
+        m_gyro.weight = 0;
+    }
+}
+
+void GamepadHandler::run()
+{
+    bool vibrating = false;
+    uint64_t lastPublish = 0;
+
+    while (true) {
+        // Only take the lock when another thread has asked us to do something
+        if (m_wakePending.exchange(false)) {
+            m_mutex.lock();
+
+            if (m_closed) {
+                m_mutex.unlock();
                 break;
-            case SDL_CONTROLLERDEVICEREMOVED:
-                // Our connected controller was disconnected
-                if (m_controller && event.cdevice.which == SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(m_controller))) {
+            }
+
+            if (m_nextGamepad != -2) {
+                if (m_controller) {
                     SDL_GameControllerClose(m_controller);
-                    m_controller = nullptr;
                 }
-                emit gamepadsChanged();
-                break;
-            case SDL_CONTROLLERDEVICEREMAPPED:
-                break;
-            case SDL_CONTROLLERBUTTONDOWN:
-            case SDL_CONTROLLERBUTTONUP:
-                if (m_controller && event.cdevice.which == SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(m_controller))) {
-                    int vanilla_btn = g_buttonMap[event.cbutton.button];
-                    if (vanilla_btn != -1) {
-                        emit buttonStateChanged(vanilla_btn, event.type == SDL_CONTROLLERBUTTONDOWN ? INT16_MAX : 0);
-                    }
-                }
-                break;
-            case SDL_CONTROLLERAXISMOTION:
-                if (m_controller && event.cdevice.which == SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(m_controller))) {
-                    int vanilla_axis = g_axisMap[event.caxis.axis];
-                    Sint16 axis_value = event.caxis.value;
-                    if (vanilla_axis != -1) {
-                        emit buttonStateChanged(vanilla_axis, axis_value);
-                    }
-                }
-                break;
-            case SDL_CONTROLLERSENSORUPDATE:
-                if (event.csensor.sensor == SDL_SENSOR_ACCEL) {
-                    emit buttonStateChanged(VANILLA_SENSOR_ACCEL_X, packFloat(event.csensor.data[0]));
-                    emit buttonStateChanged(VANILLA_SENSOR_ACCEL_Y, packFloat(event.csensor.data[1]));
-                    emit buttonStateChanged(VANILLA_SENSOR_ACCEL_Z, packFloat(event.csensor.data[2]));
-                } else if (event.csensor.sensor == SDL_SENSOR_GYRO) {
-                    emit buttonStateChanged(VANILLA_SENSOR_GYRO_PITCH, packFloat(event.csensor.data[0]));
-                    emit buttonStateChanged(VANILLA_SENSOR_GYRO_YAW, packFloat(event.csensor.data[1]));
-                    emit buttonStateChanged(VANILLA_SENSOR_GYRO_ROLL, packFloat(event.csensor.data[2]));
+                if (m_nextGamepad != -1) {
+                    m_controller = SDL_GameControllerOpen(m_nextGamepad);
+                    EnableSensorIfAvailable(m_controller, SDL_SENSOR_ACCEL);
+                    EnableSensorIfAvailable(m_controller, SDL_SENSOR_GYRO);
+                } else {
+                    m_controller = nullptr;
                 }
-                break;
+                m_nextGamepad = -2;
+                vibrating = false;
+
+                memset(&m_accel, 0, sizeof(m_accel));
+                memset(&m_gyro, 0, sizeof(m_gyro));
             }
+
+            // Rumble is only touched on transitions, each call is a write to the device
+            if (m_controller && m_vibrate != vibrating) {
+                uint16_t amount = m_vibrate ? 0xFFFF : 0;
+                SDL_GameControllerRumble(m_controller, amount, amount, 0);
+                vibrating = m_vibrate;
+            }
+
+            m_mutex.unlock();
+        }
+
+        // Sleep until SDL has something for us. If motion samples are waiting to be
+        // published, wake up in time for the next HID interval instead.
+        int timeout = IDLE_WAIT_MS;
+        if (m_accel.weight || m_gyro.weight) {
+            uint64_t elapsed = SDL_GetTicks64() - lastPublish;
+            timeout = elapsed >= SENSOR_PUBLISH_INTERVAL_MS ? 0 : int(SENSOR_PUBLISH_INTERVAL_MS - elapsed);
         }
 
-        // Don't spam CPU cycles, still allow for up to 200Hz polling (for reference, Wii U gamepad is 180Hz)
-        SDL_Delay(5);
+        SDL_Event event;
+        if (SDL_WaitEventTimeout(&event, timeout)) {
+            do {
+                processEvent(event);
+            } while (SDL_PollEvent(&event));
+        }
 
-        m_mutex.lock();
+        uint64_t now = SDL_GetTicks64();
+        if (now - lastPublish >= SENSOR_PUBLISH_INTERVAL_MS) {
+            publishSensors();
+            lastPublish = now;
+        }
     }
+}
 
-    m_mutex.unlock();
+void GamepadHandler::processEvent(const SDL_Event &event)
+{
+    switch (event.type) {
+    case SDL_CONTROLLERDEVICEADDED:
+        emit gamepadsChanged();
+        break;
+    case SDL_CONTROLLERDEVICEREMOVED:
+        // Our connected controller was disconnected
+        if (m_controller && event.cdevice.which == SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(m_controller))) {
+            SDL_GameControllerClose(m_controller);
+            m_controller = nullptr;
+        }
+        emit gamepadsChanged();
+        break;
+    case SDL_CONTROLLERDEVICEREMAPPED:
+        break;
+    case SDL_CONTROLLERBUTTONDOWN:
+    case SDL_CONTROLLERBUTTONUP:
+        if (m_controller && event.cdevice.which == SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(m_controller))) {
+            int vanilla_btn = g_buttonMap[event.cbutton.button];
+            if (vanilla_btn != -1) {
+                emit buttonStateChanged(vanilla_btn, event.type == SDL_CONTROLLERBUTTONDOWN ? INT16_MAX : 0);
+            }
+        }
+        break;
+    case SDL_CONTROLLERAXISMOTION:
+        if (m_controller && event.cdevice.which == SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(m_controller))) {
+            int vanilla_axis = g_axisMap[event.caxis.axis];
+            Sint16 axis_value = event.caxis.value;
+            if (vanilla_axis != -1) {
+                emit buttonStateChanged(vanilla_axis, axis_value);
+            }
+        }
+        break;
+    case SDL_CONTROLLERSENSORUPDATE:
+        if (event.csensor.sensor == SDL_SENSOR_ACCEL) {
+            accumulateSensor(&m_accel, event.csensor.data, sensorTimestamp(event.csensor));
+        } else if (event.csensor.sensor == SDL_SENSOR_GYRO) {
+            accumulateSensor(&m_gyro, event.csensor.data, sensorTimestamp(event.csensor));
+        }
+        break;
+    }
+}
+
+void GamepadHandler::wake()
+{
+    m_wakePending = true;
+
+    // Our own event type only exists to make SDL_WaitEventTimeout return
+    if (g_wakeEventType != (Uint32) -1) {
+        SDL_Event event;
+        SDL_zero(event);
+        event.type = g_wakeEventType;
+        SDL_PushEvent(&event);
+    }
 }
 
 void GamepadHandler::vibrate(bool on)
@@ -154,6 +262,7 @@ void GamepadHandler::vibrate(bool on)
     m_mutex.lock();
     m_vibrate = on;
     m_mutex.unlock();
+    wake();
 }
 
 void GamepadHandler::keyPressed(Qt::Key key)
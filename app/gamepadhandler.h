@@ -4,6 +4,7 @@
 #include <QMutex>
 #include <QObject>
 #include <SDL2/SDL.h>
+#include <atomic>
 
 class GamepadHandler : public QObject
 {
@@ -29,14 +30,30 @@ public slots:
     void keyReleased(Qt::Key key);
 
 private:
+    struct SensorAccumulator
+    {
+        float sum[3];
+        uint64_t weight;
+        uint64_t lastTimestamp;
+    };
+
+    void accumulateSensor(SensorAccumulator *acc, const float *data, uint64_t timestamp);
+    void publishSensors();
+    void processEvent(const SDL_Event &event);
+    void wake();
+
     QMutex m_mutex;
 
     bool m_closed;
     int m_nextGamepad;
     bool m_vibrate;
+    std::atomic_bool m_wakePending;
 
     SDL_GameController *m_controller;
 
+    SensorAccumulator m_accel;
+    SensorAccumulator m_gyro;
+
 };
 
 #endif // GAMEPAD_HANDLER_H
\ No newline at end of file
@@ -0,0 +1,199 @@
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gamepad/fec.h"
+
+// What the video parity costs against what it saves. Frames of video datagrams go through
+// fec_encoder and fec_decoder the way vanilla-pipe and the library use them, with datagrams of
+// both kinds dropped at random from a seeded generator, so every run with the same seed loses the
+// same datagrams. A frame that still has a datagram missing after recovery would need an IDR.
+//
+// Usage: vanilla-fec-bench [seed] [frames]
+
+#define BENCH_DEFAULT_SEED 1
+#define BENCH_DEFAULT_FRAMES 20000
+
+// Roughly a P-frame of the console's video
+#define BENCH_DATAGRAMS_PER_FRAME 12
+#define BENCH_MIN_PAYLOAD 200
+#define BENCH_MAX_PAYLOAD 1400
+
+// Sent without loss after the measured frames, so the decoder can give up on or recover whatever
+// it was still waiting for
+#define BENCH_TAIL_FRAMES 8
+
+static const double loss_rates[] = {0.001, 0.01, 0.02, 0.05, 0.10};
+static const int group_sizes[] = {0, 4, 8, 16, 32};
+
+typedef struct
+{
+    uint64_t data_sent;
+    uint64_t parity_sent;
+    uint64_t lost;
+    uint64_t recovered;
+    uint64_t corrupted;
+    uint64_t frames_needing_idr;
+} bench_result;
+
+// xorshift64, so the losses don't depend on the libc
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static int is_lost(uint64_t *state, double loss_rate)
+{
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0) < loss_rate;
+}
+
+// Every byte follows from the datagram's number, so anything rebuilt wrongly shows up
+static size_t make_payload(uint32_t number, uint64_t *state, uint8_t *out)
+{
+    size_t size = BENCH_MIN_PAYLOAD + next_random(state) % (BENCH_MAX_PAYLOAD - BENCH_MIN_PAYLOAD + 1);
+    uint32_t be = htonl(number);
+    memcpy(out, &be, sizeof(be));
+    for (size_t i = sizeof(be); i < size; i++) {
+        out[i] = (uint8_t) (number * 31 + i);
+    }
+    return size;
+}
+
+static int payload_is_intact(const uint8_t *data, size_t size, uint32_t *number)
+{
+    uint32_t be;
+    if (size < sizeof(be)) {
+        return 0;
+    }
+    memcpy(&be, data, sizeof(be));
+    *number = ntohl(be);
+    for (size_t i = sizeof(be); i < size; i++) {
+        if (data[i] != (uint8_t) (*number * 31 + i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void deliver(fec_decoder *d, const uint8_t *datagram, size_t size, uint8_t *delivered, uint32_t total, bench_result *r)
+{
+    static uint8_t out[FEC_MAX_PAYLOAD];
+    fec_decoder_push(d, datagram, size);
+
+    size_t out_size;
+    while ((out_size = fec_decoder_pop(d, out, sizeof(out))) > 0) {
+        uint32_t number;
+        if (!payload_is_intact(out, out_size, &number) || number >= total) {
+            r->corrupted++;
+            continue;
+        }
+        delivered[number] = 1;
+    }
+}
+
+static void run_bench(uint64_t seed, int frames, double loss_rate, int group_size, bench_result *r)
+{
+    memset(r, 0, sizeof(*r));
+
+    uint32_t total = (uint32_t) (frames + BENCH_TAIL_FRAMES) * BENCH_DATAGRAMS_PER_FRAME;
+    uint8_t *delivered = calloc(total, 1);
+
+    static fec_encoder encoder;
+    static fec_decoder decoder;
+    fec_encoder_init(&encoder, group_size);
+    fec_decoder_init(&decoder);
+
+    // Sizes and losses come from separate streams, so every group size sees the same video
+    uint64_t payload_state = seed * 2 + 1;
+    uint64_t loss_state = seed * 2 + 2;
+
+    static uint8_t datagram[sizeof(fec_header) + FEC_MAX_PAYLOAD];
+    static uint8_t parity[FEC_MAX_PAYLOAD];
+    for (uint32_t n = 0; n < total; n++) {
+        int measured = n < (uint32_t) frames * BENCH_DATAGRAMS_PER_FRAME;
+        int frame_end = (n % BENCH_DATAGRAMS_PER_FRAME) == BENCH_DATAGRAMS_PER_FRAME - 1;
+
+        size_t size = make_payload(n, &payload_state, datagram + sizeof(fec_header));
+        int lost = is_lost(&loss_state, loss_rate) && measured;
+        if (measured) {
+            r->data_sent++;
+            r->lost += lost;
+        }
+
+        if (group_size == 0) {
+            // Without parity what's lost stays lost
+            if (!lost) {
+                delivered[n] = 1;
+            }
+            continue;
+        }
+
+        fec_header header;
+        fec_encode_data(&encoder, datagram + sizeof(fec_header), size, &header);
+        memcpy(datagram, &header, sizeof(header));
+        if (!lost) {
+            deliver(&decoder, datagram, sizeof(fec_header) + size, delivered, total, r);
+        }
+
+        size_t parity_size;
+        if (fec_encode_parity(&encoder, frame_end, &header, parity, &parity_size)) {
+            int parity_lost = is_lost(&loss_state, loss_rate) && measured;
+            if (measured) {
+                r->parity_sent++;
+                r->lost += parity_lost;
+            }
+            if (!parity_lost) {
+                memcpy(datagram, &header, sizeof(header));
+                memcpy(datagram + sizeof(header), parity, parity_size);
+                deliver(&decoder, datagram, sizeof(header) + parity_size, delivered, total, r);
+            }
+        }
+    }
+
+    r->recovered = decoder.recovered;
+    for (int f = 0; f < frames; f++) {
+        for (int i = 0; i < BENCH_DATAGRAMS_PER_FRAME; i++) {
+            if (!delivered[f * BENCH_DATAGRAMS_PER_FRAME + i]) {
+                r->frames_needing_idr++;
+                break;
+            }
+        }
+    }
+
+    free(delivered);
+}
+
+int main(int argc, const char **argv)
+{
+    uint64_t seed = argc > 1 ? strtoull(argv[1], NULL, 0) : BENCH_DEFAULT_SEED;
+    int frames = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_FRAMES;
+    if (frames <= 0) {
+        fprintf(stderr, "Usage: %s [seed] [frames]\n", argv[0]);
+        return 1;
+    }
+
+    printf("seed %llu, %i frames of %i datagrams, group 0 is no parity\n", (unsigned long long) seed, frames, BENCH_DATAGRAMS_PER_FRAME);
+    printf("%6s %6s %10s %12s %10s %10s\n", "loss", "group", "overhead", "needing IDR", "recovered", "corrupted");
+
+    int failed = 0;
+    for (size_t l = 0; l < sizeof(loss_rates) / sizeof(loss_rates[0]); l++) {
+        for (size_t g = 0; g < sizeof(group_sizes) / sizeof(group_sizes[0]); g++) {
+            bench_result r;
+            run_bench(seed, frames, loss_rates[l], group_sizes[g], &r);
+            printf("%5.1f%% %6i %9.2f%% %5llu %5.2f%% %10llu %10llu\n", loss_rates[l] * 100, group_sizes[g],
+                   100.0 * r.parity_sent / r.data_sent, (unsigned long long) r.frames_needing_idr,
+                   100.0 * r.frames_needing_idr / frames, (unsigned long long) r.recovered, (unsigned long long) r.corrupted);
+            failed |= r.corrupted != 0;
+        }
+    }
+
+    // A datagram rebuilt wrongly is worse than one lost, the frontend would decode garbage
+    return failed;
+}
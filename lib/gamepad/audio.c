@@ -5,61 +5,42 @@
 #include <stdint.h>
 
 #include "gamepad.h"
+#include "reassembly.h"
 #include "status.h"
 #include "vanilla.h"
 #include "util.h"
 
-#pragma pack(push, 1)
-typedef struct {
-    unsigned format : 3;
-    unsigned mono : 1;
-    unsigned vibrate : 1;
-    unsigned type : 1;
-    unsigned seq_id : 10;
-    unsigned payload_size : 16;
-    unsigned timestamp : 32;
-    unsigned char payload[2048];
-} AudioPacket;
-const static unsigned int TYPE_AUDIO = 0;
-const static unsigned int TYPE_VIDEO = 1;
-#pragma pack(pop)
+int vibrate_on = 0;
+uint64_t vibrate_start = 0;
 
-typedef struct {
-    uint32_t timestamp;
-    uint32_t unknown_freq_0[2];
-    uint32_t unknown_freq_1[2];
-    uint32_t video_format;
-} AudioPacketVideoFormat;
-
-void handle_audio_packet(vanilla_event_handler_t event_handler, void *context, char *data, size_t len)
+void set_vibrate_state(vanilla_event_handler_t event_handler, void *context, int on)
 {
-    for (int byte = 0; byte < len; byte++) {
-        data[byte] = (unsigned char) reverse_bits(data[byte], 8);
+    // Every audio packet carries the vibrate bit, only tell the frontend when it changes
+    if (on == vibrate_on) {
+        return;
     }
 
-    AudioPacket *ap = (AudioPacket *) data;
+    VanillaVibrateEvent ev;
+    ev.on = on;
+    ev.timestamp = get_monotonic_time_us();
+    ev.duration = on ? 0 : (uint32_t) ((ev.timestamp - vibrate_start) / 1000);
 
-    ap->format = reverse_bits(ap->format, 3);
-    ap->seq_id = reverse_bits(ap->seq_id, 10);
-    ap->payload_size = reverse_bits(ap->payload_size, 16);
-    ap->timestamp = reverse_bits(ap->timestamp, 32);
-    for (int byte = 0; byte < ap->payload_size; ++byte) {
-        ap->payload[byte] = (unsigned char) reverse_bits(ap->payload[byte], 8);
-    }
+    vibrate_on = on;
+    vibrate_start = ev.timestamp;
 
-    if (ap->type == TYPE_VIDEO) {
-        AudioPacketVideoFormat *avp = (AudioPacketVideoFormat *) ap->payload;
-        avp->timestamp = ntohl(avp->timestamp);
-        avp->video_format = ntohl(avp->video_format);
+    event_handler(context, VANILLA_EVENT_VIBRATE, (const char *) &ev, sizeof(ev));
+}
 
-        // TODO: Implement
+void handle_audio_packet(vanilla_event_handler_t event_handler, void *context, unsigned char *data, size_t len)
+{
+    audio_block block;
+    if (!audio_packet_decode(data, len, &block)) {
         return;
     }
 
-    event_handler(context, VANILLA_EVENT_AUDIO, ap->payload, ap->payload_size);
+    event_handler(context, VANILLA_EVENT_AUDIO, (const char *) block.payload, block.payload_size);
 
-    uint8_t vibrate_val = ap->vibrate;
-    event_handler(context, VANILLA_EVENT_VIBRATE, &vibrate_val, sizeof(vibrate_val));
+    set_vibrate_state(event_handler, context, block.vibrate);
 }
 
 void *listen_audio(void *x)
@@ -67,13 +48,19 @@ void *listen_audio(void *x)
     struct gamepad_thread_context *info = (struct gamepad_thread_context *) x;
     unsigned char data[2048];
     ssize_t size;
+
+    vibrate_on = 0;
+
     do {
-        size = recv(info->socket_aud, data, sizeof(data), 0);
+        size = recv_from_console(VANILLA_RING_AUD, info->socket_aud, data, sizeof(data));
         if (size > 0) {
             if (is_stop_code(data, size)) break;
             handle_audio_packet(info->event_handler, info->context, data, size);
         }
     } while (!is_interrupted());
+
+    // Don't leave the frontend vibrating if the stream ends mid-rumble
+    set_vibrate_state(info->event_handler, info->context, 0);
     
     pthread_exit(NULL);
 
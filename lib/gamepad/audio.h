@@ -1,6 +1,9 @@
 #ifndef GAMEPAD_AUDIO_H
 #define GAMEPAD_AUDIO_H
 
+#include "vanilla.h"
+
 void *listen_audio(void *x);
+void set_vibrate_state(vanilla_event_handler_t event_handler, void *context, int on);
 
 #endif // GAMEPAD_AUDIO_H
\ No newline at end of file
@@ -0,0 +1,88 @@
+#include "bundle.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <string.h>
+
+// Per-frame cost of 802.11 at OFDM rates (DIFS, average backoff, preamble, SIFS and the ACK), and
+// the IP/UDP and MAC/LLC headers every frame carries. Only meant to compare the two approaches.
+#define AIRTIME_FRAME_OVERHEAD_US 100.0
+#define AIRTIME_HEADER_BYTES (28 + 36)
+#define AIRTIME_RATE_MBPS 54.0
+
+void bundle_writer_reset(bundle_writer *w)
+{
+    w->size = 0;
+    w->records = 0;
+}
+
+int bundle_writer_fits(const bundle_writer *w, size_t size)
+{
+    size_t needed = sizeof(bundle_record_header) + size;
+
+    // Something too big for a carrier of its own still goes, just without company
+    if (w->records == 0) {
+        return size <= BUNDLE_MAX_DATAGRAM;
+    }
+
+    return w->size + needed <= BUNDLE_TARGET_SIZE;
+}
+
+void bundle_writer_add(bundle_writer *w, uint8_t type, const void *data, size_t size)
+{
+    bundle_record_header header = {0};
+    header.type = type;
+    header.length = htons((uint16_t) size);
+
+    memcpy(w->data + w->size, &header, sizeof(header));
+    memcpy(w->data + w->size + sizeof(header), data, size);
+    w->size += sizeof(header) + size;
+    w->records++;
+}
+
+void bundle_reader_init(bundle_reader *r, const uint8_t *data, size_t size)
+{
+    r->data = data;
+    r->size = size;
+    r->offset = 0;
+}
+
+int bundle_reader_next(bundle_reader *r, uint8_t *type, const uint8_t **payload, size_t *payload_size)
+{
+    if (r->size - r->offset < sizeof(bundle_record_header)) {
+        return 0;
+    }
+
+    bundle_record_header header;
+    memcpy(&header, r->data + r->offset, sizeof(header));
+    size_t length = ntohs(header.length);
+    if (r->size - r->offset - sizeof(header) < length) {
+        // Truncated, nothing after this can be trusted
+        return 0;
+    }
+
+    *type = header.type;
+    *payload = r->data + r->offset + sizeof(header);
+    *payload_size = length;
+    r->offset += sizeof(header) + length;
+    return 1;
+}
+
+static double estimate_airtime_ms(uint64_t frames, uint64_t bytes)
+{
+    double us = frames * AIRTIME_FRAME_OVERHEAD_US + (bytes + frames * AIRTIME_HEADER_BYTES) * 8.0 / AIRTIME_RATE_MBPS;
+    return us / 1000.0;
+}
+
+void bundle_format_stats(char *out, size_t out_size, const bundle_stats *stats, double seconds)
+{
+    if (seconds <= 0) {
+        seconds = 1;
+    }
+
+    snprintf(out, out_size, "%llu DATAGRAMS IN %llu CARRIERS (%.0f/S INSTEAD OF %.0f/S), ESTIMATED AIRTIME %.1f MS INSTEAD OF %.1f MS",
+             (unsigned long long) stats->datagrams, (unsigned long long) stats->carriers,
+             stats->carriers / seconds, stats->datagrams / seconds,
+             estimate_airtime_ms(stats->carriers, stats->carrier_bytes),
+             estimate_airtime_ms(stats->datagrams, stats->datagram_bytes));
+}
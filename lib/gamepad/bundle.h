@@ -0,0 +1,65 @@
+#ifndef GAMEPAD_BUNDLE_H
+#define GAMEPAD_BUNDLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Packing of small datagrams into carrier datagrams for the pipe-to-frontend hop, shared between
+// the library and vanilla-pipe, so this must not depend on anything else in the library.
+//
+// A carrier is a run of records, each a bundle_record_header followed by `length` bytes of one
+// datagram. Carriers are kept under a typical MTU unless a single datagram is bigger than that.
+
+#define BUNDLE_TARGET_SIZE 1400
+#define BUNDLE_MAX_DATAGRAM 2048
+
+// Multi-byte fields are big endian
+typedef struct
+{
+    uint8_t type; // One of the VANILLA_PIPE_BUNDLE_* types
+    uint8_t reserved;
+    uint16_t length;
+} bundle_record_header;
+
+#define BUNDLE_MAX_SIZE (sizeof(bundle_record_header) + BUNDLE_MAX_DATAGRAM)
+
+typedef struct
+{
+    size_t size;
+    int records;
+    uint8_t data[BUNDLE_MAX_SIZE];
+} bundle_writer;
+
+void bundle_writer_reset(bundle_writer *w);
+
+// Whether a datagram of `size` bytes can be added without sending the carrier first
+int bundle_writer_fits(const bundle_writer *w, size_t size);
+
+// Append a datagram, bundle_writer_fits() must have been checked first
+void bundle_writer_add(bundle_writer *w, uint8_t type, const void *data, size_t size);
+
+typedef struct
+{
+    const uint8_t *data;
+    size_t size;
+    size_t offset;
+} bundle_reader;
+
+void bundle_reader_init(bundle_reader *r, const uint8_t *data, size_t size);
+
+// Returns 0 once there are no more (intact) records
+int bundle_reader_next(bundle_reader *r, uint8_t *type, const uint8_t **payload, size_t *payload_size);
+
+typedef struct
+{
+    uint64_t datagrams;
+    uint64_t datagram_bytes;
+    uint64_t carriers;
+    uint64_t carrier_bytes;
+} bundle_stats;
+
+// Summarise `stats` gathered over `seconds` as one line of text, including a rough estimate of
+// the Wi-Fi airtime the carriers took compared to sending every datagram on its own
+void bundle_format_stats(char *out, size_t out_size, const bundle_stats *stats, double seconds);
+
+#endif // GAMEPAD_BUNDLE_H
@@ -0,0 +1,355 @@
+#define _GNU_SOURCE
+#include "coalesce.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bundle.h"
+#include "gamepad.h"
+
+#include "../pipe/linux/def.h"
+#include "status.h"
+#include "util.h"
+
+static int requested_window_us = 0;
+
+static int carrier_socket = -1;
+static int wake_fd = -1;
+static int stopping = 0;
+static pthread_t carrier_thread;
+
+// Datagrams unpacked from carriers are handed to the channel's reader through these, [0] is read
+static int channel_sockets[VANILLA_RING_CHANNEL_COUNT][2];
+
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bundle_writer writer;
+static int window_us = 0;
+static int deadline_set = 0;
+static struct timespec deadline;
+
+static bundle_stats to_console;
+static bundle_stats to_frontend;
+static struct timespec started;
+
+void set_pipe_bundle(int window)
+{
+    // Has to fit in the bind flags
+    int max_window = (VANILLA_PIPE_BIND_BUNDLE_WINDOW_MASK >> VANILLA_PIPE_BIND_BUNDLE_WINDOW_SHIFT) * VANILLA_PIPE_BUNDLE_WINDOW_UNIT_US;
+    if (window < 0) {
+        window = 0;
+    } else if (window > max_window) {
+        window = max_window;
+    }
+    requested_window_us = window;
+}
+
+int get_pipe_bundle()
+{
+    return requested_window_us;
+}
+
+static uint8_t get_bundle_type(uint16_t port)
+{
+    if (port == PORT_MSG) return VANILLA_PIPE_BUNDLE_MSG;
+    if (port == PORT_AUD) return VANILLA_PIPE_BUNDLE_AUD;
+    if (port == PORT_CMD) return VANILLA_PIPE_BUNDLE_CMD;
+    if (port == PORT_HID) return VANILLA_PIPE_BUNDLE_HID;
+    return 0;
+}
+
+static int get_bundle_channel(uint8_t type)
+{
+    if (type == VANILLA_PIPE_BUNDLE_AUD) return VANILLA_RING_AUD;
+    if (type == VANILLA_PIPE_BUNDLE_CMD) return VANILLA_RING_CMD;
+    return -1;
+}
+
+static int64_t timespec_diff_ns(const struct timespec *a, const struct timespec *b)
+{
+    return (int64_t) (a->tv_sec - b->tv_sec) * 1000000000 + (a->tv_nsec - b->tv_nsec);
+}
+
+// Must be called with writer_mutex held
+static void flush_locked()
+{
+    if (writer.records > 0) {
+        if (send(carrier_socket, writer.data, writer.size, 0) != -1) {
+            to_console.carriers++;
+            to_console.carrier_bytes += writer.size;
+        }
+        bundle_writer_reset(&writer);
+    }
+    deadline_set = 0;
+}
+
+int bundle_to_console(uint16_t port, const struct iovec *packets, size_t count)
+{
+    if (carrier_socket == -1) {
+        return 0;
+    }
+
+    uint8_t type = get_bundle_type(port);
+    if (type == 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&writer_mutex);
+
+    for (size_t i = 0; i < count; i++) {
+        if (!bundle_writer_fits(&writer, packets[i].iov_len)) {
+            flush_locked();
+            if (!bundle_writer_fits(&writer, packets[i].iov_len)) {
+                continue;
+            }
+        }
+        bundle_writer_add(&writer, type, packets[i].iov_base, packets[i].iov_len);
+        to_console.datagrams++;
+        to_console.datagram_bytes += packets[i].iov_len;
+    }
+
+    if (writer.records > 0) {
+        if (window_us == 0) {
+            flush_locked();
+        } else if (!deadline_set) {
+            // The window starts with the oldest datagram in the carrier, let the carrier thread
+            // know when it ends
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_nsec += (long) window_us * 1000;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000;
+            deadline.tv_nsec %= 1000000000;
+            deadline_set = 1;
+
+            uint64_t one = 1;
+            write(wake_fd, &one, sizeof(one));
+        }
+    }
+
+    pthread_mutex_unlock(&writer_mutex);
+    return 1;
+}
+
+static void read_carriers()
+{
+    static uint8_t carrier[BUNDLE_MAX_SIZE];
+
+    while (1) {
+        ssize_t r = recv(carrier_socket, carrier, sizeof(carrier), MSG_DONTWAIT);
+        if (r < 0) {
+            break;
+        }
+
+        to_frontend.carriers++;
+        to_frontend.carrier_bytes += r;
+
+        bundle_reader reader;
+        bundle_reader_init(&reader, carrier, r);
+
+        uint8_t type;
+        const uint8_t *payload;
+        size_t payload_size;
+        while (bundle_reader_next(&reader, &type, &payload, &payload_size)) {
+            to_frontend.datagrams++;
+            to_frontend.datagram_bytes += payload_size;
+
+            int channel = get_bundle_channel(type);
+            if (channel != -1) {
+                // Drop rather than wait if the reader has fallen behind, same as a full UDP socket would
+                send(channel_sockets[channel][1], payload, payload_size, MSG_DONTWAIT);
+            }
+        }
+    }
+}
+
+static void *run_carrier_thread(void *x)
+{
+    (void) x;
+
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+        struct timespec timeout;
+        struct timespec *timeout_ptr = NULL;
+
+        pthread_mutex_lock(&writer_mutex);
+        if (deadline_set) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            int64_t remaining = timespec_diff_ns(&deadline, &now);
+            if (remaining < 0) {
+                remaining = 0;
+            }
+            timeout.tv_sec = remaining / 1000000000;
+            timeout.tv_nsec = remaining % 1000000000;
+            timeout_ptr = &timeout;
+        }
+        pthread_mutex_unlock(&writer_mutex);
+
+        struct pollfd pfd[2];
+        pfd[0].fd = carrier_socket;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = wake_fd;
+        pfd[1].events = POLLIN;
+        if (ppoll(pfd, 2, timeout_ptr, NULL) < 0 && errno != EINTR) {
+            break;
+        }
+
+        if (pfd[1].revents & POLLIN) {
+            uint64_t count;
+            read(wake_fd, &count, sizeof(count));
+        }
+
+        if (pfd[0].revents & POLLIN) {
+            read_carriers();
+        }
+
+        pthread_mutex_lock(&writer_mutex);
+        if (deadline_set) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (timespec_diff_ns(&deadline, &now) <= 0) {
+                flush_locked();
+            }
+        }
+        pthread_mutex_unlock(&writer_mutex);
+    }
+
+    return NULL;
+}
+
+int open_pipe_bundle(uint32_t server_address, int window)
+{
+    for (int i = 0; i < VANILLA_RING_CHANNEL_COUNT; i++) {
+        channel_sockets[i][0] = channel_sockets[i][1] = -1;
+    }
+
+    carrier_socket = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (carrier_socket == -1) {
+        return 0;
+    }
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(VANILLA_PIPE_BUNDLE_CLIENT_PORT);
+    if (bind(carrier_socket, (const struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        print_info("FAILED TO BIND BUNDLE PORT %u: %i", VANILLA_PIPE_BUNDLE_CLIENT_PORT, errno);
+        goto fail;
+    }
+
+    // Only the pipe sends carriers, and everything we send goes there
+    addr.sin_addr.s_addr = server_address;
+    addr.sin_port = htons(VANILLA_PIPE_BUNDLE_SERVER_PORT);
+    if (connect(carrier_socket, (const struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        goto fail;
+    }
+
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (wake_fd == -1) {
+        goto fail;
+    }
+
+    for (int i = 0; i < VANILLA_RING_CHANNEL_COUNT; i++) {
+        if (i == VANILLA_RING_VID) {
+            // Video is never bundled
+            continue;
+        }
+        if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, channel_sockets[i]) == -1) {
+            goto fail;
+        }
+    }
+
+    window_us = window;
+    deadline_set = 0;
+    bundle_writer_reset(&writer);
+    memset(&to_console, 0, sizeof(to_console));
+    memset(&to_frontend, 0, sizeof(to_frontend));
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    stopping = 0;
+    if (pthread_create(&carrier_thread, NULL, run_carrier_thread, NULL) != 0) {
+        goto fail;
+    }
+
+    return 1;
+
+fail:
+    for (int i = 0; i < VANILLA_RING_CHANNEL_COUNT; i++) {
+        if (channel_sockets[i][0] != -1) {
+            close(channel_sockets[i][0]);
+            close(channel_sockets[i][1]);
+            channel_sockets[i][0] = channel_sockets[i][1] = -1;
+        }
+    }
+    if (wake_fd != -1) {
+        close(wake_fd);
+        wake_fd = -1;
+    }
+    close(carrier_socket);
+    carrier_socket = -1;
+    return 0;
+}
+
+void wake_pipe_bundle()
+{
+    if (carrier_socket == -1) {
+        return;
+    }
+
+    for (int i = 0; i < VANILLA_RING_CHANNEL_COUNT; i++) {
+        if (channel_sockets[i][0] != -1) {
+            shutdown(channel_sockets[i][0], SHUT_RD);
+        }
+    }
+}
+
+void close_pipe_bundle()
+{
+    if (carrier_socket == -1) {
+        return;
+    }
+
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    uint64_t one = 1;
+    write(wake_fd, &one, sizeof(one));
+    pthread_join(carrier_thread, NULL);
+
+    pthread_mutex_lock(&writer_mutex);
+    flush_locked();
+    pthread_mutex_unlock(&writer_mutex);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double seconds = timespec_diff_ns(&now, &started) / 1e9;
+
+    char line[256];
+    bundle_format_stats(line, sizeof(line), &to_console, seconds);
+    print_info("BUNDLED TO PIPE: %s", line);
+    bundle_format_stats(line, sizeof(line), &to_frontend, seconds);
+    print_info("BUNDLED FROM PIPE: %s", line);
+
+    for (int i = 0; i < VANILLA_RING_CHANNEL_COUNT; i++) {
+        if (channel_sockets[i][0] != -1) {
+            close(channel_sockets[i][0]);
+            close(channel_sockets[i][1]);
+            channel_sockets[i][0] = channel_sockets[i][1] = -1;
+        }
+    }
+    close(wake_fd);
+    wake_fd = -1;
+    close(carrier_socket);
+    carrier_socket = -1;
+}
+
+int get_bundle_channel_fd(int channel)
+{
+    if (carrier_socket == -1) {
+        return -1;
+    }
+    return channel_sockets[channel][0];
+}
@@ -0,0 +1,24 @@
+#ifndef GAMEPAD_COALESCE_H
+#define GAMEPAD_COALESCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+void set_pipe_bundle(int window_us);
+int get_pipe_bundle();
+
+// Open the carrier socket to the pipe at `server_address` (network byte order), returns 0 on failure
+int open_pipe_bundle(uint32_t server_address, int window_us);
+void close_pipe_bundle();
+
+// Wake up anything blocked reading a bundled channel
+void wake_pipe_bundle();
+
+// Queue datagrams for `port` into the next carrier, returns 0 if they should be sent as they are
+int bundle_to_console(uint16_t port, const struct iovec *packets, size_t count);
+
+// Socket a channel's datagrams are read from while they arrive in carriers, or -1
+int get_bundle_channel_fd(int channel);
+
+#endif // GAMEPAD_COALESCE_H
@@ -218,34 +218,48 @@ enum MethodIDPeripheral
     METHOD_ID_PERIPHERAL_SET_REMOCON = 0x18,
 };
 
-void send_ack_packet(int skt, CmdHeader *pkt)
+void build_ack_packet(CmdHeader *ack, const CmdHeader *pkt)
 {
-    CmdHeader ack;
-    ack.packet_type = pkt->packet_type == PACKET_TYPE_REQUEST ? PACKET_TYPE_REQUEST_ACK : PACKET_TYPE_RESPONSE_ACK;
-    ack.query_type = pkt->query_type;
-    ack.payload_size = 0;
-    ack.seq_id = pkt->seq_id;
-    send_to_console(skt, &ack, sizeof(ack), PORT_CMD);
+    ack->packet_type = pkt->packet_type == PACKET_TYPE_REQUEST ? PACKET_TYPE_REQUEST_ACK : PACKET_TYPE_RESPONSE_ACK;
+    ack->query_type = pkt->query_type;
+    ack->payload_size = 0;
+    ack->seq_id = pkt->seq_id;
 }
 
-void send_quick_response(int skt, CmdHeader *request)
+void send_ack_packet(int skt, const CmdHeader *ack)
+{
+    send_to_console(skt, ack, sizeof(*ack), PORT_CMD);
+}
+
+void send_response_with_ack(int skt, const CmdHeader *ack, const CmdHeader *response)
+{
+    // The ACK and the response always go out back-to-back, so hand both to the kernel at once
+    struct iovec packets[2];
+    packets[0].iov_base = (void *) ack;
+    packets[0].iov_len = sizeof(*ack);
+    packets[1].iov_base = (void *) response;
+    packets[1].iov_len = response->payload_size + sizeof(CmdHeader);
+    send_to_console_batch(skt, packets, 2, PORT_CMD);
+}
+
+void send_quick_response(int skt, const CmdHeader *ack, CmdHeader *request)
 {
     CmdHeader response;
     response.packet_type = PACKET_TYPE_RESPONSE;
     response.payload_size = 0;
     response.query_type = request->query_type;
     response.seq_id = request->seq_id;
-    send_to_console(skt, &response, sizeof(CmdHeader), PORT_CMD);
+    send_response_with_ack(skt, ack, &response);
 }
 
-void send_generic_response(int skt, CmdHeader *response)
+void send_generic_response(int skt, const CmdHeader *ack, CmdHeader *response)
 {
     response->packet_type = PACKET_TYPE_RESPONSE;
 
-    send_to_console(skt, response, response->payload_size + sizeof(CmdHeader), PORT_CMD);
+    send_response_with_ack(skt, ack, response);
 }
 
-void handle_generic_packet(int skt, GenericPacket *request)
+void handle_generic_packet(int skt, const CmdHeader *ack, GenericPacket *request)
 {
     GenericCmdHeader *gen_cmd = &request->generic_cmd_header;
     print_info("magic: %x, flags: %x, service ID: %u, method ID: %u", gen_cmd->magic_0x7E, gen_cmd->flags, gen_cmd->service_id, gen_cmd->method_id);
@@ -357,52 +371,58 @@ void handle_generic_packet(int skt, GenericPacket *request)
     response.cmd_header.seq_id = request->cmd_header.seq_id;
     response.cmd_header.query_type = request->cmd_header.query_type;
     response.cmd_header.payload_size = ntohs(response.generic_cmd_header.payload_size) + sizeof(GenericCmdHeader);
-    send_generic_response(skt, (CmdHeader *) &response);
+    send_generic_response(skt, ack, (CmdHeader *) &response);
 }
 
-void handle_uac_uvc_packet(int skt, UvcUacPacket *request)
+void handle_uac_uvc_packet(int skt, const CmdHeader *ack, UvcUacPacket *request)
 {
     print_info("uac/uvc - mic_enable: %u, mic_freq: %u, mic_mute: %u, mic_volume: %i, mic_volume2: %i", request->uac_uvc.mic_enable, request->uac_uvc.mic_freq, request->uac_uvc.mic_mute, request->uac_uvc.mic_volume, request->uac_uvc.mic_volume_2);
 
-    // send_quick_response(skt, &request->cmd_header);
+    // send_quick_response(skt, ack, &request->cmd_header);
+    send_ack_packet(skt, ack);
 }
 
-void handle_time_packet(int skt, TimePacket *request)
+void handle_time_packet(int skt, const CmdHeader *ack, TimePacket *request)
 {
     print_info("time - days: %u, padding: %u, seconds: %u", request->time.days_counter, request->time.padding, request->time.seconds_counter);
     
-    send_quick_response(skt, &request->cmd_header);
+    send_quick_response(skt, ack, &request->cmd_header);
 }
 
 void handle_command_packet(int skt, CmdHeader *request)
 {
+    CmdHeader ack;
+
     switch (request->packet_type)
     {
     case PACKET_TYPE_REQUEST:
-        send_ack_packet(skt, request);
+        // Handlers are responsible for sending the ACK, so it can go out together with their response
+        build_ack_packet(&ack, request);
         switch (request->query_type)
         {
         case CMD_GENERIC:
         {
-            handle_generic_packet(skt, (GenericPacket *)request);
+            handle_generic_packet(skt, &ack, (GenericPacket *)request);
             break;
         }
         case CMD_UVC_UAC:
         {
-            handle_uac_uvc_packet(skt, (UvcUacPacket *)request);
+            handle_uac_uvc_packet(skt, &ack, (UvcUacPacket *)request);
             break;
         }
         case CMD_TIME:
         {
-            handle_time_packet(skt, (TimePacket *)request);
+            handle_time_packet(skt, &ack, (TimePacket *)request);
             break;
         }
         default:
+            send_ack_packet(skt, &ack);
             print_info("[Command] Unhandled request command: %u", request->query_type);
         }
         break;
     case PACKET_TYPE_RESPONSE:
-        send_ack_packet(skt, request);
+        build_ack_packet(&ack, request);
+        send_ack_packet(skt, &ack);
         switch (request->query_type)
         {
         default:
@@ -427,7 +447,7 @@ void *listen_command(void *x)
 
     do
     {
-        size = recv(info->socket_cmd, data, sizeof(data), 0);
+        size = recv_from_console(VANILLA_RING_CMD, info->socket_cmd, data, sizeof(data));
         if (size > 0)
         {
             if (is_stop_code(data, size))
@@ -0,0 +1,122 @@
+#include "escalation.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "status.h"
+
+static const char *step_names[VANILLA_RECOVERY_STEP_COUNT] = {"IDR", "REBIND", "REASSOCIATE"};
+
+void escalation_init(escalation *e, const char *name, const char **stream_names, int stream_count)
+{
+    memset(e, 0, sizeof(*e));
+    e->name = name;
+    e->stream_names = stream_names;
+    e->stream_count = stream_count;
+}
+
+static void log_stall_end(const escalation *e, const char *outcome, uint64_t now)
+{
+    // A step that didn't apply has no time, nothing could happen at 0 MS
+    char steps[128] = "";
+    int len = 0;
+    for (int i = 0; i < e->steps_taken && len < (int) sizeof(steps); i++) {
+        if (e->stats.step_ms[i]) {
+            len += snprintf(steps + len, sizeof(steps) - len, "%s%s AT %u MS", len ? ", " : " (", step_names[i], e->stats.step_ms[i]);
+        }
+    }
+    if (len > 0 && len < (int) sizeof(steps)) {
+        snprintf(steps + len, sizeof(steps) - len, ")");
+    }
+
+    print_info("%s%s%s AFTER %llu MS%s", outcome, e->name ? " ON " : "", e->name ? e->name : "",
+               (unsigned long long) (now - e->stall_start_us) / 1000, steps);
+}
+
+int escalation_check(escalation *e, const uint32_t *thresholds_ms, const uint64_t *progress_us, uint64_t now, uint64_t elapsed)
+{
+    uint32_t stalled = 0;
+    uint64_t stall_start = 0;
+    int due = -1;
+    for (int i = 0; i < e->stream_count; i++) {
+        uint64_t threshold_us = thresholds_ms[i] * 1000ULL;
+        uint64_t quiet = now - progress_us[i];
+        if (threshold_us == 0 || quiet < threshold_us) {
+            continue;
+        }
+
+        stalled |= 1 << i;
+        if (!stall_start || progress_us[i] < stall_start) {
+            stall_start = progress_us[i];
+        }
+
+        // Each step is due once the stream has been quiet for twice as long as the one before
+        for (int step = 0; step < VANILLA_RECOVERY_STEP_COUNT && quiet >= threshold_us << step; step++) {
+            if (step > due) {
+                due = step;
+            }
+        }
+    }
+
+    e->stalled_streams = stalled;
+    e->stats.connected_us += elapsed;
+
+    if (!stalled) {
+        if (e->stall_start_us) {
+            // It was still stalled as of the last check
+            e->stats.stalled_us += elapsed;
+            e->stats.recoveries++;
+            e->stats.recovery_us += now - e->stall_start_us;
+            e->stats.stalled = 0;
+            log_stall_end(e, "RECOVERED", now);
+            e->stall_start_us = 0;
+        }
+        return -1;
+    }
+
+    if (!e->stall_start_us) {
+        e->stall_start_us = stall_start;
+        e->steps_taken = 0;
+        memset(e->stats.step_ms, 0, sizeof(e->stats.step_ms));
+        e->stats.stalled = 1;
+        e->stats.stalls++;
+        e->stats.stalled_us += now - stall_start;
+
+        char streams[64] = "";
+        int len = 0;
+        for (int i = 0; i < e->stream_count && len < (int) sizeof(streams); i++) {
+            if (stalled & (1 << i)) {
+                len += snprintf(streams + len, sizeof(streams) - len, "%s%s", len ? ", " : "", e->stream_names[i]);
+            }
+        }
+        print_info("NOTHING FROM CONSOLE%s%s FOR %llu MS (%s)", e->name ? " ON " : "", e->name ? e->name : "",
+                   (unsigned long long) (now - stall_start) / 1000, streams);
+    } else {
+        e->stats.stalled_us += elapsed;
+    }
+
+    if (e->steps_taken < VANILLA_RECOVERY_STEP_COUNT) {
+        return due >= e->steps_taken ? e->steps_taken : -1;
+    }
+    return now - e->last_step_us >= ESCALATION_REASSOCIATE_INTERVAL_US ? VANILLA_RECOVERY_REASSOCIATE : -1;
+}
+
+void escalation_step_taken(escalation *e, int step, int taken, uint64_t now)
+{
+    if (step == e->steps_taken) {
+        e->stats.step_ms[step] = taken ? (now - e->stall_start_us) / 1000 : 0;
+        e->steps_taken++;
+    }
+    e->stats.steps[step] += taken;
+    e->last_step_us = now;
+}
+
+void escalation_stop(escalation *e, uint64_t now)
+{
+    if (e->stall_start_us) {
+        log_stall_end(e, "STALL ENDED UNRECOVERED", now);
+        e->stall_start_us = 0;
+        e->stalled_streams = 0;
+        e->stats.stalled = 0;
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef GAMEPAD_ESCALATION_H
+#define GAMEPAD_ESCALATION_H
+
+#include <stdint.h>
+
+#include "vanilla.h"
+
+// When a stream from the console goes quiet and what to try about it, shared between the library's
+// watchdog and vanilla-pipe's, so this must not depend on anything in the library besides
+// print_info(), which vanilla-pipe has its own of. Callers keep track of when their streams last
+// received anything and take the steps themselves.
+
+// Reassociating takes a few seconds, so while a stall goes on it's repeated no more often than this
+#define ESCALATION_REASSOCIATE_INTERVAL_US (10 * 1000 * 1000)
+
+typedef struct
+{
+    // Who the logs are about, e.g. the interface, or NULL. Stream names are indexed like the
+    // thresholds and progress passed to escalation_check().
+    const char *name;
+    const char **stream_names;
+    int stream_count;
+
+    // When the stalled streams last received anything, 0 while nothing is stalled
+    uint64_t stall_start_us;
+
+    // Which streams were stalled as of the last check
+    uint32_t stalled_streams;
+
+    // Steps taken in this stall, and when the last one was
+    int steps_taken;
+    uint64_t last_step_us;
+
+    // connected_us counts the time escalation_check() was called over
+    VanillaStallStats stats;
+} escalation;
+
+void escalation_init(escalation *e, const char *name, const char **stream_names, int stream_count);
+
+// Look for streams that have received nothing for longer than their threshold (0 isn't watched),
+// `elapsed` after the last check. Returns the VanillaRecoveryStep to take now, or -1.
+int escalation_check(escalation *e, const uint32_t *thresholds_ms, const uint64_t *progress_us, uint64_t now, uint64_t elapsed);
+
+// Record a step escalation_check() asked for, `taken` is 0 if it didn't apply this time
+void escalation_step_taken(escalation *e, int step, int taken, uint64_t now);
+
+// Nothing is being watched any more, a stall still going on ends without recovering
+void escalation_stop(escalation *e, uint64_t now);
+
+#endif // GAMEPAD_ESCALATION_H
@@ -0,0 +1,233 @@
+#include "fec.h"
+
+#include <arpa/inet.h>
+#include <string.h>
+
+static int16_t index_diff(uint16_t a, uint16_t b)
+{
+    return (int16_t) (a - b);
+}
+
+void fec_encoder_init(fec_encoder *e, int group_size)
+{
+    memset(e, 0, sizeof(*e));
+    if (group_size < 1) {
+        group_size = 1;
+    } else if (group_size > FEC_MAX_GROUP) {
+        group_size = FEC_MAX_GROUP;
+    }
+    e->group_size = group_size;
+}
+
+void fec_encode_data(fec_encoder *e, const uint8_t *data, size_t size, fec_header *header)
+{
+    if (size > FEC_MAX_PAYLOAD) {
+        size = FEC_MAX_PAYLOAD;
+    }
+
+    if (e->group_count == 0) {
+        e->group_first = e->next_index;
+        e->length_xor = 0;
+        e->parity_size = 0;
+        memset(e->parity, 0, sizeof(e->parity));
+    }
+
+    memset(header, 0, sizeof(*header));
+    header->index = htons(e->next_index);
+    header->type = FEC_TYPE_DATA;
+
+    for (size_t i = 0; i < size; i++) {
+        e->parity[i] ^= data[i];
+    }
+    if (size > e->parity_size) {
+        e->parity_size = size;
+    }
+    e->length_xor ^= (uint16_t) size;
+
+    e->group_count++;
+    e->next_index++;
+}
+
+int fec_encode_parity(fec_encoder *e, int flush, fec_header *header, uint8_t *parity, size_t *parity_size)
+{
+    if (e->group_count == 0 || (e->group_count < e->group_size && !flush)) {
+        return 0;
+    }
+
+    memset(header, 0, sizeof(*header));
+    header->index = htons(e->group_first);
+    header->type = FEC_TYPE_PARITY;
+    header->count = (uint8_t) e->group_count;
+    header->length = htons(e->length_xor);
+
+    memcpy(parity, e->parity, e->parity_size);
+    *parity_size = e->parity_size;
+
+    e->group_count = 0;
+    return 1;
+}
+
+void fec_decoder_init(fec_decoder *d)
+{
+    d->started = 0;
+    d->recovered = 0;
+    d->lost = 0;
+    memset(d->present, 0, sizeof(d->present));
+}
+
+static int has_index(fec_decoder *d, uint16_t index)
+{
+    int slot = index % FEC_WINDOW;
+    return d->present[slot] && d->slot_index[slot] == index;
+}
+
+static void store(fec_decoder *d, uint16_t index, const uint8_t *data, size_t size)
+{
+    int slot = index % FEC_WINDOW;
+    memcpy(d->data[slot], data, size);
+    d->length[slot] = (uint16_t) size;
+    d->slot_index[slot] = index;
+    d->present[slot] = 1;
+}
+
+static void resolve_through(fec_decoder *d, uint16_t index)
+{
+    if (index_diff(index, d->resolved_through) > 0) {
+        d->resolved_through = index;
+    }
+}
+
+static void recover(fec_decoder *d, uint16_t first, int count, uint16_t missing, uint16_t length_xor, const uint8_t *parity, size_t parity_size)
+{
+    // The missing datagram's length falls out of the XOR of every length in the group
+    uint16_t length = length_xor;
+    for (int i = 0; i < count; i++) {
+        uint16_t index = first + i;
+        if (index != missing) {
+            length ^= d->length[index % FEC_WINDOW];
+        }
+    }
+    if (length > parity_size) {
+        return;
+    }
+
+    int slot = missing % FEC_WINDOW;
+    uint8_t *out = d->data[slot];
+    memcpy(out, parity, length);
+
+    for (int i = 0; i < count; i++) {
+        uint16_t index = first + i;
+        if (index == missing) {
+            continue;
+        }
+
+        const uint8_t *other = d->data[index % FEC_WINDOW];
+        size_t other_length = d->length[index % FEC_WINDOW];
+        if (other_length > length) {
+            other_length = length;
+        }
+        for (size_t b = 0; b < other_length; b++) {
+            out[b] ^= other[b];
+        }
+    }
+
+    d->length[slot] = length;
+    d->slot_index[slot] = missing;
+    d->present[slot] = 1;
+    d->recovered++;
+}
+
+void fec_decoder_push(fec_decoder *d, const uint8_t *data, size_t size)
+{
+    if (size < sizeof(fec_header)) {
+        return;
+    }
+
+    fec_header header;
+    memcpy(&header, data, sizeof(header));
+    uint16_t index = ntohs(header.index);
+    const uint8_t *payload = data + sizeof(header);
+    size_t payload_size = size - sizeof(header);
+    if (payload_size > FEC_MAX_PAYLOAD) {
+        payload_size = FEC_MAX_PAYLOAD;
+    }
+
+    if (d->started && index_diff(index, d->next_index) < -FEC_WINDOW) {
+        // Far further back than anything reordered, the pipe has started counting again after a
+        // new bind, so whatever we were waiting for is gone
+        memset(d->present, 0, sizeof(d->present));
+        d->started = 0;
+    }
+
+    if (!d->started) {
+        d->started = 1;
+        d->next_index = index;
+        d->resolved_through = index;
+    }
+
+    if (header.type == FEC_TYPE_DATA) {
+        if (index_diff(index, d->next_index) < 0) {
+            // Already handed out, or given up on
+            return;
+        }
+
+        if (index_diff(index, d->next_index) >= FEC_WINDOW) {
+            // Too far ahead to keep waiting for whatever is missing
+            resolve_through(d, index - FEC_WINDOW + 1);
+        }
+
+        store(d, index, payload, payload_size);
+    } else if (header.type == FEC_TYPE_PARITY) {
+        int count = header.count;
+        if (count < 1 || count > FEC_MAX_GROUP) {
+            return;
+        }
+
+        // Parity is sent after its group, so anything still missing from earlier groups won't be
+        // rebuilt any more
+        resolve_through(d, index);
+
+        int missing_count = 0;
+        uint16_t missing = 0;
+        for (int i = 0; i < count; i++) {
+            uint16_t member = index + i;
+            if (!has_index(d, member)) {
+                missing_count++;
+                missing = member;
+            }
+        }
+
+        if (missing_count == 1 && index_diff(missing, d->next_index) >= 0) {
+            recover(d, index, count, missing, ntohs(header.length), payload, payload_size);
+        }
+
+        // Whether or not that worked, this group is as complete as it'll ever be
+        resolve_through(d, index + count);
+    }
+}
+
+size_t fec_decoder_pop(fec_decoder *d, uint8_t *out, size_t out_size)
+{
+    while (d->started) {
+        if (has_index(d, d->next_index)) {
+            int slot = d->next_index % FEC_WINDOW;
+            size_t size = d->length[slot];
+            if (size > out_size) {
+                size = out_size;
+            }
+            memcpy(out, d->data[slot], size);
+            d->next_index++;
+            return size;
+        }
+
+        if (index_diff(d->resolved_through, d->next_index) > 0) {
+            d->lost++;
+            d->next_index++;
+            continue;
+        }
+
+        break;
+    }
+
+    return 0;
+}
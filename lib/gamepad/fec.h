@@ -0,0 +1,76 @@
+#ifndef GAMEPAD_FEC_H
+#define GAMEPAD_FEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// XOR parity for the pipe-to-frontend video hop, shared between the library and vanilla-pipe, so
+// this must not depend on anything else in the library.
+//
+// Every video datagram gets a fec_header and the pipe sends one parity datagram per group, so any
+// single datagram lost from a group can be rebuilt without asking the console for an IDR.
+
+#define FEC_MAX_PAYLOAD 2048
+#define FEC_MAX_GROUP 32
+#define FEC_WINDOW (FEC_MAX_GROUP * 2)
+
+enum FecType
+{
+    FEC_TYPE_DATA,
+    FEC_TYPE_PARITY
+};
+
+// Precedes every datagram, multi-byte fields are big endian
+typedef struct
+{
+    uint16_t index; // Data: this datagram's index. Parity: index of the first datagram it covers.
+    uint8_t type;
+    uint8_t count; // Parity: number of datagrams covered
+    uint16_t length; // Parity: XOR of the covered datagrams' lengths
+    uint16_t reserved;
+} fec_header;
+
+typedef struct
+{
+    int group_size;
+    uint16_t next_index;
+    uint16_t group_first;
+    int group_count;
+    uint16_t length_xor;
+    size_t parity_size;
+    uint8_t parity[FEC_MAX_PAYLOAD];
+} fec_encoder;
+
+void fec_encoder_init(fec_encoder *e, int group_size);
+
+// Fill in `header` for the next data datagram and add it to the current group's parity
+void fec_encode_data(fec_encoder *e, const uint8_t *data, size_t size, fec_header *header);
+
+// Returns non-zero if a parity datagram should be sent now, because the group is full or `flush`
+// was set and the group isn't empty. `header` and `parity` are filled in, and a new group begins.
+int fec_encode_parity(fec_encoder *e, int flush, fec_header *header, uint8_t *parity, size_t *parity_size);
+
+typedef struct
+{
+    int started;
+    uint16_t next_index; // Next data datagram to hand out
+    uint16_t resolved_through; // Anything before this that's still missing won't be coming
+
+    uint8_t present[FEC_WINDOW];
+    uint16_t slot_index[FEC_WINDOW];
+    uint16_t length[FEC_WINDOW];
+    uint8_t data[FEC_WINDOW][FEC_MAX_PAYLOAD];
+
+    uint64_t recovered;
+    uint64_t lost;
+} fec_decoder;
+
+void fec_decoder_init(fec_decoder *d);
+
+// Feed a datagram (with its fec_header) received from the pipe
+void fec_decoder_push(fec_decoder *d, const uint8_t *data, size_t size);
+
+// Copy the next in-order data datagram to `out`, returns its size or 0 if nothing is ready yet
+size_t fec_decoder_pop(fec_decoder *d, uint8_t *out, size_t out_size);
+
+#endif // GAMEPAD_FEC_H
@@ -1,28 +1,45 @@
+#define _GNU_SOURCE
+
 #include "gamepad.h"
 
 #include <arpa/inet.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "audio.h"
+#include "coalesce.h"
 #include "command.h"
 #include "input.h"
+#include "stream.h"
+#include "tuning.h"
 #include "video.h"
+#include "watchdog.h"
 
 #include "../pipe/linux/def.h"
 #include "status.h"
 #include "util.h"
 
 static const uint32_t STOP_CODE = 0xCAFEBABE;
+
+// Binding again is a recovery step the watchdog waits on, so it gets one try for this long
+#define PIPE_REBIND_TIMEOUT_MS 250
 static uint32_t SERVER_ADDRESS = 0;
 
+// Added to the pipe's command ports for the slot we're using
+static uint16_t PIPE_PORT_OFFSET = 0;
+
 uint16_t PORT_MSG;
 uint16_t PORT_VID;
 uint16_t PORT_AUD;
@@ -40,19 +57,117 @@ unsigned int reverse_bits(unsigned int b, int bit_count)
     return result;
 }
 
-void send_to_console(int fd, const void *data, size_t data_size, int port)
+// Where each console-facing socket sends to. Sockets that could be connect()ed are sent on without
+// an address so the kernel can skip the per-packet route lookup.
+struct console_destination
 {
+    int fd;
+    int connected;
     struct sockaddr_in address;
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = SERVER_ADDRESS;
-    address.sin_port = htons((uint16_t) (port - 100));
+};
+static struct console_destination destinations[5];
+static size_t destination_count = 0;
+
+static uint64_t packets_sent = 0;
+static uint64_t send_calls = 0;
+
+// Shared rings from a pipe on the same host, NULL when receiving over UDP
+static vanilla_ring_shm *ring_memory = NULL;
+static size_t ring_memory_size = 0;
+static int ring_events[VANILLA_RING_CHANNEL_COUNT];
+static int ring_socket = -1;
+
+int pipe_spectator_requested = 0;
+int pipe_slot = 0;
+
+void set_pipe_spectator(int enabled)
+{
+    pipe_spectator_requested = enabled;
+}
+
+int is_pipe_spectator_requested()
+{
+    return pipe_spectator_requested;
+}
+
+void set_pipe_slot(int slot)
+{
+    pipe_slot = slot;
+}
+
+int get_pipe_slot()
+{
+    return pipe_slot;
+}
+
+void add_console_destination(int fd, uint16_t port, int connect_socket)
+{
+    struct console_destination *d = &destinations[destination_count++];
+    d->fd = fd;
+    d->address.sin_family = AF_INET;
+    d->address.sin_addr.s_addr = SERVER_ADDRESS;
+    d->address.sin_port = htons((uint16_t) (port - 100));
+    d->connected = connect_socket && connect(fd, (const struct sockaddr *) &d->address, sizeof(d->address)) == 0;
+}
 
-    char ip[20];
-    inet_ntop(AF_INET, &address.sin_addr, ip, sizeof(ip));
+const struct console_destination *get_console_destination(int fd)
+{
+    for (size_t i = 0; i < destination_count; i++) {
+        if (destinations[i].fd == fd) {
+            return &destinations[i];
+        }
+    }
+    return NULL;
+}
+
+void send_to_console(int fd, const void *data, size_t data_size, int port)
+{
+    struct iovec packet;
+    packet.iov_base = (void *) data;
+    packet.iov_len = data_size;
+    send_to_console_batch(fd, &packet, 1, port);
+}
+
+void send_to_console_batch(int fd, const struct iovec *packets, size_t count, int port)
+{
+    if (bundle_to_console(port, packets, count)) {
+        return;
+    }
 
-    ssize_t sent = sendto(fd, data, data_size, 0, (const struct sockaddr *) &address, sizeof(address));
+    const struct console_destination *d = get_console_destination(fd);
+    if (!d) {
+        print_info("Failed to send to Wii U socket: fd - %d; port - %d", fd, port);
+        return;
+    }
+
+    struct mmsghdr msgs[count];
+    memset(msgs, 0, sizeof(msgs));
+    for (size_t i = 0; i < count; i++) {
+        if (!d->connected) {
+            msgs[i].msg_hdr.msg_name = (void *) &d->address;
+            msgs[i].msg_hdr.msg_namelen = sizeof(d->address);
+        }
+        msgs[i].msg_hdr.msg_iov = (struct iovec *) &packets[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int sent;
+    if (count == 1) {
+        sent = sendmsg(fd, &msgs[0].msg_hdr, 0) == -1 ? -1 : 1;
+    } else {
+        sent = sendmmsg(fd, msgs, count, 0);
+    }
+
+    __atomic_add_fetch(&send_calls, 1, __ATOMIC_RELAXED);
     if (sent == -1) {
+        // Connected sockets report ICMP port unreachable from earlier packets as ECONNREFUSED, which
+        // just means the other end isn't listening (yet). Unconnected sends never saw this.
+        if (errno == ECONNREFUSED) {
+            return;
+        }
         print_info("Failed to send to Wii U socket: fd - %d; port - %d", fd, port);
+    } else {
+        __atomic_add_fetch(&packets_sent, sent, __ATOMIC_RELAXED);
     }
 }
 
@@ -82,32 +197,252 @@ void send_stop_code(int from_socket, in_port_t port)
     sendto(from_socket, &STOP_CODE, sizeof(STOP_CODE), 0, (struct sockaddr *)&address, sizeof(address));
 }
 
-int send_pipe_cc(int skt, uint32_t cc, int wait_for_reply)
+static int receive_bind_ack(int skt, uint32_t *accepted_flags)
+{
+    uint32_t recv_cc[2];
+    ssize_t read_size = recv(skt, recv_cc, sizeof(recv_cc), 0);
+    if (read_size >= (ssize_t) sizeof(uint32_t) && ntohl(recv_cc[0]) == VANILLA_PIPE_CC_BIND_ACK) {
+        if (accepted_flags) {
+            *accepted_flags = (read_size == sizeof(recv_cc)) ? ntohl(recv_cc[1]) : 0;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+int send_pipe_cc(int skt, uint32_t cc, uint32_t flags, int wait_for_reply, uint32_t *accepted_flags)
 {
     struct sockaddr_in addr = {0};
 
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = SERVER_ADDRESS;
-    addr.sin_port = htons(VANILLA_PIPE_CMD_SERVER_PORT);
+    addr.sin_port = htons(VANILLA_PIPE_CMD_SERVER_PORT + PIPE_PORT_OFFSET);
 
-    ssize_t read_size;
-    uint32_t send_cc = htonl(cc);
-    uint32_t recv_cc;
+    uint32_t send_cc[2] = {htonl(cc), htonl(flags)};
 
     do {
-        sendto(skt, &send_cc, sizeof(send_cc), 0, (struct sockaddr *) &addr, sizeof(addr));
+        // Only send the flags word if there is one, so pipes that don't know about it still understand us
+        sendto(skt, send_cc, flags ? sizeof(send_cc) : sizeof(uint32_t), 0, (struct sockaddr *) &addr, sizeof(addr));
 
-        if (wait_for_reply) {
-            read_size = recv(skt, &recv_cc, sizeof(recv_cc), 0);
-            if (read_size == sizeof(recv_cc) && ntohl(recv_cc) == VANILLA_PIPE_CC_BIND_ACK) {
-                return 1;
-            }
+        if (wait_for_reply && receive_bind_ack(skt, accepted_flags)) {
+            return 1;
         }
-    } while (!is_interrupted());
+    } while (wait_for_reply && !is_interrupted());
     
     return 0;
 }
 
+// Bind once without retrying, the pipe may well be unreachable while a stall goes on. Returns 1 if
+// the pipe acknowledged it.
+static int rebind_pipe(int skt, uint32_t flags)
+{
+    // Anything already waiting is an acknowledgement from an earlier bind
+    uint32_t stale[2];
+    while (recv(skt, stale, sizeof(stale), MSG_DONTWAIT) > 0) {
+    }
+
+    send_pipe_cc(skt, VANILLA_PIPE_CC_BIND, flags, 0, NULL);
+
+    struct pollfd pfd = {skt, POLLIN, 0};
+    return poll(&pfd, 1, PIPE_REBIND_TIMEOUT_MS) > 0 && receive_bind_ack(skt, NULL);
+}
+
+void close_pipe_rings()
+{
+    if (ring_memory) {
+        munmap(ring_memory, ring_memory_size);
+        ring_memory = NULL;
+        for (int i = 0; i < VANILLA_RING_CHANNEL_COUNT; i++) {
+            close(ring_events[i]);
+        }
+    }
+
+    if (ring_socket != -1) {
+        close(ring_socket);
+        ring_socket = -1;
+    }
+}
+
+int open_pipe_rings()
+{
+    ring_socket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (ring_socket == -1) {
+        return 0;
+    }
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path + 1, VANILLA_PIPE_SHM_SOCKET, strlen(VANILLA_PIPE_SHM_SOCKET));
+    socklen_t addr_len = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(VANILLA_PIPE_SHM_SOCKET);
+
+    if (connect(ring_socket, (const struct sockaddr *) &addr, addr_len) == -1) {
+        goto fail;
+    }
+
+    struct timeval tv = {0};
+    tv.tv_sec = 2;
+    setsockopt(ring_socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    int fds[1 + VANILLA_RING_CHANNEL_COUNT];
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+
+    uint32_t size;
+    struct iovec iov = {&size, sizeof(size)};
+
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    if (recvmsg(ring_socket, &msg, MSG_CMSG_CLOEXEC) != sizeof(size)) {
+        goto fail;
+    }
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        goto fail;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    for (int i = 0; i < VANILLA_RING_CHANNEL_COUNT; i++) {
+        ring_events[i] = fds[1 + i];
+    }
+
+    vanilla_ring_shm *memory = NULL;
+    if (size == sizeof(vanilla_ring_shm)) {
+        memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    }
+    close(fds[0]);
+
+    if (memory == NULL || memory == MAP_FAILED || memory->magic != VANILLA_RING_MAGIC || memory->channel_count != VANILLA_RING_CHANNEL_COUNT) {
+        // Different build of the pipe, don't trust the layout
+        if (memory && memory != MAP_FAILED) {
+            munmap(memory, size);
+        }
+        for (int i = 0; i < VANILLA_RING_CHANNEL_COUNT; i++) {
+            close(ring_events[i]);
+        }
+        goto fail;
+    }
+
+    ring_memory = memory;
+    ring_memory_size = size;
+
+    // The pipe notices we've gone when this socket closes, so it stays open until we disconnect
+    return 1;
+
+fail:
+    close(ring_socket);
+    ring_socket = -1;
+    return 0;
+}
+
+void wake_pipe_rings()
+{
+    if (ring_memory) {
+        uint64_t one = 1;
+        for (int i = 0; i < VANILLA_RING_CHANNEL_COUNT; i++) {
+            write(ring_events[i], &one, sizeof(one));
+        }
+    }
+}
+
+static ssize_t receive_from_console(int channel, int fd, void *data, size_t data_size)
+{
+    int bundled = get_bundle_channel_fd(channel);
+    if (bundled != -1) {
+        return recv(bundled, data, data_size, 0);
+    }
+
+    if (!ring_memory) {
+        return recv(fd, data, data_size, 0);
+    }
+
+    vanilla_ring *r = &ring_memory->rings[channel];
+    while (!vanilla_ring_pending(r)) {
+        if (is_interrupted()) {
+            return -1;
+        }
+
+        if (!vanilla_ring_prepare_wait(r)) {
+            struct pollfd pfd = {ring_events[channel], POLLIN, 0};
+            poll(&pfd, 1, -1);
+
+            uint64_t count;
+            read(ring_events[channel], &count, sizeof(count));
+
+            vanilla_ring_finish_wait(r);
+        }
+    }
+
+    // The slot is ours until it's released, so the pipe won't touch it while we copy
+    vanilla_ring_slot *slot = vanilla_ring_slot_at(r, r->tail);
+    size_t size = slot->size < data_size ? slot->size : data_size;
+    memcpy(data, slot->data, size);
+    vanilla_ring_release(r);
+
+    return size;
+}
+
+ssize_t recv_from_console(int channel, int fd, void *data, size_t data_size)
+{
+    ssize_t size = receive_from_console(channel, fd, data, data_size);
+    if (size > 0) {
+        // Ring channels are in the same order as VanillaStream
+        watchdog_feed(channel);
+    }
+    return size;
+}
+
+// What the watchdog needs to get a stalled stream going again
+struct recovery_context
+{
+    int socket_msg;
+    int pipe_cc_skt;
+
+    // Whether the pipe can be bound to again without losing anything, and the flags to ask for
+    int can_rebind;
+    uint32_t rebind_flags;
+
+    // Whether the pipe may be asked to reassociate
+    int can_reassociate;
+};
+
+static int take_recovery_step(int step, uint32_t into_stall_ms, void *context)
+{
+    struct recovery_context *r = (struct recovery_context *) context;
+    switch (step) {
+    case VANILLA_RECOVERY_IDR:
+        print_info("REQUESTING IDR, %u MS INTO STALL", into_stall_ms);
+
+        // The video thread would only send a queued request once video arrives
+        send_idr_request_to_console(r->socket_msg);
+        return 1;
+    case VANILLA_RECOVERY_REBIND:
+        if (!r->can_rebind) {
+            return 0;
+        }
+        print_info("BINDING TO PIPE AGAIN, %u MS INTO STALL", into_stall_ms);
+        if (!rebind_pipe(r->pipe_cc_skt, r->rebind_flags)) {
+            print_info("PIPE DIDN'T ACKNOWLEDGE THE BIND");
+            return 0;
+        }
+        return 1;
+    case VANILLA_RECOVERY_REASSOCIATE:
+        if (!r->can_reassociate) {
+            return 0;
+        }
+        print_info("ASKING PIPE TO REASSOCIATE, %u MS INTO STALL", into_stall_ms);
+        send_pipe_cc(r->pipe_cc_skt, VANILLA_PIPE_CC_REASSOCIATE, 0, 0, NULL);
+        return 1;
+    }
+    return 0;
+}
+
 int connect_as_gamepad_internal(vanilla_event_handler_t event_handler, void *context, uint32_t server_address)
 {
     clear_interrupt();
@@ -120,34 +455,103 @@ int connect_as_gamepad_internal(vanilla_event_handler_t event_handler, void *con
 
     if (server_address == 0) {
         SERVER_ADDRESS = inet_addr("192.168.1.10");
+        PIPE_PORT_OFFSET = 0;
     } else {
         SERVER_ADDRESS = htonl(server_address);
-        PORT_MSG += 200;
-        PORT_VID += 200;
-        PORT_AUD += 200;
-        PORT_HID += 200;
-        PORT_CMD += 200;
+
+        // Every port moves up together for the pipe's other slots
+        PIPE_PORT_OFFSET = get_pipe_slot() * VANILLA_PIPE_SLOT_PORT_STRIDE;
+        PORT_MSG += 200 + PIPE_PORT_OFFSET;
+        PORT_VID += 200 + PIPE_PORT_OFFSET;
+        PORT_AUD += 200 + PIPE_PORT_OFFSET;
+        PORT_HID += 200 + PIPE_PORT_OFFSET;
+        PORT_CMD += 200 + PIPE_PORT_OFFSET;
     }
 
     struct gamepad_thread_context info;
     info.event_handler = event_handler;
     info.context = context;
+    info.socket_stream = -1;
+    info.video_fec = 0;
+    info.input_deltas = 0;
 
     int ret = VANILLA_ERROR;
 
     // Try to bind with backend
     int pipe_cc_skt;
-    if (!create_socket(&pipe_cc_skt, VANILLA_PIPE_CMD_CLIENT_PORT)) goto exit;
+    if (!create_socket(&pipe_cc_skt, VANILLA_PIPE_CMD_CLIENT_PORT + PIPE_PORT_OFFSET)) goto exit;
 
     struct timeval tv = {0};
     tv.tv_sec = 2;
     setsockopt(pipe_cc_skt, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
 
-    if (!send_pipe_cc(pipe_cc_skt, VANILLA_PIPE_CC_BIND, 1)) {
+    // A pipe on this host can skip UDP and hand us datagrams through shared memory
+    uint32_t bind_flags = 0;
+    if (server_address != 0 && (server_address >> 24) == 127) {
+        bind_flags |= VANILLA_PIPE_BIND_FLAG_SHM;
+    } else if (server_address != 0 && is_pipe_frames_requested()) {
+        // Further away, have the pipe reassemble frames so fewer, larger packets cross the network
+        bind_flags |= VANILLA_PIPE_BIND_FLAG_FRAMES;
+    }
+    if (server_address != 0 && (server_address >> 24) != 127 && get_pipe_fec() > 0) {
+        // Let the pipe cover video datagrams with parity, in case frames aren't accepted
+        bind_flags |= VANILLA_PIPE_BIND_FLAG_FEC | ((uint32_t) get_pipe_fec() << VANILLA_PIPE_BIND_FEC_GROUP_SHIFT);
+    }
+    if (server_address != 0 && (server_address >> 24) != 127 && get_pipe_bundle() > 0 && get_pipe_slot() == 0) {
+        // The carrier socket has to be ready before the pipe starts sending to it
+        int units = (get_pipe_bundle() + VANILLA_PIPE_BUNDLE_WINDOW_UNIT_US - 1) / VANILLA_PIPE_BUNDLE_WINDOW_UNIT_US;
+        if (open_pipe_bundle(SERVER_ADDRESS, units * VANILLA_PIPE_BUNDLE_WINDOW_UNIT_US)) {
+            bind_flags |= VANILLA_PIPE_BIND_FLAG_BUNDLE | ((uint32_t) units << VANILLA_PIPE_BIND_BUNDLE_WINDOW_SHIFT);
+        }
+    }
+    if (server_address != 0 && is_pipe_input_deltas_requested()) {
+        bind_flags |= VANILLA_PIPE_BIND_FLAG_INPUT_DELTAS;
+    }
+    if (server_address != 0 && is_pipe_spectator_requested()) {
+        // Spectators are only ever sent plain datagrams
+        bind_flags = VANILLA_PIPE_BIND_FLAG_SPECTATOR;
+    }
+
+    uint32_t accepted_flags = 0;
+    if (!send_pipe_cc(pipe_cc_skt, VANILLA_PIPE_CC_BIND, bind_flags, 1, &accepted_flags)) {
         print_info("FAILED TO BIND TO PIPE");
         goto exit_pipe;
     }
 
+    int spectating = (accepted_flags & VANILLA_PIPE_BIND_FLAG_SPECTATOR) != 0;
+    if (spectating) {
+        print_info("WATCHING AS A SPECTATOR");
+    } else if (bind_flags & VANILLA_PIPE_BIND_FLAG_SPECTATOR) {
+        print_info("PIPE DID NOT ACCEPT SPECTATOR, CONNECTED AS PLAYER");
+    }
+
+    if (accepted_flags & VANILLA_PIPE_BIND_FLAG_SHM) {
+        if (open_pipe_rings()) {
+            print_info("RECEIVING FROM PIPE OVER SHARED MEMORY");
+        } else {
+            print_info("FAILED TO OPEN SHARED MEMORY, USING UDP");
+        }
+    } else if (accepted_flags & VANILLA_PIPE_BIND_FLAG_FRAMES) {
+        info.socket_stream = open_pipe_stream(SERVER_ADDRESS);
+        if (info.socket_stream != -1) {
+            print_info("RECEIVING FRAMES FROM PIPE");
+        }
+    } else if (accepted_flags & VANILLA_PIPE_BIND_FLAG_FEC) {
+        info.video_fec = 1;
+        print_info("RECEIVING VIDEO FROM PIPE WITH PARITY");
+    }
+
+    if (accepted_flags & VANILLA_PIPE_BIND_FLAG_INPUT_DELTAS) {
+        info.input_deltas = 1;
+        print_info("SENDING INPUT DELTAS TO PIPE");
+    }
+
+    if (accepted_flags & VANILLA_PIPE_BIND_FLAG_BUNDLE) {
+        print_info("BUNDLING SMALL DATAGRAMS WITH PIPE");
+    } else {
+        close_pipe_bundle();
+    }
+
     // Open all required sockets
     if (!create_socket(&info.socket_vid, PORT_VID)) goto exit_pipe;
     if (!create_socket(&info.socket_msg, PORT_MSG)) goto exit_vid;
@@ -155,30 +559,139 @@ int connect_as_gamepad_internal(vanilla_event_handler_t event_handler, void *con
     if (!create_socket(&info.socket_aud, PORT_AUD)) goto exit_hid;
     if (!create_socket(&info.socket_cmd, PORT_CMD)) goto exit_aud;
 
-    pthread_t video_thread, audio_thread, input_thread, msg_thread, cmd_thread;
+    if (is_low_latency_requested()) {
+        // Closing the sockets is all it takes to undo this
+        socket_tuning applied;
+        int sockets[] = {info.socket_vid, info.socket_msg, info.socket_hid, info.socket_aud, info.socket_cmd, info.socket_stream};
+        for (size_t i = 0; i < sizeof(sockets) / sizeof(sockets[0]); i++) {
+            if (sockets[i] != -1) {
+                tune_socket(sockets[i], &applied);
+            }
+        }
+        print_info("SOCKETS AT PRIORITY %i, DSCP %i, RECEIVE BUFFER %i BYTES", applied.priority, applied.dscp, applied.rcvbuf);
+    }
+
+    // The HID and message sockets are only ever sent on, so they can always be connected to the
+    // console. The others are also read from, and in relay mode the pipe sends from exactly the
+    // address we send to, so they can be connected too. A direct connection to the console
+    // doesn't give us that guarantee, so leave those unconnected there.
+    int connect_receivers = (server_address != 0);
+    destination_count = 0;
+    packets_sent = 0;
+    send_calls = 0;
+    add_console_destination(info.socket_hid, PORT_HID, 1);
+    add_console_destination(info.socket_msg, PORT_MSG, 1);
+    add_console_destination(info.socket_vid, PORT_VID, connect_receivers);
+    add_console_destination(info.socket_aud, PORT_AUD, connect_receivers);
+    add_console_destination(info.socket_cmd, PORT_CMD, connect_receivers);
+
+    // Binding again replaces the pipe's shared memory, frames, bundles and input state, which
+    // we'd have to set up again too, so it's only done when there are none. Parity only needs its
+    // group size asked for again.
+    struct recovery_context recovery;
+    recovery.socket_msg = info.socket_msg;
+    recovery.pipe_cc_skt = pipe_cc_skt;
+    recovery.can_rebind = server_address != 0
+                          && !(accepted_flags & (VANILLA_PIPE_BIND_FLAG_SHM | VANILLA_PIPE_BIND_FLAG_FRAMES | VANILLA_PIPE_BIND_FLAG_BUNDLE | VANILLA_PIPE_BIND_FLAG_INPUT_DELTAS));
+    recovery.rebind_flags = accepted_flags;
+    if (accepted_flags & VANILLA_PIPE_BIND_FLAG_FEC) {
+        recovery.rebind_flags |= bind_flags & VANILLA_PIPE_BIND_FEC_GROUP_MASK;
+    }
+    recovery.can_reassociate = server_address != 0 && !spectating;
+
+    watchdog_start();
 
-    pthread_create(&video_thread, NULL, listen_video, &info);
-    pthread_create(&audio_thread, NULL, listen_audio, &info);
-    pthread_create(&input_thread, NULL, listen_input, &info);
+    pthread_t video_thread, audio_thread, input_thread, msg_thread, cmd_thread, stream_thread;
+
+    if (info.socket_stream != -1) {
+        // Video and audio both arrive already assembled on the stream
+        pthread_create(&stream_thread, NULL, listen_pipe_stream, &info);
+    } else {
+        pthread_create(&video_thread, NULL, listen_video, &info);
+        pthread_create(&audio_thread, NULL, listen_audio, &info);
+    }
+    if (!spectating) {
+        // The pipe would only throw input from a spectator away
+        pthread_create(&input_thread, NULL, listen_input, &info);
+    }
     pthread_create(&cmd_thread, NULL, listen_command, &info);
 
+    if (is_realtime_requested()) {
+        // The threads end with the connection, so there's nothing to put back afterwards
+        pthread_t threads[5];
+        size_t thread_count = 0;
+        if (info.socket_stream != -1) {
+            threads[thread_count++] = stream_thread;
+        } else {
+            threads[thread_count++] = video_thread;
+            threads[thread_count++] = audio_thread;
+        }
+        if (!spectating) {
+            threads[thread_count++] = input_thread;
+        }
+        threads[thread_count++] = cmd_thread;
+
+        int realtime = 1;
+        int pinned = 1;
+        for (size_t i = 0; i < thread_count; i++) {
+            int thread_pinned;
+            realtime &= make_thread_realtime(threads[i], get_realtime_cpu(), &thread_pinned);
+            pinned &= thread_pinned;
+        }
+
+        if (realtime) {
+            print_info("THREADS ON SCHED_FIFO PRIORITY %i", TUNING_FIFO_PRIORITY);
+        } else {
+            print_info("COULDN'T PUT THREADS ON SCHED_FIFO, IT NEEDS CAP_SYS_NICE OR AN RLIMIT_RTPRIO");
+        }
+        if (get_realtime_cpu() >= 0) {
+            print_info(pinned ? "THREADS PINNED TO CPU %i" : "COULDN'T PIN THREADS TO CPU %i", get_realtime_cpu());
+        }
+    }
+
     while (1) {
         usleep(250 * 1000);
         if (is_interrupted()) {
-            // Wake up any threads that might be blocked on `recv`
+            // Wake up any threads that might be blocked on `recv`. Connected sockets won't accept
+            // the stop code since it doesn't come from the console, so shut them down instead.
             send_stop_code(info.socket_msg, PORT_VID);
             send_stop_code(info.socket_msg, PORT_AUD);
             send_stop_code(info.socket_msg, PORT_CMD);
+            wake_pipe_rings();
+            wake_pipe_bundle();
+            if (info.socket_stream != -1) {
+                shutdown(info.socket_stream, SHUT_RDWR);
+            }
+            for (size_t i = 0; i < destination_count; i++) {
+                if (destinations[i].connected) {
+                    shutdown(destinations[i].fd, SHUT_RD);
+                }
+            }
             break;
         }
+
+        watchdog_check(take_recovery_step, &recovery);
     }
 
-    pthread_join(video_thread, NULL);
-    pthread_join(audio_thread, NULL);
-    pthread_join(input_thread, NULL);
+    if (info.socket_stream != -1) {
+        pthread_join(stream_thread, NULL);
+    } else {
+        pthread_join(video_thread, NULL);
+        pthread_join(audio_thread, NULL);
+    }
+    if (!spectating) {
+        pthread_join(input_thread, NULL);
+    }
     pthread_join(cmd_thread, NULL);
 
-    send_pipe_cc(pipe_cc_skt, VANILLA_PIPE_CC_UNBIND, 0);
+    watchdog_stop();
+
+    // Anything still waiting for a carrier goes out before the pipe forgets about us
+    close_pipe_bundle();
+
+    send_pipe_cc(pipe_cc_skt, VANILLA_PIPE_CC_UNBIND, 0, 0, NULL);
+
+    print_info("SENT %llu PACKETS TO CONSOLE IN %llu SYSCALLS", (unsigned long long) packets_sent, (unsigned long long) send_calls);
 
     ret = VANILLA_SUCCESS;
 
@@ -198,6 +711,11 @@ exit_vid:
     close(info.socket_vid);
 
 exit_pipe:
+    if (info.socket_stream != -1) {
+        close(info.socket_stream);
+    }
+    close_pipe_rings();
+    close_pipe_bundle();
     close(pipe_cc_skt);
 
 exit:
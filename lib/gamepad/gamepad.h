@@ -4,6 +4,10 @@
 #include "vanilla.h"
 
 #include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "../pipe/linux/ring.h"
 
 extern uint16_t PORT_MSG;
 extern uint16_t PORT_VID;
@@ -23,11 +27,28 @@ struct gamepad_thread_context
     int socket_hid;
     int socket_msg;
     int socket_cmd;
+
+    // Connection to the pipe's frame port, or -1 if video and audio arrive as datagrams
+    int socket_stream;
+
+    // Whether video datagrams from the pipe carry a fec_header, with parity datagrams in between
+    int video_fec;
+
+    // Whether the pipe builds HID packets itself, so only input deltas are sent to it
+    int input_deltas;
 };
 
+void set_pipe_spectator(int enabled);
+int is_pipe_spectator_requested();
+
+void set_pipe_slot(int slot);
+int get_pipe_slot();
+
 int connect_as_gamepad_internal(vanilla_event_handler_t event_handler, void *context, uint32_t server_address);
 unsigned int reverse_bits(unsigned int b, int bit_count);
 void send_to_console(int fd, const void *data, size_t data_size, int port);
+void send_to_console_batch(int fd, const struct iovec *packets, size_t count, int port);
+ssize_t recv_from_console(int channel, int fd, void *data, size_t data_size);
 int is_stop_code(const char *data, size_t data_length);
 
 #endif // VANILLA_GAMEPAD_H
\ No newline at end of file
@@ -0,0 +1,325 @@
+#include "hid.h"
+
+#include <arpa/inet.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../pipe/linux/def.h"
+
+#pragma pack(push, 1)
+
+typedef struct {
+    // Little endian
+    int16_t z;
+    int16_t x;
+    int16_t y;
+} InputPacketAccelerometer;
+
+typedef struct {
+    // Little endian
+    signed roll : 24;
+    signed pitch : 24;
+    signed yaw : 24;
+} InputPacketGyroscope;
+
+typedef struct {
+    signed char unknown[6];
+} InputPacketMagnet;
+
+typedef struct {
+    unsigned pad : 1;
+    unsigned extra : 3;
+    unsigned value : 12;
+} TouchCoord;
+
+typedef struct {
+    TouchCoord x;
+    TouchCoord y;
+} TouchPoint;
+
+typedef struct {
+    // Big endian
+    TouchPoint points[10];
+} TouchScreenState;
+
+typedef struct {
+    // Big endian
+    uint16_t seq_id;
+    uint16_t buttons;
+    uint8_t power_status;
+    uint8_t battery_charge;
+    uint16_t stick_left_x;
+    uint16_t stick_left_y;
+    uint16_t stick_right_x;
+    uint16_t stick_right_y;
+    uint8_t audio_volume;
+    InputPacketAccelerometer accelerometer;
+    InputPacketGyroscope gyroscope;
+    InputPacketMagnet magnet;
+    TouchScreenState touchscreen; // byte 36 - 76
+    unsigned char unknown_0[4];
+    uint8_t extra_buttons;
+    unsigned char unknown_1[46];
+    uint8_t fw_version_neg;
+} InputPacket;
+
+typedef struct {
+    uint8_t index;
+    int32_t value; // Big endian
+} InputDeltaEntry;
+
+#pragma pack(pop)
+
+_Static_assert(sizeof(InputPacket) == INPUT_PACKET_SIZE, "InputPacket layout");
+
+static unsigned int hid_reverse_bits(unsigned int b, int bit_count)
+{
+    unsigned int result = 0;
+
+    for (int i = 0; i < bit_count; i++) {
+        result |= ((b >> i) & 1) << (bit_count - 1 - i);
+    }
+
+    return result;
+}
+
+void input_state_init(input_state *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->touch_x = -1;
+    s->touch_y = -1;
+    s->battery_status = VANILLA_BATTERY_STATUS_CHARGING;
+}
+
+static uint16_t resolve_axis_value(float axis, float neg, float pos, int flip)
+{
+    float val = axis < 0 ? axis / 32768.0f : axis / 32767.0f;
+
+    neg = abs(neg);
+    pos = abs(pos);
+
+    neg /= 32767.0f;
+    pos /= 32767.0f;
+
+    val -= neg;
+    val += pos;
+
+    if (flip) {
+        val = -val;
+    }
+    
+    return ((int) (val * 1024)) + 2048;
+}
+
+static int64_t scale_x_touch_value(int64_t v)
+{
+    // Scales 0-854 to 0-4096 with a 2.5% margin on each side
+    const int scale_percent = 95;
+
+    v *= 4096;
+    v *= scale_percent;
+    v /= 854;
+    v /= 100;
+    v += (4096 * (100 - scale_percent) / 200);
+
+    return v;
+}
+
+static int64_t scale_y_touch_value(int64_t v)
+{
+    // Scales 0-854 to 0-4096 with a 5% margin on the bottom and 3% margin on the top (I don't know why, but these values worked best)
+    const int scale_percent = 92;
+
+    v *= 4096;
+    v *= scale_percent;
+    v /= 480;
+    v /= 100;
+    v += (4096 * (100 - 90) / 200);
+    v = 4096 - v;
+
+    return v;
+}
+
+static float unpack_float(int32_t x)
+{
+    float f;
+    memcpy(&f, &x, sizeof(int32_t));
+    return f;
+}
+
+void build_input_packet(const input_state *s, uint16_t seq_id, uint8_t *out)
+{
+    InputPacket ip;
+    memset(&ip, 0, sizeof(ip));
+
+    const int32_t *current_buttons = s->buttons;
+
+    ip.touchscreen.points[9].x.extra = hid_reverse_bits(s->battery_status, 3);
+
+    if (s->touch_x >= 0 && s->touch_y >= 0) {
+        for (int i = 0; i < 10; i++) {
+            ip.touchscreen.points[i].x.pad = 1;
+            ip.touchscreen.points[i].y.pad = 1;
+            ip.touchscreen.points[i].x.value = hid_reverse_bits(scale_x_touch_value(s->touch_x), 12);
+            ip.touchscreen.points[i].y.value = hid_reverse_bits(scale_y_touch_value(s->touch_y), 12);
+        }
+
+        ip.touchscreen.points[0].y.extra = hid_reverse_bits(2, 3);
+        ip.touchscreen.points[1].x.extra = hid_reverse_bits(7, 3);
+        ip.touchscreen.points[1].y.extra = hid_reverse_bits(3, 3);
+    }
+
+    for (int byte = 0; byte < sizeof(ip.touchscreen); byte += 2)
+    {
+        unsigned char *touchscreen_bytes = (unsigned char *)(&ip.touchscreen);
+        unsigned char first = (unsigned char)hid_reverse_bits(touchscreen_bytes[byte], 8);
+        touchscreen_bytes[byte] = (unsigned char)hid_reverse_bits(touchscreen_bytes[byte + 1], 8);
+        touchscreen_bytes[byte + 1] = first;
+    }
+
+    uint16_t button_mask = 0;
+
+    if (current_buttons[VANILLA_BTN_A]) button_mask |= 0x8000;
+    if (current_buttons[VANILLA_BTN_B]) button_mask |= 0x4000;
+    if (current_buttons[VANILLA_BTN_X]) button_mask |= 0x2000;
+    if (current_buttons[VANILLA_BTN_Y]) button_mask |= 0x1000;
+    if (current_buttons[VANILLA_BTN_L]) button_mask |= 0x0020;
+    if (current_buttons[VANILLA_BTN_R]) button_mask |= 0x0010;
+    if (current_buttons[VANILLA_BTN_ZL]) button_mask |= 0x0080;
+    if (current_buttons[VANILLA_BTN_ZR]) button_mask |= 0x0040;
+    if (current_buttons[VANILLA_BTN_MINUS]) button_mask |= 0x0004;
+    if (current_buttons[VANILLA_BTN_PLUS]) button_mask |= 0x0008;
+    if (current_buttons[VANILLA_BTN_HOME]) button_mask |= 0x0002;
+    if (current_buttons[VANILLA_BTN_LEFT]) button_mask |= 0x800;
+    if (current_buttons[VANILLA_BTN_RIGHT]) button_mask |= 0x400;
+    if (current_buttons[VANILLA_BTN_DOWN]) button_mask |= 0x100;
+    if (current_buttons[VANILLA_BTN_UP]) button_mask |= 0x200;
+
+    ip.buttons = htons(button_mask);
+
+    button_mask = 0;
+    
+    if (current_buttons[VANILLA_BTN_L3]) button_mask |= 0x80;
+    if (current_buttons[VANILLA_BTN_R3]) button_mask |= 0x40;
+
+    ip.extra_buttons = button_mask;
+
+    ip.stick_left_x = resolve_axis_value(current_buttons[VANILLA_AXIS_L_X], current_buttons[VANILLA_AXIS_L_LEFT], current_buttons[VANILLA_AXIS_L_RIGHT], 0);
+    ip.stick_left_y = resolve_axis_value(current_buttons[VANILLA_AXIS_L_Y], current_buttons[VANILLA_AXIS_L_UP], current_buttons[VANILLA_AXIS_L_DOWN], 1);
+    ip.stick_right_x = resolve_axis_value(current_buttons[VANILLA_AXIS_R_X], current_buttons[VANILLA_AXIS_R_LEFT], current_buttons[VANILLA_AXIS_R_RIGHT], 0);
+    ip.stick_right_y = resolve_axis_value(current_buttons[VANILLA_AXIS_R_Y], current_buttons[VANILLA_AXIS_R_UP], current_buttons[VANILLA_AXIS_R_DOWN], 1);
+
+    ip.audio_volume = current_buttons[VANILLA_AXIS_VOLUME];
+
+    ip.accelerometer.x = unpack_float(current_buttons[VANILLA_SENSOR_ACCEL_X]) * -800;
+    ip.accelerometer.y = unpack_float(current_buttons[VANILLA_SENSOR_ACCEL_Y]) * -800;
+    ip.accelerometer.z = unpack_float(current_buttons[VANILLA_SENSOR_ACCEL_Z]) * 800;
+
+    ip.gyroscope.yaw = (unpack_float(current_buttons[VANILLA_SENSOR_GYRO_YAW]) * (180.0f/M_PI)) / ((200.0f * 6.0f) / 154000.0f);
+    ip.gyroscope.pitch = (unpack_float(current_buttons[VANILLA_SENSOR_GYRO_PITCH]) * (180.0f/M_PI)) / ((200.0f * 6.0f) / 154000.0f);
+    ip.gyroscope.roll = (unpack_float(current_buttons[VANILLA_SENSOR_GYRO_ROLL]) * (180.0f/M_PI)) / ((200.0f * 6.0f) / 154000.0f);
+
+    ip.seq_id = htons(seq_id);
+
+    ip.fw_version_neg = 215;
+
+    memcpy(out, &ip, sizeof(ip));
+}
+
+static size_t add_delta_entry(uint8_t *out, size_t offset, uint8_t index, int32_t value)
+{
+    InputDeltaEntry entry;
+    entry.index = index;
+    entry.value = (int32_t) htonl((uint32_t) value);
+    memcpy(out + offset, &entry, sizeof(entry));
+    return offset + sizeof(entry);
+}
+
+size_t encode_input_delta(const input_state *current, const input_state *previous, uint16_t seq, uint8_t *out)
+{
+    size_t offset = sizeof(vanilla_pipe_input_header);
+
+    for (int i = 0; i < VANILLA_BTN_COUNT; i++) {
+        if (!previous || current->buttons[i] != previous->buttons[i]) {
+            offset = add_delta_entry(out, offset, (uint8_t) i, current->buttons[i]);
+        }
+    }
+    if (!previous || current->touch_x != previous->touch_x) {
+        offset = add_delta_entry(out, offset, INPUT_DELTA_TOUCH_X, current->touch_x);
+    }
+    if (!previous || current->touch_y != previous->touch_y) {
+        offset = add_delta_entry(out, offset, INPUT_DELTA_TOUCH_Y, current->touch_y);
+    }
+    if (!previous || current->battery_status != previous->battery_status) {
+        offset = add_delta_entry(out, offset, INPUT_DELTA_BATTERY, current->battery_status);
+    }
+
+    size_t count = (offset - sizeof(vanilla_pipe_input_header)) / sizeof(InputDeltaEntry);
+    if (count == 0) {
+        return 0;
+    }
+
+    vanilla_pipe_input_header header = {0};
+    header.magic = htonl(VANILLA_PIPE_INPUT_MAGIC);
+    header.seq = htons(seq);
+    header.flags = previous ? 0 : VANILLA_PIPE_INPUT_FLAG_FULL;
+    header.count = (uint8_t) count;
+    memcpy(out, &header, sizeof(header));
+
+    return offset;
+}
+
+void input_delta_receiver_init(input_delta_receiver *r)
+{
+    input_state_init(&r->state);
+    r->has_state = 0;
+    r->last_seq = 0;
+}
+
+int apply_input_delta(input_delta_receiver *r, const uint8_t *data, size_t size)
+{
+    vanilla_pipe_input_header header;
+    if (size < sizeof(header)) {
+        return 0;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (ntohl(header.magic) != VANILLA_PIPE_INPUT_MAGIC) {
+        return 0;
+    }
+    if (size < sizeof(header) + header.count * sizeof(InputDeltaEntry)) {
+        // Truncated, but it was still meant for us
+        return 1;
+    }
+
+    uint16_t seq = ntohs(header.seq);
+    int full = (header.flags & VANILLA_PIPE_INPUT_FLAG_FULL) != 0;
+
+    // A delta only makes sense on top of the state it was made from
+    if (!full && !r->has_state) {
+        return 1;
+    }
+    if (r->has_state && (int16_t) (seq - r->last_seq) <= 0) {
+        return 1;
+    }
+
+    for (int i = 0; i < header.count; i++) {
+        InputDeltaEntry entry;
+        memcpy(&entry, data + sizeof(header) + i * sizeof(entry), sizeof(entry));
+        int32_t value = (int32_t) ntohl((uint32_t) entry.value);
+
+        if (entry.index < VANILLA_BTN_COUNT) {
+            r->state.buttons[entry.index] = value;
+        } else if (entry.index == INPUT_DELTA_TOUCH_X) {
+            r->state.touch_x = value;
+        } else if (entry.index == INPUT_DELTA_TOUCH_Y) {
+            r->state.touch_y = value;
+        } else if (entry.index == INPUT_DELTA_BATTERY) {
+            r->state.battery_status = value;
+        }
+    }
+
+    r->has_state = 1;
+    r->last_seq = seq;
+    return 1;
+}
@@ -0,0 +1,56 @@
+#ifndef GAMEPAD_HID_H
+#define GAMEPAD_HID_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vanilla.h"
+
+// Gamepad input state and the HID packets built from it, shared between the library and
+// vanilla-pipe, so this must not depend on anything else in the library.
+
+#define INPUT_PACKET_SIZE 128
+
+// Entries in an input delta that aren't buttons or axes
+#define INPUT_DELTA_TOUCH_X 0xF0
+#define INPUT_DELTA_TOUCH_Y 0xF1
+#define INPUT_DELTA_BATTERY 0xF2
+
+// Big enough for a delta carrying every value
+#define INPUT_DELTA_MAX_SIZE 256
+
+typedef struct
+{
+    int32_t buttons[VANILLA_BTN_COUNT];
+    int32_t touch_x;
+    int32_t touch_y;
+    int32_t battery_status;
+} input_state;
+
+void input_state_init(input_state *s);
+
+// Build the HID packet the console expects from `s`, `out` must be INPUT_PACKET_SIZE bytes
+void build_input_packet(const input_state *s, uint16_t seq_id, uint8_t *out);
+
+/**
+ * Encode the values in `current` that differ from `previous` as an input delta
+ *
+ * With `previous` NULL every value is sent, and the receiver replaces its whole state. Returns the
+ * size written to `out` (at least INPUT_DELTA_MAX_SIZE bytes), or 0 if nothing changed.
+ */
+size_t encode_input_delta(const input_state *current, const input_state *previous, uint16_t seq, uint8_t *out);
+
+typedef struct
+{
+    input_state state;
+    int has_state; // Set once a full delta has arrived
+    uint16_t last_seq;
+} input_delta_receiver;
+
+void input_delta_receiver_init(input_delta_receiver *r);
+
+// Apply a datagram from the frontend, returns 0 if it isn't an input delta. Deltas older than the
+// last one applied are ignored.
+int apply_input_delta(input_delta_receiver *r, const uint8_t *data, size_t size);
+
+#endif // GAMEPAD_HID_H
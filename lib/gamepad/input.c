@@ -1,7 +1,5 @@
 #include "input.h"
 
-#include <arpa/inet.h>
-#include <math.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -9,234 +7,177 @@
 #include <unistd.h>
 
 #include "gamepad.h"
+#include "hid.h"
+#include "status.h"
 #include "vanilla.h"
 #include "util.h"
 
-#pragma pack(push, 1)
-
-typedef struct {
-    // Little endian
-    int16_t z;
-    int16_t x;
-    int16_t y;
-} InputPacketAccelerometer;
-
-typedef struct {
-    // Little endian
-    signed roll : 24;
-    signed pitch : 24;
-    signed yaw : 24;
-} InputPacketGyroscope;
-
-typedef struct {
-    signed char unknown[6];
-} InputPacketMagnet;
-
-typedef struct {
-    unsigned pad : 1;
-    unsigned extra : 3;
-    unsigned value : 12;
-} TouchCoord;
-
-typedef struct {
-    TouchCoord x;
-    TouchCoord y;
-} TouchPoint;
-
-typedef struct {
-    // Big endian
-    TouchPoint points[10];
-} TouchScreenState;
+// Every input delta is a full one this often, so a lost delta doesn't leave the pipe's state wrong for long
+#define INPUT_DELTA_REFRESH_US (100 * 1000)
 
 pthread_mutex_t button_mtx;
-int32_t current_buttons[VANILLA_BTN_COUNT] = {0};
-int current_touch_x = -1;
-int current_touch_y = -1;
-
-typedef struct {
-    // Big endian
-    uint16_t seq_id;
-    uint16_t buttons;
-    uint8_t power_status;
-    uint8_t battery_charge;
-    uint16_t stick_left_x;
-    uint16_t stick_left_y;
-    uint16_t stick_right_x;
-    uint16_t stick_right_y;
-    uint8_t audio_volume;
-    InputPacketAccelerometer accelerometer;
-    InputPacketGyroscope gyroscope;
-    InputPacketMagnet magnet;
-    TouchScreenState touchscreen; // byte 36 - 76
-    unsigned char unknown_0[4];
-    uint8_t extra_buttons;
-    unsigned char unknown_1[46];
-    uint8_t fw_version_neg;
-} InputPacket;
-
-#pragma pack(pop)
+input_state current_state = {.touch_x = -1, .touch_y = -1, .battery_status = VANILLA_BATTERY_STATUS_CHARGING};
+
+int pipe_input_deltas_requested = 0;
+
+// What the pipe was last sent when it builds HID packets from deltas
+static uint16_t delta_seq = 0;
+static input_state last_sent_state;
+static uint64_t last_full_delta_time = 0;
+
+// Time of the oldest input change that hasn't been sent to the console yet, 0 if there is none
+uint64_t pending_change_time = 0;
+
+pthread_mutex_t latency_mtx = PTHREAD_MUTEX_INITIALIZER;
+VanillaLatencyHistogram input_latency;
+int log_input_latency = 0;
+
+void set_pipe_input_deltas(int enabled)
+{
+    pipe_input_deltas_requested = enabled;
+}
+
+int is_pipe_input_deltas_requested()
+{
+    return pipe_input_deltas_requested;
+}
+
+void mark_input_changed()
+{
+    if (!pending_change_time) {
+        pending_change_time = get_monotonic_time_us();
+    }
+}
 
 void set_button_state(int button, int32_t value)
 {
     pthread_mutex_lock(&button_mtx);
-    current_buttons[button] = value;
+    if (current_state.buttons[button] != value) {
+        current_state.buttons[button] = value;
+        mark_input_changed();
+    }
     pthread_mutex_unlock(&button_mtx);
 }
 
 void set_touch_state(int x, int y)
 {
     pthread_mutex_lock(&button_mtx);
-    current_touch_x = x;
-    current_touch_y = y;
+    if (current_state.touch_x != x || current_state.touch_y != y) {
+        current_state.touch_x = x;
+        current_state.touch_y = y;
+        mark_input_changed();
+    }
     pthread_mutex_unlock(&button_mtx);
 }
 
-uint16_t resolve_axis_value(float axis, float neg, float pos, int flip)
+void reset_input_latency()
 {
-    float val = axis < 0 ? axis / 32768.0f : axis / 32767.0f;
-
-    neg = abs(neg);
-    pos = abs(pos);
-
-    neg /= 32767.0f;
-    pos /= 32767.0f;
-
-    val -= neg;
-    val += pos;
-
-    if (flip) {
-        val = -val;
-    }
-    
-    return ((int) (val * 1024)) + 2048;
+    pthread_mutex_lock(&latency_mtx);
+    memset(&input_latency, 0, sizeof(input_latency));
+    pthread_mutex_unlock(&latency_mtx);
 }
 
-int64_t scale_x_touch_value(int64_t v)
+void get_input_latency(VanillaLatencyHistogram *histogram)
 {
-    // Scales 0-854 to 0-4096 with a 2.5% margin on each side
-    const int scale_percent = 95;
-
-    v *= 4096;
-    v *= scale_percent;
-    v /= 854;
-    v /= 100;
-    v += (4096 * (100 - scale_percent) / 200);
-
-    return v;
+    pthread_mutex_lock(&latency_mtx);
+    memcpy(histogram, &input_latency, sizeof(input_latency));
+    pthread_mutex_unlock(&latency_mtx);
 }
 
-int64_t scale_y_touch_value(int64_t v)
+void set_input_latency_logging(int enabled)
 {
-    // Scales 0-854 to 0-4096 with a 5% margin on the bottom and 3% margin on the top (I don't know why, but these values worked best)
-    const int scale_percent = 92;
+    log_input_latency = enabled;
+}
 
-    v *= 4096;
-    v *= scale_percent;
-    v /= 480;
-    v /= 100;
-    v += (4096 * (100 - 90) / 200);
-    v = 4096 - v;
+void record_input_latency(uint64_t latency_us)
+{
+    uint32_t latency = (uint32_t) MIN(latency_us, UINT32_MAX);
+    size_t bucket = MIN(latency / VANILLA_LATENCY_BUCKET_WIDTH_US, VANILLA_LATENCY_BUCKET_COUNT - 1);
 
-    return v;
+    pthread_mutex_lock(&latency_mtx);
+    if (input_latency.count == 0 || latency < input_latency.min_us) {
+        input_latency.min_us = latency;
+    }
+    if (latency > input_latency.max_us) {
+        input_latency.max_us = latency;
+    }
+    input_latency.count++;
+    input_latency.total_us += latency;
+    input_latency.buckets[bucket]++;
+    pthread_mutex_unlock(&latency_mtx);
 }
 
-float unpack_float(int32_t x)
+void print_input_latency()
 {
-    float f;
-    memcpy(&f, &x, sizeof(int32_t));
-    return f;
+    VanillaLatencyHistogram h;
+    get_input_latency(&h);
+    if (h.count) {
+        print_info("INPUT LATENCY - changes: %llu, avg: %lluus, min: %uus, max: %uus",
+                   (unsigned long long) h.count, (unsigned long long) (h.total_us / h.count), h.min_us, h.max_us);
+    }
 }
 
-int current_battery_status = VANILLA_BATTERY_STATUS_CHARGING;
 void set_battery_status(int status)
 {
     pthread_mutex_lock(&button_mtx);
-    current_battery_status = status;
+    current_state.battery_status = status;
     pthread_mutex_unlock(&button_mtx);
 }
 
 void send_input(int socket_hid)
 {
-    InputPacket ip;
-    memset(&ip, 0, sizeof(ip));
-
     static uint16_t seq_id = 0;
+    uint8_t packet[INPUT_PACKET_SIZE];
 
     pthread_mutex_lock(&button_mtx);
 
-    ip.touchscreen.points[9].x.extra = reverse_bits(current_battery_status, 3);
+    build_input_packet(&current_state, seq_id, packet);
 
-    if (current_touch_x >= 0 && current_touch_y >= 0) {
-        for (int i = 0; i < 10; i++) {
-            ip.touchscreen.points[i].x.pad = 1;
-            ip.touchscreen.points[i].y.pad = 1;
-            ip.touchscreen.points[i].x.value = reverse_bits(scale_x_touch_value(current_touch_x), 12);
-            ip.touchscreen.points[i].y.value = reverse_bits(scale_y_touch_value(current_touch_y), 12);
-        }
+    uint64_t change_time = pending_change_time;
+    pending_change_time = 0;
 
-        ip.touchscreen.points[0].y.extra = reverse_bits(2, 3);
-        ip.touchscreen.points[1].x.extra = reverse_bits(7, 3);
-        ip.touchscreen.points[1].y.extra = reverse_bits(3, 3);
-    }
+    pthread_mutex_unlock(&button_mtx);
 
-    for (int byte = 0; byte < sizeof(ip.touchscreen); byte += 2)
-    {
-        unsigned char *touchscreen_bytes = (unsigned char *)(&ip.touchscreen);
-        unsigned char first = (unsigned char)reverse_bits(touchscreen_bytes[byte], 8);
-        touchscreen_bytes[byte] = (unsigned char)reverse_bits(touchscreen_bytes[byte + 1], 8);
-        touchscreen_bytes[byte + 1] = first;
-    }
+    seq_id++;
 
-    uint16_t button_mask = 0;
-
-    if (current_buttons[VANILLA_BTN_A]) button_mask |= 0x8000;
-    if (current_buttons[VANILLA_BTN_B]) button_mask |= 0x4000;
-    if (current_buttons[VANILLA_BTN_X]) button_mask |= 0x2000;
-    if (current_buttons[VANILLA_BTN_Y]) button_mask |= 0x1000;
-    if (current_buttons[VANILLA_BTN_L]) button_mask |= 0x0020;
-    if (current_buttons[VANILLA_BTN_R]) button_mask |= 0x0010;
-    if (current_buttons[VANILLA_BTN_ZL]) button_mask |= 0x0080;
-    if (current_buttons[VANILLA_BTN_ZR]) button_mask |= 0x0040;
-    if (current_buttons[VANILLA_BTN_MINUS]) button_mask |= 0x0004;
-    if (current_buttons[VANILLA_BTN_PLUS]) button_mask |= 0x0008;
-    if (current_buttons[VANILLA_BTN_HOME]) button_mask |= 0x0002;
-    if (current_buttons[VANILLA_BTN_LEFT]) button_mask |= 0x800;
-    if (current_buttons[VANILLA_BTN_RIGHT]) button_mask |= 0x400;
-    if (current_buttons[VANILLA_BTN_DOWN]) button_mask |= 0x100;
-    if (current_buttons[VANILLA_BTN_UP]) button_mask |= 0x200;
-
-    ip.buttons = htons(button_mask);
-
-    button_mask = 0;
-    
-    if (current_buttons[VANILLA_BTN_L3]) button_mask |= 0x80;
-    if (current_buttons[VANILLA_BTN_R3]) button_mask |= 0x40;
+    send_to_console(socket_hid, packet, sizeof(packet), PORT_HID);
 
-    ip.extra_buttons = button_mask;
+    if (change_time) {
+        record_input_latency(get_monotonic_time_us() - change_time);
+    }
+}
 
-    ip.stick_left_x = resolve_axis_value(current_buttons[VANILLA_AXIS_L_X], current_buttons[VANILLA_AXIS_L_LEFT], current_buttons[VANILLA_AXIS_L_RIGHT], 0);
-    ip.stick_left_y = resolve_axis_value(current_buttons[VANILLA_AXIS_L_Y], current_buttons[VANILLA_AXIS_L_UP], current_buttons[VANILLA_AXIS_L_DOWN], 1);
-    ip.stick_right_x = resolve_axis_value(current_buttons[VANILLA_AXIS_R_X], current_buttons[VANILLA_AXIS_R_LEFT], current_buttons[VANILLA_AXIS_R_RIGHT], 0);
-    ip.stick_right_y = resolve_axis_value(current_buttons[VANILLA_AXIS_R_Y], current_buttons[VANILLA_AXIS_R_UP], current_buttons[VANILLA_AXIS_R_DOWN], 1);
+void send_input_delta(int socket_hid)
+{
+    uint8_t delta[INPUT_DELTA_MAX_SIZE];
 
-    ip.audio_volume = current_buttons[VANILLA_AXIS_VOLUME];
+    uint64_t now = get_monotonic_time_us();
+    int full = (last_full_delta_time == 0 || now - last_full_delta_time >= INPUT_DELTA_REFRESH_US);
 
-    ip.accelerometer.x = unpack_float(current_buttons[VANILLA_SENSOR_ACCEL_X]) * -800;
-    ip.accelerometer.y = unpack_float(current_buttons[VANILLA_SENSOR_ACCEL_Y]) * -800;
-    ip.accelerometer.z = unpack_float(current_buttons[VANILLA_SENSOR_ACCEL_Z]) * 800;
+    pthread_mutex_lock(&button_mtx);
+
+    size_t size = encode_input_delta(&current_state, full ? NULL : &last_sent_state, delta_seq, delta);
+    last_sent_state = current_state;
 
-    ip.gyroscope.yaw = (unpack_float(current_buttons[VANILLA_SENSOR_GYRO_YAW]) * (180.0f/M_PI)) / ((200.0f * 6.0f) / 154000.0f);
-    ip.gyroscope.pitch = (unpack_float(current_buttons[VANILLA_SENSOR_GYRO_PITCH]) * (180.0f/M_PI)) / ((200.0f * 6.0f) / 154000.0f);
-    ip.gyroscope.roll = (unpack_float(current_buttons[VANILLA_SENSOR_GYRO_ROLL]) * (180.0f/M_PI)) / ((200.0f * 6.0f) / 154000.0f);
+    uint64_t change_time = pending_change_time;
+    pending_change_time = 0;
 
     pthread_mutex_unlock(&button_mtx);
 
-    ip.seq_id = htons(seq_id);
-    seq_id++;
+    if (size == 0) {
+        return;
+    }
+
+    if (full) {
+        last_full_delta_time = now;
+    }
+    delta_seq++;
 
-    ip.fw_version_neg = 215;
+    send_to_console(socket_hid, delta, size, PORT_HID);
 
-    send_to_console(socket_hid, &ip, sizeof(ip), PORT_HID);
+    if (change_time) {
+        record_input_latency(get_monotonic_time_us() - change_time);
+    }
 }
 
 void *listen_input(void *x)
@@ -245,11 +186,35 @@ void *listen_input(void *x)
 
     pthread_mutex_init(&button_mtx, NULL);
 
+    reset_input_latency();
+
+    // The first delta of a session has to be a full one
+    last_full_delta_time = 0;
+
+    // Log roughly once per second
+    static const int latency_log_interval = 200;
+    int tick = 0;
+
     do {
-        send_input(info->socket_hid);
+        // With deltas the pipe keeps sending HID packets to the console itself, only changes go out
+        if (info->input_deltas) {
+            send_input_delta(info->socket_hid);
+        } else {
+            send_input(info->socket_hid);
+        }
+
+        if (log_input_latency && ++tick == latency_log_interval) {
+            print_input_latency();
+            tick = 0;
+        }
+
         usleep(5 * 1000); // Produces 200Hz input, probably no need to go higher for the Wii U (supposedly the real gamepad is 180Hz)
     } while (!is_interrupted());
 
+    if (log_input_latency) {
+        print_input_latency();
+    }
+
     pthread_mutex_destroy(&button_mtx);
 
     pthread_exit(NULL);
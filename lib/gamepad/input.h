@@ -3,9 +3,18 @@
 
 #include <stdint.h>
 
+#include "vanilla.h"
+
 void *listen_input(void *x);
 void set_button_state(int button, int32_t value);
 void set_touch_state(int x, int y);
 void set_battery_status(int status);
 
+void get_input_latency(VanillaLatencyHistogram *histogram);
+void reset_input_latency();
+void set_input_latency_logging(int enabled);
+
+void set_pipe_input_deltas(int enabled);
+int is_pipe_input_deltas_requested();
+
 #endif // GAMEPAD_INPUT_H
\ No newline at end of file
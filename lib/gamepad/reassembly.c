@@ -0,0 +1,253 @@
+#include "reassembly.h"
+
+#include <string.h>
+
+typedef struct
+{
+    unsigned magic : 4;
+    unsigned packet_type : 2;
+    unsigned seq_id : 10;
+    unsigned init : 1;
+    unsigned frame_begin : 1;
+    unsigned chunk_end : 1;
+    unsigned frame_end : 1;
+    unsigned has_timestamp : 1;
+    unsigned payload_size : 11;
+    unsigned timestamp : 32;
+    uint8_t extended_header[8];
+    uint8_t payload[2048];
+} VideoPacket;
+
+#pragma pack(push, 1)
+typedef struct {
+    unsigned format : 3;
+    unsigned mono : 1;
+    unsigned vibrate : 1;
+    unsigned type : 1;
+    unsigned seq_id : 10;
+    unsigned payload_size : 16;
+    unsigned timestamp : 32;
+    unsigned char payload[2048];
+} AudioPacket;
+const static unsigned int TYPE_AUDIO = 0;
+const static unsigned int TYPE_VIDEO = 1;
+#pragma pack(pop)
+
+// Everything before the payload is bit-reversed, the payload itself is sent as-is
+#define VIDEO_PACKET_HEADER_SIZE offsetof(VideoPacket, payload)
+#define VIDEO_PACKET_BITFIELD_SIZE offsetof(VideoPacket, extended_header)
+#define AUDIO_PACKET_HEADER_SIZE offsetof(AudioPacket, payload)
+
+static unsigned int reassembly_reverse_bits(unsigned int b, int bit_count)
+{
+    unsigned int result = 0;
+
+    for (int i = 0; i < bit_count; i++) {
+        result |= ((b >> i) & 1) << (bit_count - 1 - i);
+    }
+
+    return result;
+}
+
+static void reverse_header_bytes(uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (uint8_t) reassembly_reverse_bits(data[i], 8);
+    }
+}
+
+int video_packet_is_frame_end(const uint8_t *data, size_t size)
+{
+    if (size < VIDEO_PACKET_BITFIELD_SIZE) {
+        return 0;
+    }
+
+    VideoPacket header;
+    memcpy(&header, data, VIDEO_PACKET_BITFIELD_SIZE);
+    reverse_header_bytes((uint8_t *) &header, VIDEO_PACKET_BITFIELD_SIZE);
+    return header.frame_end;
+}
+
+void video_assembler_init(video_assembler *a)
+{
+    a->seq_id_expected = -1;
+    a->is_streaming = 0;
+    a->packet_seq = -1;
+    a->packet_seq_end = -1;
+    a->frame_decode_num = 0;
+}
+
+void video_assembler_reset(video_assembler *a)
+{
+    a->is_streaming = 0;
+}
+
+static size_t build_nals(video_assembler *a, size_t frame_size, int is_idr, uint8_t *out, size_t out_size)
+{
+    // Encapsulate packet data into NAL unit
+    uint8_t *nals_current = out;
+    uint8_t *nals_end = out + out_size;
+    int slice_header = is_idr ? 0x25b804ff : (0x21e003ff | ((a->frame_decode_num & 0xff) << 13));
+    a->frame_decode_num++;
+
+    if (out_size < sizeof(sps_pps_params) + 10) {
+        return 0;
+    }
+
+    if (is_idr) {
+        memcpy(nals_current, sps_pps_params, sizeof(sps_pps_params));
+        nals_current += sizeof(sps_pps_params);
+    }
+
+    // begin slice nalu
+    uint8_t slice[] = {0x00, 0x00, 0x00, 0x01,
+                    (uint8_t) ((slice_header >> 24) & 0xff),
+                    (uint8_t) ((slice_header >> 16) & 0xff),
+                    (uint8_t) ((slice_header >> 8) & 0xff),
+                    (uint8_t) (slice_header & 0xff)
+    };
+    memcpy(nals_current, slice, sizeof(slice));
+    nals_current += sizeof(slice);
+
+    // Frame
+    memcpy(nals_current, a->frame, 2);
+    nals_current += 2;
+
+    // Escape codes
+    for (size_t byte = 2; byte < frame_size; ++byte) {
+        if (nals_end - nals_current < 2) {
+            return 0;
+        }
+        if (a->frame[byte] <= 3 && *(nals_current - 2) == 0 && *(nals_current - 1) == 0) {
+            *nals_current = 3;
+            nals_current++;
+        }
+        *nals_current = a->frame[byte];
+        nals_current++;
+    }
+
+    return nals_current - out;
+}
+
+int video_assembler_push(video_assembler *a, uint8_t *data, size_t size, uint8_t *out, size_t out_size, size_t *out_len, int *is_idr_out)
+{
+    if (size < VIDEO_PACKET_HEADER_SIZE) {
+        return VIDEO_ASSEMBLER_NONE;
+    }
+
+    reverse_header_bytes(data, VIDEO_PACKET_BITFIELD_SIZE);
+
+    VideoPacket *vp = (VideoPacket *) data;
+
+    vp->magic = reassembly_reverse_bits(vp->magic, 4);
+    vp->packet_type = reassembly_reverse_bits(vp->packet_type, 2);
+    vp->seq_id = reassembly_reverse_bits(vp->seq_id, 10);
+    vp->payload_size = reassembly_reverse_bits(vp->payload_size, 11);
+    vp->timestamp = reassembly_reverse_bits(vp->timestamp, 32);
+
+    size_t payload_size = vp->payload_size;
+    if (payload_size > size - VIDEO_PACKET_HEADER_SIZE) {
+        payload_size = size - VIDEO_PACKET_HEADER_SIZE;
+    }
+
+    // Check if packet is IDR (instantaneous decoder refresh)
+    int is_idr = 0;
+    for (int i = 0; i < sizeof(vp->extended_header); i++) {
+        if (vp->extended_header[i] == 0x80) {
+            is_idr = 1;
+            break;
+        }
+    }
+
+    // Check seq ID
+    int seq_matched = 1;
+    if (a->seq_id_expected == -1) {
+        a->seq_id_expected = vp->seq_id;
+    } else if (a->seq_id_expected != vp->seq_id) {
+        seq_matched = 0;
+    }
+    a->seq_id_expected = (vp->seq_id + 1) & 0x3ff;  // 10 bit number
+    if (!seq_matched) {
+        a->is_streaming = 0;
+    }
+
+    // Check if this is the beginning of the packet
+    if (vp->frame_begin) {
+        a->packet_seq = vp->seq_id;
+        a->packet_seq_end = -1;
+
+        if (!a->is_streaming) {
+            if (is_idr) {
+                a->is_streaming = 1;
+            } else {
+                return VIDEO_ASSEMBLER_NEED_IDR;
+            }
+        }
+    }
+
+    memcpy(a->segments[vp->seq_id], vp->payload, payload_size);
+    a->segment_size[vp->seq_id] = payload_size;
+
+    if (vp->frame_end) {
+        a->packet_seq_end = vp->seq_id;
+    }
+
+    if (a->packet_seq_end == -1 || a->packet_seq == -1 || !a->is_streaming) {
+        // We haven't received the complete frame (yet)
+        return VIDEO_ASSEMBLER_NONE;
+    }
+
+    // Combine segments
+    size_t frame_size = 0;
+    for (int i = a->packet_seq; ; i = (i + 1) % 1024) {
+        if (frame_size + a->segment_size[i] > sizeof(a->frame)) {
+            a->packet_seq_end = -1;
+            return VIDEO_ASSEMBLER_NONE;
+        }
+        memcpy(a->frame + frame_size, a->segments[i], a->segment_size[i]);
+        frame_size += a->segment_size[i];
+        if (i == a->packet_seq_end) {
+            break;
+        }
+    }
+    a->packet_seq_end = -1;
+
+    if (frame_size < 2) {
+        return VIDEO_ASSEMBLER_NONE;
+    }
+
+    *out_len = build_nals(a, frame_size, is_idr, out, out_size);
+    *is_idr_out = is_idr;
+    return *out_len ? VIDEO_ASSEMBLER_FRAME : VIDEO_ASSEMBLER_NONE;
+}
+
+int audio_packet_decode(uint8_t *data, size_t size, audio_block *block)
+{
+    if (size < AUDIO_PACKET_HEADER_SIZE) {
+        return 0;
+    }
+
+    reverse_header_bytes(data, AUDIO_PACKET_HEADER_SIZE);
+
+    AudioPacket *ap = (AudioPacket *) data;
+
+    ap->format = reassembly_reverse_bits(ap->format, 3);
+    ap->seq_id = reassembly_reverse_bits(ap->seq_id, 10);
+    ap->payload_size = reassembly_reverse_bits(ap->payload_size, 16);
+    ap->timestamp = reassembly_reverse_bits(ap->timestamp, 32);
+
+    if (ap->type == TYPE_VIDEO) {
+        // Video format packet
+        // TODO: Implement
+        return 0;
+    }
+
+    block->vibrate = ap->vibrate;
+    block->payload = ap->payload;
+    block->payload_size = ap->payload_size;
+    if (block->payload_size > size - AUDIO_PACKET_HEADER_SIZE) {
+        block->payload_size = size - AUDIO_PACKET_HEADER_SIZE;
+    }
+
+    return 1;
+}
@@ -0,0 +1,70 @@
+#ifndef GAMEPAD_REASSEMBLY_H
+#define GAMEPAD_REASSEMBLY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Video and audio packet decoding shared between the library and vanilla-pipe, so this must not
+// depend on anything else in the library.
+
+#define VIDEO_MAX_FRAME_SIZE 100000
+
+// Big enough for any frame video_assembler_push() can produce
+#define VIDEO_MAX_NAL_SIZE (VIDEO_MAX_FRAME_SIZE * 2)
+
+static const uint8_t sps_pps_params[] = {
+    // sps
+    0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x20, 0xac, 0x2b, 0x40, 0x6c, 0x1e, 0xf3, 0x68,
+    // pps
+    0x00, 0x00, 0x00, 0x01, 0x68, 0xee, 0x06, 0x0c, 0xe8
+};
+
+enum VideoAssemblerResult
+{
+    VIDEO_ASSEMBLER_NONE,
+    VIDEO_ASSEMBLER_FRAME,
+    VIDEO_ASSEMBLER_NEED_IDR
+};
+
+typedef struct
+{
+    int seq_id_expected;
+    int is_streaming;
+    int packet_seq;
+    int packet_seq_end;
+    int frame_decode_num;
+
+    size_t segment_size[1024];
+    uint8_t segments[1024][2048];
+
+    uint8_t frame[VIDEO_MAX_FRAME_SIZE];
+} video_assembler;
+
+void video_assembler_init(video_assembler *a);
+
+// Drop the current stream, the next frame will only be output once an IDR arrives
+void video_assembler_reset(video_assembler *a);
+
+/**
+ * Feed one datagram from the console's video port
+ *
+ * `data` is decoded in place. Returns VIDEO_ASSEMBLER_FRAME when a complete Annex-B frame has been
+ * written to `out` (`out_size` should be at least VIDEO_MAX_NAL_SIZE), or VIDEO_ASSEMBLER_NEED_IDR
+ * if the console should be asked for an IDR before anything can be output.
+ */
+int video_assembler_push(video_assembler *a, uint8_t *data, size_t size, uint8_t *out, size_t out_size, size_t *out_len, int *is_idr);
+
+// Whether a datagram from the console's video port is the last one of its frame, without decoding it
+int video_packet_is_frame_end(const uint8_t *data, size_t size);
+
+typedef struct
+{
+    int vibrate;
+    const uint8_t *payload;
+    size_t payload_size;
+} audio_block;
+
+// Decode a datagram from the console's audio port in place, returns 0 if it doesn't carry audio
+int audio_packet_decode(uint8_t *data, size_t size, audio_block *block);
+
+#endif // GAMEPAD_REASSEMBLY_H
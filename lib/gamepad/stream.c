@@ -0,0 +1,122 @@
+#include "stream.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "audio.h"
+#include "gamepad.h"
+#include "reassembly.h"
+#include "video.h"
+#include "watchdog.h"
+
+#include "../pipe/linux/def.h"
+#include "status.h"
+#include "util.h"
+
+int pipe_frames_requested = 0;
+
+void set_pipe_frames(int enabled)
+{
+    pipe_frames_requested = enabled;
+}
+
+int is_pipe_frames_requested()
+{
+    return pipe_frames_requested;
+}
+
+int open_pipe_stream(uint32_t server_address)
+{
+    int skt = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (skt == -1) {
+        return -1;
+    }
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = server_address;
+    addr.sin_port = htons(VANILLA_PIPE_FRAME_PORT);
+
+    if (connect(skt, (const struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        print_info("FAILED TO CONNECT TO PIPE FRAME PORT: %i", errno);
+        close(skt);
+        return -1;
+    }
+
+    return skt;
+}
+
+static int recv_all(int skt, void *data, size_t size)
+{
+    size_t received = 0;
+    while (received < size) {
+        ssize_t r = recv(skt, (uint8_t *) data + received, size - received, MSG_WAITALL);
+        if (r <= 0) {
+            if (r < 0 && errno == EINTR && !is_interrupted()) {
+                continue;
+            }
+            return 0;
+        }
+        received += r;
+    }
+    return 1;
+}
+
+void *listen_pipe_stream(void *x)
+{
+    struct gamepad_thread_context *info = (struct gamepad_thread_context *) x;
+    static uint8_t data[VIDEO_MAX_NAL_SIZE];
+
+    uint32_t expected_seq[3] = {0};
+    uint64_t frames = 0;
+    uint64_t missing = 0;
+
+    while (!is_interrupted()) {
+        vanilla_pipe_frame_header header;
+        if (!recv_all(info->socket_stream, &header, sizeof(header))) {
+            break;
+        }
+
+        uint32_t length = ntohl(header.length);
+        uint32_t seq = ntohl(header.seq);
+        if (length > sizeof(data)) {
+            print_info("INVALID FRAME LENGTH FROM PIPE: %u", length);
+            break;
+        }
+        if (!recv_all(info->socket_stream, data, length)) {
+            break;
+        }
+
+        // The pipe skips sequence numbers for frames it had to drop
+        if (header.type < 3) {
+            missing += seq - expected_seq[header.type];
+            expected_seq[header.type] = seq + 1;
+        }
+        frames++;
+
+        if (header.type == VANILLA_PIPE_FRAME_VIDEO) {
+            watchdog_feed(VANILLA_STREAM_VIDEO);
+            info->event_handler(info->context, VANILLA_EVENT_VIDEO, (const char *) data, length);
+            send_queued_idr_request(info->socket_msg);
+        } else if (header.type == VANILLA_PIPE_FRAME_AUDIO) {
+            watchdog_feed(VANILLA_STREAM_AUDIO);
+            info->event_handler(info->context, VANILLA_EVENT_AUDIO, (const char *) data, length);
+            set_vibrate_state(info->event_handler, info->context, (header.flags & VANILLA_PIPE_FRAME_FLAG_VIBRATE) != 0);
+        }
+    }
+
+    // Don't leave the frontend vibrating if the stream ends mid-rumble
+    set_vibrate_state(info->event_handler, info->context, 0);
+
+    print_info("RECEIVED %llu FRAMES FROM PIPE, %llu MISSING", (unsigned long long) frames, (unsigned long long) missing);
+
+    pthread_exit(NULL);
+
+    return NULL;
+}
@@ -0,0 +1,13 @@
+#ifndef GAMEPAD_STREAM_H
+#define GAMEPAD_STREAM_H
+
+#include <stdint.h>
+
+void set_pipe_frames(int enabled);
+int is_pipe_frames_requested();
+
+// Connect to the frame port of the pipe at `server_address` (network byte order), returns -1 on failure
+int open_pipe_stream(uint32_t server_address);
+void *listen_pipe_stream(void *x);
+
+#endif // GAMEPAD_STREAM_H
@@ -0,0 +1,71 @@
+#define _GNU_SOURCE
+#include "tuning.h"
+
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <sched.h>
+#include <sys/socket.h>
+
+static int low_latency_requested = 0;
+static int realtime_requested = 0;
+static int realtime_cpu = -1;
+
+void set_low_latency(int enabled)
+{
+    low_latency_requested = enabled;
+}
+
+int is_low_latency_requested()
+{
+    return low_latency_requested;
+}
+
+void set_realtime(int enabled, int cpu)
+{
+    realtime_requested = enabled;
+    realtime_cpu = cpu;
+}
+
+int is_realtime_requested()
+{
+    return realtime_requested;
+}
+
+int get_realtime_cpu()
+{
+    return realtime_cpu;
+}
+
+void tune_socket(int skt, socket_tuning *applied)
+{
+    int priority = TUNING_SOCKET_PRIORITY;
+    applied->priority = setsockopt(skt, SOL_SOCKET, SO_PRIORITY, &priority, sizeof(priority)) == 0 ? priority : -1;
+
+    int tos = TUNING_SOCKET_DSCP << 2;
+    applied->dscp = setsockopt(skt, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) == 0 ? TUNING_SOCKET_DSCP : -1;
+
+    // Going past net.core.rmem_max needs CAP_NET_ADMIN, without it we get as close as we're allowed
+    int rcvbuf = TUNING_SOCKET_RCVBUF;
+    if (setsockopt(skt, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) == -1) {
+        setsockopt(skt, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+
+    // The kernel reports double what it was asked for, to account for its bookkeeping
+    socklen_t size = sizeof(rcvbuf);
+    applied->rcvbuf = getsockopt(skt, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &size) == 0 ? rcvbuf / 2 : -1;
+}
+
+int make_thread_realtime(pthread_t thread, int cpu, int *pinned)
+{
+    *pinned = 0;
+    if (cpu >= 0 && cpu < CPU_SETSIZE) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        *pinned = pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+    }
+
+    struct sched_param param = {0};
+    param.sched_priority = TUNING_FIFO_PRIORITY;
+    return pthread_setschedparam(thread, SCHED_FIFO, &param) == 0;
+}
@@ -0,0 +1,39 @@
+#ifndef GAMEPAD_TUNING_H
+#define GAMEPAD_TUNING_H
+
+#include <pthread.h>
+
+// Priority, DSCP and receive buffer given to latency-sensitive sockets by the low-latency profile.
+// DSCP 46 (expedited forwarding) is queued in the Wi-Fi video access category, and priority 6 is
+// the band the default qdisc sends first.
+#define TUNING_SOCKET_PRIORITY 6
+#define TUNING_SOCKET_DSCP 46
+#define TUNING_SOCKET_RCVBUF (4 * 1024 * 1024)
+
+// Low in the real-time range, so the kernel's own threads still come first
+#define TUNING_FIFO_PRIORITY 10
+
+void set_low_latency(int enabled);
+int is_low_latency_requested();
+
+void set_realtime(int enabled, int cpu);
+int is_realtime_requested();
+int get_realtime_cpu();
+
+// What tune_socket() managed to set, -1 for anything it couldn't
+typedef struct
+{
+    int priority;
+    int dscp;
+    int rcvbuf;
+} socket_tuning;
+
+// Apply the low-latency priority, DSCP and receive buffer to `skt`
+void tune_socket(int skt, socket_tuning *applied);
+
+// Put `thread` on SCHED_FIFO, pinned to `cpu` unless it's negative. Returns 0 if the scheduler
+// couldn't be changed, which needs CAP_SYS_NICE or an RLIMIT_RTPRIO. `pinned` is set if the
+// thread was pinned.
+int make_thread_realtime(pthread_t thread, int cpu, int *pinned);
+
+#endif // GAMEPAD_TUNING_H
@@ -3,14 +3,14 @@
 
 #include <stdint.h>
 
+#include "reassembly.h"
+
 void *listen_video(void *x);
 void request_idr();
+void send_queued_idr_request(int socket_msg);
+void send_idr_request_to_console(int socket_msg);
 
-static const uint8_t sps_pps_params[] = {
-    // sps
-    0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x20, 0xac, 0x2b, 0x40, 0x6c, 0x1e, 0xf3, 0x68,
-    // pps
-    0x00, 0x00, 0x00, 0x01, 0x68, 0xee, 0x06, 0x0c, 0xe8
-};
+void set_pipe_fec(int group_size);
+int get_pipe_fec();
 
 #endif // GAMEPAD_VIDEO_H
\ No newline at end of file
@@ -0,0 +1,105 @@
+#include "watchdog.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#include "escalation.h"
+#include "status.h"
+#include "util.h"
+
+static const char *stream_names[VANILLA_STREAM_COUNT] = {"VIDEO", "AUDIO", "COMMAND"};
+
+// The console sends video and audio all the time it's on, commands only now and then
+static uint32_t stall_thresholds_ms[VANILLA_STREAM_COUNT] = {500, 500, 0};
+
+// Counted by the receiving threads
+static uint64_t received[VANILLA_STREAM_COUNT];
+
+// Only used by the thread calling watchdog_check()
+static uint64_t last_received[VANILLA_STREAM_COUNT];
+static uint64_t progress_us[VANILLA_STREAM_COUNT];
+static uint64_t last_check_us = 0;
+
+// Its stats are read by other threads
+static pthread_mutex_t stats_mtx = PTHREAD_MUTEX_INITIALIZER;
+static escalation stalls;
+
+void set_stall_threshold(int stream, int threshold_ms)
+{
+    stall_thresholds_ms[stream] = threshold_ms;
+}
+
+void get_stall_stats(VanillaStallStats *stats)
+{
+    pthread_mutex_lock(&stats_mtx);
+    memcpy(stats, &stalls.stats, sizeof(stalls.stats));
+    pthread_mutex_unlock(&stats_mtx);
+}
+
+void watchdog_start()
+{
+    uint64_t now = get_monotonic_time_us();
+    for (int i = 0; i < VANILLA_STREAM_COUNT; i++) {
+        received[i] = 0;
+        last_received[i] = 0;
+        progress_us[i] = now;
+    }
+    last_check_us = now;
+
+    pthread_mutex_lock(&stats_mtx);
+    escalation_init(&stalls, NULL, stream_names, VANILLA_STREAM_COUNT);
+    pthread_mutex_unlock(&stats_mtx);
+}
+
+void watchdog_feed(int stream)
+{
+    __atomic_add_fetch(&received[stream], 1, __ATOMIC_RELAXED);
+}
+
+void watchdog_check(recovery_step_t take_step, void *context)
+{
+    uint64_t now = get_monotonic_time_us();
+    uint64_t elapsed = now - last_check_us;
+    last_check_us = now;
+
+    for (int i = 0; i < VANILLA_STREAM_COUNT; i++) {
+        uint64_t count = __atomic_load_n(&received[i], __ATOMIC_RELAXED);
+
+        // A stream is only watched once it has started, a console that never sent anything hasn't stalled
+        if (count != last_received[i] || count == 0) {
+            last_received[i] = count;
+            progress_us[i] = now;
+        }
+    }
+
+    pthread_mutex_lock(&stats_mtx);
+    int step = escalation_check(&stalls, stall_thresholds_ms, progress_us, now, elapsed);
+    uint32_t into_stall_ms = (now - stalls.stall_start_us) / 1000;
+    pthread_mutex_unlock(&stats_mtx);
+
+    if (step == -1) {
+        return;
+    }
+
+    // Steps can wait on the pipe, so they're taken without holding up anyone reading the stats
+    int taken = take_step(step, into_stall_ms, context);
+
+    pthread_mutex_lock(&stats_mtx);
+    escalation_step_taken(&stalls, step, taken, now);
+    pthread_mutex_unlock(&stats_mtx);
+}
+
+void watchdog_stop()
+{
+    pthread_mutex_lock(&stats_mtx);
+    escalation_stop(&stalls, get_monotonic_time_us());
+    const VanillaStallStats *stats = &stalls.stats;
+    if (stats->stalls) {
+        print_info("STALLS - count: %llu, recovered: %llu, mttr: %llums, streaming %.2f%% of %llus",
+                   (unsigned long long) stats->stalls, (unsigned long long) stats->recoveries,
+                   (unsigned long long) (stats->recoveries ? stats->recovery_us / stats->recoveries / 1000 : 0),
+                   stats->connected_us ? 100.0 - 100.0 * stats->stalled_us / stats->connected_us : 100.0,
+                   (unsigned long long) (stats->connected_us / 1000000));
+    }
+    pthread_mutex_unlock(&stats_mtx);
+}
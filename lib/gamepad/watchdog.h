@@ -0,0 +1,27 @@
+#ifndef GAMEPAD_WATCHDOG_H
+#define GAMEPAD_WATCHDOG_H
+
+#include <stdint.h>
+
+#include "vanilla.h"
+
+// Take VanillaRecoveryStep `step`, `into_stall_ms` after the stall started. Returns 0 if the step
+// doesn't apply to this connection.
+typedef int (*recovery_step_t)(int step, uint32_t into_stall_ms, void *context);
+
+void set_stall_threshold(int stream, int threshold_ms);
+void get_stall_stats(VanillaStallStats *stats);
+
+// Start watching a new connection, before any of its threads receive anything
+void watchdog_start();
+
+// Something arrived on VanillaStream `stream`, called from the receiving threads
+void watchdog_feed(int stream);
+
+// Look for streams that have gone quiet and take the next recovery step if one is due
+void watchdog_check(recovery_step_t take_step, void *context);
+
+// The connection has ended, a stall still going on ends without recovering
+void watchdog_stop();
+
+#endif // GAMEPAD_WATCHDOG_H
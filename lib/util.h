@@ -22,4 +22,6 @@ void uninstall_interrupt_handler();
 
 uint16_t crc16(const void* data, size_t len);
 
+uint64_t get_monotonic_time_us();
+
 #endif // VANILLA_UTIL_H
\ No newline at end of file
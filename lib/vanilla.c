@@ -5,10 +5,17 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "gamepad/coalesce.h"
 #include "gamepad/command.h"
+#include "gamepad/fec.h"
 #include "gamepad/gamepad.h"
 #include "gamepad/input.h"
+#include "gamepad/stream.h"
+#include "gamepad/tuning.h"
 #include "gamepad/video.h"
+#include "gamepad/watchdog.h"
+
+#include "../pipe/linux/def.h"
 #include "status.h"
 #include "util.h"
 #include "vanilla.h"
@@ -57,6 +64,85 @@ void vanilla_set_touch(int x, int y)
     set_touch_state(x, y);
 }
 
+void vanilla_get_input_latency(VanillaLatencyHistogram *histogram)
+{
+    get_input_latency(histogram);
+}
+
+void vanilla_reset_input_latency()
+{
+    reset_input_latency();
+}
+
+void vanilla_set_input_latency_logging(int enabled)
+{
+    set_input_latency_logging(enabled);
+}
+
+void vanilla_set_pipe_frames(int enabled)
+{
+    set_pipe_frames(enabled);
+}
+
+void vanilla_set_pipe_bundle(int window_us)
+{
+    set_pipe_bundle(window_us);
+}
+
+void vanilla_set_pipe_input_deltas(int enabled)
+{
+    set_pipe_input_deltas(enabled);
+}
+
+void vanilla_set_pipe_spectator(int enabled)
+{
+    set_pipe_spectator(enabled);
+}
+
+void vanilla_set_pipe_slot(int slot)
+{
+    if (slot < 0 || slot >= VANILLA_PIPE_MAX_SLOTS) {
+        slot = 0;
+    }
+    set_pipe_slot(slot);
+}
+
+void vanilla_set_low_latency(int enabled)
+{
+    set_low_latency(enabled);
+}
+
+void vanilla_set_realtime(int enabled, int cpu)
+{
+    set_realtime(enabled, cpu);
+}
+
+void vanilla_set_stall_threshold(int stream, int threshold_ms)
+{
+    if (stream < 0 || stream >= VANILLA_STREAM_COUNT) {
+        return;
+    }
+    if (threshold_ms < 0) {
+        threshold_ms = 0;
+    }
+    set_stall_threshold(stream, threshold_ms);
+}
+
+void vanilla_get_stall_stats(VanillaStallStats *stats)
+{
+    get_stall_stats(stats);
+}
+
+void vanilla_set_pipe_fec(int group_size)
+{
+    if (group_size < 0) {
+        group_size = 0;
+    } else if (group_size > FEC_MAX_GROUP) {
+        group_size = FEC_MAX_GROUP;
+    }
+    set_pipe_fec(group_size);
+}
+
 void default_logger(const char *format, va_list args)
 {
     vprintf(format, args);
@@ -85,6 +85,86 @@ enum VanillaBatteryStatus {
     VANILLA_BATTERY_STATUS_FULL     = 6
 };
 
+/**
+ * Data sent with VANILLA_EVENT_VIBRATE
+ *
+ * This event is only sent when the console turns the vibration motor on or off, not for every audio packet.
+ */
+typedef struct
+{
+    // Non-zero if the motor should now be running
+    uint8_t on;
+
+    // Time of the change in microseconds (CLOCK_MONOTONIC)
+    uint64_t timestamp;
+
+    // When turning off, how long the motor was on for in milliseconds, otherwise 0
+    uint32_t duration;
+} VanillaVibrateEvent;
+
+#define VANILLA_LATENCY_BUCKET_COUNT 32
+#define VANILLA_LATENCY_BUCKET_WIDTH_US 250
+
+/**
+ * Histogram of the delay between an input state change and the first HID packet that carries it
+ *
+ * `buckets[i]` counts delays from `i * VANILLA_LATENCY_BUCKET_WIDTH_US` up to the next bucket. The
+ * last bucket also counts everything above it.
+ */
+typedef struct
+{
+    uint64_t count;
+    uint64_t total_us;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t buckets[VANILLA_LATENCY_BUCKET_COUNT];
+} VanillaLatencyHistogram;
+
+enum VanillaStream
+{
+    VANILLA_STREAM_VIDEO,
+    VANILLA_STREAM_AUDIO,
+    VANILLA_STREAM_COMMAND,
+    VANILLA_STREAM_COUNT
+};
+
+/**
+ * What's tried when a stream stalls, in order
+ */
+enum VanillaRecoveryStep
+{
+    VANILLA_RECOVERY_IDR,
+    VANILLA_RECOVERY_REBIND,
+    VANILLA_RECOVERY_REASSOCIATE,
+    VANILLA_RECOVERY_STEP_COUNT
+};
+
+/**
+ * Stalls in the current session and how they were recovered from
+ *
+ * Availability is `1 - stalled_us / connected_us`, and the mean time to recover is
+ * `recovery_us / recoveries`. A stall is timed from the last packet before it.
+ */
+typedef struct
+{
+    uint64_t connected_us;
+    uint64_t stalled_us;
+
+    uint64_t stalls;
+
+    // Stalls that ended with every stream receiving again, and how long they took in total
+    uint64_t recoveries;
+    uint64_t recovery_us;
+
+    // Times each VanillaRecoveryStep was taken
+    uint64_t steps[VANILLA_RECOVERY_STEP_COUNT];
+
+    // Whether a stream is stalled now, and how far into the current or last stall each step was
+    // taken in milliseconds, 0 if it wasn't
+    int stalled;
+    uint32_t step_ms[VANILLA_RECOVERY_STEP_COUNT];
+} VanillaStallStats;
+
 /**
  * Event handler used by caller to receive events
  */
@@ -125,6 +205,123 @@ void vanilla_set_button(int button, int32_t value);
  */
 void vanilla_set_touch(int x, int y);
 
+/**
+ * Retrieve the input-to-wire latency histogram for the current session
+ *
+ * Each change made through vanilla_set_button() or vanilla_set_touch() is timestamped, and the time
+ * until the HID packet carrying it is sent to the console is recorded. The histogram is reset every
+ * time vanilla_start() is called.
+ */
+void vanilla_get_input_latency(VanillaLatencyHistogram *histogram);
+void vanilla_reset_input_latency();
+
+/**
+ * Periodically log a summary of the input latency histogram
+ */
+void vanilla_set_input_latency_logging(int enabled);
+
+/**
+ * Ask vanilla-pipe to reassemble video and audio itself
+ *
+ * When enabled, vanilla_start_udp() asks a pipe on another host to send complete frames over a
+ * single TCP connection instead of forwarding every datagram. Pipes that don't support it, and
+ * pipes on this host, carry on as before. Takes effect on the next call to vanilla_start_udp().
+ */
+void vanilla_set_pipe_frames(int enabled);
+
+/**
+ * Ask vanilla-pipe to add parity to the video it forwards
+ *
+ * When `group_size` is non-zero, vanilla_start_udp() asks a pipe on another host to send one XOR
+ * parity datagram for every `group_size` video datagrams (and at the end of every frame), so any
+ * single datagram lost from a group can be rebuilt instead of waiting for the next IDR. Costs
+ * roughly 1/`group_size` more bandwidth. Frames take priority if both are requested and accepted.
+ * Takes effect on the next call to vanilla_start_udp(), 0 (the default) disables it.
+ */
+void vanilla_set_pipe_fec(int group_size);
+
+/**
+ * Join vanilla-pipe as a spectator
+ *
+ * When enabled, vanilla_start_udp() asks the pipe to send video and audio to this frontend
+ * alongside the player's, instead of replacing the player. Input sent while spectating is ignored
+ * by the pipe. Other pipe options don't apply to spectators. Pipes that don't support spectators
+ * accept the connection as the player, which is logged. Takes effect on the next call to
+ * vanilla_start_udp().
+ */
+void vanilla_set_pipe_spectator(int enabled);
+
+/**
+ * Ask vanilla-pipe to bundle small datagrams
+ *
+ * When `window_us` is non-zero, vanilla_start_udp() asks a pipe on another host to pack audio,
+ * command and message datagrams that arrive within `window_us` microseconds of each other into a
+ * single carrier datagram, and input sent to the console is bundled the same way. This trades up to
+ * `window_us` of extra latency for far fewer frames on the network. Statistics are logged when the
+ * connection ends. The window is rounded up to 100us, at most 25.5ms. Takes effect on the next call
+ * to vanilla_start_udp(), 0 (the default) disables it.
+ */
+void vanilla_set_pipe_bundle(int window_us);
+
+/**
+ * Have vanilla-pipe build input packets itself
+ *
+ * When enabled, vanilla_start_udp() asks the pipe to keep the gamepad's input state and send HID
+ * packets to the console on its own 200Hz clock. Only changes are sent to the pipe (plus the whole
+ * state every 100ms in case one is lost), so network jitter no longer reaches the console's input
+ * timing. Pipes that don't support it get full packets as before. Takes effect on the next call to
+ * vanilla_start_udp().
+ */
+void vanilla_set_pipe_input_deltas(int enabled);
+
+/**
+ * Choose which of the pipe's consoles to use
+ *
+ * A pipe given several wireless interfaces relays a console on each, and `slot` is the interface's
+ * place in its list. Slot 0 (the default) is the only one that shared memory, frames, bundles and
+ * input deltas are offered on, frontends using the others get plain datagrams and parity. Takes
+ * effect on the next call to vanilla_start_udp().
+ */
+void vanilla_set_pipe_slot(int slot);
+
+/**
+ * Tune the connection for latency
+ *
+ * When enabled, vanilla_start() and vanilla_start_udp() give their sockets a higher priority, DSCP
+ * 46 (which Wi-Fi drivers queue as video) and a larger receive buffer, so bursts of video aren't
+ * dropped while a thread is busy. The settings that were applied are logged. Nothing outlives the
+ * connection. Takes effect on the next call to vanilla_start() or vanilla_start_udp().
+ */
+void vanilla_set_low_latency(int enabled);
+
+/**
+ * Run the library's threads on the real-time scheduler
+ *
+ * When enabled, the threads receiving from the console and sending input run on SCHED_FIFO, pinned
+ * to `cpu` unless it's negative. This needs CAP_SYS_NICE or an RLIMIT_RTPRIO, which is logged if
+ * missing. Takes effect on the next call to vanilla_start() or vanilla_start_udp().
+ */
+void vanilla_set_realtime(int enabled, int cpu);
+
+/**
+ * Set how long a VanillaStream may receive nothing before it counts as stalled
+ *
+ * While connected, a stalled stream is recovered step by step: an IDR is requested at once, the
+ * pipe is bound to again at twice the threshold, and the pipe is asked to reassociate with the
+ * console at four times the threshold (and every 10 seconds after that while the stall goes on).
+ * Binding again is skipped when shared memory, frames, bundles or input deltas were accepted, since
+ * the pipe would start them over, and neither pipe step is taken on a direct connection or by a
+ * spectator. A stream is only watched once it has received something. Defaults to 500ms for video
+ * and audio and 0, which doesn't watch the stream, for commands.
+ */
+void vanilla_set_stall_threshold(int stream, int threshold_ms);
+
+/**
+ * Retrieve stall statistics for the current session, reset every time vanilla_start() or
+ * vanilla_start_udp() is called
+ */
+void vanilla_get_stall_stats(VanillaStallStats *stats);
+
 /**
  * Logging function
  */
@@ -0,0 +1,283 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "def.h"
+#include "ports.h"
+#include "relay.h"
+#include "vanilla.h"
+
+// Loopback throughput of the relay's console to frontend path, once with epoll and once with
+// io_uring. A sender floods the video port as the console would and a bound frontend counts what
+// reaches it, so what's measured is what the relay thread manages to forward.
+//
+// Usage: vanilla-pipe-relay-bench [seconds per run] [datagram size]
+
+#define BENCH_DEFAULT_SECONDS 5
+#define BENCH_DEFAULT_SIZE 1400
+#define BENCH_MAX_SIZE 2048
+
+// The relay's ports are all on loopback, the console's own address isn't needed to send to them
+static const char *BENCH_ADDRESS = "127.0.0.1";
+
+static volatile int bench_running = 1;
+static volatile int relay_ready = 0;
+static volatile int sending = 0;
+
+typedef struct
+{
+    int seconds;
+    size_t size;
+
+    uint64_t sent;
+    uint64_t received;
+    struct rusage relay_usage;
+    struct rusage process_usage;
+} bench_run;
+
+// The relay's own logging, wpa.c has these in vanilla-pipe
+void pprint(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+void print_info(const char *errstr, ...)
+{
+    va_list args;
+    va_start(args, errstr);
+    vfprintf(stderr, errstr, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+}
+
+int is_interrupted()
+{
+    return !bench_running;
+}
+
+static void on_relay_ready()
+{
+    relay_ready = 1;
+}
+
+static uint64_t usage_us(const struct rusage *u)
+{
+    return (u->ru_utime.tv_sec + u->ru_stime.tv_sec) * 1000000ULL + u->ru_utime.tv_usec + u->ru_stime.tv_usec;
+}
+
+// What was used since `before`, left in `after`
+static void subtract_usage(struct rusage *after, const struct rusage *before)
+{
+    timersub(&after->ru_utime, &before->ru_utime, &after->ru_utime);
+    timersub(&after->ru_stime, &before->ru_stime, &after->ru_stime);
+}
+
+static void *run_relay(void *arg)
+{
+    bench_run *run = arg;
+    const char *interfaces[] = {"lo"};
+
+    struct rusage before;
+    getrusage(RUSAGE_THREAD, &before);
+    relay_run(interfaces, 1);
+    getrusage(RUSAGE_THREAD, &run->relay_usage);
+    subtract_usage(&run->relay_usage, &before);
+    return NULL;
+}
+
+static void *send_console(void *arg)
+{
+    bench_run *run = arg;
+    int skt = socket(AF_INET, SOCK_DGRAM, 0);
+    if (skt == -1) {
+        return NULL;
+    }
+
+    struct sockaddr_in to = {0};
+    to.sin_family = AF_INET;
+    to.sin_addr.s_addr = inet_addr(BENCH_ADDRESS);
+    to.sin_port = htons(PORT_VID);
+
+    uint8_t data[BENCH_MAX_SIZE];
+    memset(data, 0xAB, sizeof(data));
+    while (sending) {
+        if (sendto(skt, data, run->size, 0, (const struct sockaddr *) &to, sizeof(to)) > 0) {
+            run->sent++;
+        }
+    }
+
+    close(skt);
+    return NULL;
+}
+
+static int open_frontend_socket(in_port_t port)
+{
+    int skt = socket(AF_INET, SOCK_DGRAM, 0);
+    if (skt == -1) {
+        return -1;
+    }
+
+    struct sockaddr_in in = {0};
+    in.sin_family = AF_INET;
+    in.sin_addr.s_addr = inet_addr(BENCH_ADDRESS);
+    in.sin_port = htons(port);
+
+    // Short enough to notice the sender stopping
+    struct timeval tv = {0, 100 * 1000};
+    setsockopt(skt, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    if (bind(skt, (const struct sockaddr *) &in, sizeof(in)) == -1) {
+        close(skt);
+        return -1;
+    }
+    return skt;
+}
+
+// Bind as the player from the same address the video socket is on, so that's where video goes
+static int bind_frontend()
+{
+    int skt = open_frontend_socket(0);
+    if (skt == -1) {
+        return VANILLA_ERROR;
+    }
+
+    struct sockaddr_in to = {0};
+    to.sin_family = AF_INET;
+    to.sin_addr.s_addr = inet_addr(BENCH_ADDRESS);
+    to.sin_port = htons(VANILLA_PIPE_CMD_SERVER_PORT);
+
+    int ret = VANILLA_ERROR;
+    for (int attempt = 0; attempt < 10 && ret != VANILLA_SUCCESS; attempt++) {
+        uint32_t control = htonl(VANILLA_PIPE_CC_BIND);
+        sendto(skt, &control, sizeof(control), 0, (const struct sockaddr *) &to, sizeof(to));
+
+        uint32_t reply[2];
+        if (recv(skt, reply, sizeof(reply), 0) >= (ssize_t) sizeof(uint32_t) && ntohl(reply[0]) == VANILLA_PIPE_CC_BIND_ACK) {
+            ret = VANILLA_SUCCESS;
+        }
+    }
+
+    close(skt);
+    return ret;
+}
+
+static int run_bench(int use_io_uring, bench_run *run)
+{
+    relay_config.use_io_uring = use_io_uring;
+    relay_config.ready_callback = on_relay_ready;
+    relay_ready = 0;
+    bench_running = 1;
+
+    int frontend = open_frontend_socket(PORT_VID + 200);
+    if (frontend == -1) {
+        fprintf(stderr, "FAILED TO OPEN FRONTEND SOCKET: %i\n", errno);
+        return VANILLA_ERROR;
+    }
+
+    pthread_t relay_thread;
+    pthread_create(&relay_thread, NULL, run_relay, run);
+    while (!relay_ready) {
+        usleep(1000);
+    }
+
+    int ret = VANILLA_ERROR;
+    if (bind_frontend() != VANILLA_SUCCESS) {
+        fprintf(stderr, "RELAY DIDN'T ACKNOWLEDGE THE BIND\n");
+        goto stop;
+    }
+
+    struct rusage process_before;
+    getrusage(RUSAGE_SELF, &process_before);
+
+    sending = 1;
+    pthread_t sender_thread;
+    pthread_create(&sender_thread, NULL, send_console, run);
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    end.tv_sec += run->seconds;
+
+    uint8_t data[BENCH_MAX_SIZE];
+    while (1) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > end.tv_sec || (now.tv_sec == end.tv_sec && now.tv_nsec >= end.tv_nsec)) {
+            break;
+        }
+        if (recv(frontend, data, sizeof(data), 0) > 0) {
+            run->received++;
+        }
+    }
+
+    sending = 0;
+    pthread_join(sender_thread, NULL);
+
+    getrusage(RUSAGE_SELF, &run->process_usage);
+    subtract_usage(&run->process_usage, &process_before);
+    ret = VANILLA_SUCCESS;
+
+stop:
+    bench_running = 0;
+    relay_quit();
+    pthread_join(relay_thread, NULL);
+    close(frontend);
+    return ret;
+}
+
+static void print_run(const char *name, const bench_run *run)
+{
+    if (!run->received) {
+        printf("%-8s nothing relayed\n", name);
+        return;
+    }
+
+    printf("%-8s %10.0f datagrams/s  %6.2f%% of %llu sent  relay thread %6.2f us/datagram  process %6.2f us/datagram\n",
+           name, (double) run->received / run->seconds, 100.0 * run->received / run->sent, (unsigned long long) run->sent,
+           (double) usage_us(&run->relay_usage) / run->received, (double) usage_us(&run->process_usage) / run->received);
+}
+
+int main(int argc, const char **argv)
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_SECONDS;
+    size_t size = argc > 2 ? (size_t) atoi(argv[2]) : BENCH_DEFAULT_SIZE;
+    if (seconds <= 0 || size == 0 || size > BENCH_MAX_SIZE) {
+        fprintf(stderr, "Usage: %s [seconds per run] [datagram size, at most %i]\n", argv[0], BENCH_MAX_SIZE);
+        return 1;
+    }
+
+    printf("%i s per run, %zu byte datagrams to the video port\n", seconds, size);
+
+    bench_run epoll_run = {.seconds = seconds, .size = size};
+    if (run_bench(0, &epoll_run) != VANILLA_SUCCESS) {
+        return 1;
+    }
+
+#ifdef VANILLA_PIPE_IO_URING
+    bench_run uring_run = {.seconds = seconds, .size = size};
+    if (run_bench(1, &uring_run) != VANILLA_SUCCESS) {
+        return 1;
+    }
+#endif
+
+    print_run("epoll", &epoll_run);
+#ifdef VANILLA_PIPE_IO_URING
+    print_run("io_uring", &uring_run);
+#else
+    printf("io_uring not built, liburing wasn't found\n");
+#endif
+
+    return 0;
+}
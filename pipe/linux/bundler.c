@@ -0,0 +1,213 @@
+#include "bundler.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "def.h"
+#include "gamepad/bundle.h"
+#include "status.h"
+
+static int bundle_socket = -1;
+static int timer_fd = -1;
+static int timer_armed = 0;
+
+static struct sockaddr_in client_address = {0};
+static int window_us = 0;
+
+static bundle_writer writer;
+static uint8_t incoming[BUNDLE_MAX_SIZE];
+
+static bundle_stats to_frontend;
+static bundle_stats to_console;
+static struct timespec started;
+
+int bundler_open()
+{
+    bundle_socket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (bundle_socket == -1) {
+        return -1;
+    }
+
+    struct sockaddr_in in = {0};
+    in.sin_family = AF_INET;
+    in.sin_addr.s_addr = INADDR_ANY;
+    in.sin_port = htons(VANILLA_PIPE_BUNDLE_SERVER_PORT);
+
+    if (bind(bundle_socket, (const struct sockaddr *) &in, sizeof(in)) == -1) {
+        print_info("FAILED TO OPEN BUNDLE PORT %u: %i", VANILLA_PIPE_BUNDLE_SERVER_PORT, errno);
+        goto fail;
+    }
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd == -1) {
+        goto fail;
+    }
+
+    return bundle_socket;
+
+fail:
+    close(bundle_socket);
+    bundle_socket = -1;
+    return -1;
+}
+
+int bundler_get_timer_fd()
+{
+    return timer_fd;
+}
+
+void bundler_exit()
+{
+    bundler_close();
+    if (timer_fd != -1) {
+        close(timer_fd);
+        timer_fd = -1;
+    }
+    if (bundle_socket != -1) {
+        close(bundle_socket);
+        bundle_socket = -1;
+    }
+}
+
+void bundler_prepare(struct in_addr client, int window)
+{
+    bundler_close();
+
+    client_address.sin_family = AF_INET;
+    client_address.sin_addr = client;
+    client_address.sin_port = htons(VANILLA_PIPE_BUNDLE_CLIENT_PORT);
+    window_us = window;
+
+    bundle_writer_reset(&writer);
+    memset(&to_frontend, 0, sizeof(to_frontend));
+    memset(&to_console, 0, sizeof(to_console));
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    print_info("BUNDLING SMALL DATAGRAMS WITH A %i US WINDOW", window_us);
+}
+
+int bundler_is_active()
+{
+    return client_address.sin_addr.s_addr != 0;
+}
+
+static void set_timer(int us)
+{
+    struct itimerspec its = {0};
+    its.it_value.tv_sec = us / 1000000;
+    its.it_value.tv_nsec = (us % 1000000) * 1000;
+    timerfd_settime(timer_fd, 0, &its, NULL);
+    timer_armed = (us != 0);
+}
+
+static void flush()
+{
+    if (writer.records == 0) {
+        return;
+    }
+
+    if (sendto(bundle_socket, writer.data, writer.size, 0, (const struct sockaddr *) &client_address, sizeof(client_address)) != -1) {
+        to_frontend.carriers++;
+        to_frontend.carrier_bytes += writer.size;
+    }
+
+    bundle_writer_reset(&writer);
+    if (timer_armed) {
+        set_timer(0);
+    }
+}
+
+void bundler_add(uint8_t type, const uint8_t *data, size_t size)
+{
+    if (!bundle_writer_fits(&writer, size)) {
+        flush();
+        if (!bundle_writer_fits(&writer, size)) {
+            return;
+        }
+    }
+
+    bundle_writer_add(&writer, type, data, size);
+    to_frontend.datagrams++;
+    to_frontend.datagram_bytes += size;
+}
+
+void bundler_end_batch()
+{
+    if (writer.records == 0) {
+        return;
+    }
+
+    if (window_us == 0) {
+        flush();
+    } else if (!timer_armed) {
+        // The window starts with the oldest datagram in the carrier, later ones don't extend it
+        set_timer(window_us);
+    }
+}
+
+void bundler_handle_timer()
+{
+    uint64_t expirations;
+    read(timer_fd, &expirations, sizeof(expirations));
+
+    timer_armed = 0;
+    flush();
+}
+
+void bundler_read(bundler_deliver_t deliver)
+{
+    while (1) {
+        struct sockaddr_in from;
+        socklen_t from_size = sizeof(from);
+        ssize_t r = recvfrom(bundle_socket, incoming, sizeof(incoming), 0, (struct sockaddr *) &from, &from_size);
+        if (r < 0) {
+            break;
+        }
+
+        // Only the bound frontend gets to send to the console
+        if (!bundler_is_active() || from.sin_addr.s_addr != client_address.sin_addr.s_addr) {
+            continue;
+        }
+
+        to_console.carriers++;
+        to_console.carrier_bytes += r;
+
+        bundle_reader reader;
+        bundle_reader_init(&reader, incoming, r);
+
+        uint8_t type;
+        const uint8_t *payload;
+        size_t payload_size;
+        while (bundle_reader_next(&reader, &type, &payload, &payload_size)) {
+            to_console.datagrams++;
+            to_console.datagram_bytes += payload_size;
+            deliver(type, payload, payload_size);
+        }
+    }
+}
+
+void bundler_close()
+{
+    if (!bundler_is_active()) {
+        return;
+    }
+
+    flush();
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double seconds = (now.tv_sec - started.tv_sec) + (now.tv_nsec - started.tv_nsec) / 1e9;
+
+    char line[256];
+    bundle_format_stats(line, sizeof(line), &to_frontend, seconds);
+    print_info("BUNDLED TO FRONTEND: %s", line);
+    bundle_format_stats(line, sizeof(line), &to_console, seconds);
+    print_info("BUNDLED FROM FRONTEND: %s", line);
+
+    client_address.sin_addr.s_addr = 0;
+}
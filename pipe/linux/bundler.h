@@ -0,0 +1,48 @@
+#ifndef VANILLA_PIPE_BUNDLER_H
+#define VANILLA_PIPE_BUNDLER_H
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Carries small datagrams between the pipe and a remote frontend in bundles
+ *
+ * Datagrams from the console's non-video ports are held for up to the frontend's window and sent
+ * together in one carrier datagram, and carriers from the frontend are unpacked and forwarded to
+ * the console port each record belongs to. Fewer, larger frames cost a lot less airtime on a busy
+ * network than many tiny ones.
+ */
+
+typedef void (*bundler_deliver_t)(uint8_t type, const uint8_t *data, size_t size);
+
+// Open the carrier socket, returns -1 on failure
+int bundler_open();
+
+// Timer that expires when the current carrier has to go out
+int bundler_get_timer_fd();
+
+// Start bundling for `client`, holding datagrams for at most `window_us`
+void bundler_prepare(struct in_addr client, int window_us);
+
+// Send whatever is pending, log statistics and stop bundling
+void bundler_close();
+
+int bundler_is_active();
+
+// Queue a datagram for the frontend, the carrier is sent first if it doesn't fit
+void bundler_add(uint8_t type, const uint8_t *data, size_t size);
+
+// Call once a batch has been added, starts the window (or sends right away if there isn't one)
+void bundler_end_batch();
+
+// The timer expired
+void bundler_handle_timer();
+
+// Unpack carriers waiting on the socket from the frontend, each record is passed to `deliver`
+void bundler_read(bundler_deliver_t deliver);
+
+// Close the socket and timer
+void bundler_exit();
+
+#endif // VANILLA_PIPE_BUNDLER_H
@@ -0,0 +1,369 @@
+#define _GNU_SOURCE
+#include "daemon.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "relay.h"
+#include "status.h"
+#include "vanilla.h"
+#include "wpa.h"
+
+// First descriptor passed by systemd socket activation
+#define SD_LISTEN_FDS_START 3
+
+#define DAEMON_MAX_CLIENTS 8
+
+// How long to wait before connecting again if the connection drops while a frontend wants it
+#define DAEMON_RECONNECT_DELAY_MS 1000
+
+enum DaemonState
+{
+    DAEMON_IDLE,
+    DAEMON_CONNECTING,
+    DAEMON_CONNECTED,
+    DAEMON_SYNCING
+};
+
+static const char *state_names[] = {"IDLE", "CONNECTING", "CONNECTED", "SYNCING"};
+
+typedef struct
+{
+    int fd;
+    int waiting_for_ready;
+    int waiting_for_sync;
+    char line[128];
+    size_t line_size;
+} daemon_client;
+
+// Everything below is shared between the control thread and the thread running the connection
+static pthread_mutex_t daemon_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t daemon_cond = PTHREAD_COND_INITIALIZER;
+static int state = DAEMON_IDLE;
+static int want_connection = 0;
+static int pending_sync_code = 0;
+static int exiting = 0;
+static daemon_client clients[DAEMON_MAX_CLIENTS];
+static uint64_t connect_requested_at = 0;
+
+static uint64_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void reply(daemon_client *c, const char *line)
+{
+    // Clients are expected to keep up with a handful of short lines, don't let one block us
+    char buf[64];
+    int len = snprintf(buf, sizeof(buf), "%s\n", line);
+    send(c->fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+static void reply_waiting(int for_sync, const char *line)
+{
+    for (int i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+        daemon_client *c = &clients[i];
+        if (c->fd == -1) {
+            continue;
+        }
+        if (for_sync ? c->waiting_for_sync : c->waiting_for_ready) {
+            reply(c, line);
+            c->waiting_for_sync = 0;
+            c->waiting_for_ready = 0;
+        }
+    }
+}
+
+static int open_listener(const char *wireless_interface)
+{
+    // Socket-activated by systemd, see sd_listen_fds(3)
+    const char *listen_pid = getenv("LISTEN_PID");
+    const char *listen_fds = getenv("LISTEN_FDS");
+    if (listen_pid && listen_fds && atoi(listen_pid) == getpid() && atoi(listen_fds) >= 1) {
+        unsetenv("LISTEN_PID");
+        unsetenv("LISTEN_FDS");
+        fcntl(SD_LISTEN_FDS_START, F_SETFD, FD_CLOEXEC);
+        print_info("USING CONTROL SOCKET FROM SYSTEMD");
+        return SD_LISTEN_FDS_START;
+    }
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    int r = snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%s.sock", VANILLA_PIPE_DAEMON_SOCKET_DIR, wireless_interface);
+    if (r < 0 || (size_t) r >= sizeof(addr.sun_path)) {
+        print_info("CONTROL SOCKET PATH TOO LONG");
+        return -1;
+    }
+
+    mkdir(VANILLA_PIPE_DAEMON_SOCKET_DIR, 0755);
+    unlink(addr.sun_path);
+
+    int skt = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (skt == -1) {
+        return -1;
+    }
+
+    if (bind(skt, (const struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(skt, DAEMON_MAX_CLIENTS) == -1) {
+        print_info("FAILED TO OPEN CONTROL SOCKET %s: %i", addr.sun_path, errno);
+        close(skt);
+        return -1;
+    }
+
+    // The frontend doesn't run as root, but only users allowed to use the pipe should be able to
+    // connect or sync it
+    struct group *group = getgrnam(VANILLA_PIPE_DAEMON_GROUP);
+    if (!group || chown(addr.sun_path, -1, group->gr_gid) == -1) {
+        print_info("NO %s GROUP, ONLY ROOT CAN USE THE CONTROL SOCKET", VANILLA_PIPE_DAEMON_GROUP);
+    }
+    chmod(addr.sun_path, 0660);
+
+    print_info("LISTENING ON %s", addr.sun_path);
+    return skt;
+}
+
+// Called with daemon_mutex held
+static void handle_command(daemon_client *c, char *line)
+{
+    if (!strcasecmp(line, "CONNECT")) {
+        want_connection = 1;
+        if (state == DAEMON_CONNECTED) {
+            reply(c, "READY");
+        } else {
+            c->waiting_for_ready = 1;
+            if (state == DAEMON_IDLE) {
+                connect_requested_at = now_ms();
+            }
+            pthread_cond_signal(&daemon_cond);
+        }
+    } else if (!strncasecmp(line, "SYNC ", 5)) {
+        int code = atoi(line + 5);
+        if (code <= 0 || pending_sync_code || state == DAEMON_SYNCING) {
+            reply(c, "FAILED");
+            return;
+        }
+
+        want_connection = 0;
+        pending_sync_code = code;
+        c->waiting_for_sync = 1;
+        if (state != DAEMON_IDLE) {
+            quit_loop();
+        }
+        pthread_cond_signal(&daemon_cond);
+    } else if (!strcasecmp(line, "DISCONNECT")) {
+        want_connection = 0;
+        if (state == DAEMON_CONNECTING || state == DAEMON_CONNECTED) {
+            quit_loop();
+        }
+        reply(c, "OK");
+    } else if (!strcasecmp(line, "STATUS")) {
+        reply(c, state_names[state]);
+    } else {
+        reply(c, "UNKNOWN COMMAND");
+    }
+}
+
+static void read_client(daemon_client *c)
+{
+    ssize_t r = recv(c->fd, c->line + c->line_size, sizeof(c->line) - c->line_size - 1, MSG_DONTWAIT);
+    if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR)) {
+        close(c->fd);
+        c->fd = -1;
+        return;
+    }
+    if (r < 0) {
+        return;
+    }
+    c->line_size += r;
+    c->line[c->line_size] = 0;
+
+    char *end;
+    while ((end = strchr(c->line, '\n'))) {
+        *end = 0;
+        if (end > c->line && end[-1] == '\r') {
+            end[-1] = 0;
+        }
+
+        handle_command(c, c->line);
+
+        size_t consumed = end + 1 - c->line;
+        memmove(c->line, end + 1, c->line_size - consumed + 1);
+        c->line_size -= consumed;
+    }
+
+    if (c->line_size == sizeof(c->line) - 1) {
+        // Nothing we accept is this long
+        c->line_size = 0;
+    }
+}
+
+static void accept_client(int listener)
+{
+    int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+    if (fd == -1) {
+        return;
+    }
+
+    for (int i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+        if (clients[i].fd == -1) {
+            memset(&clients[i], 0, sizeof(clients[i]));
+            clients[i].fd = fd;
+            return;
+        }
+    }
+
+    daemon_client overflow = {.fd = fd};
+    reply(&overflow, "BUSY");
+    close(fd);
+}
+
+static void *serve_clients(void *arg)
+{
+    int listener = (intptr_t) arg;
+
+    while (1) {
+        struct pollfd fds[1 + DAEMON_MAX_CLIENTS];
+        int slots[DAEMON_MAX_CLIENTS];
+        int n = 0;
+
+        pthread_mutex_lock(&daemon_mutex);
+        if (exiting) {
+            pthread_mutex_unlock(&daemon_mutex);
+            break;
+        }
+        fds[n].fd = listener;
+        fds[n].events = POLLIN;
+        n++;
+        for (int i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+            if (clients[i].fd != -1) {
+                slots[n - 1] = i;
+                fds[n].fd = clients[i].fd;
+                fds[n].events = POLLIN;
+                n++;
+            }
+        }
+        pthread_mutex_unlock(&daemon_mutex);
+
+        // Wake up now and then to notice we're exiting
+        if (poll(fds, n, 500) <= 0) {
+            continue;
+        }
+
+        pthread_mutex_lock(&daemon_mutex);
+        for (int i = 1; i < n; i++) {
+            if (fds[i].revents) {
+                read_client(&clients[slots[i - 1]]);
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            accept_client(listener);
+        }
+        pthread_mutex_unlock(&daemon_mutex);
+    }
+
+    return NULL;
+}
+
+static void relay_ready()
+{
+    pthread_mutex_lock(&daemon_mutex);
+    state = DAEMON_CONNECTED;
+    if (connect_requested_at) {
+        print_info("CONNECTED %llu MS AFTER REQUEST", (unsigned long long) (now_ms() - connect_requested_at));
+        connect_requested_at = 0;
+    }
+    reply_waiting(0, "READY");
+    pthread_mutex_unlock(&daemon_mutex);
+}
+
+int daemon_run(const char *wireless_interface)
+{
+    for (int i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+        clients[i].fd = -1;
+    }
+
+    int listener = open_listener(wireless_interface);
+    if (listener == -1) {
+        return VANILLA_ERROR;
+    }
+
+    // Our control socket replaces stdin
+    wpa_read_stdin = 0;
+    relay_config.ready_callback = relay_ready;
+
+    pthread_t control_thread;
+    if (pthread_create(&control_thread, NULL, serve_clients, (void *) (intptr_t) listener) != 0) {
+        close(listener);
+        return VANILLA_ERROR;
+    }
+
+    pthread_mutex_lock(&daemon_mutex);
+    while (!is_terminating()) {
+        // A stop asked for before now was meant for the last sync or connection. Forget it before
+        // the next one is published, so a DISCONNECT or signal from then on reaches that one.
+        wpa_reset_interrupt();
+        if (is_terminating()) {
+            break;
+        }
+
+        if (pending_sync_code) {
+            int code = pending_sync_code;
+            state = DAEMON_SYNCING;
+            pthread_mutex_unlock(&daemon_mutex);
+
+            int r = vanilla_sync_with_console(wireless_interface, 0, code);
+
+            pthread_mutex_lock(&daemon_mutex);
+            pending_sync_code = 0;
+            state = DAEMON_IDLE;
+            reply_waiting(1, r == VANILLA_SUCCESS ? "SYNCED" : "FAILED");
+        } else if (want_connection) {
+            state = DAEMON_CONNECTING;
+            pthread_mutex_unlock(&daemon_mutex);
+
+            vanilla_connect_to_console(wireless_interface);
+
+            pthread_mutex_lock(&daemon_mutex);
+            state = DAEMON_IDLE;
+            reply_waiting(0, "FAILED");
+
+            if (want_connection && !pending_sync_code && !is_terminating()) {
+                // Lost the console, try again shortly unless we're told otherwise
+                print_info("CONNECTION ENDED, RECONNECTING");
+                struct timespec until;
+                clock_gettime(CLOCK_REALTIME, &until);
+                until.tv_sec += DAEMON_RECONNECT_DELAY_MS / 1000;
+                pthread_cond_timedwait(&daemon_cond, &daemon_mutex, &until);
+            }
+        } else {
+            pthread_cond_wait(&daemon_cond, &daemon_mutex);
+        }
+    }
+    exiting = 1;
+    pthread_mutex_unlock(&daemon_mutex);
+
+    pthread_join(control_thread, NULL);
+
+    for (int i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+        if (clients[i].fd != -1) {
+            close(clients[i].fd);
+        }
+    }
+    close(listener);
+
+    return VANILLA_SUCCESS;
+}
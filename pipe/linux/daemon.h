@@ -0,0 +1,28 @@
+#ifndef VANILLA_PIPE_DAEMON_H
+#define VANILLA_PIPE_DAEMON_H
+
+// Control sockets are created here as <wireless-interface>.sock when not socket-activated
+#define VANILLA_PIPE_DAEMON_SOCKET_DIR "/run/vanilla-pipe"
+
+// Members of this group can use the control socket, as set up by the systemd socket unit
+#define VANILLA_PIPE_DAEMON_GROUP "vanilla"
+
+/**
+ * Long-running mode, controlled over a local socket
+ *
+ * Instead of starting wpa_supplicant and getting an address every time a frontend connects, the
+ * daemon stays associated with the console and keeps the relay running between frontend sessions,
+ * so connecting again only costs a round trip on the control socket. The socket is taken from
+ * systemd if we were socket-activated, otherwise it's created in VANILLA_PIPE_DAEMON_SOCKET_DIR.
+ *
+ * Commands are single lines, each answered with a single line:
+ *
+ *   CONNECT       Connect to the console if we aren't already, replies READY once the relay is
+ *                 running or FAILED if the connection attempt ended
+ *   SYNC <code>   Drop any connection and sync with the console, replies SYNCED or FAILED
+ *   DISCONNECT    Drop the connection to the console, replies OK
+ *   STATUS        Replies IDLE, CONNECTING, CONNECTED or SYNCING
+ */
+int daemon_run(const char *wireless_interface);
+
+#endif // VANILLA_PIPE_DAEMON_H
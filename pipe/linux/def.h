@@ -9,4 +9,121 @@
 #define VANILLA_PIPE_CC_BIND_ACK 0x56414245
 #define VANILLA_PIPE_CC_UNBIND 0x5641554E
 
+// Ask for the slot's latest vanilla_pipe_link_stats, which is sent back as the reply. Anyone may ask,
+// bound or not.
+#define VANILLA_PIPE_CC_LINK_STATS 0x56414C53
+
+// Ask the pipe to reassociate the slot with its console, for a player that has stopped receiving
+// anything. Only the player may ask, and there's no reply.
+#define VANILLA_PIPE_CC_REASSOCIATE 0x56415241
+
+// A pipe can serve a console on each of several wireless interfaces, each one a slot. Every port a
+// frontend uses (the relay ports and the command ports above) is moved up by this much per slot, so
+// slot 0 is where a pipe with one interface has always been.
+#define VANILLA_PIPE_SLOT_PORT_STRIDE 1000
+#define VANILLA_PIPE_MAX_SLOTS 4
+
+// Optional flags word following VANILLA_PIPE_CC_BIND (requested) and VANILLA_PIPE_CC_BIND_ACK (accepted)
+#define VANILLA_PIPE_BIND_FLAG_SHM 0x1
+#define VANILLA_PIPE_BIND_FLAG_FRAMES 0x2
+#define VANILLA_PIPE_BIND_FLAG_FEC 0x4
+
+// Only watch: receive video and audio alongside the player without replacing it. Input sent by a
+// spectator is ignored, apart from IDR requests. Not combined with any other flag.
+#define VANILLA_PIPE_BIND_FLAG_SPECTATOR 0x8
+
+// Pack datagrams for every port but video into carriers, both ways
+#define VANILLA_PIPE_BIND_FLAG_BUNDLE 0x10
+
+// Send input as vanilla_pipe_input_header deltas on the HID port, and have the pipe build HID
+// packets for the console itself
+#define VANILLA_PIPE_BIND_FLAG_INPUT_DELTAS 0x20
+
+// With VANILLA_PIPE_BIND_FLAG_FEC, the number of video datagrams covered by each parity datagram
+#define VANILLA_PIPE_BIND_FEC_GROUP_SHIFT 8
+#define VANILLA_PIPE_BIND_FEC_GROUP_MASK 0xFF00
+
+// With VANILLA_PIPE_BIND_FLAG_BUNDLE, how long a datagram may wait for others to share its carrier,
+// in units of VANILLA_PIPE_BUNDLE_WINDOW_UNIT_US
+#define VANILLA_PIPE_BIND_BUNDLE_WINDOW_SHIFT 16
+#define VANILLA_PIPE_BIND_BUNDLE_WINDOW_MASK 0xFF0000
+#define VANILLA_PIPE_BUNDLE_WINDOW_UNIT_US 100
+
+// TCP port the pipe sends reassembled frames on when VANILLA_PIPE_BIND_FLAG_FRAMES is accepted
+#define VANILLA_PIPE_FRAME_PORT 51002
+
+// UDP ports carriers are exchanged on when VANILLA_PIPE_BIND_FLAG_BUNDLE is accepted
+#define VANILLA_PIPE_BUNDLE_SERVER_PORT 51003
+#define VANILLA_PIPE_BUNDLE_CLIENT_PORT 51004
+
+// Record types in a carrier, which console port the datagram belongs to
+#define VANILLA_PIPE_BUNDLE_MSG 1
+#define VANILLA_PIPE_BUNDLE_AUD 2
+#define VANILLA_PIPE_BUNDLE_CMD 3
+#define VANILLA_PIPE_BUNDLE_HID 4
+
+#define VANILLA_PIPE_INPUT_MAGIC 0x56494E50
+#define VANILLA_PIPE_INPUT_FLAG_FULL 0x1 // Every value is included, replace the whole state
+
+// Precedes `count` entries of a one byte index and a big endian 32-bit value, multi-byte fields
+// are big endian
+typedef struct
+{
+    uint32_t magic;
+    uint16_t seq;
+    uint8_t flags;
+    uint8_t count;
+} vanilla_pipe_input_header;
+
+// Which fields of vanilla_pipe_link_stats the wireless driver reported
+#define VANILLA_PIPE_LINK_SIGNAL 0x1
+#define VANILLA_PIPE_LINK_TX_BITRATE 0x2
+#define VANILLA_PIPE_LINK_RX_BITRATE 0x4
+#define VANILLA_PIPE_LINK_TX_MCS 0x8
+#define VANILLA_PIPE_LINK_RX_MCS 0x10
+#define VANILLA_PIPE_LINK_RETRIES 0x20
+#define VANILLA_PIPE_LINK_FAILED 0x40
+#define VANILLA_PIPE_LINK_BEACON_LOSS 0x80
+#define VANILLA_PIPE_LINK_CHANNEL_BUSY 0x100
+
+// Reply to VANILLA_PIPE_CC_LINK_STATS, multi-byte fields are big endian. The wireless counters are
+// totals since the console was associated and the relay counters totals since the relay started,
+// both taken at the same sample, so the difference between two replies shows what the radio was
+// doing while datagrams went missing.
+typedef struct
+{
+    uint32_t control_code;
+    uint32_t valid;
+    uint32_t sample; // Counts up once a second, 0 if the interface couldn't be sampled yet
+    int32_t signal_dbm;
+    uint32_t tx_bitrate; // 100kbit/s
+    uint32_t rx_bitrate;
+    int32_t tx_mcs; // HT, VHT or HE index, whichever the rate uses
+    int32_t rx_mcs;
+    uint32_t tx_retries;
+    uint32_t tx_failed;
+    uint32_t beacon_loss;
+    uint32_t channel_time_ms;
+    uint32_t channel_busy_ms;
+    uint32_t video_datagrams; // Relayed from the console on the video port, by the relay or nftables
+    uint32_t console_datagrams; // Relayed from the console on any port, by the relay or nftables
+    uint32_t dropped; // Not delivered by the relay, either way
+} vanilla_pipe_link_stats;
+
+#define VANILLA_PIPE_FRAME_VIDEO 1
+#define VANILLA_PIPE_FRAME_AUDIO 2
+
+#define VANILLA_PIPE_FRAME_FLAG_IDR 0x1
+#define VANILLA_PIPE_FRAME_FLAG_VIBRATE 0x2
+
+// Precedes every frame on the stream, multi-byte fields are big endian
+typedef struct
+{
+    uint8_t type;
+    uint8_t flags;
+    uint16_t reserved;
+    uint32_t seq; // Counts up by one per frame of this type, gaps mean the pipe dropped frames
+    uint32_t length; // Bytes following this header
+} vanilla_pipe_frame_header;
+
 #endif // VANILLA_PIPE_DEF_H
\ No newline at end of file
@@ -0,0 +1,478 @@
+#include "dhcp.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <net/if.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/ioctl.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "status.h"
+#include "util.h"
+#include "vanilla.h"
+
+#define DHCP_SERVER_PORT 67
+#define DHCP_CLIENT_PORT 68
+#define DHCP_MAGIC_COOKIE 0x63825363
+#define DHCP_FLAG_BROADCAST 0x8000
+
+#define DHCP_OPTION_PAD 0
+#define DHCP_OPTION_NETMASK 1
+#define DHCP_OPTION_REQUESTED_ADDRESS 50
+#define DHCP_OPTION_LEASE_TIME 51
+#define DHCP_OPTION_MESSAGE_TYPE 53
+#define DHCP_OPTION_SERVER_ID 54
+#define DHCP_OPTION_PARAMETER_LIST 55
+#define DHCP_OPTION_END 255
+
+enum DhcpMessageType
+{
+    DHCP_DISCOVER = 1,
+    DHCP_OFFER = 2,
+    DHCP_REQUEST = 3,
+    DHCP_ACK = 5,
+    DHCP_NAK = 6,
+};
+
+typedef struct __attribute__((packed))
+{
+    uint8_t op;
+    uint8_t htype;
+    uint8_t hlen;
+    uint8_t hops;
+    uint32_t xid;
+    uint16_t secs;
+    uint16_t flags;
+    uint32_t ciaddr;
+    uint32_t yiaddr;
+    uint32_t siaddr;
+    uint32_t giaddr;
+    uint8_t chaddr[16];
+    uint8_t sname[64];
+    uint8_t file[128];
+    uint32_t cookie;
+    uint8_t options[312];
+} dhcp_packet;
+
+typedef struct
+{
+    int socket;
+    uint32_t xid;
+    uint8_t mac[6];
+} dhcp_client;
+
+// How long to wait for each reply before sending again, the console normally answers in a few ms
+static const int reply_timeouts_ms[] = {250, 500, 1000, 2000};
+#define DHCP_ATTEMPTS (sizeof(reply_timeouts_ms) / sizeof(reply_timeouts_ms[0]))
+
+static uint64_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int client_open(dhcp_client *c, const char *wireless_interface)
+{
+    c->socket = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (c->socket == -1) {
+        return VANILLA_ERROR;
+    }
+
+    struct ifreq ifr = {0};
+    strncpy(ifr.ifr_name, wireless_interface, sizeof(ifr.ifr_name) - 1);
+    if (ioctl(c->socket, SIOCGIFHWADDR, &ifr) == -1) {
+        print_info("FAILED TO GET HARDWARE ADDRESS OF %s: %i", wireless_interface, errno);
+        goto fail;
+    }
+    memcpy(c->mac, ifr.ifr_hwaddr.sa_data, sizeof(c->mac));
+
+    int on = 1;
+    setsockopt(c->socket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(c->socket, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+    if (setsockopt(c->socket, SOL_SOCKET, SO_BINDTODEVICE, wireless_interface, strlen(wireless_interface)) == -1) {
+        print_info("FAILED TO BIND DHCP SOCKET TO %s: %i", wireless_interface, errno);
+        goto fail;
+    }
+
+    struct sockaddr_in in = {0};
+    in.sin_family = AF_INET;
+    in.sin_addr.s_addr = INADDR_ANY;
+    in.sin_port = htons(DHCP_CLIENT_PORT);
+    if (bind(c->socket, (const struct sockaddr *) &in, sizeof(in)) == -1) {
+        print_info("FAILED TO BIND DHCP PORT %u: %i", DHCP_CLIENT_PORT, errno);
+        goto fail;
+    }
+
+    if (getrandom(&c->xid, sizeof(c->xid), 0) != sizeof(c->xid)) {
+        c->xid = (uint32_t) now_ms();
+    }
+
+    return VANILLA_SUCCESS;
+
+fail:
+    close(c->socket);
+    return VANILLA_ERROR;
+}
+
+static uint8_t *add_option(uint8_t *o, uint8_t code, uint8_t length, const void *data)
+{
+    o[0] = code;
+    o[1] = length;
+    memcpy(o + 2, data, length);
+    return o + 2 + length;
+}
+
+static int send_message(dhcp_client *c, uint8_t type, struct in_addr client_address, const dhcp_lease *offer)
+{
+    dhcp_packet p = {0};
+    p.op = 1;
+    p.htype = 1; // Ethernet
+    p.hlen = sizeof(c->mac);
+    p.xid = c->xid;
+    p.flags = htons(DHCP_FLAG_BROADCAST);
+    p.ciaddr = client_address.s_addr;
+    memcpy(p.chaddr, c->mac, sizeof(c->mac));
+    p.cookie = htonl(DHCP_MAGIC_COOKIE);
+
+    uint8_t *o = p.options;
+    o = add_option(o, DHCP_OPTION_MESSAGE_TYPE, 1, &type);
+    if (offer && client_address.s_addr == 0) {
+        // Selecting an offer, or confirming a saved lease without a server ID. Renewals identify
+        // themselves with ciaddr instead.
+        o = add_option(o, DHCP_OPTION_REQUESTED_ADDRESS, 4, &offer->address);
+        if (offer->server.s_addr != 0) {
+            o = add_option(o, DHCP_OPTION_SERVER_ID, 4, &offer->server);
+        }
+    }
+    static const uint8_t parameters[] = {DHCP_OPTION_NETMASK, DHCP_OPTION_LEASE_TIME};
+    o = add_option(o, DHCP_OPTION_PARAMETER_LIST, sizeof(parameters), parameters);
+    *o++ = DHCP_OPTION_END;
+
+    struct sockaddr_in to = {0};
+    to.sin_family = AF_INET;
+    to.sin_addr.s_addr = INADDR_BROADCAST;
+    to.sin_port = htons(DHCP_SERVER_PORT);
+
+    size_t size = offsetof(dhcp_packet, options) + (o - p.options);
+    if (sendto(c->socket, &p, size, 0, (const struct sockaddr *) &to, sizeof(to)) == -1) {
+        print_info("FAILED TO SEND DHCP MESSAGE: %i", errno);
+        return VANILLA_ERROR;
+    }
+    return VANILLA_SUCCESS;
+}
+
+// Returns the message type of a reply meant for us, or 0 if it isn't one
+static int parse_reply(dhcp_client *c, const dhcp_packet *p, size_t size, dhcp_lease *lease)
+{
+    if (size < offsetof(dhcp_packet, options) || p->op != 2 || p->xid != c->xid
+        || ntohl(p->cookie) != DHCP_MAGIC_COOKIE || memcmp(p->chaddr, c->mac, sizeof(c->mac)) != 0) {
+        return 0;
+    }
+
+    int type = 0;
+    memset(lease, 0, sizeof(*lease));
+    lease->address.s_addr = p->yiaddr;
+    lease->netmask.s_addr = htonl(0xFFFFFF00);
+    lease->lease_time = 0xFFFFFFFF;
+
+    const uint8_t *o = p->options;
+    const uint8_t *end = (const uint8_t *) p + size;
+    while (o < end && *o != DHCP_OPTION_END) {
+        if (*o == DHCP_OPTION_PAD) {
+            o++;
+            continue;
+        }
+        if (o + 2 > end || o + 2 + o[1] > end) {
+            break;
+        }
+
+        uint8_t code = o[0];
+        uint8_t length = o[1];
+        const uint8_t *data = o + 2;
+        if (code == DHCP_OPTION_MESSAGE_TYPE && length == 1) {
+            type = data[0];
+        } else if (code == DHCP_OPTION_NETMASK && length == 4) {
+            memcpy(&lease->netmask, data, 4);
+        } else if (code == DHCP_OPTION_SERVER_ID && length == 4) {
+            memcpy(&lease->server, data, 4);
+        } else if (code == DHCP_OPTION_LEASE_TIME && length == 4) {
+            uint32_t t;
+            memcpy(&t, data, 4);
+            lease->lease_time = ntohl(t);
+        }
+        o += 2 + length;
+    }
+
+    return type;
+}
+
+// Send a message and wait for an OFFER, ACK or NAK, retrying with longer timeouts
+static int exchange(dhcp_client *c, uint8_t type, struct in_addr client_address, const dhcp_lease *offer, dhcp_lease *reply)
+{
+    for (size_t attempt = 0; attempt < DHCP_ATTEMPTS; attempt++) {
+        if (send_message(c, type, client_address, offer) != VANILLA_SUCCESS) {
+            return 0;
+        }
+
+        uint64_t deadline = now_ms() + reply_timeouts_ms[attempt];
+        uint64_t now;
+        while ((now = now_ms()) < deadline) {
+            if (is_interrupted()) {
+                return 0;
+            }
+
+            struct pollfd pfd = {c->socket, POLLIN, 0};
+            if (poll(&pfd, 1, (int) (deadline - now)) <= 0) {
+                continue;
+            }
+
+            dhcp_packet p;
+            ssize_t r = recv(c->socket, &p, sizeof(p), 0);
+            if (r <= 0) {
+                continue;
+            }
+
+            int reply_type = parse_reply(c, &p, r, reply);
+            if ((type == DHCP_DISCOVER && reply_type == DHCP_OFFER)
+                || (type == DHCP_REQUEST && (reply_type == DHCP_ACK || reply_type == DHCP_NAK))) {
+                return reply_type;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int dhcp_request_lease(const char *wireless_interface, dhcp_lease *lease)
+{
+    dhcp_client c;
+    if (client_open(&c, wireless_interface) != VANILLA_SUCCESS) {
+        return VANILLA_ERROR;
+    }
+
+    int ret = VANILLA_ERROR;
+    uint64_t start = now_ms();
+    struct in_addr none = {0};
+
+    dhcp_lease offer;
+    if (exchange(&c, DHCP_DISCOVER, none, NULL, &offer) != DHCP_OFFER) {
+        print_info("NO DHCP OFFER FROM CONSOLE");
+        goto exit;
+    }
+
+    int reply = exchange(&c, DHCP_REQUEST, none, &offer, lease);
+    if (reply != DHCP_ACK) {
+        print_info("DHCP REQUEST %s", reply == DHCP_NAK ? "REFUSED" : "NOT ANSWERED");
+        goto exit;
+    }
+
+    if (lease->server.s_addr == 0) {
+        lease->server = offer.server;
+    }
+
+    char address[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &lease->address, address, sizeof(address));
+    print_info("LEASED %s FOR %u SECONDS IN %llu MS", address, lease->lease_time, (unsigned long long) (now_ms() - start));
+    ret = VANILLA_SUCCESS;
+
+exit:
+    close(c.socket);
+    return ret;
+}
+
+// Wait for `seconds` or until we're told to stop, returns non-zero if we should stop
+static int renewal_wait(dhcp_renewal *r, uint32_t seconds)
+{
+    struct timespec until;
+    clock_gettime(CLOCK_MONOTONIC, &until);
+    until.tv_sec += seconds;
+
+    pthread_mutex_lock(&r->mutex);
+    while (!r->stop) {
+        if (pthread_cond_timedwait(&r->cond, &r->mutex, &until) == ETIMEDOUT) {
+            break;
+        }
+    }
+    int stop = r->stop;
+    pthread_mutex_unlock(&r->mutex);
+    return stop;
+}
+
+// Renew halfway through the lease, but not constantly if the console hands out very short ones
+static uint32_t renewal_interval(uint32_t lease_time)
+{
+    return lease_time / 2 > 10 ? lease_time / 2 : 10;
+}
+
+// Check a saved lease is still ours, falling back to a new one if the console refuses it
+static void confirm_lease(dhcp_renewal *renewal)
+{
+    dhcp_client c;
+    if (client_open(&c, renewal->wireless_interface) != VANILLA_SUCCESS) {
+        return;
+    }
+
+    dhcp_lease requested = renewal->lease;
+    requested.server.s_addr = 0;
+
+    struct in_addr none = {0};
+    dhcp_lease reply;
+    int r = exchange(&c, DHCP_REQUEST, none, &requested, &reply);
+    close(c.socket);
+
+    if (r == DHCP_ACK && reply.address.s_addr == renewal->lease.address.s_addr) {
+        renewal->lease.lease_time = reply.lease_time;
+        if (reply.server.s_addr != 0) {
+            renewal->lease.server = reply.server;
+        }
+        print_info("SAVED DHCP LEASE CONFIRMED");
+    } else if (r == DHCP_NAK || r == DHCP_ACK) {
+        print_info("SAVED DHCP LEASE REFUSED, REQUESTING A NEW ONE");
+        if (dhcp_request_lease(renewal->wireless_interface, &reply) != VANILLA_SUCCESS) {
+            return;
+        }
+        renewal->lease = reply;
+    } else {
+        // Nobody answered, keep using it as we would if a renewal went unanswered
+        return;
+    }
+
+    if (renewal->updated) {
+        renewal->updated(&renewal->lease, renewal->context);
+    }
+}
+
+static void *renew_lease(void *arg)
+{
+    dhcp_renewal *renewal = (dhcp_renewal *) arg;
+
+    if (renewal->confirm) {
+        confirm_lease(renewal);
+    }
+
+    uint32_t wait = renewal_interval(renewal->lease.lease_time);
+
+    while (!renewal_wait(renewal, wait)) {
+        dhcp_client c;
+        dhcp_lease reply;
+        int r = 0;
+        if (client_open(&c, renewal->wireless_interface) == VANILLA_SUCCESS) {
+            r = exchange(&c, DHCP_REQUEST, renewal->lease.address, NULL, &reply);
+            close(c.socket);
+        }
+
+        if (r == DHCP_ACK && reply.address.s_addr == renewal->lease.address.s_addr) {
+            renewal->lease.lease_time = reply.lease_time;
+            wait = renewal_interval(renewal->lease.lease_time);
+            if (renewal->updated) {
+                renewal->updated(&renewal->lease, renewal->context);
+            }
+        } else {
+            // Keep trying until the lease runs out, the console may just be busy
+            print_info("FAILED TO RENEW DHCP LEASE");
+            wait = renewal_interval(wait);
+        }
+    }
+
+    return NULL;
+}
+
+void dhcp_start_renewal(dhcp_renewal *renewal, const char *wireless_interface, const dhcp_lease *lease, int confirm, dhcp_lease_updated_t updated, void *context)
+{
+    dhcp_stop_renewal(renewal);
+
+    if (lease->lease_time == 0xFFFFFFFF && !confirm) {
+        return;
+    }
+
+    memset(renewal->wireless_interface, 0, sizeof(renewal->wireless_interface));
+    strncpy(renewal->wireless_interface, wireless_interface, sizeof(renewal->wireless_interface) - 1);
+    renewal->lease = *lease;
+    renewal->confirm = confirm;
+    renewal->updated = updated;
+    renewal->context = context;
+    renewal->stop = 0;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&renewal->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&renewal->mutex, NULL);
+
+    renewal->running = pthread_create(&renewal->thread, NULL, renew_lease, renewal) == 0;
+    if (!renewal->running) {
+        pthread_cond_destroy(&renewal->cond);
+        pthread_mutex_destroy(&renewal->mutex);
+    }
+}
+
+void dhcp_stop_renewal(dhcp_renewal *renewal)
+{
+    if (!renewal->running) {
+        return;
+    }
+
+    pthread_mutex_lock(&renewal->mutex);
+    renewal->stop = 1;
+    pthread_cond_signal(&renewal->cond);
+    pthread_mutex_unlock(&renewal->mutex);
+
+    pthread_join(renewal->thread, NULL);
+    renewal->running = 0;
+
+    pthread_cond_destroy(&renewal->cond);
+    pthread_mutex_destroy(&renewal->mutex);
+}
+
+int dhcp_save_lease(const char *filename, const dhcp_lease *lease, const char *bssid)
+{
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        print_info("FAILED TO SAVE DHCP LEASE: %i", errno);
+        return VANILLA_ERROR;
+    }
+
+    char address[INET_ADDRSTRLEN], netmask[INET_ADDRSTRLEN], server[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &lease->address, address, sizeof(address));
+    inet_ntop(AF_INET, &lease->netmask, netmask, sizeof(netmask));
+    inet_ntop(AF_INET, &lease->server, server, sizeof(server));
+
+    fprintf(file, "bssid=%s\naddress=%s\nnetmask=%s\nserver=%s\nlease_time=%u\n", bssid, address, netmask, server, lease->lease_time);
+    fclose(file);
+    return VANILLA_SUCCESS;
+}
+
+int dhcp_load_lease(const char *filename, dhcp_lease *lease, const char *bssid)
+{
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        return VANILLA_ERROR;
+    }
+
+    char saved_bssid[18] = {0};
+    char address[INET_ADDRSTRLEN] = {0}, netmask[INET_ADDRSTRLEN] = {0}, server[INET_ADDRSTRLEN] = {0};
+    unsigned int lease_time = 0;
+    int fields = fscanf(file, "bssid=%17s\naddress=%15s\nnetmask=%15s\nserver=%15s\nlease_time=%u", saved_bssid, address, netmask, server, &lease_time);
+    fclose(file);
+
+    if (fields != 5 || strcasecmp(saved_bssid, bssid) != 0
+        || inet_pton(AF_INET, address, &lease->address) != 1
+        || inet_pton(AF_INET, netmask, &lease->netmask) != 1
+        || inet_pton(AF_INET, server, &lease->server) != 1) {
+        return VANILLA_ERROR;
+    }
+
+    lease->lease_time = lease_time;
+    return VANILLA_SUCCESS;
+}
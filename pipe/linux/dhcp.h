@@ -0,0 +1,59 @@
+#ifndef VANILLA_PIPE_DHCP_H
+#define VANILLA_PIPE_DHCP_H
+
+#include <net/if.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+
+/**
+ * Minimal DHCP client for the console's network
+ *
+ * The console always hands out a 192.168.1.x address with nothing else we care about, so this only
+ * does the DISCOVER/OFFER/REQUEST/ACK exchange and renews the lease while the relay runs. Replies
+ * are requested as broadcasts, so an ordinary UDP socket works before the interface has an address.
+ */
+
+typedef struct
+{
+    struct in_addr address;
+    struct in_addr netmask;
+    struct in_addr server;
+    uint32_t lease_time; // Seconds, 0xFFFFFFFF if it never expires
+} dhcp_lease;
+
+// Called from the renewal thread whenever the console confirms, renews or replaces the lease
+typedef void (*dhcp_lease_updated_t)(const dhcp_lease *lease, void *context);
+
+// Keeps one lease renewed, zero it before it's first used
+typedef struct
+{
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int running;
+    int stop;
+
+    char wireless_interface[IFNAMSIZ];
+    dhcp_lease lease;
+    int confirm;
+    dhcp_lease_updated_t updated;
+    void *context;
+} dhcp_renewal;
+
+// Get a lease on `wireless_interface`, gives up after a few seconds
+int dhcp_request_lease(const char *wireless_interface, dhcp_lease *lease);
+
+// Renew `lease` in the background until dhcp_stop_renewal() is called. With `confirm`, the lease
+// was loaded from a previous connection and is checked with the console straight away, getting a
+// new one if it's refused. `updated` is called with `context`.
+void dhcp_start_renewal(dhcp_renewal *renewal, const char *wireless_interface, const dhcp_lease *lease, int confirm, dhcp_lease_updated_t updated, void *context);
+void dhcp_stop_renewal(dhcp_renewal *renewal);
+
+// Remember the lease from the access point `bssid` for the next connection
+int dhcp_save_lease(const char *filename, const dhcp_lease *lease, const char *bssid);
+
+// Load a lease saved by dhcp_save_lease(), only if it was from the access point `bssid`
+int dhcp_load_lease(const char *filename, dhcp_lease *lease, const char *bssid);
+
+#endif // VANILLA_PIPE_DHCP_H
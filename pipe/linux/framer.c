@@ -0,0 +1,261 @@
+#define _GNU_SOURCE
+#include "framer.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "def.h"
+#include "gamepad/reassembly.h"
+#include "status.h"
+
+// Roughly a second of video at the console's bitrate, anything beyond that is better dropped
+#define FRAMER_QUEUE_SIZE (2 * 1024 * 1024)
+
+static struct in_addr expected_client = {0};
+static int connection = -1;
+static int connection_epoll = -1;
+static uint32_t connection_tag = 0;
+static int watching_writes = 0;
+
+static uint8_t queue[FRAMER_QUEUE_SIZE];
+static size_t queue_start = 0;
+static size_t queue_end = 0;
+
+static video_assembler assembler;
+static uint8_t nals[VIDEO_MAX_NAL_SIZE];
+
+static uint32_t video_seq = 0;
+static uint32_t audio_seq = 0;
+static uint64_t frames_sent = 0;
+static uint64_t frames_dropped = 0;
+static uint64_t send_calls = 0;
+
+int framer_listen()
+{
+    int skt = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (skt == -1) {
+        return -1;
+    }
+
+    int on = 1;
+    setsockopt(skt, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in in = {0};
+    in.sin_family = AF_INET;
+    in.sin_addr.s_addr = INADDR_ANY;
+    in.sin_port = htons(VANILLA_PIPE_FRAME_PORT);
+
+    if (bind(skt, (const struct sockaddr *) &in, sizeof(in)) == -1 || listen(skt, 1) == -1) {
+        print_info("FAILED TO OPEN FRAME PORT %u: %i", VANILLA_PIPE_FRAME_PORT, errno);
+        close(skt);
+        return -1;
+    }
+
+    return skt;
+}
+
+void framer_prepare(struct in_addr client)
+{
+    framer_close();
+    expected_client = client;
+}
+
+static void set_write_watch(int watch)
+{
+    if (watch == watching_writes) {
+        return;
+    }
+
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN | (watch ? EPOLLOUT : 0);
+    ev.data.u32 = connection_tag;
+    epoll_ctl(connection_epoll, EPOLL_CTL_MOD, connection, &ev);
+    watching_writes = watch;
+}
+
+void framer_accept(int listener, int epoll_fd, uint32_t tag)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_size = sizeof(addr);
+    int conn = accept4(listener, (struct sockaddr *) &addr, &addr_size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (conn == -1) {
+        return;
+    }
+
+    if (expected_client.s_addr == 0 || addr.sin_addr.s_addr != expected_client.s_addr || connection != -1) {
+        // Nobody asked for this (or someone already has it)
+        close(conn);
+        return;
+    }
+
+    int on = 1;
+    setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.u32 = tag;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn, &ev) == -1) {
+        close(conn);
+        return;
+    }
+
+    connection = conn;
+    connection_epoll = epoll_fd;
+    connection_tag = tag;
+    watching_writes = 0;
+
+    queue_start = queue_end = 0;
+    video_seq = audio_seq = 0;
+    frames_sent = frames_dropped = send_calls = 0;
+
+    // Don't send anything until the next IDR
+    video_assembler_init(&assembler);
+
+    print_info("FRONTEND CONNECTED FOR FRAMES");
+}
+
+void framer_close()
+{
+    expected_client.s_addr = 0;
+
+    if (connection == -1) {
+        return;
+    }
+
+    print_info("SENT %llu FRAMES IN %llu SENDS, DROPPED %llu",
+               (unsigned long long) frames_sent, (unsigned long long) send_calls, (unsigned long long) frames_dropped);
+
+    // Closing removes it from epoll too
+    close(connection);
+    connection = -1;
+    watching_writes = 0;
+}
+
+int framer_is_prepared()
+{
+    return expected_client.s_addr != 0;
+}
+
+int framer_is_active()
+{
+    return connection != -1;
+}
+
+static void flush_queue()
+{
+    while (queue_start < queue_end) {
+        ssize_t r = send(connection, queue + queue_start, queue_end - queue_start, MSG_DONTWAIT | MSG_NOSIGNAL);
+        send_calls++;
+        if (r < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            print_info("FRAME CONNECTION LOST: %i", errno);
+            framer_close();
+            return;
+        }
+        queue_start += r;
+    }
+
+    if (queue_start == queue_end) {
+        queue_start = queue_end = 0;
+    }
+
+    // Only ask to hear about the socket becoming writable while something is waiting
+    set_write_watch(queue_start != queue_end);
+}
+
+static int queue_frame(uint8_t type, uint8_t flags, uint32_t seq, const void *data, size_t size)
+{
+    vanilla_pipe_frame_header header = {0};
+    header.type = type;
+    header.flags = flags;
+    header.seq = htonl(seq);
+    header.length = htonl((uint32_t) size);
+
+    size_t total = sizeof(header) + size;
+    if (FRAMER_QUEUE_SIZE - queue_end < total && queue_start > 0) {
+        memmove(queue, queue + queue_start, queue_end - queue_start);
+        queue_end -= queue_start;
+        queue_start = 0;
+    }
+    if (FRAMER_QUEUE_SIZE - queue_end < total) {
+        frames_dropped++;
+        return 0;
+    }
+
+    memcpy(queue + queue_end, &header, sizeof(header));
+    memcpy(queue + queue_end + sizeof(header), data, size);
+    queue_end += total;
+    frames_sent++;
+
+    flush_queue();
+    return 1;
+}
+
+int framer_handle_video(uint8_t *data, size_t size)
+{
+    size_t nals_size;
+    int is_idr;
+    int r = video_assembler_push(&assembler, data, size, nals, sizeof(nals), &nals_size, &is_idr);
+
+    if (r == VIDEO_ASSEMBLER_NEED_IDR) {
+        return 1;
+    }
+
+    if (r == VIDEO_ASSEMBLER_FRAME) {
+        if (!queue_frame(VANILLA_PIPE_FRAME_VIDEO, is_idr ? VANILLA_PIPE_FRAME_FLAG_IDR : 0, video_seq, nals, nals_size)) {
+            // The frontend's decoder can't continue past a missing frame, start again from an IDR
+            video_assembler_reset(&assembler);
+        }
+        video_seq++;
+    }
+
+    return 0;
+}
+
+void framer_handle_audio(uint8_t *data, size_t size)
+{
+    audio_block block;
+    if (!audio_packet_decode(data, size, &block)) {
+        return;
+    }
+
+    queue_frame(VANILLA_PIPE_FRAME_AUDIO, block.vibrate ? VANILLA_PIPE_FRAME_FLAG_VIBRATE : 0, audio_seq, block.payload, block.payload_size);
+    audio_seq++;
+}
+
+void framer_handle_connection(uint32_t events)
+{
+    if (connection == -1) {
+        return;
+    }
+
+    if (events & EPOLLIN) {
+        // The frontend never sends anything, so this is either junk or the connection closing
+        char buf[64];
+        ssize_t r = recv(connection, buf, sizeof(buf), MSG_DONTWAIT);
+        if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            print_info("FRONTEND DISCONNECTED FROM FRAMES");
+            framer_close();
+            return;
+        }
+    }
+
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        framer_close();
+        return;
+    }
+
+    if (events & EPOLLOUT) {
+        flush_queue();
+    }
+}
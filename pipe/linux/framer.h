@@ -0,0 +1,41 @@
+#ifndef VANILLA_PIPE_FRAMER_H
+#define VANILLA_PIPE_FRAMER_H
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Reassembles video and audio in the pipe for remote frontends
+ *
+ * Instead of forwarding every console datagram, complete Annex-B frames and audio blocks are sent
+ * to the frontend over one TCP stream, each preceded by a vanilla_pipe_frame_header. If the
+ * frontend can't keep up, frames are dropped (and a new IDR is waited for) rather than queued.
+ */
+
+// Open the TCP listener frontends connect to for frames
+int framer_listen();
+
+// Expect a connection from `client`, who asked for frames in its bind
+void framer_prepare(struct in_addr client);
+
+// Accept a connection, registering it with `epoll_fd` under `tag` if it came from the prepared client
+void framer_accept(int listener, int epoll_fd, uint32_t tag);
+
+// Handle activity on the connection, flushes queued frames or closes it if the frontend went away
+void framer_handle_connection(uint32_t events);
+
+// Drop the connection, traffic goes back to being forwarded datagram by datagram
+void framer_close();
+
+// Whether a frontend was told to connect, frames are only sent once it has
+int framer_is_prepared();
+int framer_is_active();
+
+// Feed a datagram from the console's video port, returns non-zero if the console should be asked for an IDR
+int framer_handle_video(uint8_t *data, size_t size);
+
+// Feed a datagram from the console's audio port
+void framer_handle_audio(uint8_t *data, size_t size);
+
+#endif // VANILLA_PIPE_FRAMER_H
@@ -0,0 +1,107 @@
+#include "hidgen.h"
+
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "status.h"
+
+// Same rate the library sends at when it builds packets itself
+#define HIDGEN_INTERVAL_NS (5 * 1000 * 1000)
+
+static int timer_fd = -1;
+static int active = 0;
+
+static input_delta_receiver receiver;
+static uint16_t seq_id = 0;
+
+static uint64_t deltas_applied = 0;
+static uint64_t packets_built = 0;
+static uint64_t ticks_missed = 0;
+
+int hidgen_open()
+{
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    return timer_fd;
+}
+
+static void set_timer(long interval_ns)
+{
+    struct itimerspec its = {0};
+    its.it_value.tv_nsec = interval_ns;
+    its.it_interval.tv_nsec = interval_ns;
+    timerfd_settime(timer_fd, 0, &its, NULL);
+}
+
+void hidgen_start()
+{
+    hidgen_stop();
+
+    input_delta_receiver_init(&receiver);
+    seq_id = 0;
+    deltas_applied = packets_built = ticks_missed = 0;
+
+    set_timer(HIDGEN_INTERVAL_NS);
+    active = 1;
+
+    print_info("BUILDING HID PACKETS FROM INPUT DELTAS");
+}
+
+void hidgen_stop()
+{
+    if (!active) {
+        return;
+    }
+
+    set_timer(0);
+    active = 0;
+
+    print_info("BUILT %llu HID PACKETS FROM %llu INPUT DELTAS, %llu TICKS MISSED",
+               (unsigned long long) packets_built, (unsigned long long) deltas_applied, (unsigned long long) ticks_missed);
+}
+
+int hidgen_is_active()
+{
+    return active;
+}
+
+int hidgen_apply(const uint8_t *data, size_t size)
+{
+    if (!apply_input_delta(&receiver, data, size)) {
+        return 0;
+    }
+    deltas_applied++;
+    return 1;
+}
+
+int hidgen_tick(uint8_t *packet)
+{
+    uint64_t expirations = 0;
+    if (read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations) || !active) {
+        return 0;
+    }
+
+    // Don't try to catch up on ticks the relay was too busy for, the console only cares about the latest state
+    if (expirations > 1) {
+        ticks_missed += expirations - 1;
+    }
+
+    if (!receiver.has_state) {
+        return 0;
+    }
+
+    build_input_packet(&receiver.state, seq_id, packet);
+    seq_id++;
+    packets_built++;
+    return 1;
+}
+
+void hidgen_exit()
+{
+    hidgen_stop();
+    if (timer_fd != -1) {
+        close(timer_fd);
+        timer_fd = -1;
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef VANILLA_PIPE_HIDGEN_H
+#define VANILLA_PIPE_HIDGEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gamepad/hid.h"
+
+/**
+ * Builds HID packets for the console from input deltas sent by the frontend
+ *
+ * The pipe keeps the authoritative input state and sends it to the console on its own 200Hz
+ * timer, so the timing the console sees no longer depends on the network between the pipe and the
+ * frontend.
+ */
+
+// Create the timer, returns its descriptor or -1 on failure
+int hidgen_open();
+
+// Forget any previous state and start the timer, nothing is sent until the first full delta arrives
+void hidgen_start();
+
+// Stop the timer and log statistics
+void hidgen_stop();
+
+int hidgen_is_active();
+
+// Apply a datagram from the frontend's HID port, returns 0 if it isn't an input delta
+int hidgen_apply(const uint8_t *data, size_t size);
+
+// The timer expired, returns non-zero if `packet` (INPUT_PACKET_SIZE bytes) should be sent now
+int hidgen_tick(uint8_t *packet);
+
+// Close the timer
+void hidgen_exit();
+
+#endif // VANILLA_PIPE_HIDGEN_H
@@ -1,12 +1,65 @@
 #include <pthread.h>
 #include <arpa/inet.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "daemon.h"
+#include "def.h"
 #include "mdns.h"
+#include "relay.h"
 #include "vanilla.h"
 #include "wpa.h"
 
+// "[<address>:]<port>" into relay_config, the address defaults to loopback so nothing is exposed
+// unless asked for
+static int parse_metrics_address(const char *arg)
+{
+    char address[INET_ADDRSTRLEN] = "127.0.0.1";
+    const char *port = arg;
+    const char *colon = strrchr(arg, ':');
+    if (colon) {
+        if (colon - arg >= (int) sizeof(address)) {
+            return VANILLA_ERROR;
+        }
+        memcpy(address, arg, colon - arg);
+        address[colon - arg] = 0;
+        port = colon + 1;
+    }
+
+    char *end;
+    long port_number = strtol(port, &end, 10);
+    if (*port == 0 || *end != 0 || port_number < 1 || port_number > 65535
+        || inet_pton(AF_INET, address, &relay_config.metrics_address) != 1) {
+        return VANILLA_ERROR;
+    }
+
+    relay_config.metrics_port = (in_port_t) port_number;
+    return VANILLA_SUCCESS;
+}
+
+// "<port>=<ms>" into relay_config, e.g. "vid=500"
+static int parse_stall_threshold(const char *arg)
+{
+    char name[8];
+    const char *equals = strchr(arg, '=');
+    if (!equals || equals - arg >= (int) sizeof(name)) {
+        return VANILLA_ERROR;
+    }
+    memcpy(name, arg, equals - arg);
+    name[equals - arg] = 0;
+
+    int port = relay_find_port(name);
+    char *end;
+    long threshold = strtol(equals + 1, &end, 10);
+    if (port == -1 || equals[1] == 0 || *end != 0 || threshold < 0 || threshold > 60000) {
+        return VANILLA_ERROR;
+    }
+
+    relay_config.stall_threshold_ms[port] = (uint32_t) threshold;
+    return VANILLA_SUCCESS;
+}
+
 int main(int argc, const char **argv)
 {
     if (argc < 3) {
@@ -16,31 +69,102 @@ int main(int argc, const char **argv)
     const char *wireless_interface = argv[1];
     const char *mode = argv[2];
 
-    if (!strcmp("-sync", mode)) {
-        if (argc < 4) {
-            pprint("ERROR: -sync requires sync code\n\n");
+    // Several interfaces are separated by commas, each one is the next slot
+    char interface_list[256];
+    const char *wireless_interfaces[VANILLA_PIPE_MAX_SLOTS];
+    int interface_count = 0;
+    snprintf(interface_list, sizeof(interface_list), "%s", wireless_interface);
+    char *save_interface;
+    for (char *i = strtok_r(interface_list, ",", &save_interface); i; i = strtok_r(NULL, ",", &save_interface)) {
+        if (interface_count == VANILLA_PIPE_MAX_SLOTS) {
+            pprint("ERROR: At most %i wireless interfaces are supported\n\n", VANILLA_PIPE_MAX_SLOTS);
             goto show_help;
         }
+        wireless_interfaces[interface_count++] = i;
+    }
+    if (interface_count == 0) {
+        goto show_help;
+    }
+
+    if (!strcmp("-sync", mode) || !strcmp("-is_synced", mode)) {
+        int arg = 3;
+        int code = 0;
+        if (!strcmp("-sync", mode)) {
+            if (argc < 4) {
+                pprint("ERROR: -sync requires sync code\n\n");
+                goto show_help;
+            }
 
-        int code = atoi(argv[3]);
-        if (code == 0) {
-            pprint("ERROR: Invalid sync code\n\n");
+            code = atoi(argv[3]);
+            if (code == 0) {
+                pprint("ERROR: Invalid sync code\n\n");
+                goto show_help;
+            }
+            arg = 4;
+        }
+
+        int slot = 0;
+        if (argc > arg + 1 && !strcmp("-slot", argv[arg])) {
+            slot = atoi(argv[arg + 1]);
+            arg += 2;
+        }
+        if (argc > arg || interface_count > 1 || slot < 0 || slot >= VANILLA_PIPE_MAX_SLOTS) {
+            pprint("ERROR: %s takes one wireless interface and an optional slot\n\n", mode);
             goto show_help;
         }
 
-        vanilla_sync_with_console(wireless_interface, code);
-    } else if (!strcmp("-connect", mode)) {
+        if (code) {
+            vanilla_sync_with_console(wireless_interfaces[0], slot, code);
+        } else if (vanilla_has_config(slot)) {
+            pprint("YES\n");
+        } else {
+            pprint("NO\n");
+        }
+    } else if (!strcmp("-connect", mode) || !strcmp("-daemon", mode)) {
+        for (int i = 3; i < argc; i++) {
+            if (!strcmp("-io-uring", argv[i])) {
+                relay_config.use_io_uring = 1;
+            } else if (!strcmp("-nftables", argv[i])) {
+                relay_config.use_nftables = 1;
+            } else if (!strcmp("-link-stats", argv[i])) {
+                relay_config.log_link_stats = 1;
+            } else if (!strcmp("-low-latency", argv[i])) {
+                relay_config.low_latency = 1;
+            } else if (!strcmp("-realtime", argv[i])) {
+                relay_config.realtime = 1;
+            } else if (!strcmp("-cpu", argv[i]) && i + 1 < argc) {
+                relay_config.cpu = atoi(argv[++i]);
+            } else if (!strcmp("-metrics", argv[i]) && i + 1 < argc) {
+                if (parse_metrics_address(argv[++i]) != VANILLA_SUCCESS) {
+                    pprint("ERROR: Invalid metrics address: %s\n\n", argv[i]);
+                    goto show_help;
+                }
+            } else if (!strcmp("-watchdog", argv[i])) {
+                relay_config.watchdog = 1;
+            } else if (!strcmp("-stall-threshold", argv[i]) && i + 1 < argc) {
+                if (parse_stall_threshold(argv[++i]) != VANILLA_SUCCESS) {
+                    pprint("ERROR: Invalid stall threshold: %s\n\n", argv[i]);
+                    goto show_help;
+                }
+            } else {
+                pprint("ERROR: Unknown connect option: %s\n\n", argv[i]);
+                goto show_help;
+            }
+        }
+
         pthread_t registerThread;
         pthread_create(&registerThread, NULL, regService, NULL);
 
-        vanilla_connect_to_console(wireless_interface);
-        pthread_join(registerThread, NULL);
-    } else if (!strcmp("-is_synced", mode)) {
-        if (vanilla_has_config()) {
-            pprint("YES\n");
+        if (!strcmp("-daemon", mode)) {
+            if (interface_count > 1) {
+                pprint("ERROR: -daemon takes one wireless interface\n\n");
+                goto show_help;
+            }
+            daemon_run(wireless_interface);
         } else {
-            pprint("NO\n");
+            vanilla_connect_to_consoles(wireless_interfaces, interface_count);
         }
+        pthread_join(registerThread, NULL);
     } else {
         pprint("ERROR: Invalid mode\n\n");
         goto show_help;
@@ -51,12 +175,37 @@ int main(int argc, const char **argv)
 show_help:
     pprint("vanilla-pipe - brokers a connection between Vanilla and the Wii U\n");
     pprint("\n");
-    pprint("Usage: %s <wireless-interface> <mode> [args]\n", argv[0]);
+    pprint("Usage: %s <wireless-interface>[,<wireless-interface>...] <mode> [args]\n", argv[0]);
     pprint("\n");
     pprint("Modes: \n");
     pprint("  -sync <code>  Sync/authenticate with the Wii U.\n");
     pprint("  -connect      Connect to the Wii U (requires syncing prior).\n");
     pprint("  -is_synced    Returns 1 if gamepad has been synced or 0 if it hasn't yet.\n");
+    pprint("  -daemon       Stay running and take connect/sync commands from a local socket\n");
+    pprint("                (" VANILLA_PIPE_DAEMON_SOCKET_DIR "/<wireless-interface>.sock for the " VANILLA_PIPE_DAEMON_GROUP " group,\n");
+    pprint("                or from systemd).\n");
+    pprint("\n");
+    pprint("Connect options (also for -daemon): \n");
+    pprint("  -io-uring     Relay console traffic with io_uring if the kernel supports it.\n");
+    pprint("  -nftables     Forward traffic in the kernel with nftables rules, using the relay only as a fallback.\n");
+    pprint("  -link-stats   Log signal, bitrate, retries and channel load every second alongside relayed datagrams.\n");
+    pprint("  -low-latency  Turn Wi-Fi power save off and prioritize the relay's traffic until the connection ends.\n");
+    pprint("  -realtime     Run the relay on the SCHED_FIFO scheduler (needs CAP_SYS_NICE).\n");
+    pprint("  -cpu <n>      With -realtime, pin the relay to CPU n.\n");
+    pprint("  -metrics [<address>:]<port>\n");
+    pprint("                Serve OpenMetrics over HTTP for Prometheus (on 127.0.0.1 unless an address is given).\n");
+    pprint("  -watchdog     When the Wii U stops sending on a port, request an IDR, then reopen the port,\n");
+    pprint("                then reassociate, at 1x, 2x and 4x the port's stall threshold.\n");
+    pprint("  -stall-threshold <port>=<ms>\n");
+    pprint("                With -watchdog, how long vid, aud, msg, cmd or hid may be quiet (default vid=500\n");
+    pprint("                and aud=500, 0 stops watching the port).\n");
+    pprint("\n");
+    pprint("Sync options (also for -is_synced): \n");
+    pprint("  -slot <n>     Slot to sync, each one remembers its own Wii U (default 0).\n");
+    pprint("\n");
+    pprint("Several comma-separated interfaces can be given to -connect, each connecting to the\n");
+    pprint("Wii U synced with its slot (its place in the list). Frontends for slot n use ports\n");
+    pprint("n*%i higher than usual.\n", VANILLA_PIPE_SLOT_PORT_STRIDE);
     pprint("\n");
     pprint("Sync code is a 4-digit PIN based on the card suits shown on the console.\n\n");
     pprint("  To calculate the code, use the following:\n");
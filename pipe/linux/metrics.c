@@ -0,0 +1,256 @@
+#define _GNU_SOURCE
+#include "metrics.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "status.h"
+
+#define METRICS_REQUEST_SIZE 2048
+#define METRICS_HEADER_SIZE 256
+#define METRICS_BODY_SIZE (64 * 1024)
+
+// Ends every body, there's always room kept for it
+#define METRICS_EOF "# EOF\n"
+
+struct metrics_writer
+{
+    char *data;
+    size_t size;
+    size_t length;
+
+    // Something didn't fit, so nothing after it is written either
+    int full;
+};
+
+typedef struct
+{
+    int fd;
+    uint64_t accepted; // Order the connection was accepted in, to find the oldest
+
+    char request[METRICS_REQUEST_SIZE];
+    size_t request_length;
+
+    // Set once the whole response has been built, until then we're still reading the request
+    int responding;
+    size_t response_start;
+    size_t response_end;
+} metrics_connection;
+
+static metrics_connection connections[METRICS_MAX_CONNECTIONS] = {
+    [0 ... METRICS_MAX_CONNECTIONS - 1] = {.fd = -1}
+};
+static char responses[METRICS_MAX_CONNECTIONS][METRICS_HEADER_SIZE + METRICS_BODY_SIZE];
+static char body[METRICS_BODY_SIZE];
+static int warned_full = 0;
+static int connection_epoll = -1;
+static uint32_t connection_tag = 0;
+static uint64_t accept_count = 0;
+
+int metrics_listen(struct in_addr address, in_port_t port)
+{
+    int skt = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (skt == -1) {
+        return -1;
+    }
+
+    int on = 1;
+    setsockopt(skt, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in in = {0};
+    in.sin_family = AF_INET;
+    in.sin_addr = address;
+    in.sin_port = htons(port);
+
+    if (bind(skt, (const struct sockaddr *) &in, sizeof(in)) == -1 || listen(skt, METRICS_MAX_CONNECTIONS) == -1) {
+        print_info("FAILED TO OPEN METRICS PORT %u: %i", port, errno);
+        close(skt);
+        return -1;
+    }
+
+    return skt;
+}
+
+static void close_connection(metrics_connection *c)
+{
+    if (c->fd == -1) {
+        return;
+    }
+
+    // Closing removes it from epoll too
+    close(c->fd);
+    c->fd = -1;
+}
+
+void metrics_accept(int listener, int epoll_fd, uint32_t first_tag)
+{
+    int conn = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (conn == -1) {
+        return;
+    }
+
+    // A scraper that never finishes its request shouldn't keep the next one out
+    int index = 0;
+    for (int i = 0; i < METRICS_MAX_CONNECTIONS; i++) {
+        if (connections[i].fd == -1) {
+            index = i;
+            break;
+        }
+        if (connections[i].accepted < connections[index].accepted) {
+            index = i;
+        }
+    }
+    metrics_connection *c = &connections[index];
+    close_connection(c);
+
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.u32 = first_tag + index;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn, &ev) == -1) {
+        close(conn);
+        return;
+    }
+
+    connection_epoll = epoll_fd;
+    connection_tag = first_tag;
+
+    c->fd = conn;
+    c->accepted = ++accept_count;
+    c->request_length = 0;
+    c->responding = 0;
+}
+
+void metrics_append(metrics_writer *w, const char *format, ...)
+{
+    if (w->full) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    int r = vsnprintf(w->data + w->length, w->size - w->length, format, args);
+    va_end(args);
+
+    // Half a line would leave the scraper unable to parse anything, so the body stops before it
+    if (r < 0 || (size_t) r >= w->size - w->length) {
+        w->full = 1;
+        return;
+    }
+    w->length += r;
+}
+
+static void build_response(int index, metrics_render_t render)
+{
+    metrics_connection *c = &connections[index];
+
+    // Only the request line matters, we serve the same thing at every path but answer HEAD and
+    // anything else properly so a browser pointed at it doesn't get confused
+    const char *status = "200 OK";
+    int send_body = 1;
+    if (c->request_length >= 4 && !memcmp(c->request, "HEAD", 4)) {
+        send_body = 0;
+    } else if (c->request_length < 3 || memcmp(c->request, "GET", 3)) {
+        status = "405 Method Not Allowed";
+        send_body = 0;
+    }
+
+    metrics_writer w = {body, sizeof(body) - strlen(METRICS_EOF), 0, 0};
+    if (status[0] == '2') {
+        render(&w);
+        if (w.full && !warned_full) {
+            print_info("METRICS CUT OFF AT %zu BYTES", w.length);
+            warned_full = 1;
+        }
+        memcpy(body + w.length, METRICS_EOF, strlen(METRICS_EOF));
+        w.length += strlen(METRICS_EOF);
+    }
+
+    int header = snprintf(responses[index], METRICS_HEADER_SIZE,
+                          "HTTP/1.1 %s\r\n"
+                          "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                          "Content-Length: %zu\r\n"
+                          "Connection: close\r\n"
+                          "\r\n",
+                          status, w.length);
+
+    size_t body_size = send_body ? w.length : 0;
+    memcpy(responses[index] + header, body, body_size);
+
+    c->responding = 1;
+    c->response_start = 0;
+    c->response_end = header + body_size;
+}
+
+static void flush_response(int index)
+{
+    metrics_connection *c = &connections[index];
+    while (c->response_start < c->response_end) {
+        ssize_t r = send(c->fd, responses[index] + c->response_start, c->response_end - c->response_start, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                close_connection(c);
+                return;
+            }
+
+            // Wait for room, without hearing about the request side any more
+            struct epoll_event ev = {0};
+            ev.events = EPOLLOUT;
+            ev.data.u32 = connection_tag + index;
+            epoll_ctl(connection_epoll, EPOLL_CTL_MOD, c->fd, &ev);
+            return;
+        }
+        c->response_start += r;
+    }
+
+    close_connection(c);
+}
+
+void metrics_handle_connection(int index, uint32_t events, metrics_render_t render)
+{
+    metrics_connection *c = &connections[index];
+    if (c->fd == -1) {
+        return;
+    }
+
+    if (c->responding) {
+        if (events & (EPOLLERR | EPOLLHUP)) {
+            close_connection(c);
+        } else {
+            flush_response(index);
+        }
+        return;
+    }
+
+    ssize_t r = recv(c->fd, c->request + c->request_length, sizeof(c->request) - 1 - c->request_length, MSG_DONTWAIT);
+    if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        close_connection(c);
+        return;
+    }
+    if (r > 0) {
+        c->request_length += r;
+        c->request[c->request_length] = 0;
+    }
+
+    // Wait for the end of the headers, a request too big for the buffer gets answered as it is
+    if (!strstr(c->request, "\r\n\r\n") && c->request_length < sizeof(c->request) - 1) {
+        return;
+    }
+
+    build_response(index, render);
+    flush_response(index);
+}
+
+void metrics_close()
+{
+    for (int i = 0; i < METRICS_MAX_CONNECTIONS; i++) {
+        close_connection(&connections[i]);
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef VANILLA_PIPE_METRICS_H
+#define VANILLA_PIPE_METRICS_H
+
+#include <netinet/in.h>
+#include <stdint.h>
+
+/**
+ * A minimal HTTP server for Prometheus/OpenMetrics scrapes
+ *
+ * Everything runs on the relay's thread from its epoll loop, the relay renders the current values
+ * into the response when a request has been read, so nothing it forwards is ever locked.
+ */
+
+// Scrapes served at once, the oldest is dropped to make room for a new one
+#define METRICS_MAX_CONNECTIONS 4
+
+typedef struct metrics_writer metrics_writer;
+
+// Called for each scrape to write the body with metrics_append()
+typedef void (*metrics_render_t)(metrics_writer *w);
+
+// Listen for scrapes on `address` and `port`, returns the listening socket or -1 on failure
+int metrics_listen(struct in_addr address, in_port_t port);
+
+// Accept a scrape, each connection is added to `epoll_fd` tagged `first_tag` plus its index
+void metrics_accept(int listener, int epoll_fd, uint32_t first_tag);
+
+// Connection `index` is readable or writable, answers its request once all of it has arrived
+void metrics_handle_connection(int index, uint32_t events, metrics_render_t render);
+
+// printf() to the response body. Once something doesn't fit the body ends before it, so whatever
+// is sent is whole lines.
+void metrics_append(metrics_writer *w, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+// Close every connection
+void metrics_close();
+
+#endif // VANILLA_PIPE_METRICS_H
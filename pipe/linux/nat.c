@@ -0,0 +1,793 @@
+#define _GNU_SOURCE
+#include "nat.h"
+
+#include <arpa/inet.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ifaddrs.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nf_tables.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter_ipv4.h>
+#include <net/if.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <netlink/attr.h>
+#include <netlink/msg.h>
+#include <netlink/netlink.h>
+#include <netlink/socket.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "ports.h"
+#include "status.h"
+#include "vanilla.h"
+
+#define NAT_TABLE "vanilla_pipe"
+
+// Everything add_rules() adds fits in this with room to spare
+#define NAT_BATCH_SIZE (64 * 1024)
+
+// Each message is allocated with this much room, a rule's attributes take about a tenth of it
+#define NAT_MESSAGE_SIZE 16384
+
+// The kernel answers straight away, this is only so a wedged netlink socket can't hang the relay
+#define NAT_NETLINK_TIMEOUT_MS 1000
+
+// nft keeps a rule's comment in its userdata as this type, so `nft list` still shows ours
+#define NAT_UDATA_COMMENT 0
+
+static const char *CONSOLE_ADDRESS = "192.168.1.10";
+
+static const uint16_t nat_ports[NAT_PORT_COUNT] = {PORT_VID, PORT_AUD, PORT_MSG, PORT_CMD, PORT_HID};
+
+static int installed = 0;
+
+// What earlier rules forwarded before they were removed, so the totals only ever count up
+static nat_stats removed_stats;
+
+// Values to put back when the rules are removed, empty if we didn't change them
+static char route_localnet_path[128];
+static char old_route_localnet[16];
+static char old_ip_forward[16];
+static const char *IP_FORWARD_PATH = "/proc/sys/net/ipv4/ip_forward";
+
+int read_sysctl(const char *path, char *buf, size_t buf_size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return VANILLA_ERROR;
+    }
+
+    ssize_t r = read(fd, buf, buf_size - 1);
+    close(fd);
+    if (r <= 0) {
+        return VANILLA_ERROR;
+    }
+
+    buf[r] = 0;
+    return VANILLA_SUCCESS;
+}
+
+int write_sysctl(const char *path, const char *value)
+{
+    int fd = open(path, O_WRONLY);
+    if (fd == -1) {
+        print_info("FAILED TO OPEN %s: %i", path, errno);
+        return VANILLA_ERROR;
+    }
+
+    ssize_t r = write(fd, value, strlen(value));
+    close(fd);
+    return r < 0 ? VANILLA_ERROR : VANILLA_SUCCESS;
+}
+
+// Set a sysctl to "1", storing the previous value in `old` if it was anything else
+void enable_sysctl(const char *path, char *old, size_t old_size)
+{
+    old[0] = 0;
+    if (read_sysctl(path, old, old_size) != VANILLA_SUCCESS || old[0] == '1') {
+        old[0] = 0;
+        return;
+    }
+
+    if (write_sysctl(path, "1") != VANILLA_SUCCESS) {
+        old[0] = 0;
+    }
+}
+
+void restore_sysctl(const char *path, char *old)
+{
+    if (old[0]) {
+        write_sysctl(path, old);
+        old[0] = 0;
+    }
+}
+
+int get_interface_address(const char *interface, struct in_addr *addr)
+{
+    struct ifaddrs *ifaddr;
+    if (getifaddrs(&ifaddr) == -1) {
+        return VANILLA_ERROR;
+    }
+
+    int ret = VANILLA_ERROR;
+    for (struct ifaddrs *ifa = ifaddr; ifa; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr && ifa->ifa_addr->sa_family == AF_INET && !strcmp(ifa->ifa_name, interface)) {
+            *addr = ((struct sockaddr_in *) ifa->ifa_addr)->sin_addr;
+            ret = VANILLA_SUCCESS;
+            break;
+        }
+    }
+
+    freeifaddrs(ifaddr);
+    return ret;
+}
+
+int is_local_address(struct in_addr addr)
+{
+    struct ifaddrs *ifaddr;
+    if (getifaddrs(&ifaddr) == -1) {
+        return 0;
+    }
+
+    int local = 0;
+    for (struct ifaddrs *ifa = ifaddr; ifa; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr && ifa->ifa_addr->sa_family == AF_INET
+            && ((struct sockaddr_in *) ifa->ifa_addr)->sin_addr.s_addr == addr.s_addr) {
+            local = 1;
+            break;
+        }
+    }
+
+    freeifaddrs(ifaddr);
+    return local;
+}
+
+// The address the kernel sends from to reach `to`, which is where the userspace relay's frontend
+// datagrams come from and so where the frontend expects them from
+int get_source_address(struct in_addr to, struct in_addr *from)
+{
+    int skt = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (skt == -1) {
+        return VANILLA_ERROR;
+    }
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr = to;
+    addr.sin_port = htons(PORT_VID + 200);
+
+    socklen_t addr_len = sizeof(addr);
+    int ret = VANILLA_ERROR;
+    if (connect(skt, (const struct sockaddr *) &addr, sizeof(addr)) == 0
+        && getsockname(skt, (struct sockaddr *) &addr, &addr_len) == 0) {
+        *from = addr.sin_addr;
+        ret = VANILLA_SUCCESS;
+    }
+
+    close(skt);
+    return ret;
+}
+
+
+// A stateless rewrite. It matches the fields that are set, then rewrites the ones that are set.
+// Rules with a comment count what they match, under that name.
+typedef struct
+{
+    const char *iifname;
+    struct in_addr saddr;
+    struct in_addr daddr;
+    uint16_t sport;
+    uint16_t dport;
+
+    int notrack;
+    const char *comment;
+
+    struct in_addr set_saddr;
+    struct in_addr set_daddr;
+    uint16_t set_sport;
+    uint16_t set_dport;
+} nat_rule;
+
+// nf_tables messages sent to the kernel together, so they're applied atomically
+typedef struct
+{
+    char data[NAT_BATCH_SIZE];
+    size_t length;
+    uint32_t seq;
+
+    // Messages the kernel will acknowledge, everything besides the batch's begin and end
+    int acks;
+
+    // Something didn't fit, so the batch mustn't be sent
+    int failed;
+} nat_batch;
+
+// Messages are allocated far bigger than the largest rule, so the attributes put into them aren't
+// checked one by one
+static struct nl_msg *begin_message(int type, int flags, int family, uint16_t res_id)
+{
+    struct nl_msg *msg = nlmsg_alloc_size(NAT_MESSAGE_SIZE);
+    if (!msg) {
+        return NULL;
+    }
+
+    struct nlmsghdr *hdr = nlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, type, sizeof(struct nfgenmsg), NLM_F_REQUEST | flags);
+    struct nfgenmsg *nfg = nlmsg_data(hdr);
+    nfg->nfgen_family = family;
+    nfg->version = NFNETLINK_V0;
+    nfg->res_id = htons(res_id);
+    return msg;
+}
+
+static void add_to_batch(nat_batch *b, struct nl_msg *msg)
+{
+    if (!msg) {
+        b->failed = 1;
+        return;
+    }
+
+    struct nlmsghdr *hdr = nlmsg_hdr(msg);
+    hdr->nlmsg_seq = b->seq++;
+    if (b->length + NLMSG_ALIGN(hdr->nlmsg_len) > sizeof(b->data)) {
+        b->failed = 1;
+    } else {
+        memcpy(b->data + b->length, hdr, hdr->nlmsg_len);
+        b->length += NLMSG_ALIGN(hdr->nlmsg_len);
+        if (hdr->nlmsg_flags & NLM_F_ACK) {
+            b->acks++;
+        }
+    }
+    nlmsg_free(msg);
+}
+
+static struct nl_msg *begin_nft_message(int type, int flags)
+{
+    return begin_message((NFNL_SUBSYS_NFTABLES << 8) | type, flags, AF_INET, 0);
+}
+
+static void add_batch_marker(nat_batch *b, int type)
+{
+    add_to_batch(b, begin_message(type, 0, AF_UNSPEC, NFNL_SUBSYS_NFTABLES));
+}
+
+static void add_table(nat_batch *b, int type)
+{
+    struct nl_msg *msg = begin_nft_message(type, NLM_F_CREATE | NLM_F_ACK);
+    if (msg) {
+        nla_put_string(msg, NFTA_TABLE_NAME, NAT_TABLE);
+    }
+    add_to_batch(b, msg);
+}
+
+static void add_chain(nat_batch *b, const char *name, const char *type, int hook, int priority)
+{
+    struct nl_msg *msg = begin_nft_message(NFT_MSG_NEWCHAIN, NLM_F_CREATE | NLM_F_ACK);
+    if (msg) {
+        nla_put_string(msg, NFTA_CHAIN_TABLE, NAT_TABLE);
+        nla_put_string(msg, NFTA_CHAIN_NAME, name);
+
+        struct nlattr *hook_attr = nla_nest_start(msg, NLA_F_NESTED | NFTA_CHAIN_HOOK);
+        nla_put_u32(msg, NFTA_HOOK_HOOKNUM, htonl(hook));
+        nla_put_u32(msg, NFTA_HOOK_PRIORITY, htonl((uint32_t) priority));
+        nla_nest_end(msg, hook_attr);
+
+        nla_put_u32(msg, NFTA_CHAIN_POLICY, htonl(NF_ACCEPT));
+        nla_put_string(msg, NFTA_CHAIN_TYPE, type);
+    }
+    add_to_batch(b, msg);
+}
+
+// Every expression works through register 1. A match loads it and compares it, a rewrite loads it
+// with the new value and writes it into the packet.
+static struct nlattr *begin_expression(struct nl_msg *msg, const char *name, struct nlattr **data)
+{
+    struct nlattr *elem = nla_nest_start(msg, NLA_F_NESTED | NFTA_LIST_ELEM);
+    nla_put_string(msg, NFTA_EXPR_NAME, name);
+    *data = nla_nest_start(msg, NLA_F_NESTED | NFTA_EXPR_DATA);
+    return elem;
+}
+
+static void end_expression(struct nl_msg *msg, struct nlattr *elem, struct nlattr *data)
+{
+    nla_nest_end(msg, data);
+    nla_nest_end(msg, elem);
+}
+
+static void put_value(struct nl_msg *msg, int type, const void *value, int len)
+{
+    struct nlattr *data = nla_nest_start(msg, NLA_F_NESTED | type);
+    nla_put(msg, NFTA_DATA_VALUE, len, value);
+    nla_nest_end(msg, data);
+}
+
+static void put_load_meta(struct nl_msg *msg, int key)
+{
+    struct nlattr *data;
+    struct nlattr *elem = begin_expression(msg, "meta", &data);
+    nla_put_u32(msg, NFTA_META_DREG, htonl(NFT_REG_1));
+    nla_put_u32(msg, NFTA_META_KEY, htonl(key));
+    end_expression(msg, elem, data);
+}
+
+static void put_load_payload(struct nl_msg *msg, int base, int offset, int len)
+{
+    struct nlattr *data;
+    struct nlattr *elem = begin_expression(msg, "payload", &data);
+    nla_put_u32(msg, NFTA_PAYLOAD_DREG, htonl(NFT_REG_1));
+    nla_put_u32(msg, NFTA_PAYLOAD_BASE, htonl(base));
+    nla_put_u32(msg, NFTA_PAYLOAD_OFFSET, htonl(offset));
+    nla_put_u32(msg, NFTA_PAYLOAD_LEN, htonl(len));
+    end_expression(msg, elem, data);
+}
+
+static void put_compare(struct nl_msg *msg, const void *value, int len)
+{
+    struct nlattr *data;
+    struct nlattr *elem = begin_expression(msg, "cmp", &data);
+    nla_put_u32(msg, NFTA_CMP_SREG, htonl(NFT_REG_1));
+    nla_put_u32(msg, NFTA_CMP_OP, htonl(NFT_CMP_EQ));
+    put_value(msg, NFTA_CMP_DATA, value, len);
+    end_expression(msg, elem, data);
+}
+
+static void put_match(struct nl_msg *msg, int base, int offset, const void *value, int len)
+{
+    put_load_payload(msg, base, offset, len);
+    put_compare(msg, value, len);
+}
+
+// Checksums are fixed up as it's written, `csum_offset` is where the header's own checksum is and
+// `csum_flags` says whether the UDP one covers the field too
+static void put_rewrite(struct nl_msg *msg, int base, int offset, const void *value, int len, int csum_offset, int csum_flags)
+{
+    struct nlattr *data;
+    struct nlattr *elem = begin_expression(msg, "immediate", &data);
+    nla_put_u32(msg, NFTA_IMMEDIATE_DREG, htonl(NFT_REG_1));
+    put_value(msg, NFTA_IMMEDIATE_DATA, value, len);
+    end_expression(msg, elem, data);
+
+    elem = begin_expression(msg, "payload", &data);
+    nla_put_u32(msg, NFTA_PAYLOAD_SREG, htonl(NFT_REG_1));
+    nla_put_u32(msg, NFTA_PAYLOAD_BASE, htonl(base));
+    nla_put_u32(msg, NFTA_PAYLOAD_OFFSET, htonl(offset));
+    nla_put_u32(msg, NFTA_PAYLOAD_LEN, htonl(len));
+    nla_put_u32(msg, NFTA_PAYLOAD_CSUM_TYPE, htonl(NFT_PAYLOAD_CSUM_INET));
+    nla_put_u32(msg, NFTA_PAYLOAD_CSUM_OFFSET, htonl(csum_offset));
+    nla_put_u32(msg, NFTA_PAYLOAD_CSUM_FLAGS, htonl(csum_flags));
+    end_expression(msg, elem, data);
+}
+
+static void put_statement(struct nl_msg *msg, const char *name)
+{
+    struct nlattr *data;
+    struct nlattr *elem = begin_expression(msg, name, &data);
+    end_expression(msg, elem, data);
+}
+
+static void put_address_rewrite(struct nl_msg *msg, int offset, struct in_addr addr)
+{
+    put_rewrite(msg, NFT_PAYLOAD_NETWORK_HEADER, offset, &addr, sizeof(addr), offsetof(struct iphdr, check), NFT_PAYLOAD_L4CSUM_PSEUDOHDR);
+}
+
+static void put_port_rewrite(struct nl_msg *msg, int offset, uint16_t port)
+{
+    uint16_t value = htons(port);
+    put_rewrite(msg, NFT_PAYLOAD_TRANSPORT_HEADER, offset, &value, sizeof(value), offsetof(struct udphdr, check), 0);
+}
+
+static void add_rule(nat_batch *b, const char *chain, const nat_rule *r)
+{
+    struct nl_msg *msg = begin_nft_message(NFT_MSG_NEWRULE, NLM_F_CREATE | NLM_F_APPEND | NLM_F_ACK);
+    if (!msg) {
+        b->failed = 1;
+        return;
+    }
+
+    nla_put_string(msg, NFTA_RULE_TABLE, NAT_TABLE);
+    nla_put_string(msg, NFTA_RULE_CHAIN, chain);
+
+    struct nlattr *exprs = nla_nest_start(msg, NLA_F_NESTED | NFTA_RULE_EXPRESSIONS);
+    if (r->iifname) {
+        char name[IFNAMSIZ] = {0};
+        strncpy(name, r->iifname, sizeof(name) - 1);
+        put_load_meta(msg, NFT_META_IIFNAME);
+        put_compare(msg, name, sizeof(name));
+    }
+    if (r->saddr.s_addr) {
+        put_match(msg, NFT_PAYLOAD_NETWORK_HEADER, offsetof(struct iphdr, saddr), &r->saddr, sizeof(r->saddr));
+    }
+    if (r->daddr.s_addr) {
+        put_match(msg, NFT_PAYLOAD_NETWORK_HEADER, offsetof(struct iphdr, daddr), &r->daddr, sizeof(r->daddr));
+    }
+
+    uint8_t protocol = IPPROTO_UDP;
+    uint16_t sport = htons(r->sport);
+    uint16_t dport = htons(r->dport);
+    put_load_meta(msg, NFT_META_L4PROTO);
+    put_compare(msg, &protocol, sizeof(protocol));
+    if (r->sport) {
+        put_match(msg, NFT_PAYLOAD_TRANSPORT_HEADER, offsetof(struct udphdr, source), &sport, sizeof(sport));
+    }
+    if (r->dport) {
+        put_match(msg, NFT_PAYLOAD_TRANSPORT_HEADER, offsetof(struct udphdr, dest), &dport, sizeof(dport));
+    }
+
+    if (r->notrack) {
+        put_statement(msg, "notrack");
+    }
+    if (r->comment) {
+        put_statement(msg, "counter");
+    }
+
+    if (r->set_saddr.s_addr) {
+        put_address_rewrite(msg, offsetof(struct iphdr, saddr), r->set_saddr);
+    }
+    if (r->set_daddr.s_addr) {
+        put_address_rewrite(msg, offsetof(struct iphdr, daddr), r->set_daddr);
+    }
+    if (r->set_sport) {
+        put_port_rewrite(msg, offsetof(struct udphdr, source), r->set_sport);
+    }
+    if (r->set_dport) {
+        put_port_rewrite(msg, offsetof(struct udphdr, dest), r->set_dport);
+    }
+    nla_nest_end(msg, exprs);
+
+    if (r->comment) {
+        uint8_t udata[2 + 32];
+        size_t len = strlen(r->comment) + 1;
+        udata[0] = NAT_UDATA_COMMENT;
+        udata[1] = len;
+        memcpy(udata + 2, r->comment, len);
+        nla_put(msg, NFTA_RULE_USERDATA, 2 + len, udata);
+    }
+
+    add_to_batch(b, msg);
+}
+
+static struct nl_sock *open_netfilter_socket()
+{
+    struct nl_sock *sk = nl_socket_alloc();
+    if (!sk) {
+        return NULL;
+    }
+
+    int err = nl_connect(sk, NETLINK_NETFILTER);
+    if (err < 0) {
+        print_info("FAILED TO OPEN NETFILTER SOCKET: %s", nl_geterror(err));
+        nl_socket_free(sk);
+        return NULL;
+    }
+
+    // Rule dumps can be bigger than a page
+    nl_socket_enable_msg_peek(sk);
+    nl_socket_disable_auto_ack(sk);
+
+    struct timeval tv = {0};
+    tv.tv_sec = NAT_NETLINK_TIMEOUT_MS / 1000;
+    tv.tv_usec = (NAT_NETLINK_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(nl_socket_get_fd(sk), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    return sk;
+}
+
+// Send `b` and wait until the kernel has acknowledged all of it, returns 0 or the first error
+static int send_batch(nat_batch *b)
+{
+    if (b->failed) {
+        return -ENOMEM;
+    }
+
+    struct nl_sock *sk = open_netfilter_socket();
+    if (!sk) {
+        return -ENOTCONN;
+    }
+
+    int ret = 0;
+    if (nl_sendto(sk, b->data, b->length) < 0) {
+        ret = -EIO;
+        goto exit;
+    }
+
+    // The whole batch is abandoned at the first error, so there's nothing to wait for after one
+    int acks = 0;
+    while (acks < b->acks && ret == 0) {
+        struct sockaddr_nl from;
+        unsigned char *buf = NULL;
+        int len = nl_recv(sk, &from, &buf, NULL);
+        if (len <= 0) {
+            ret = -ETIMEDOUT;
+            break;
+        }
+
+        for (struct nlmsghdr *hdr = (struct nlmsghdr *) buf; nlmsg_ok(hdr, len); hdr = nlmsg_next(hdr, &len)) {
+            if (hdr->nlmsg_type != NLMSG_ERROR) {
+                continue;
+            }
+
+            const struct nlmsgerr *e = nlmsg_data(hdr);
+            if (e->error) {
+                ret = e->error;
+                break;
+            }
+            acks++;
+        }
+        free(buf);
+    }
+
+exit:
+    nl_socket_free(sk);
+    return ret;
+}
+
+// Add the counter of the rule that `comment` names to `stats`
+static void count_rule(nat_stats *stats, const char *comment, uint64_t packets, uint64_t bytes)
+{
+    unsigned int port;
+    nat_counter *counters;
+    if (sscanf(comment, "frontend-%u", &port) == 1) {
+        counters = stats->to_frontend;
+    } else if (sscanf(comment, "console-local-%u", &port) == 1 || sscanf(comment, "console-%u", &port) == 1) {
+        counters = stats->to_console;
+    } else {
+        return;
+    }
+
+    for (int i = 0; i < NAT_PORT_COUNT; i++) {
+        if (nat_ports[i] == port) {
+            counters[i].packets += packets;
+            counters[i].bytes += bytes;
+        }
+    }
+}
+
+// Look for a counter in a rule from the dump, and add it to `stats`
+static void read_rule_counter(struct nlmsghdr *hdr, nat_stats *stats, int log)
+{
+    struct nlattr *tb[NFTA_RULE_MAX + 1];
+    if (nlmsg_parse(hdr, sizeof(struct nfgenmsg), tb, NFTA_RULE_MAX, NULL) < 0 || !tb[NFTA_RULE_USERDATA] || !tb[NFTA_RULE_EXPRESSIONS]) {
+        return;
+    }
+
+    // Only our own comments, which are the userdata's first and only entry
+    char comment[32];
+    const uint8_t *udata = nla_data(tb[NFTA_RULE_USERDATA]);
+    int udata_len = nla_len(tb[NFTA_RULE_USERDATA]);
+    if (udata_len < 3 || udata[0] != NAT_UDATA_COMMENT || udata[1] > udata_len - 2 || udata[1] > sizeof(comment)) {
+        return;
+    }
+    memcpy(comment, udata + 2, udata[1]);
+    comment[udata[1] - 1] = 0;
+
+    struct nlattr *elem;
+    int rem;
+    nla_for_each_nested(elem, tb[NFTA_RULE_EXPRESSIONS], rem) {
+        struct nlattr *etb[NFTA_EXPR_MAX + 1];
+        if (nla_parse_nested(etb, NFTA_EXPR_MAX, elem, NULL) < 0 || !etb[NFTA_EXPR_NAME] || !etb[NFTA_EXPR_DATA]
+            || strcmp(nla_get_string(etb[NFTA_EXPR_NAME]), "counter")) {
+            continue;
+        }
+
+        struct nlattr *ctb[NFTA_COUNTER_MAX + 1];
+        if (nla_parse_nested(ctb, NFTA_COUNTER_MAX, etb[NFTA_EXPR_DATA], NULL) < 0 || !ctb[NFTA_COUNTER_PACKETS] || !ctb[NFTA_COUNTER_BYTES]) {
+            continue;
+        }
+
+        uint64_t packets = be64toh(nla_get_u64(ctb[NFTA_COUNTER_PACKETS]));
+        uint64_t bytes = be64toh(nla_get_u64(ctb[NFTA_COUNTER_BYTES]));
+        if (log) {
+            print_info("NFTABLES %s: %llu PACKETS, %llu BYTES", comment, (unsigned long long) packets, (unsigned long long) bytes);
+        }
+        count_rule(stats, comment, packets, bytes);
+    }
+}
+
+// Add what the installed rules have counted to `stats`, logging each rule if `log` is set
+static int read_counters(nat_stats *stats, int log)
+{
+    struct nl_sock *sk = open_netfilter_socket();
+    if (!sk) {
+        return VANILLA_ERROR;
+    }
+
+    int ret = VANILLA_ERROR;
+    struct nl_msg *msg = begin_nft_message(NFT_MSG_GETRULE, NLM_F_DUMP);
+    if (!msg) {
+        goto exit;
+    }
+    nla_put_string(msg, NFTA_RULE_TABLE, NAT_TABLE);
+    int err = nl_send_auto(sk, msg);
+    nlmsg_free(msg);
+    if (err < 0) {
+        goto exit;
+    }
+
+    int done = 0;
+    while (!done) {
+        struct sockaddr_nl from;
+        unsigned char *buf = NULL;
+        int len = nl_recv(sk, &from, &buf, NULL);
+        if (len <= 0) {
+            goto exit;
+        }
+
+        for (struct nlmsghdr *hdr = (struct nlmsghdr *) buf; nlmsg_ok(hdr, len); hdr = nlmsg_next(hdr, &len)) {
+            if (hdr->nlmsg_type == NLMSG_DONE) {
+                done = 1;
+            } else if (hdr->nlmsg_type == NLMSG_ERROR) {
+                done = -1;
+            } else if (hdr->nlmsg_type == ((NFNL_SUBSYS_NFTABLES << 8) | NFT_MSG_NEWRULE)) {
+                read_rule_counter(hdr, stats, log);
+            }
+        }
+        free(buf);
+    }
+    if (done == 1) {
+        ret = VANILLA_SUCCESS;
+    }
+
+exit:
+    nl_socket_free(sk);
+    return ret;
+}
+
+// Rules for the ports console datagrams have to appear to come from, `source` being the address
+// the frontend expects them from
+static void add_source_rules(nat_batch *b, const char *chain, const char *wireless_interface, struct in_addr console, struct in_addr source)
+{
+    for (int i = 0; i < NAT_PORT_COUNT; i++) {
+        uint16_t p = nat_ports[i];
+        nat_rule r = {.iifname = wireless_interface, .saddr = console, .sport = p + 100, .dport = p + 200, .set_saddr = source};
+        add_rule(b, chain, &r);
+    }
+}
+
+static void add_rules(nat_batch *b, const char *wireless_interface, struct in_addr client, struct in_addr local, struct in_addr source)
+{
+    struct in_addr console;
+    inet_pton(AF_INET, CONSOLE_ADDRESS, &console);
+    char comments[3][NAT_PORT_COUNT][32];
+
+    // Creating the table before deleting it makes sure we start from an empty one without failing
+    // if it doesn't exist yet
+    add_table(b, NFT_MSG_NEWTABLE);
+    add_table(b, NFT_MSG_DELTABLE);
+    add_table(b, NFT_MSG_NEWTABLE);
+
+    // Console to frontend, and frontends on other hosts to the console. Source addresses can't be
+    // rewritten here, a local one would make the kernel drop the packet as a martian, so that's
+    // left to the chains after routing.
+    add_chain(b, "prerouting", "filter", NF_INET_PRE_ROUTING, NF_IP_PRI_RAW);
+    for (int i = 0; i < NAT_PORT_COUNT; i++) {
+        uint16_t p = nat_ports[i];
+        snprintf(comments[0][i], sizeof(comments[0][i]), "frontend-%u", p);
+        snprintf(comments[1][i], sizeof(comments[1][i]), "console-%u", p);
+
+        nat_rule to_frontend = {.iifname = wireless_interface, .saddr = console, .dport = p, .notrack = 1, .comment = comments[0][i],
+                                .set_daddr = client, .set_sport = p + 100, .set_dport = p + 200};
+        add_rule(b, "prerouting", &to_frontend);
+
+        nat_rule to_console = {.saddr = client, .sport = p + 200, .dport = p + 100, .notrack = 1, .comment = comments[1][i],
+                               .set_daddr = console, .set_sport = p, .set_dport = p - 100};
+        add_rule(b, "prerouting", &to_console);
+    }
+
+    // Frontends on this host to the console, a route chain so the packet is rerouted after rewriting
+    add_chain(b, "output", "route", NF_INET_LOCAL_OUT, NF_IP_PRI_RAW);
+    for (int i = 0; i < NAT_PORT_COUNT; i++) {
+        uint16_t p = nat_ports[i];
+        snprintf(comments[2][i], sizeof(comments[2][i]), "console-local-%u", p);
+
+        nat_rule r = {.saddr = client, .sport = p + 200, .dport = p + 100, .notrack = 1, .comment = comments[2][i],
+                      .set_saddr = local, .set_daddr = console, .set_sport = p, .set_dport = p - 100};
+        add_rule(b, "output", &r);
+    }
+
+    // The frontend connects its sockets to our port+100 ports, so console datagrams have to look like
+    // they came from there. Forwarded ones are fixed up on the way out, along with frontends on
+    // other hosts that have to look like us to the console, and local ones on the way in.
+    add_chain(b, "postrouting", "filter", NF_INET_POST_ROUTING, NF_IP_PRI_FILTER);
+    add_source_rules(b, "postrouting", wireless_interface, console, source);
+    for (int i = 0; i < NAT_PORT_COUNT; i++) {
+        uint16_t p = nat_ports[i];
+        nat_rule r = {.saddr = client, .daddr = console, .sport = p, .dport = p - 100, .set_saddr = local};
+        add_rule(b, "postrouting", &r);
+    }
+
+    add_chain(b, "input", "filter", NF_INET_LOCAL_IN, NF_IP_PRI_FILTER);
+    add_source_rules(b, "input", wireless_interface, console, source);
+}
+
+int nat_install(const char *wireless_interface, struct in_addr client)
+{
+    nat_remove();
+
+    struct in_addr local;
+    if (get_interface_address(wireless_interface, &local) != VANILLA_SUCCESS) {
+        print_info("FAILED TO GET ADDRESS OF %s", wireless_interface);
+        return VANILLA_ERROR;
+    }
+
+    struct in_addr source;
+    if (get_source_address(client, &source) != VANILLA_SUCCESS) {
+        print_info("FAILED TO FIND A ROUTE TO THE FRONTEND");
+        return VANILLA_ERROR;
+    }
+
+    // Too big for the relay thread's stack
+    static nat_batch b;
+    memset(&b, 0, sizeof(b));
+    add_batch_marker(&b, NFNL_MSG_BATCH_BEGIN);
+    add_rules(&b, wireless_interface, client, local, source);
+    add_batch_marker(&b, NFNL_MSG_BATCH_END);
+
+    int err = send_batch(&b);
+    if (err != 0) {
+        print_info("FAILED TO INSTALL NFTABLES RULES: %s", strerror(-err));
+        return VANILLA_ERROR;
+    }
+
+    installed = 1;
+
+    // The kernel drops packets for 127.0.0.0/8 arriving on a real interface unless told otherwise
+    if ((ntohl(client.s_addr) >> 24) == 127) {
+        snprintf(route_localnet_path, sizeof(route_localnet_path), "/proc/sys/net/ipv4/conf/%s/route_localnet", wireless_interface);
+        enable_sysctl(route_localnet_path, old_route_localnet, sizeof(old_route_localnet));
+    } else if (!is_local_address(client)) {
+        enable_sysctl(IP_FORWARD_PATH, old_ip_forward, sizeof(old_ip_forward));
+    }
+
+    char client_str[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &client, client_str, sizeof(client_str));
+    print_info("INSTALLED NFTABLES FORWARDING TO %s", client_str);
+
+    return VANILLA_SUCCESS;
+}
+
+void nat_remove()
+{
+    if (!installed) {
+        return;
+    }
+
+    // Whatever the rules counted would be lost with them
+    read_counters(&removed_stats, 1);
+
+    static nat_batch b;
+    memset(&b, 0, sizeof(b));
+    add_batch_marker(&b, NFNL_MSG_BATCH_BEGIN);
+    add_table(&b, NFT_MSG_DELTABLE);
+    add_batch_marker(&b, NFNL_MSG_BATCH_END);
+
+    int err = send_batch(&b);
+    if (err != 0) {
+        print_info("FAILED TO REMOVE NFTABLES RULES: %s", strerror(-err));
+    }
+
+    restore_sysctl(route_localnet_path, old_route_localnet);
+    restore_sysctl(IP_FORWARD_PATH, old_ip_forward);
+
+    installed = 0;
+}
+
+int nat_is_installed()
+{
+    return installed;
+}
+
+int nat_get_stats(nat_stats *stats)
+{
+    *stats = removed_stats;
+    if (installed) {
+        return read_counters(stats, 0);
+    }
+    return VANILLA_SUCCESS;
+}
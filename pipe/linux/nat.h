@@ -0,0 +1,49 @@
+#ifndef VANILLA_PIPE_NAT_H
+#define VANILLA_PIPE_NAT_H
+
+#include <netinet/in.h>
+#include <stdint.h>
+
+/**
+ * In-kernel forwarding between the console and the frontend using nftables
+ *
+ * Console datagrams are rewritten to go from our port+100 ports to the frontend's port+200 ports,
+ * as if the userspace relay had sent them, and frontend datagrams sent to port+100 are rewritten to
+ * come from our port and go to the console, so nothing gets copied through vanilla-pipe. The rewrite is stateless (the flows
+ * bypass conntrack) because both directions share one console-side 4-tuple, which conntrack would
+ * otherwise treat as a clash and remap.
+ *
+ * Rules are programmed over nf_tables netlink in one atomic batch, so nothing is spawned and the
+ * relay thread only waits for the kernel to acknowledge it. If that fails, the userspace relay
+ * keeps handling the traffic.
+ */
+
+// The ports forwarded, in the relay's order (video, audio, message, command, input)
+#define NAT_PORT_COUNT 5
+
+typedef struct
+{
+    uint64_t packets;
+    uint64_t bytes;
+} nat_counter;
+
+// What the rules forwarded on each port
+typedef struct
+{
+    nat_counter to_frontend[NAT_PORT_COUNT];
+    nat_counter to_console[NAT_PORT_COUNT];
+} nat_stats;
+
+// Install rules for frontend `client` on `wireless_interface`, replacing any previous ones
+int nat_install(const char *wireless_interface, struct in_addr client);
+
+// Log the rule counters and remove the rules (does nothing if none are installed)
+void nat_remove();
+
+// Whether rules are installed, the relay doesn't see the datagrams they forward
+int nat_is_installed();
+
+// Everything the rules have forwarded since vanilla-pipe started, including rules since removed
+int nat_get_stats(nat_stats *stats);
+
+#endif // VANILLA_PIPE_NAT_H
@@ -0,0 +1,339 @@
+#include "radio.h"
+
+#include <net/if.h>
+#include <string.h>
+#include <linux/nl80211.h>
+#include <netlink/errno.h>
+#include <netlink/genl/ctrl.h>
+#include <netlink/genl/genl.h>
+#include <netlink/netlink.h>
+
+#include "def.h"
+#include "status.h"
+#include "vanilla.h"
+
+enum RadioPhase
+{
+    RADIO_IDLE,
+    RADIO_STATION,
+    RADIO_SURVEY
+};
+
+static int send_dump(radio_link *link, uint8_t command)
+{
+    struct nl_msg *msg = nlmsg_alloc();
+    if (!msg) {
+        return -1;
+    }
+
+    int err = -1;
+    if (genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, link->family, 0, NLM_F_DUMP, command, 0)
+        && nla_put_u32(msg, NL80211_ATTR_IFINDEX, link->ifindex) == 0) {
+        err = nl_send_auto(link->socket, msg);
+    }
+
+    nlmsg_free(msg);
+    return err < 0 ? -1 : 0;
+}
+
+static void complete_sample(radio_link *link)
+{
+    link->stats = link->pending;
+    link->samples++;
+    link->completed = 1;
+    link->phase = RADIO_IDLE;
+}
+
+static void parse_rate(struct nlattr *attr, uint32_t *bitrate, int *mcs, uint32_t *valid, uint32_t bitrate_flag, uint32_t mcs_flag)
+{
+    struct nlattr *rate[NL80211_RATE_INFO_MAX + 1];
+    if (nla_parse_nested(rate, NL80211_RATE_INFO_MAX, attr, NULL) < 0) {
+        return;
+    }
+
+    if (rate[NL80211_RATE_INFO_BITRATE32]) {
+        *bitrate = nla_get_u32(rate[NL80211_RATE_INFO_BITRATE32]);
+        *valid |= bitrate_flag;
+    } else if (rate[NL80211_RATE_INFO_BITRATE]) {
+        *bitrate = nla_get_u16(rate[NL80211_RATE_INFO_BITRATE]);
+        *valid |= bitrate_flag;
+    }
+
+    // Only one of these is present, depending on which generation of rates is in use
+    static const int mcs_attrs[] = {NL80211_RATE_INFO_MCS, NL80211_RATE_INFO_VHT_MCS, NL80211_RATE_INFO_HE_MCS};
+    for (size_t i = 0; i < sizeof(mcs_attrs) / sizeof(mcs_attrs[0]); i++) {
+        if (rate[mcs_attrs[i]]) {
+            *mcs = nla_get_u8(rate[mcs_attrs[i]]);
+            *valid |= mcs_flag;
+            break;
+        }
+    }
+}
+
+static void parse_station(radio_link *link, struct nlattr **tb)
+{
+    struct nlattr *info[NL80211_STA_INFO_MAX + 1];
+    if (!tb[NL80211_ATTR_STA_INFO] || nla_parse_nested(info, NL80211_STA_INFO_MAX, tb[NL80211_ATTR_STA_INFO], NULL) < 0) {
+        return;
+    }
+
+    // A client only has the one station, the console
+    radio_link_stats *s = &link->pending;
+    if (info[NL80211_STA_INFO_SIGNAL]) {
+        s->signal_dbm = (int8_t) nla_get_u8(info[NL80211_STA_INFO_SIGNAL]);
+        s->valid |= VANILLA_PIPE_LINK_SIGNAL;
+    }
+    if (info[NL80211_STA_INFO_TX_BITRATE]) {
+        parse_rate(info[NL80211_STA_INFO_TX_BITRATE], &s->tx_bitrate, &s->tx_mcs, &s->valid, VANILLA_PIPE_LINK_TX_BITRATE, VANILLA_PIPE_LINK_TX_MCS);
+    }
+    if (info[NL80211_STA_INFO_RX_BITRATE]) {
+        parse_rate(info[NL80211_STA_INFO_RX_BITRATE], &s->rx_bitrate, &s->rx_mcs, &s->valid, VANILLA_PIPE_LINK_RX_BITRATE, VANILLA_PIPE_LINK_RX_MCS);
+    }
+    if (info[NL80211_STA_INFO_TX_RETRIES]) {
+        s->tx_retries = nla_get_u32(info[NL80211_STA_INFO_TX_RETRIES]);
+        s->valid |= VANILLA_PIPE_LINK_RETRIES;
+    }
+    if (info[NL80211_STA_INFO_TX_FAILED]) {
+        s->tx_failed = nla_get_u32(info[NL80211_STA_INFO_TX_FAILED]);
+        s->valid |= VANILLA_PIPE_LINK_FAILED;
+    }
+    if (info[NL80211_STA_INFO_BEACON_LOSS]) {
+        s->beacon_loss = nla_get_u32(info[NL80211_STA_INFO_BEACON_LOSS]);
+        s->valid |= VANILLA_PIPE_LINK_BEACON_LOSS;
+    }
+}
+
+static void parse_survey(radio_link *link, struct nlattr **tb)
+{
+    struct nlattr *survey[NL80211_SURVEY_INFO_MAX + 1];
+    if (!tb[NL80211_ATTR_SURVEY_INFO] || nla_parse_nested(survey, NL80211_SURVEY_INFO_MAX, tb[NL80211_ATTR_SURVEY_INFO], NULL) < 0) {
+        return;
+    }
+
+    // Every channel the card has visited is listed, only the console's matters
+    if (!survey[NL80211_SURVEY_INFO_IN_USE] || !survey[NL80211_SURVEY_INFO_TIME] || !survey[NL80211_SURVEY_INFO_TIME_BUSY]) {
+        return;
+    }
+
+    link->pending.channel_time_ms = nla_get_u64(survey[NL80211_SURVEY_INFO_TIME]);
+    link->pending.channel_busy_ms = nla_get_u64(survey[NL80211_SURVEY_INFO_TIME_BUSY]);
+    link->pending.valid |= VANILLA_PIPE_LINK_CHANNEL_BUSY;
+}
+
+static int handle_valid(struct nl_msg *msg, void *arg)
+{
+    radio_link *link = (radio_link *) arg;
+    struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+    struct nlattr *tb[NL80211_ATTR_MAX + 1];
+
+    if (nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0), genlmsg_attrlen(gnlh, 0), NULL) < 0) {
+        return NL_SKIP;
+    }
+
+    if (link->phase == RADIO_STATION && gnlh->cmd == NL80211_CMD_NEW_STATION) {
+        parse_station(link, tb);
+    } else if (link->phase == RADIO_SURVEY && gnlh->cmd == NL80211_CMD_NEW_SURVEY_RESULTS) {
+        parse_survey(link, tb);
+    }
+
+    return NL_OK;
+}
+
+static int handle_finish(struct nl_msg *msg, void *arg)
+{
+    (void) msg;
+    radio_link *link = (radio_link *) arg;
+
+    if (link->phase == RADIO_STATION) {
+        // Station and survey dumps can't share a request, ask for the survey next
+        if (send_dump(link, NL80211_CMD_GET_SURVEY) == 0) {
+            link->phase = RADIO_SURVEY;
+        } else {
+            complete_sample(link);
+        }
+    } else if (link->phase == RADIO_SURVEY) {
+        complete_sample(link);
+    }
+
+    return NL_STOP;
+}
+
+static struct nl_sock *open_nl80211(int *family)
+{
+    struct nl_sock *socket = nl_socket_alloc();
+    if (!socket) {
+        return NULL;
+    }
+
+    int err = genl_connect(socket);
+    if (err < 0) {
+        print_info("FAILED TO OPEN GENERIC NETLINK SOCKET: %s", nl_geterror(err));
+        goto fail;
+    }
+
+    *family = genl_ctrl_resolve(socket, NL80211_GENL_NAME);
+    if (*family < 0) {
+        print_info("NL80211 IS NOT AVAILABLE: %s", nl_geterror(*family));
+        goto fail;
+    }
+
+    return socket;
+
+fail:
+    nl_socket_free(socket);
+    return NULL;
+}
+
+int radio_open(radio_link *link, const char *wireless_interface)
+{
+    radio_close(link);
+
+    link->ifindex = if_nametoindex(wireless_interface);
+    if (link->ifindex == 0) {
+        print_info("UNKNOWN INTERFACE %s", wireless_interface);
+        return VANILLA_ERROR;
+    }
+
+    link->socket = open_nl80211(&link->family);
+    if (!link->socket) {
+        return VANILLA_ERROR;
+    }
+
+    // Only one request is ever outstanding, and dumps don't need acknowledging
+    nl_socket_disable_seq_check(link->socket);
+    nl_socket_disable_auto_ack(link->socket);
+    nl_socket_modify_cb(link->socket, NL_CB_VALID, NL_CB_CUSTOM, handle_valid, link);
+    nl_socket_modify_cb(link->socket, NL_CB_FINISH, NL_CB_CUSTOM, handle_finish, link);
+    nl_socket_set_nonblocking(link->socket);
+
+    link->phase = RADIO_IDLE;
+    link->samples = 0;
+    memset(&link->stats, 0, sizeof(link->stats));
+    return VANILLA_SUCCESS;
+}
+
+int radio_get_fd(const radio_link *link)
+{
+    return link->socket ? nl_socket_get_fd(link->socket) : -1;
+}
+
+void radio_request_stats(radio_link *link)
+{
+    if (!link->socket || link->phase != RADIO_IDLE) {
+        return;
+    }
+
+    memset(&link->pending, 0, sizeof(link->pending));
+    link->pending.tx_mcs = link->pending.rx_mcs = -1;
+
+    if (send_dump(link, NL80211_CMD_GET_STATION) == 0) {
+        link->phase = RADIO_STATION;
+    }
+}
+
+int radio_read(radio_link *link)
+{
+    if (!link->socket) {
+        return 0;
+    }
+
+    link->completed = 0;
+
+    int err = nl_recvmsgs_default(link->socket);
+    if (err < 0 && err != -NLE_AGAIN) {
+        // Not every driver has surveys, the station alone is still worth reporting
+        if (link->phase == RADIO_SURVEY) {
+            complete_sample(link);
+        } else {
+            link->phase = RADIO_IDLE;
+        }
+    }
+
+    return link->completed;
+}
+
+void radio_close(radio_link *link)
+{
+    if (link->socket) {
+        nl_socket_free(link->socket);
+        link->socket = NULL;
+    }
+    link->phase = RADIO_IDLE;
+}
+
+static int handle_power_save(struct nl_msg *msg, void *arg)
+{
+    int *state = (int *) arg;
+    struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+    struct nlattr *tb[NL80211_ATTR_MAX + 1];
+
+    if (nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0), genlmsg_attrlen(gnlh, 0), NULL) == 0 && tb[NL80211_ATTR_PS_STATE]) {
+        *state = nla_get_u32(tb[NL80211_ATTR_PS_STATE]) == NL80211_PS_ENABLED;
+    }
+
+    return NL_OK;
+}
+
+int radio_get_power_save(const char *wireless_interface)
+{
+    int state = -1;
+
+    int ifindex = if_nametoindex(wireless_interface);
+    int family;
+    struct nl_sock *socket = open_nl80211(&family);
+    struct nl_msg *msg = nlmsg_alloc();
+    if (ifindex == 0 || !socket || !msg) {
+        goto exit;
+    }
+
+    if (genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, family, 0, 0, NL80211_CMD_GET_POWER_SAVE, 0)
+        && nla_put_u32(msg, NL80211_ATTR_IFINDEX, ifindex) == 0
+        && nl_send_auto(socket, msg) >= 0) {
+        // The reply comes before the acknowledgement
+        nl_socket_modify_cb(socket, NL_CB_VALID, NL_CB_CUSTOM, handle_power_save, &state);
+        nl_wait_for_ack(socket);
+    }
+
+exit:
+    if (msg) {
+        nlmsg_free(msg);
+    }
+    if (socket) {
+        nl_socket_free(socket);
+    }
+    return state;
+}
+
+int radio_set_power_save(const char *wireless_interface, int enabled)
+{
+    int ret = VANILLA_ERROR;
+
+    int ifindex = if_nametoindex(wireless_interface);
+    int family;
+    struct nl_sock *socket = open_nl80211(&family);
+    if (ifindex == 0 || !socket) {
+        goto exit;
+    }
+
+    struct nl_msg *msg = nlmsg_alloc();
+    if (msg
+        && genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, family, 0, 0, NL80211_CMD_SET_POWER_SAVE, 0)
+        && nla_put_u32(msg, NL80211_ATTR_IFINDEX, ifindex) == 0
+        && nla_put_u32(msg, NL80211_ATTR_PS_STATE, enabled ? NL80211_PS_ENABLED : NL80211_PS_DISABLED) == 0) {
+        // Takes ownership of the message
+        int err = nl_send_sync(socket, msg);
+        if (err < 0) {
+            print_info("FAILED TO SET POWER SAVE ON %s: %s", wireless_interface, nl_geterror(err));
+        } else {
+            ret = VANILLA_SUCCESS;
+        }
+    } else {
+        nlmsg_free(msg);
+    }
+
+exit:
+    if (socket) {
+        nl_socket_free(socket);
+    }
+    return ret;
+}
@@ -0,0 +1,68 @@
+#ifndef VANILLA_PIPE_RADIO_H
+#define VANILLA_PIPE_RADIO_H
+
+#include <stdint.h>
+
+/**
+ * Link quality of the connection to the console, read from nl80211 with libnl
+ *
+ * Requests are sent without waiting for the reply, so the relay can poll from its own event loop
+ * and read the answer when the socket becomes readable.
+ */
+
+struct nl_sock;
+
+// Fields are only meaningful if their VANILLA_PIPE_LINK_* flag is set in `valid`. Counters are
+// totals since the console was associated.
+typedef struct
+{
+    uint32_t valid;
+    int signal_dbm;
+    uint32_t tx_bitrate; // 100kbit/s
+    uint32_t rx_bitrate;
+    int tx_mcs;
+    int rx_mcs;
+    uint32_t tx_retries;
+    uint32_t tx_failed;
+    uint32_t beacon_loss;
+    uint64_t channel_time_ms;
+    uint64_t channel_busy_ms;
+} radio_link_stats;
+
+// One interface's nl80211 socket, zero it before it's first used
+typedef struct
+{
+    struct nl_sock *socket;
+    int family;
+    int ifindex;
+    int phase;
+    int completed;
+
+    // Filled in while the replies to a request arrive
+    radio_link_stats pending;
+
+    // The last complete sample
+    radio_link_stats stats;
+    uint32_t samples;
+} radio_link;
+
+// Open an nl80211 socket for `wireless_interface`, fails if the interface isn't a wireless one
+int radio_open(radio_link *link, const char *wireless_interface);
+
+// Descriptor to wait on for replies
+int radio_get_fd(const radio_link *link);
+
+// Ask for a new sample, does nothing if the last one is still being answered
+void radio_request_stats(radio_link *link);
+
+// Read whatever replies have arrived, returns non-zero if that completed a sample
+int radio_read(radio_link *link);
+
+void radio_close(radio_link *link);
+
+// Returns 1 if power save is on for `wireless_interface`, 0 if it's off, or -1 if it can't be read
+int radio_get_power_save(const char *wireless_interface);
+
+int radio_set_power_save(const char *wireless_interface, int enabled);
+
+#endif // VANILLA_PIPE_RADIO_H
@@ -0,0 +1,1903 @@
+#define _GNU_SOURCE
+#include "relay.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bundler.h"
+#include "def.h"
+#include "framer.h"
+#include "gamepad/escalation.h"
+#include "gamepad/fec.h"
+#include "hidgen.h"
+#include "metrics.h"
+#include "gamepad/reassembly.h"
+#include "gamepad/tuning.h"
+#include "nat.h"
+#include "ports.h"
+#include "radio.h"
+#include "shm.h"
+#include "status.h"
+#include "util.h"
+#include "vanilla.h"
+#include "wpa.h"
+
+#ifdef VANILLA_PIPE_IO_URING
+#include "relay_uring.h"
+#endif
+
+// Index of PORT_MSG in a slot's ports, IDR requests are sent from it on the frontend's behalf
+#define RELAY_PORT_MSG 2
+
+// Index of PORT_HID in a slot's ports, packets built from input deltas are sent from it
+#define RELAY_PORT_HID 4
+
+// Don't let one busy socket starve the others
+#define RELAY_MAX_READS_PER_WAKE 64
+
+#define RELAY_PACKET_SIZE 2048
+
+// Frontends that only watch, in addition to the one that plays
+#define RELAY_MAX_SPECTATORS 8
+
+// A spectator that couldn't be sent a batch, or still had this many bytes queued after it, is
+// behind. One that's behind for this many batches in a row is dropped.
+#define RELAY_SPECTATOR_MAX_BACKLOG (64 * 1024)
+#define RELAY_SPECTATOR_MAX_FAILURES 64
+
+// How often each slot's link quality is sampled
+#define RELAY_LINK_STATS_INTERVAL_S 1
+
+// How often the watchdog looks at each port
+#define RELAY_WATCHDOG_INTERVAL_MS 100
+
+// Used unless relay_config.stall_threshold_ms says otherwise, the console sends video and audio
+// all the time it's on
+#define RELAY_DEFAULT_VIDEO_STALL_MS 500
+#define RELAY_DEFAULT_AUDIO_STALL_MS 500
+
+static const char *CONSOLE_ADDRESS = "192.168.1.10";
+
+static const char *port_names[RELAY_PORT_COUNT] = {"vid", "aud", "msg", "cmd", "hid"};
+
+enum RelayTag
+{
+    RELAY_TAG_QUIT,
+    RELAY_TAG_URING,
+    RELAY_TAG_SHM_LISTEN,
+    RELAY_TAG_SHM_CONNECTION,
+    RELAY_TAG_FRAME_LISTEN,
+    RELAY_TAG_FRAME_CONNECTION,
+    RELAY_TAG_BUNDLE,
+    RELAY_TAG_BUNDLE_TIMER,
+    RELAY_TAG_HID_TIMER,
+    RELAY_TAG_RADIO_TIMER,
+    RELAY_TAG_WATCHDOG_TIMER,
+    RELAY_TAG_METRICS_LISTEN,
+
+    // Followed by one tag for each of METRICS_MAX_CONNECTIONS
+    RELAY_TAG_METRICS_CONNECTION,
+
+    // Followed by RELAY_SLOT_TAG_COUNT tags for each slot
+    RELAY_TAG_SLOTS = RELAY_TAG_METRICS_CONNECTION + METRICS_MAX_CONNECTIONS
+};
+
+enum RelaySlotTag
+{
+    RELAY_SLOT_TAG_CONTROL,
+    RELAY_SLOT_TAG_RADIO,
+    RELAY_SLOT_TAG_CONSOLE,
+    RELAY_SLOT_TAG_FRONTEND = RELAY_SLOT_TAG_CONSOLE + RELAY_PORT_COUNT,
+    RELAY_SLOT_TAG_COUNT = RELAY_SLOT_TAG_FRONTEND + RELAY_PORT_COUNT
+};
+
+static const char *step_names[VANILLA_RECOVERY_STEP_COUNT] = {"idr", "rebind", "reassociate"};
+
+typedef struct {
+    uint64_t datagrams;
+    uint64_t bytes;
+    uint64_t dropped;
+    uint64_t recv_calls;
+    uint64_t send_calls;
+} relay_stats;
+
+typedef struct relay_slot relay_slot;
+
+typedef struct {
+    relay_slot *slot;
+
+    in_port_t port;
+
+    // Bound to `port`, receives from and sends to the console
+    int console_socket;
+
+    // Bound to `port + 100` plus the slot's offset, receives from and sends to the frontend
+    int frontend_socket;
+
+    struct sockaddr_in console_address;
+    struct sockaddr_in frontend_address;
+
+    // Shared memory channel for local frontends, or -1 if this port is always sent over UDP
+    int ring_channel;
+
+    // Type of frame this port is reassembled into for frontends that asked for frames, or 0
+    int frame_type;
+
+    // Whether spectators receive this port too
+    int fan_out;
+
+    // Record type for this port's datagrams in a bundle, or 0 if it's never bundled
+    int bundle_type;
+
+    // io_uring forwards this port's console datagrams, so the relay never sees them
+    int on_uring;
+
+    relay_stats to_frontend;
+    relay_stats to_console;
+
+    // to_frontend.bytes when the watchdog last saw it change, and when that was
+    uint64_t watched_bytes;
+    uint64_t progress_us;
+} relay_port;
+
+typedef struct {
+    struct in_addr address;
+
+    // Connected to the spectator from the fanned out ports, so each socket's send queue only ever
+    // holds this spectator's backlog. -1 for ports that aren't fanned out.
+    int sockets[RELAY_PORT_COUNT];
+
+    uint32_t failures;
+    relay_stats stats;
+} relay_spectator;
+
+// One console on one wireless interface, and the frontends using it
+struct relay_slot {
+    int index;
+    const char *interface;
+    int bind_to_interface;
+
+    // Added to every port the frontend sees
+    in_port_t port_offset;
+
+    relay_port ports[RELAY_PORT_COUNT];
+    int opened_ports;
+    int control_socket;
+
+    struct in_addr client_address;
+
+    // Flags accepted for the current player, and how many times a player has bound
+    uint32_t client_flags;
+    uint64_t binds;
+
+    relay_spectator spectators[RELAY_MAX_SPECTATORS];
+    int spectator_count;
+
+    // Parity for the video port, only while the frontend has asked for it
+    int video_fec_group;
+    fec_encoder video_fec;
+    uint64_t fec_parity_sent;
+
+    // Link quality of the interface along with the relay counters at the same moment, in host order
+    radio_link radio;
+    vanilla_pipe_link_stats link_stats;
+
+    // The low-latency profile turned power save off, and it goes back on when the slot closes
+    int restore_power_save;
+
+    // Stalls of the ports the console sends on, and when the watchdog last had the slot reassociate
+    escalation watchdog;
+    uint64_t last_reassociate_us;
+};
+
+relay_options relay_config = {
+    .cpu = -1,
+    .stall_threshold_ms = {RELAY_DEFAULT_VIDEO_STALL_MS, RELAY_DEFAULT_AUDIO_STALL_MS}
+};
+
+static relay_slot relay_slots[VANILLA_PIPE_MAX_SLOTS];
+static int relay_slot_count = 0;
+static int quit_fd = -1;
+static int epoll_fd = -1;
+static int frame_listener = -1;
+static int bundle_socket = -1;
+static int hid_timer = -1;
+static int radio_timer = -1;
+static int watchdog_timer = -1;
+static uint64_t last_watchdog_us = 0;
+static int metrics_listener = -1;
+
+// What the low-latency profile managed to set on the last socket opened, they're all treated the same
+static socket_tuning relay_socket_tuning;
+
+// Shared by every forwarding function, the relay only ever runs on one thread
+static unsigned char batch_buffers[RELAY_MAX_READS_PER_WAKE][RELAY_PACKET_SIZE];
+static struct iovec batch_iov[RELAY_MAX_READS_PER_WAKE];
+static struct mmsghdr batch_msgs[RELAY_MAX_READS_PER_WAKE];
+static struct sockaddr_in batch_sources[RELAY_MAX_READS_PER_WAKE];
+
+// Spectators are sent the same received batch, one sendmmsg each
+static struct mmsghdr fan_out_msgs[RELAY_MAX_READS_PER_WAKE];
+
+// Every datagram in a batch plus at most one parity datagram each (a group can be a single datagram)
+static fec_header fec_headers[RELAY_MAX_READS_PER_WAKE * 2];
+static unsigned char fec_parity[RELAY_MAX_READS_PER_WAKE][FEC_MAX_PAYLOAD];
+static struct iovec fec_iov[RELAY_MAX_READS_PER_WAKE * 2][2];
+static struct mmsghdr fec_msgs[RELAY_MAX_READS_PER_WAKE * 2];
+
+static uint64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int relay_find_port(const char *name)
+{
+    for (int i = 0; i < RELAY_PORT_COUNT; i++) {
+        if (!strcmp(port_names[i], name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// With `device`, only datagrams arriving on that interface are received, so each slot can bind the
+// same console-facing ports
+// With `reuse_port`, spectators' sockets can share the port (see open_spectator_socket())
+int open_socket(in_port_t port, const char *device, int reuse_port)
+{
+    struct sockaddr_in in = {0};
+    in.sin_family = AF_INET;
+    in.sin_addr.s_addr = INADDR_ANY;
+    in.sin_port = htons(port);
+
+    int skt = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (skt == -1) {
+        return -1;
+    }
+
+    if (device && setsockopt(skt, SOL_SOCKET, SO_BINDTODEVICE, device, strlen(device)) == -1) {
+        print_info("FAILED TO BIND PORT %u TO %s: %i", port, device, errno);
+        close(skt);
+        return -1;
+    }
+
+    int one = 1;
+    if (reuse_port && setsockopt(skt, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1) {
+        print_info("FAILED TO SHARE PORT %u: %i", port, errno);
+    }
+
+    if (bind(skt, (const struct sockaddr *) &in, sizeof(in)) == -1) {
+        print_info("FAILED TO BIND PORT %u: %i", port, errno);
+        close(skt);
+        return -1;
+    }
+
+    if (relay_config.low_latency) {
+        tune_socket(skt, &relay_socket_tuning);
+    }
+
+    return skt;
+}
+
+int add_to_epoll(int fd, uint32_t tag)
+{
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.u32 = tag;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+uint32_t slot_tag(const relay_slot *s, uint32_t tag)
+{
+    return RELAY_TAG_SLOTS + s->index * RELAY_SLOT_TAG_COUNT + tag;
+}
+
+// Shared memory, frames, bundles, input deltas, io_uring and nftables each keep the state of a
+// single frontend, so only the first slot offers them
+int is_primary_slot(const relay_slot *s)
+{
+    return s == &relay_slots[0];
+}
+
+// Whether console datagrams on any of the slot's ports skip the relay thread
+int slot_is_on_uring(const relay_slot *s)
+{
+    for (int i = 0; i < RELAY_PORT_COUNT; i++) {
+        if (s->ports[i].on_uring) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int can_use_nat(const relay_slot *s)
+{
+    // nftables would take these packets away before they could be put in the shared rings, framed,
+    // given parity, copied to spectators, bundled or turned into HID packets
+    return is_primary_slot(s) && !shm_ring_is_prepared() && !framer_is_prepared() && s->video_fec_group == 0
+           && s->spectator_count == 0 && !bundler_is_active() && !hidgen_is_active();
+}
+
+// Install or remove the nftables rules to match the slot's frontend and what it asked for
+void update_nat(relay_slot *s)
+{
+    if (!relay_config.use_nftables || !is_primary_slot(s)) {
+        return;
+    }
+
+    if (s->client_address.s_addr == 0 || !can_use_nat(s)) {
+        nat_remove();
+    } else if (!nat_is_installed() && nat_install(s->interface, s->client_address) != VANILLA_SUCCESS) {
+        print_info("FALLING BACK TO USERSPACE RELAY");
+    }
+}
+
+void set_client_address(relay_slot *s, struct in_addr addr)
+{
+    if (addr.s_addr == s->client_address.s_addr) {
+        return;
+    }
+
+    if (addr.s_addr != 0) {
+        print_info(s->client_address.s_addr ? "RESTARTED RELAYS ON %s" : "STARTED RELAYS ON %s", s->interface);
+    } else {
+        print_info("STOPPED RELAYS ON %s", s->interface);
+    }
+
+    s->client_address = addr;
+    for (int i = 0; i < RELAY_PORT_COUNT; i++) {
+        s->ports[i].frontend_address.sin_addr = addr;
+    }
+
+    // Rules for the previous frontend would send it the console's datagrams
+    if (relay_config.use_nftables && is_primary_slot(s)) {
+        nat_remove();
+    }
+    update_nat(s);
+}
+
+void request_idr_from_console(relay_slot *s)
+{
+    static const unsigned char idr_request[] = {1, 0, 0, 0}; // Undocumented
+    relay_port *msg = &s->ports[RELAY_PORT_MSG];
+    sendto(msg->console_socket, idr_request, sizeof(idr_request), 0, (const struct sockaddr *) &msg->console_address, sizeof(msg->console_address));
+}
+
+// Returns 0 if the slot can't reassociate, or did too recently to try again
+int reassociate_slot(relay_slot *s)
+{
+    if (!relay_config.reassociate) {
+        print_info("CAN'T REASSOCIATE ON %s", s->interface);
+        return 0;
+    }
+
+    uint64_t now = now_us();
+    if (s->last_reassociate_us && now - s->last_reassociate_us < ESCALATION_REASSOCIATE_INTERVAL_US) {
+        return 0;
+    }
+    s->last_reassociate_us = now;
+
+    relay_config.reassociate(s->index);
+    return 1;
+}
+
+int find_spectator(const relay_slot *s, struct in_addr addr)
+{
+    for (int i = 0; i < s->spectator_count; i++) {
+        if (s->spectators[i].address.s_addr == addr.s_addr) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Spectators connect to the same port as the player, so their datagrams have to come from it too.
+// A connected socket sharing the port is only handed what the spectator sends to it, the player's
+// datagrams still go to the frontend socket. Spectators may only ask for IDRs on the message port,
+// so anything that does arrive here would have been dropped anyway.
+int open_spectator_socket(const relay_port *p, struct in_addr addr)
+{
+    int skt = open_socket(ntohs(p->frontend_address.sin_port) - 100, NULL, 1);
+    if (skt == -1) {
+        return -1;
+    }
+
+    int rcvbuf = 0;
+    setsockopt(skt, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    struct sockaddr_in to_address = p->frontend_address;
+    to_address.sin_addr = addr;
+    if (connect(skt, (const struct sockaddr *) &to_address, sizeof(to_address)) == -1) {
+        print_info("FAILED TO CONNECT TO SPECTATOR %s: %i", inet_ntoa(addr), errno);
+        close(skt);
+        return -1;
+    }
+
+    return skt;
+}
+
+void close_spectator_sockets(relay_spectator *spectator)
+{
+    for (int i = 0; i < RELAY_PORT_COUNT; i++) {
+        if (spectator->sockets[i] != -1) {
+            close(spectator->sockets[i]);
+            spectator->sockets[i] = -1;
+        }
+    }
+}
+
+int add_spectator(relay_slot *s, struct in_addr addr)
+{
+    if (find_spectator(s, addr) != -1) {
+        return 1;
+    }
+
+    if (slot_is_on_uring(s)) {
+        // Console datagrams never reach the relay thread to be copied
+        print_info("SPECTATORS ARE NOT SUPPORTED WITH IO_URING");
+        return 0;
+    }
+
+    if (s->spectator_count == RELAY_MAX_SPECTATORS) {
+        print_info("TOO MANY SPECTATORS, IGNORING %s", inet_ntoa(addr));
+        return 0;
+    }
+
+    relay_spectator *spectator = &s->spectators[s->spectator_count];
+    memset(spectator, 0, sizeof(*spectator));
+    spectator->address = addr;
+    for (int i = 0; i < RELAY_PORT_COUNT; i++) {
+        spectator->sockets[i] = -1;
+        if (s->ports[i].fan_out && (spectator->sockets[i] = open_spectator_socket(&s->ports[i], addr)) == -1) {
+            close_spectator_sockets(spectator);
+            return 0;
+        }
+    }
+    s->spectator_count++;
+
+    // Spectators need every datagram to come through here
+    update_nat(s);
+
+    print_info("SPECTATOR %s JOINED (%i WATCHING)", inet_ntoa(addr), s->spectator_count);
+
+    // Nothing can be decoded until the next IDR, don't make them wait for one
+    request_idr_from_console(s);
+    return 1;
+}
+
+void remove_spectator(relay_slot *s, int index, const char *reason)
+{
+    relay_spectator *spectator = &s->spectators[index];
+    print_info("SPECTATOR %s %s: %llu DATAGRAMS (%llu BYTES, %llu DROPPED) IN %llu SEND CALLS",
+               inet_ntoa(spectator->address), reason,
+               (unsigned long long) spectator->stats.datagrams, (unsigned long long) spectator->stats.bytes,
+               (unsigned long long) spectator->stats.dropped, (unsigned long long) spectator->stats.send_calls);
+
+    close_spectator_sockets(spectator);
+    s->spectators[index] = s->spectators[s->spectator_count - 1];
+    s->spectator_count--;
+
+    update_nat(s);
+}
+
+void unbind_client(relay_slot *s)
+{
+    if (is_primary_slot(s)) {
+        shm_ring_destroy();
+        framer_close();
+        bundler_close();
+        hidgen_stop();
+    }
+    s->video_fec_group = 0;
+    s->client_flags = 0;
+    set_client_address(s, (struct in_addr) {0});
+}
+
+void log_link_sample(const relay_slot *s, const vanilla_pipe_link_stats *last, const vanilla_pipe_link_stats *now)
+{
+    char line[512] = "";
+    int len = 0;
+
+#define APPEND(...) \
+    if (len < (int) sizeof(line)) { \
+        len += snprintf(line + len, sizeof(line) - len, __VA_ARGS__); \
+    }
+
+    if (now->valid & VANILLA_PIPE_LINK_SIGNAL) {
+        APPEND(", SIGNAL %i DBM", now->signal_dbm);
+    }
+    if (now->valid & VANILLA_PIPE_LINK_TX_BITRATE) {
+        APPEND(", TX %u.%u MBIT/S", now->tx_bitrate / 10, now->tx_bitrate % 10);
+    }
+    if (now->valid & VANILLA_PIPE_LINK_TX_MCS) {
+        APPEND(" MCS %i", now->tx_mcs);
+    }
+    if (now->valid & VANILLA_PIPE_LINK_RX_BITRATE) {
+        APPEND(", RX %u.%u MBIT/S", now->rx_bitrate / 10, now->rx_bitrate % 10);
+    }
+    if (now->valid & VANILLA_PIPE_LINK_RX_MCS) {
+        APPEND(" MCS %i", now->rx_mcs);
+    }
+    if (now->valid & last->valid & VANILLA_PIPE_LINK_RETRIES) {
+        APPEND(", %u RETRIES", now->tx_retries - last->tx_retries);
+    }
+    if (now->valid & last->valid & VANILLA_PIPE_LINK_FAILED) {
+        APPEND(", %u FAILED", now->tx_failed - last->tx_failed);
+    }
+    if (now->valid & last->valid & VANILLA_PIPE_LINK_BEACON_LOSS) {
+        APPEND(", %u BEACONS LOST", now->beacon_loss - last->beacon_loss);
+    }
+    if ((now->valid & last->valid & VANILLA_PIPE_LINK_CHANNEL_BUSY) && now->channel_time_ms != last->channel_time_ms) {
+        APPEND(", CHANNEL %u%% BUSY", 100 * (now->channel_busy_ms - last->channel_busy_ms) / (now->channel_time_ms - last->channel_time_ms));
+    }
+
+#undef APPEND
+
+    // Counters are for the last interval, so a burst of drops lines up with what the radio was doing
+    print_info("LINK ON %s: %u VIDEO DATAGRAMS, %u IN TOTAL, %u DROPPED%s", s->interface,
+               now->video_datagrams - last->video_datagrams, now->console_datagrams - last->console_datagrams,
+               now->dropped - last->dropped, line);
+}
+
+void record_link_sample(relay_slot *s)
+{
+    const radio_link_stats *r = &s->radio.stats;
+    vanilla_pipe_link_stats now = {0};
+    now.control_code = VANILLA_PIPE_CC_LINK_STATS;
+    now.valid = r->valid;
+    now.sample = s->radio.samples;
+    now.signal_dbm = r->signal_dbm;
+    now.tx_bitrate = r->tx_bitrate;
+    now.rx_bitrate = r->rx_bitrate;
+    now.tx_mcs = r->tx_mcs;
+    now.rx_mcs = r->rx_mcs;
+    now.tx_retries = r->tx_retries;
+    now.tx_failed = r->tx_failed;
+    now.beacon_loss = r->beacon_loss;
+    now.channel_time_ms = (uint32_t) r->channel_time_ms;
+    now.channel_busy_ms = (uint32_t) r->channel_busy_ms;
+
+    // What nftables forwarded never reached the relay, so its counters are added on top
+    nat_stats nat = {0};
+    if (relay_config.use_nftables && is_primary_slot(s)) {
+        nat_get_stats(&nat);
+    }
+
+    now.video_datagrams = (uint32_t) (s->ports[0].to_frontend.datagrams + nat.to_frontend[0].packets);
+    for (int i = 0; i < RELAY_PORT_COUNT; i++) {
+        const relay_port *p = &s->ports[i];
+        now.console_datagrams += (uint32_t) (p->to_frontend.datagrams + nat.to_frontend[i].packets);
+        now.dropped += (uint32_t) (p->to_frontend.dropped + p->to_console.dropped);
+    }
+
+    if (relay_config.log_link_stats && s->link_stats.sample) {
+        log_link_sample(s, &s->link_stats, &now);
+    }
+
+    s->link_stats = now;
+}
+
+void send_link_stats(const relay_slot *s, const struct sockaddr_in *to)
+{
+    const vanilla_pipe_link_stats *l = &s->link_stats;
+    vanilla_pipe_link_stats reply;
+    reply.control_code = htonl(VANILLA_PIPE_CC_LINK_STATS);
+    reply.valid = htonl(l->valid);
+    reply.sample = htonl(l->sample);
+    reply.signal_dbm = htonl(l->signal_dbm);
+    reply.tx_bitrate = htonl(l->tx_bitrate);
+    reply.rx_bitrate = htonl(l->rx_bitrate);
+    reply.tx_mcs = htonl(l->tx_mcs);
+    reply.rx_mcs = htonl(l->rx_mcs);
+    reply.tx_retries = htonl(l->tx_retries);
+    reply.tx_failed = htonl(l->tx_failed);
+    reply.beacon_loss = htonl(l->beacon_loss);
+    reply.channel_time_ms = htonl(l->channel_time_ms);
+    reply.channel_busy_ms = htonl(l->channel_busy_ms);
+    reply.video_datagrams = htonl(l->video_datagrams);
+    reply.console_datagrams = htonl(l->console_datagrams);
+    reply.dropped = htonl(l->dropped);
+    sendto(s->control_socket, &reply, sizeof(reply), 0, (const struct sockaddr *) to, sizeof(*to));
+}
+
+void read_client_control(relay_slot *s)
+{
+    int skt = s->control_socket;
+    uint32_t control[2];
+    struct sockaddr_in addr;
+    socklen_t addr_size;
+
+    while (1) {
+        addr_size = sizeof(addr);
+        ssize_t r = recvfrom(skt, control, sizeof(control), 0, (struct sockaddr *) &addr, &addr_size);
+        if (r < 0) {
+            break;
+        }
+        if (r != sizeof(uint32_t) && r != sizeof(control)) {
+            continue;
+        }
+
+        uint32_t control_code = ntohl(control[0]);
+        uint32_t flags = (r == sizeof(control)) ? ntohl(control[1]) : 0;
+        switch (control_code) {
+        case VANILLA_PIPE_CC_BIND:
+        {
+            if (flags & VANILLA_PIPE_BIND_FLAG_SPECTATOR) {
+                print_info("RECEIVED SPECTATOR BIND SIGNAL");
+
+                // A player that wants to watch instead gives up its controls
+                if (addr.sin_addr.s_addr == s->client_address.s_addr) {
+                    unbind_client(s);
+                }
+
+                uint32_t accepted = add_spectator(s, addr.sin_addr) ? VANILLA_PIPE_BIND_FLAG_SPECTATOR : 0;
+
+                // Pipes without spectators reply without flags, and the frontend takes that to
+                // mean it's the player
+                control[0] = htonl(VANILLA_PIPE_CC_BIND_ACK);
+                control[1] = htonl(accepted);
+                sendto(skt, control, sizeof(control), 0, (struct sockaddr *) &addr, sizeof(addr));
+                break;
+            }
+
+            print_info("RECEIVED BIND SIGNAL");
+
+            int spectator = find_spectator(s, addr.sin_addr);
+            if (spectator != -1) {
+                remove_spectator(s, spectator, "IS NOW PLAYING");
+            }
+
+            // Console datagrams on io_uring go straight to the frontend, so there's nothing to put
+            // in rings, frames, parity or bundles
+            const uint32_t relayed_flags = VANILLA_PIPE_BIND_FLAG_SHM | VANILLA_PIPE_BIND_FLAG_FRAMES
+                                         | VANILLA_PIPE_BIND_FLAG_FEC | VANILLA_PIPE_BIND_FLAG_BUNDLE;
+            if ((flags & relayed_flags) && slot_is_on_uring(s)) {
+                print_info("SHARED MEMORY, FRAMES, PARITY AND BUNDLES ARE NOT SUPPORTED WITH IO_URING");
+                flags &= ~relayed_flags;
+            }
+
+            // Any previous rings belonged to the last bind, the frontend will connect again if it wants them
+            int primary = is_primary_slot(s);
+            if (primary) {
+                shm_ring_destroy();
+                framer_close();
+                bundler_close();
+                hidgen_stop();
+            }
+            // A frontend rebinding with the same parity group keeps its place in the sequence, so
+            // its decoder doesn't have to start over
+            int fec_group = s->video_fec_group;
+            int same_client = (addr.sin_addr.s_addr == s->client_address.s_addr);
+            s->video_fec_group = 0;
+
+            uint32_t accepted = 0;
+            if (primary && (flags & VANILLA_PIPE_BIND_FLAG_SHM) && shm_ring_prepare() == VANILLA_SUCCESS) {
+                accepted |= VANILLA_PIPE_BIND_FLAG_SHM;
+            } else if (primary && (flags & VANILLA_PIPE_BIND_FLAG_FRAMES) && frame_listener != -1) {
+                framer_prepare(addr.sin_addr);
+                accepted |= VANILLA_PIPE_BIND_FLAG_FRAMES;
+            } else if (flags & VANILLA_PIPE_BIND_FLAG_FEC) {
+                s->video_fec_group = (flags & VANILLA_PIPE_BIND_FEC_GROUP_MASK) >> VANILLA_PIPE_BIND_FEC_GROUP_SHIFT;
+                if (s->video_fec_group > 0) {
+                    if (!same_client || s->video_fec_group != fec_group) {
+                        fec_encoder_init(&s->video_fec, s->video_fec_group);
+                        print_info("SENDING ONE PARITY DATAGRAM PER %i VIDEO DATAGRAMS", s->video_fec.group_size);
+                    }
+                    accepted |= VANILLA_PIPE_BIND_FLAG_FEC;
+                }
+            }
+
+            // Shared memory already costs nothing per datagram
+            if (primary && (flags & VANILLA_PIPE_BIND_FLAG_BUNDLE) && bundle_socket != -1 && !(accepted & VANILLA_PIPE_BIND_FLAG_SHM)) {
+                int window = ((flags & VANILLA_PIPE_BIND_BUNDLE_WINDOW_MASK) >> VANILLA_PIPE_BIND_BUNDLE_WINDOW_SHIFT) * VANILLA_PIPE_BUNDLE_WINDOW_UNIT_US;
+                bundler_prepare(addr.sin_addr, window);
+                accepted |= VANILLA_PIPE_BIND_FLAG_BUNDLE;
+            }
+
+            if (primary && (flags & VANILLA_PIPE_BIND_FLAG_INPUT_DELTAS) && hid_timer != -1) {
+                hidgen_start();
+                accepted |= VANILLA_PIPE_BIND_FLAG_INPUT_DELTAS;
+            }
+
+            // The address may not have changed, but what nftables would get in the way of can have
+            set_client_address(s, addr.sin_addr);
+            update_nat(s);
+            s->client_flags = accepted;
+            s->binds++;
+
+            control[0] = htonl(VANILLA_PIPE_CC_BIND_ACK);
+            control[1] = htonl(accepted);
+            sendto(skt, control, accepted ? sizeof(control) : sizeof(uint32_t), 0, (struct sockaddr *) &addr, sizeof(addr));
+            break;
+        }
+        case VANILLA_PIPE_CC_UNBIND:
+        {
+            int spectator = find_spectator(s, addr.sin_addr);
+            if (spectator != -1) {
+                remove_spectator(s, spectator, "LEFT");
+                break;
+            }
+
+            print_info("RECEIVED UNBIND SIGNAL");
+            unbind_client(s);
+            break;
+        }
+        case VANILLA_PIPE_CC_LINK_STATS:
+            send_link_stats(s, &addr);
+            break;
+        case VANILLA_PIPE_CC_REASSOCIATE:
+            // Spectators only watch, it's up to the player whether the link is worth interrupting
+            if (s->client_address.s_addr != 0 && addr.sin_addr.s_addr == s->client_address.s_addr && reassociate_slot(s)) {
+                print_info("FRONTEND ASKED TO REASSOCIATE ON %s", s->interface);
+            }
+            break;
+        }
+    }
+}
+
+void prepare_batch()
+{
+    for (int i = 0; i < RELAY_MAX_READS_PER_WAKE; i++) {
+        batch_iov[i].iov_base = batch_buffers[i];
+        batch_iov[i].iov_len = RELAY_PACKET_SIZE;
+        memset(&batch_msgs[i].msg_hdr, 0, sizeof(batch_msgs[i].msg_hdr));
+        batch_msgs[i].msg_hdr.msg_iov = &batch_iov[i];
+        batch_msgs[i].msg_hdr.msg_iovlen = 1;
+        batch_msgs[i].msg_hdr.msg_name = &batch_sources[i];
+        batch_msgs[i].msg_hdr.msg_namelen = sizeof(batch_sources[i]);
+    }
+}
+
+// Read up to a batch of datagrams, each batch_iov is left sized to what was received
+int receive_batch(int from_socket, relay_stats *stats)
+{
+    prepare_batch();
+
+    int received = recvmmsg(from_socket, batch_msgs, RELAY_MAX_READS_PER_WAKE, MSG_DONTWAIT, NULL);
+    if (received <= 0) {
+        return 0;
+    }
+    stats->recv_calls++;
+
+    for (int i = 0; i < received; i++) {
+        batch_iov[i].iov_len = batch_msgs[i].msg_len;
+        stats->bytes += batch_msgs[i].msg_len;
+    }
+
+    return received;
+}
+
+// Send the received batch to every spectator
+void fan_out(relay_port *p, int received)
+{
+    relay_slot *slot = p->slot;
+    if (!p->fan_out || slot->spectator_count == 0) {
+        return;
+    }
+
+    for (int i = 0; i < received; i++) {
+        memset(&fan_out_msgs[i].msg_hdr, 0, sizeof(fan_out_msgs[i].msg_hdr));
+        fan_out_msgs[i].msg_hdr.msg_iov = &batch_iov[i];
+        fan_out_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    // Walk backwards so dropping a spectator doesn't skip the next one
+    int index = p - slot->ports;
+    for (int s = slot->spectator_count - 1; s >= 0; s--) {
+        relay_spectator *spectator = &slot->spectators[s];
+        int skt = spectator->sockets[index];
+
+        int sent = 0;
+        while (sent < received) {
+            int r = sendmmsg(skt, fan_out_msgs + sent, received - sent, 0);
+            spectator->stats.send_calls++;
+            if (r < 0 && errno == EINTR) {
+                continue;
+            }
+            if (r <= 0) {
+                break;
+            }
+            for (int i = sent; i < sent + r; i++) {
+                spectator->stats.bytes += batch_msgs[i].msg_len;
+            }
+            sent += r;
+        }
+        spectator->stats.datagrams += sent;
+
+        // Only this spectator's datagrams are queued on its socket, so however the player and the
+        // other spectators are doing, this says whether it's keeping up
+        int backlog = 0;
+        if (sent == received && ioctl(skt, SIOCOUTQ, &backlog) == 0 && backlog < RELAY_SPECTATOR_MAX_BACKLOG) {
+            spectator->failures = 0;
+            continue;
+        }
+
+        // Don't retry, the player and the other spectators shouldn't wait on this one
+        spectator->stats.dropped += received - sent;
+        spectator->failures++;
+        if (spectator->failures >= RELAY_SPECTATOR_MAX_FAILURES) {
+            remove_spectator(slot, s, "DROPPED FOR FALLING BEHIND");
+        }
+    }
+}
+
+void send_batch(int to_socket, struct mmsghdr *msgs, int count, relay_stats *stats)
+{
+    int sent = 0;
+    while (sent < count) {
+        int r = sendmmsg(to_socket, msgs + sent, count - sent, 0);
+        stats->send_calls++;
+        if (r <= 0) {
+            if (r < 0 && errno == EINTR) {
+                continue;
+            }
+
+            // Skip the datagram that failed and carry on with the rest
+            stats->dropped++;
+            sent++;
+            continue;
+        }
+        sent += r;
+        stats->datagrams += r;
+    }
+}
+
+void forward_to_frontend(relay_port *p)
+{
+    int received = receive_batch(p->console_socket, &p->to_frontend);
+    if (received == 0) {
+        return;
+    }
+
+    // Without a client there's nowhere to send to, drain the socket so stale packets
+    // don't get delivered to the next client
+    if (p->slot->client_address.s_addr == 0) {
+        fan_out(p, received);
+        p->to_frontend.dropped += received;
+        return;
+    }
+
+    // Send everything to the same pre-resolved destination
+    for (int i = 0; i < received; i++) {
+        batch_msgs[i].msg_hdr.msg_name = &p->frontend_address;
+        batch_msgs[i].msg_hdr.msg_namelen = sizeof(p->frontend_address);
+    }
+
+    // The player goes first so spectators can't fill the socket buffer ahead of it
+    send_batch(p->frontend_socket, batch_msgs, received, &p->to_frontend);
+    fan_out(p, received);
+}
+
+int is_idr_request(const relay_port *p, int index)
+{
+    static const unsigned char idr_request[] = {1, 0, 0, 0};
+    return p == &p->slot->ports[RELAY_PORT_MSG]
+           && batch_msgs[index].msg_len == sizeof(idr_request)
+           && memcmp(batch_buffers[index], idr_request, sizeof(idr_request)) == 0;
+}
+
+void forward_to_console(relay_port *p)
+{
+    int received = receive_batch(p->frontend_socket, &p->to_console);
+    if (received == 0) {
+        return;
+    }
+
+    // Only the player gets to control the console, spectators may only ask for IDRs
+    struct in_addr client_address = p->slot->client_address;
+    int kept = 0;
+    for (int i = 0; i < received; i++) {
+        struct in_addr source = batch_sources[i].sin_addr;
+        int allowed = (client_address.s_addr != 0 && source.s_addr == client_address.s_addr)
+                      || (find_spectator(p->slot, source) != -1 && is_idr_request(p, i));
+        if (!allowed) {
+            p->to_console.dropped++;
+            continue;
+        }
+
+        // Input deltas only update our state, the HID timer sends the packets
+        if (p == &relay_slots[0].ports[RELAY_PORT_HID] && hidgen_is_active() && hidgen_apply(batch_buffers[i], batch_msgs[i].msg_len)) {
+            continue;
+        }
+
+        batch_msgs[kept] = batch_msgs[i];
+        batch_msgs[kept].msg_hdr.msg_name = &p->console_address;
+        batch_msgs[kept].msg_hdr.msg_namelen = sizeof(p->console_address);
+        kept++;
+    }
+
+    send_batch(p->console_socket, batch_msgs, kept, &p->to_console);
+}
+
+void forward_to_bundle(relay_port *p)
+{
+    int received = receive_batch(p->console_socket, &p->to_frontend);
+    if (received == 0) {
+        return;
+    }
+
+    fan_out(p, received);
+
+    for (int i = 0; i < received; i++) {
+        bundler_add(p->bundle_type, batch_buffers[i], batch_msgs[i].msg_len);
+    }
+    p->to_frontend.datagrams += received;
+
+    bundler_end_batch();
+}
+
+void deliver_from_bundle(uint8_t type, const uint8_t *data, size_t size)
+{
+    // Bundles only ever come from the first slot's frontend
+    for (int i = 0; i < RELAY_PORT_COUNT; i++) {
+        relay_port *p = &relay_slots[0].ports[i];
+        if (p->bundle_type == type) {
+            if (i == RELAY_PORT_HID && hidgen_is_active() && hidgen_apply(data, size)) {
+                return;
+            }
+
+            p->to_console.bytes += size;
+            if (sendto(p->console_socket, data, size, 0, (const struct sockaddr *) &p->console_address, sizeof(p->console_address)) == -1) {
+                p->to_console.dropped++;
+            } else {
+                p->to_console.datagrams++;
+            }
+            p->to_console.send_calls++;
+            return;
+        }
+    }
+}
+
+void send_built_input()
+{
+    uint8_t packet[INPUT_PACKET_SIZE];
+    if (!hidgen_tick(packet)) {
+        return;
+    }
+
+    relay_port *p = &relay_slots[0].ports[RELAY_PORT_HID];
+    if (sendto(p->console_socket, packet, sizeof(packet), 0, (const struct sockaddr *) &p->console_address, sizeof(p->console_address)) == -1) {
+        p->to_console.dropped++;
+    } else {
+        p->to_console.datagrams++;
+        p->to_console.bytes += sizeof(packet);
+    }
+    p->to_console.send_calls++;
+}
+
+void add_fec_message(int index, const fec_header *header, void *payload, size_t payload_size, const struct sockaddr_in *to_address)
+{
+    fec_iov[index][0].iov_base = (void *) header;
+    fec_iov[index][0].iov_len = sizeof(*header);
+    fec_iov[index][1].iov_base = payload;
+    fec_iov[index][1].iov_len = payload_size;
+
+    memset(&fec_msgs[index].msg_hdr, 0, sizeof(fec_msgs[index].msg_hdr));
+    fec_msgs[index].msg_hdr.msg_iov = fec_iov[index];
+    fec_msgs[index].msg_hdr.msg_iovlen = 2;
+    fec_msgs[index].msg_hdr.msg_name = (void *) to_address;
+    fec_msgs[index].msg_hdr.msg_namelen = sizeof(*to_address);
+}
+
+void forward_with_fec(relay_port *p)
+{
+    int received = receive_batch(p->console_socket, &p->to_frontend);
+    if (received == 0) {
+        return;
+    }
+
+    relay_slot *s = p->slot;
+    if (s->client_address.s_addr == 0) {
+        fan_out(p, received);
+        p->to_frontend.dropped += received;
+        return;
+    }
+
+    const struct sockaddr_in *to_address = &p->frontend_address;
+    int count = 0;
+    int parity_count = 0;
+    for (int i = 0; i < received; i++) {
+        fec_encode_data(&s->video_fec, batch_buffers[i], batch_msgs[i].msg_len, &fec_headers[count]);
+        add_fec_message(count, &fec_headers[count], batch_buffers[i], batch_msgs[i].msg_len, to_address);
+        count++;
+
+        // Close the group when it's full, or at the end of a frame so a loss in its last few
+        // datagrams doesn't have to wait for the next frame to be recovered
+        int frame_end = video_packet_is_frame_end(batch_buffers[i], batch_msgs[i].msg_len);
+        size_t parity_size;
+        if (fec_encode_parity(&s->video_fec, frame_end, &fec_headers[count], fec_parity[parity_count], &parity_size)) {
+            add_fec_message(count, &fec_headers[count], fec_parity[parity_count], parity_size, to_address);
+            count++;
+            parity_count++;
+        }
+    }
+
+    s->fec_parity_sent += parity_count;
+    send_batch(p->frontend_socket, fec_msgs, count, &p->to_frontend);
+
+    // Spectators get the datagrams as they came from the console
+    fan_out(p, received);
+}
+
+void forward_to_ring(relay_port *p, vanilla_ring *ring)
+{
+    relay_stats *stats = &p->to_frontend;
+    uint32_t space = vanilla_ring_free(ring);
+    if (space == 0) {
+        // Frontend isn't keeping up, drop rather than stall the other ports (spectators still get them)
+        int received = receive_batch(p->console_socket, stats);
+        fan_out(p, received);
+        stats->dropped += received;
+        __atomic_add_fetch(&ring->dropped, (uint32_t) received, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // Receive straight into the ring's slots
+    int count = space < RELAY_MAX_READS_PER_WAKE ? space : RELAY_MAX_READS_PER_WAKE;
+    for (int i = 0; i < count; i++) {
+        vanilla_ring_slot *slot = vanilla_ring_slot_at(ring, ring->head + i);
+        batch_iov[i].iov_base = slot->data;
+        batch_iov[i].iov_len = sizeof(slot->data);
+        memset(&batch_msgs[i].msg_hdr, 0, sizeof(batch_msgs[i].msg_hdr));
+        batch_msgs[i].msg_hdr.msg_iov = &batch_iov[i];
+        batch_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int received = recvmmsg(p->console_socket, batch_msgs, count, MSG_DONTWAIT, NULL);
+    if (received <= 0) {
+        return;
+    }
+    stats->recv_calls++;
+
+    for (int i = 0; i < received; i++) {
+        vanilla_ring_slot_at(ring, ring->head + i)->size = batch_msgs[i].msg_len;
+        batch_iov[i].iov_len = batch_msgs[i].msg_len;
+        stats->bytes += batch_msgs[i].msg_len;
+    }
+    stats->datagrams += received;
+
+    // The slots aren't the frontend's until they're published
+    fan_out(p, received);
+
+    if (vanilla_ring_publish(ring, received)) {
+        shm_ring_notify(p->ring_channel);
+        stats->send_calls++;
+    }
+}
+
+void forward_to_framer(relay_port *p)
+{
+    int received = receive_batch(p->console_socket, &p->to_frontend);
+    if (received == 0) {
+        return;
+    }
+
+    // Reassembly decodes in place, so spectators have to be sent the datagrams first
+    fan_out(p, received);
+
+    int need_idr = 0;
+    for (int i = 0; i < received; i++) {
+        if (p->frame_type == VANILLA_PIPE_FRAME_VIDEO) {
+            need_idr |= framer_handle_video(batch_buffers[i], batch_msgs[i].msg_len);
+        } else {
+            framer_handle_audio(batch_buffers[i], batch_msgs[i].msg_len);
+        }
+    }
+    p->to_frontend.datagrams += received;
+
+    if (need_idr) {
+        // Ask on the frontend's behalf, it can't decode anything until an IDR arrives
+        request_idr_from_console(p->slot);
+    }
+}
+
+void forward_from_console(relay_port *p)
+{
+    int primary = is_primary_slot(p->slot);
+    vanilla_ring *ring = (primary && p->ring_channel != -1) ? shm_ring_get(p->ring_channel) : NULL;
+    if (ring) {
+        forward_to_ring(p, ring);
+    } else if (primary && p->frame_type && framer_is_active()) {
+        forward_to_framer(p);
+    } else if (p->frame_type == VANILLA_PIPE_FRAME_VIDEO && p->slot->video_fec_group) {
+        forward_with_fec(p);
+    } else if (primary && p->bundle_type && bundler_is_active()) {
+        forward_to_bundle(p);
+    } else {
+        forward_to_frontend(p);
+    }
+}
+
+void print_relay_stats(const relay_slot *s)
+{
+    for (int i = 0; i < RELAY_PORT_COUNT; i++) {
+        const relay_port *p = &s->ports[i];
+        if (!p->to_frontend.recv_calls && !p->to_console.recv_calls && !p->to_console.send_calls) {
+            continue;
+        }
+
+        print_info("PORT %u ON %s: CONSOLE->FRONTEND %llu DATAGRAMS (%llu BYTES, %llu DROPPED) IN %llu RECV/%llu SEND CALLS, "
+                   "FRONTEND->CONSOLE %llu DATAGRAMS (%llu BYTES, %llu DROPPED) IN %llu RECV/%llu SEND CALLS",
+                   p->port, s->interface,
+                   (unsigned long long) p->to_frontend.datagrams, (unsigned long long) p->to_frontend.bytes,
+                   (unsigned long long) p->to_frontend.dropped, (unsigned long long) p->to_frontend.recv_calls,
+                   (unsigned long long) p->to_frontend.send_calls,
+                   (unsigned long long) p->to_console.datagrams, (unsigned long long) p->to_console.bytes,
+                   (unsigned long long) p->to_console.dropped, (unsigned long long) p->to_console.recv_calls,
+                   (unsigned long long) p->to_console.send_calls);
+    }
+
+    if (s->fec_parity_sent) {
+        print_info("SENT %llu VIDEO PARITY DATAGRAMS ON %s", (unsigned long long) s->fec_parity_sent, s->interface);
+    }
+
+    const VanillaStallStats *w = &s->watchdog.stats;
+    if (w->connected_us) {
+        print_info("WATCHDOG ON %s: %llu STALLS, %llu RECOVERED IN %llu MS ON AVERAGE, STREAMING %.2f%% OF %llu S WATCHED",
+                   s->interface, (unsigned long long) w->stalls, (unsigned long long) w->recoveries,
+                   (unsigned long long) (w->recoveries ? w->recovery_us / w->recoveries / 1000 : 0),
+                   100.0 - 100.0 * w->stalled_us / w->connected_us, (unsigned long long) (w->connected_us / 1000000));
+    }
+}
+
+// Replace a port's console-facing socket, in case the old one has stopped receiving (the
+// interface going down and up under it, for example)
+int reopen_console_socket(relay_port *p)
+{
+    relay_slot *s = p->slot;
+    if (p->console_socket != -1) {
+        close(p->console_socket);
+    }
+
+    p->console_socket = open_socket(p->port, s->bind_to_interface ? s->interface : NULL, 0);
+    if (p->console_socket == -1) {
+        return VANILLA_ERROR;
+    }
+
+    add_to_epoll(p->console_socket, slot_tag(s, RELAY_SLOT_TAG_CONSOLE + (p - s->ports)));
+    return VANILLA_SUCCESS;
+}
+
+int is_port_watched(const relay_port *p)
+{
+    const relay_slot *s = p->slot;
+    int index = p - s->ports;
+    return relay_config.stall_threshold_ms[index] != 0
+           && s->client_address.s_addr != 0
+           && !p->on_uring
+           && !(is_primary_slot(s) && nat_is_installed());
+}
+
+void take_recovery_step(relay_slot *s, int step, uint64_t now)
+{
+    const escalation *e = &s->watchdog;
+    uint32_t into_stall = (now - e->stall_start_us) / 1000;
+    int taken = 1;
+
+    switch (step) {
+    case VANILLA_RECOVERY_IDR:
+        print_info("REQUESTING IDR ON %s, %u MS INTO STALL", s->interface, into_stall);
+        request_idr_from_console(s);
+        break;
+    case VANILLA_RECOVERY_REBIND:
+        print_info("REOPENING STALLED PORTS ON %s, %u MS INTO STALL", s->interface, into_stall);
+        for (int i = 0; i < RELAY_PORT_COUNT; i++) {
+            if (e->stalled_streams & (1 << i)) {
+                reopen_console_socket(&s->ports[i]);
+            }
+        }
+        break;
+    case VANILLA_RECOVERY_REASSOCIATE:
+        // A port that couldn't be reopened last time gets another go with the new association
+        for (int i = 0; i < RELAY_PORT_COUNT; i++) {
+            if (s->ports[i].console_socket == -1) {
+                reopen_console_socket(&s->ports[i]);
+            }
+        }
+        if (!reassociate_slot(s)) {
+            // Still counts as having got this far, it's tried again with the repeats
+            taken = 0;
+            break;
+        }
+        print_info("REASSOCIATING ON %s, %u MS INTO STALL", s->interface, into_stall);
+        break;
+    }
+
+    escalation_step_taken(&s->watchdog, step, taken, now);
+}
+
+// Look for ports the console has gone quiet on, and escalate on the slot for as long as it lasts.
+// Progress is whatever was received for the frontend, the same in every forwarding mode.
+void watch_slot(relay_slot *s, uint64_t now, uint64_t elapsed)
+{
+    int watched = 0;
+    uint64_t progress_us[RELAY_PORT_COUNT];
+
+    for (int i = 0; i < RELAY_PORT_COUNT; i++) {
+        relay_port *p = &s->ports[i];
+
+        int port_watched = is_port_watched(p);
+        watched |= port_watched;
+
+        // An unwatched port starts from now when it's watched again, e.g. the next time a frontend binds
+        if (!port_watched || p->to_frontend.bytes != p->watched_bytes) {
+            p->watched_bytes = p->to_frontend.bytes;
+            p->progress_us = now;
+        }
+        progress_us[i] = p->progress_us;
+    }
+
+    if (!watched) {
+        // The frontend gave up first
+        escalation_stop(&s->watchdog, now);
+        return;
+    }
+
+    int step = escalation_check(&s->watchdog, relay_config.stall_threshold_ms, progress_us, now, elapsed);
+    if (step != -1) {
+        take_recovery_step(s, step, now);
+    }
+}
+
+void handle_watchdog_timer()
+{
+    uint64_t expirations;
+    read(watchdog_timer, &expirations, sizeof(expirations));
+
+    uint64_t now = now_us();
+    uint64_t elapsed = last_watchdog_us ? now - last_watchdog_us : 0;
+    last_watchdog_us = now;
+
+    for (int i = 0; i < relay_slot_count; i++) {
+        watch_slot(&relay_slots[i], now, elapsed);
+    }
+}
+
+typedef struct {
+    const char *name;
+    const char *type;
+    const char *help;
+    uint32_t flag;
+    size_t offset;
+    int is_signed;
+    double scale;
+} link_metric;
+
+static const link_metric link_metrics[] = {
+    {"vanilla_pipe_link_signal_dbm", "gauge", "Signal strength of the console", VANILLA_PIPE_LINK_SIGNAL, offsetof(vanilla_pipe_link_stats, signal_dbm), 1, 1},
+    {"vanilla_pipe_link_tx_bitrate_bits_per_second", "gauge", "Rate frames are sent to the console at", VANILLA_PIPE_LINK_TX_BITRATE, offsetof(vanilla_pipe_link_stats, tx_bitrate), 0, 100000},
+    {"vanilla_pipe_link_rx_bitrate_bits_per_second", "gauge", "Rate frames are received from the console at", VANILLA_PIPE_LINK_RX_BITRATE, offsetof(vanilla_pipe_link_stats, rx_bitrate), 0, 100000},
+    {"vanilla_pipe_link_tx_mcs", "gauge", "MCS index frames are sent to the console with", VANILLA_PIPE_LINK_TX_MCS, offsetof(vanilla_pipe_link_stats, tx_mcs), 1, 1},
+    {"vanilla_pipe_link_rx_mcs", "gauge", "MCS index frames are received from the console with", VANILLA_PIPE_LINK_RX_MCS, offsetof(vanilla_pipe_link_stats, rx_mcs), 1, 1},
+    {"vanilla_pipe_link_tx_retries", "counter", "Frame retransmissions to the console", VANILLA_PIPE_LINK_RETRIES, offsetof(vanilla_pipe_link_stats, tx_retries), 0, 1},
+    {"vanilla_pipe_link_tx_failed", "counter", "Frames to the console given up on", VANILLA_PIPE_LINK_FAILED, offsetof(vanilla_pipe_link_stats, tx_failed), 0, 1},
+    {"vanilla_pipe_link_beacon_loss", "counter", "Beacons missed from the console", VANILLA_PIPE_LINK_BEACON_LOSS, offsetof(vanilla_pipe_link_stats, beacon_loss), 0, 1},
+    {"vanilla_pipe_link_channel_time_seconds", "counter", "Time the radio spent on the console's channel", VANILLA_PIPE_LINK_CHANNEL_BUSY, offsetof(vanilla_pipe_link_stats, channel_time_ms), 0, 0.001},
+    {"vanilla_pipe_link_channel_busy_seconds", "counter", "Time the console's channel was busy", VANILLA_PIPE_LINK_CHANNEL_BUSY, offsetof(vanilla_pipe_link_stats, channel_busy_ms), 0, 0.001},
+};
+
+void append_family(metrics_writer *w, const char *name, const char *type, const char *help)
+{
+    metrics_append(w, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+void append_port_counter(metrics_writer *w, const char *name, const char *help, size_t field)
+{
+    append_family(w, name, "counter", help);
+    for (int i = 0; i < relay_slot_count; i++) {
+        const relay_slot *s = &relay_slots[i];
+        for (int j = 0; j < RELAY_PORT_COUNT; j++) {
+            const relay_port *p = &s->ports[j];
+            metrics_append(w, "%s_total{interface=\"%s\",port=\"%s\",direction=\"to_frontend\"} %llu\n", name, s->interface, port_names[j],
+                           (unsigned long long) *(const uint64_t *) ((const char *) &p->to_frontend + field));
+            metrics_append(w, "%s_total{interface=\"%s\",port=\"%s\",direction=\"to_console\"} %llu\n", name, s->interface, port_names[j],
+                           (unsigned long long) *(const uint64_t *) ((const char *) &p->to_console + field));
+        }
+    }
+}
+
+void append_nat_counter(metrics_writer *w, const char *name, const char *interface, int port, const char *direction, uint64_t value)
+{
+    metrics_append(w, "%s_total{interface=\"%s\",port=\"%s\",direction=\"%s\"} %llu\n", name, interface, port_names[port], direction,
+                   (unsigned long long) value);
+}
+
+// Only the primary slot is forwarded by nftables, these are its rules' own counters
+void append_nat_metrics(metrics_writer *w)
+{
+    nat_stats nat;
+    if (!relay_config.use_nftables || nat_get_stats(&nat) != VANILLA_SUCCESS) {
+        return;
+    }
+
+    const char *interface = relay_slots[0].interface;
+    append_family(w, "vanilla_pipe_nftables_datagrams", "counter", "Datagrams forwarded by the nftables rules");
+    for (int i = 0; i < NAT_PORT_COUNT; i++) {
+        append_nat_counter(w, "vanilla_pipe_nftables_datagrams", interface, i, "to_frontend", nat.to_frontend[i].packets);
+        append_nat_counter(w, "vanilla_pipe_nftables_datagrams", interface, i, "to_console", nat.to_console[i].packets);
+    }
+
+    append_family(w, "vanilla_pipe_nftables_bytes", "counter", "Bytes forwarded by the nftables rules, including IP and UDP headers");
+    for (int i = 0; i < NAT_PORT_COUNT; i++) {
+        append_nat_counter(w, "vanilla_pipe_nftables_bytes", interface, i, "to_frontend", nat.to_frontend[i].bytes);
+        append_nat_counter(w, "vanilla_pipe_nftables_bytes", interface, i, "to_console", nat.to_console[i].bytes);
+    }
+}
+
+void append_watchdog_metrics(metrics_writer *w)
+{
+    append_family(w, "vanilla_pipe_watchdog_watched_seconds", "counter", "Time a frontend was bound with ports being watched for stalls");
+    for (int i = 0; i < relay_slot_count; i++) {
+        metrics_append(w, "vanilla_pipe_watchdog_watched_seconds_total{interface=\"%s\"} %.3f\n", relay_slots[i].interface, relay_slots[i].watchdog.stats.connected_us / 1e6);
+    }
+
+    append_family(w, "vanilla_pipe_watchdog_stalled_seconds", "counter", "Time watched ports were stalled, from the last datagram before each stall");
+    for (int i = 0; i < relay_slot_count; i++) {
+        metrics_append(w, "vanilla_pipe_watchdog_stalled_seconds_total{interface=\"%s\"} %.3f\n", relay_slots[i].interface, relay_slots[i].watchdog.stats.stalled_us / 1e6);
+    }
+
+    append_family(w, "vanilla_pipe_watchdog_stalled", "gauge", "Whether a watched port is stalled now");
+    for (int i = 0; i < relay_slot_count; i++) {
+        metrics_append(w, "vanilla_pipe_watchdog_stalled{interface=\"%s\"} %i\n", relay_slots[i].interface, relay_slots[i].watchdog.stall_start_us != 0);
+    }
+
+    append_family(w, "vanilla_pipe_watchdog_stalls", "counter", "Times a watched port stopped receiving from the console");
+    for (int i = 0; i < relay_slot_count; i++) {
+        metrics_append(w, "vanilla_pipe_watchdog_stalls_total{interface=\"%s\"} %llu\n", relay_slots[i].interface, (unsigned long long) relay_slots[i].watchdog.stats.stalls);
+    }
+
+    append_family(w, "vanilla_pipe_watchdog_recoveries", "counter", "Stalls that ended with the console sending again");
+    for (int i = 0; i < relay_slot_count; i++) {
+        metrics_append(w, "vanilla_pipe_watchdog_recoveries_total{interface=\"%s\"} %llu\n", relay_slots[i].interface, (unsigned long long) relay_slots[i].watchdog.stats.recoveries);
+    }
+
+    append_family(w, "vanilla_pipe_watchdog_recovery_seconds", "counter", "Time from the start of each recovered stall until the console sent again");
+    for (int i = 0; i < relay_slot_count; i++) {
+        metrics_append(w, "vanilla_pipe_watchdog_recovery_seconds_total{interface=\"%s\"} %.3f\n", relay_slots[i].interface, relay_slots[i].watchdog.stats.recovery_us / 1e6);
+    }
+
+    append_family(w, "vanilla_pipe_watchdog_steps", "counter", "Recovery steps taken");
+    for (int i = 0; i < relay_slot_count; i++) {
+        for (int step = 0; step < VANILLA_RECOVERY_STEP_COUNT; step++) {
+            metrics_append(w, "vanilla_pipe_watchdog_steps_total{interface=\"%s\",step=\"%s\"} %llu\n", relay_slots[i].interface, step_names[step],
+                           (unsigned long long) relay_slots[i].watchdog.stats.steps[step]);
+        }
+    }
+
+    append_family(w, "vanilla_pipe_watchdog_last_step_seconds", "gauge", "How long into the current or last stall each step was taken");
+    for (int i = 0; i < relay_slot_count; i++) {
+        const escalation *wd = &relay_slots[i].watchdog;
+        for (int step = 0; step < wd->steps_taken; step++) {
+            if (wd->stats.step_ms[step]) {
+                metrics_append(w, "vanilla_pipe_watchdog_last_step_seconds{interface=\"%s\",step=\"%s\"} %.3f\n", relay_slots[i].interface, step_names[step],
+                               wd->stats.step_ms[step] / 1000.0);
+            }
+        }
+    }
+}
+
+// Everything is read straight from the relay's own state, it's the thread doing the forwarding
+void render_metrics(metrics_writer *w)
+{
+    append_port_counter(w, "vanilla_pipe_relay_datagrams", "Datagrams relayed in userspace, see vanilla_pipe_nftables_datagrams for what nftables forwards",
+                        offsetof(relay_stats, datagrams));
+    append_port_counter(w, "vanilla_pipe_relay_bytes", "Bytes received for relaying", offsetof(relay_stats, bytes));
+    append_port_counter(w, "vanilla_pipe_relay_dropped", "Datagrams that couldn't be delivered", offsetof(relay_stats, dropped));
+
+    append_nat_metrics(w);
+
+    append_family(w, "vanilla_pipe_client_bound", "gauge", "Whether a frontend is bound as the player");
+    for (int i = 0; i < relay_slot_count; i++) {
+        metrics_append(w, "vanilla_pipe_client_bound{interface=\"%s\"} %i\n", relay_slots[i].interface, relay_slots[i].client_address.s_addr != 0);
+    }
+
+    append_family(w, "vanilla_pipe_client_flags", "gauge", "VANILLA_PIPE_BIND_FLAG_* accepted for the player");
+    for (int i = 0; i < relay_slot_count; i++) {
+        metrics_append(w, "vanilla_pipe_client_flags{interface=\"%s\"} %u\n", relay_slots[i].interface, relay_slots[i].client_flags);
+    }
+
+    append_family(w, "vanilla_pipe_client_binds", "counter", "Times a frontend bound as the player");
+    for (int i = 0; i < relay_slot_count; i++) {
+        metrics_append(w, "vanilla_pipe_client_binds_total{interface=\"%s\"} %llu\n", relay_slots[i].interface, (unsigned long long) relay_slots[i].binds);
+    }
+
+    append_family(w, "vanilla_pipe_spectators", "gauge", "Frontends watching alongside the player");
+    for (int i = 0; i < relay_slot_count; i++) {
+        metrics_append(w, "vanilla_pipe_spectators{interface=\"%s\"} %i\n", relay_slots[i].interface, relay_slots[i].spectator_count);
+    }
+
+    append_family(w, "vanilla_pipe_video_parity", "counter", "Parity datagrams sent with video");
+    for (int i = 0; i < relay_slot_count; i++) {
+        metrics_append(w, "vanilla_pipe_video_parity_total{interface=\"%s\"} %llu\n", relay_slots[i].interface, (unsigned long long) relay_slots[i].fec_parity_sent);
+    }
+
+    append_family(w, "vanilla_pipe_connect_phase_seconds", "gauge", "How long each step of connecting to the console took");
+    for (int i = 0; i < relay_slot_count; i++) {
+        const relay_connect_timings *t = &relay_config.connect_timings[i];
+        const char *interface = relay_slots[i].interface;
+        metrics_append(w, "vanilla_pipe_connect_phase_seconds{interface=\"%s\",phase=\"supplicant\"} %.3f\n", interface, t->supplicant_ms / 1000.0);
+        metrics_append(w, "vanilla_pipe_connect_phase_seconds{interface=\"%s\",phase=\"association\"} %.3f\n", interface, t->association_ms / 1000.0);
+        metrics_append(w, "vanilla_pipe_connect_phase_seconds{interface=\"%s\",phase=\"dhcp\"} %.3f\n", interface, t->dhcp_ms / 1000.0);
+    }
+
+    // Syncing happens before the relay runs, this is whatever was kept from the last one
+    append_family(w, "vanilla_pipe_sync_seconds", "gauge", "How long the last sync with the console took");
+    for (int i = 0; i < relay_slot_count; i++) {
+        const relay_connect_timings *t = &relay_config.connect_timings[i];
+        if (t->sync_ms) {
+            metrics_append(w, "vanilla_pipe_sync_seconds{interface=\"%s\"} %.3f\n", relay_slots[i].interface, t->sync_ms / 1000.0);
+        }
+    }
+
+    append_family(w, "vanilla_pipe_sync_scans", "gauge", "Scans the last sync with the console needed");
+    for (int i = 0; i < relay_slot_count; i++) {
+        const relay_connect_timings *t = &relay_config.connect_timings[i];
+        if (t->sync_ms) {
+            metrics_append(w, "vanilla_pipe_sync_scans{interface=\"%s\"} %u\n", relay_slots[i].interface, t->sync_scans);
+        }
+    }
+
+    append_family(w, "vanilla_pipe_link_samples", "counter", "Link quality samples taken");
+    for (int i = 0; i < relay_slot_count; i++) {
+        metrics_append(w, "vanilla_pipe_link_samples_total{interface=\"%s\"} %u\n", relay_slots[i].interface, relay_slots[i].link_stats.sample);
+    }
+
+    // Only what the driver reported, a missing sample is better than a made up zero
+    for (size_t m = 0; m < sizeof(link_metrics) / sizeof(link_metrics[0]); m++) {
+        const link_metric *metric = &link_metrics[m];
+        int counter = !strcmp(metric->type, "counter");
+        append_family(w, metric->name, metric->type, metric->help);
+        for (int i = 0; i < relay_slot_count; i++) {
+            const vanilla_pipe_link_stats *l = &relay_slots[i].link_stats;
+            if (!(l->valid & metric->flag)) {
+                continue;
+            }
+
+            const void *field = (const char *) l + metric->offset;
+            double value = metric->is_signed ? (double) *(const int32_t *) field : (double) *(const uint32_t *) field;
+            metrics_append(w, "%s%s{interface=\"%s\"} %.15g\n", metric->name, counter ? "_total" : "", relay_slots[i].interface, value * metric->scale);
+        }
+    }
+
+    if (relay_config.watchdog) {
+        append_watchdog_metrics(w);
+    }
+}
+
+#ifdef VANILLA_PIPE_IO_URING
+void uring_fallback(int index)
+{
+    relay_slot *s = &relay_slots[0];
+    s->ports[index].on_uring = 0;
+    add_to_epoll(s->ports[index].console_socket, slot_tag(s, RELAY_SLOT_TAG_CONSOLE + index));
+}
+#endif
+
+void close_slot(relay_slot *s)
+{
+    for (int i = 0; i < s->opened_ports; i++) {
+        close(s->ports[i].console_socket);
+        close(s->ports[i].frontend_socket);
+    }
+    s->opened_ports = 0;
+
+    if (s->control_socket != -1) {
+        close(s->control_socket);
+        s->control_socket = -1;
+    }
+
+    radio_close(&s->radio);
+
+    if (s->restore_power_save) {
+        if (radio_set_power_save(s->interface, 1) == VANILLA_SUCCESS) {
+            print_info("RESTORED POWER SAVE ON %s", s->interface);
+        }
+        s->restore_power_save = 0;
+    }
+}
+
+// With `bind_to_interface`, the console-facing sockets only receive from `interface`. The console
+// sends to fixed ports, so that's the only way more than one slot can have them.
+int open_slot(relay_slot *s, int index, const char *interface, int bind_to_interface, int use_uring)
+{
+    static const in_port_t port_numbers[RELAY_PORT_COUNT] = {PORT_VID, PORT_AUD, PORT_MSG, PORT_CMD, PORT_HID};
+    static const int ring_channels[RELAY_PORT_COUNT] = {VANILLA_RING_VID, VANILLA_RING_AUD, -1, VANILLA_RING_CMD, -1};
+    static const int frame_types[RELAY_PORT_COUNT] = {VANILLA_PIPE_FRAME_VIDEO, VANILLA_PIPE_FRAME_AUDIO, 0, 0, 0};
+    static const int fan_out_ports[RELAY_PORT_COUNT] = {1, 1, 0, 0, 0};
+    static const int bundle_types[RELAY_PORT_COUNT] = {0, VANILLA_PIPE_BUNDLE_AUD, VANILLA_PIPE_BUNDLE_MSG, VANILLA_PIPE_BUNDLE_CMD, VANILLA_PIPE_BUNDLE_HID};
+
+    memset(s, 0, sizeof(*s));
+    s->index = index;
+    s->interface = interface;
+    s->bind_to_interface = bind_to_interface;
+    escalation_init(&s->watchdog, interface, port_names, RELAY_PORT_COUNT);
+    s->port_offset = index * VANILLA_PIPE_SLOT_PORT_STRIDE;
+
+    s->control_socket = open_socket(VANILLA_PIPE_CMD_SERVER_PORT + s->port_offset, NULL, 0);
+    if (s->control_socket == -1) {
+        return VANILLA_ERROR;
+    }
+
+    const char *console_device = bind_to_interface ? interface : NULL;
+    for (; s->opened_ports < RELAY_PORT_COUNT; s->opened_ports++) {
+        int i = s->opened_ports;
+        relay_port *p = &s->ports[i];
+        p->slot = s;
+        p->port = port_numbers[i];
+        p->ring_channel = ring_channels[i];
+        p->frame_type = frame_types[i];
+        p->fan_out = fan_out_ports[i];
+        p->bundle_type = bundle_types[i];
+
+        p->console_address.sin_family = AF_INET;
+        p->console_address.sin_addr.s_addr = inet_addr(CONSOLE_ADDRESS);
+        p->console_address.sin_port = htons(p->port - 100);
+
+        p->frontend_address.sin_family = AF_INET;
+        p->frontend_address.sin_addr.s_addr = 0;
+        p->frontend_address.sin_port = htons(p->port + 200 + s->port_offset);
+
+        // Open an incoming port from the console
+        p->console_socket = open_socket(p->port, console_device, 0);
+        if (p->console_socket == -1) {
+            goto fail;
+        }
+
+        // Open an incoming port from the frontend
+        p->frontend_socket = open_socket(p->port + 100 + s->port_offset, NULL, p->fan_out);
+        if (p->frontend_socket == -1) {
+            close(p->console_socket);
+            goto fail;
+        }
+
+#ifdef VANILLA_PIPE_IO_URING
+        p->on_uring = use_uring && relay_uring_add_socket(i, p->console_socket, p->frontend_socket, &p->frontend_address) == 0;
+#endif
+        if (!p->on_uring) {
+            add_to_epoll(p->console_socket, slot_tag(s, RELAY_SLOT_TAG_CONSOLE + i));
+        }
+        add_to_epoll(p->frontend_socket, slot_tag(s, RELAY_SLOT_TAG_FRONTEND + i));
+    }
+
+    add_to_epoll(s->control_socket, slot_tag(s, RELAY_SLOT_TAG_CONTROL));
+
+    if (relay_config.low_latency) {
+        // Waking up for every beacon interval's buffered frames adds tens of milliseconds
+        int power_save = radio_get_power_save(interface);
+        if (power_save == 1 && radio_set_power_save(interface, 0) == VANILLA_SUCCESS) {
+            s->restore_power_save = 1;
+            print_info("TURNED POWER SAVE OFF ON %s", interface);
+        } else if (power_save == 0) {
+            print_info("POWER SAVE WAS ALREADY OFF ON %s", interface);
+        } else {
+            print_info("COULDN'T TURN POWER SAVE OFF ON %s", interface);
+        }
+    }
+
+    // The relay works without it, there just won't be anything to say about the link
+    if (radio_open(&s->radio, interface) == VANILLA_SUCCESS) {
+        add_to_epoll(radio_get_fd(&s->radio), slot_tag(s, RELAY_SLOT_TAG_RADIO));
+    } else {
+        print_info("LINK STATISTICS ARE NOT AVAILABLE ON %s", interface);
+    }
+
+    if (s->port_offset) {
+        print_info("RELAYING %s WITH FRONTEND PORTS MOVED UP BY %u", interface, s->port_offset);
+    }
+
+    return VANILLA_SUCCESS;
+
+fail:
+    close_slot(s);
+    return VANILLA_ERROR;
+}
+
+int relay_run(const char **wireless_interfaces, int interface_count)
+{
+    int ret = VANILLA_ERROR;
+
+    if (interface_count < 1 || interface_count > VANILLA_PIPE_MAX_SLOTS) {
+        print_info("CAN'T RELAY FOR %i INTERFACES, AT MOST %i ARE SUPPORTED", interface_count, VANILLA_PIPE_MAX_SLOTS);
+        return ret;
+    }
+
+    // The quit event stays open for the life of the process so relay_quit() never writes to a
+    // descriptor that has been closed and reused
+    if (quit_fd == -1) {
+        quit_fd = eventfd(0, EFD_NONBLOCK);
+        if (quit_fd == -1) {
+            print_info("FAILED TO CREATE QUIT EVENT: %i", errno);
+            return ret;
+        }
+    } else {
+        uint64_t count;
+        read(quit_fd, &count, sizeof(count));
+    }
+
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd == -1) {
+        print_info("FAILED TO CREATE EPOLL: %i", errno);
+        return ret;
+    }
+
+    // Put back whatever the relay thread was running as before, it may be the daemon's
+    int old_policy;
+    struct sched_param old_param;
+    cpu_set_t old_affinity;
+    int restore_thread = 0;
+    if (relay_config.realtime) {
+        pthread_t self = pthread_self();
+        pthread_getschedparam(self, &old_policy, &old_param);
+        pthread_getaffinity_np(self, sizeof(old_affinity), &old_affinity);
+
+        int pinned;
+        if (make_thread_realtime(self, relay_config.cpu, &pinned)) {
+            print_info("RELAY THREAD ON SCHED_FIFO PRIORITY %i", TUNING_FIFO_PRIORITY);
+        } else {
+            print_info("COULDN'T PUT RELAY THREAD ON SCHED_FIFO, IT NEEDS CAP_SYS_NICE");
+        }
+        if (pinned) {
+            print_info("RELAY THREAD PINNED TO CPU %i", relay_config.cpu);
+        } else if (relay_config.cpu >= 0) {
+            print_info("COULDN'T PIN RELAY THREAD TO CPU %i", relay_config.cpu);
+        }
+        restore_thread = 1;
+    }
+
+    int use_uring = 0;
+#ifdef VANILLA_PIPE_IO_URING
+    if (relay_config.use_io_uring) {
+        use_uring = (relay_uring_init() == 0);
+        if (use_uring) {
+            add_to_epoll(relay_uring_get_fd(), RELAY_TAG_URING);
+            print_info("USING IO_URING FOR CONSOLE TO FRONTEND RELAY");
+        }
+    }
+#else
+    if (relay_config.use_io_uring) {
+        print_info("BUILT WITHOUT IO_URING SUPPORT, USING EPOLL");
+    }
+#endif
+
+    int shm_listener = shm_ring_listen();
+    if (shm_listener != -1) {
+        add_to_epoll(shm_listener, RELAY_TAG_SHM_LISTEN);
+    }
+
+    frame_listener = framer_listen();
+    if (frame_listener != -1) {
+        add_to_epoll(frame_listener, RELAY_TAG_FRAME_LISTEN);
+    }
+
+    hid_timer = hidgen_open();
+    if (hid_timer != -1) {
+        add_to_epoll(hid_timer, RELAY_TAG_HID_TIMER);
+    }
+
+    bundle_socket = bundler_open();
+    if (bundle_socket != -1) {
+        add_to_epoll(bundle_socket, RELAY_TAG_BUNDLE);
+        add_to_epoll(bundler_get_timer_fd(), RELAY_TAG_BUNDLE_TIMER);
+    }
+
+    radio_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (radio_timer != -1) {
+        struct itimerspec its = {0};
+        its.it_value.tv_sec = RELAY_LINK_STATS_INTERVAL_S;
+        its.it_interval.tv_sec = RELAY_LINK_STATS_INTERVAL_S;
+        timerfd_settime(radio_timer, 0, &its, NULL);
+        add_to_epoll(radio_timer, RELAY_TAG_RADIO_TIMER);
+    }
+
+    last_watchdog_us = 0;
+    if (relay_config.watchdog) {
+        watchdog_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (watchdog_timer != -1) {
+            struct itimerspec its = {0};
+            its.it_value.tv_nsec = RELAY_WATCHDOG_INTERVAL_MS * 1000000L;
+            its.it_interval.tv_nsec = RELAY_WATCHDOG_INTERVAL_MS * 1000000L;
+            timerfd_settime(watchdog_timer, 0, &its, NULL);
+            add_to_epoll(watchdog_timer, RELAY_TAG_WATCHDOG_TIMER);
+
+            for (int i = 0; i < RELAY_PORT_COUNT; i++) {
+                if (relay_config.stall_threshold_ms[i]) {
+                    print_info("WATCHING PORT %s FOR STALLS OF %u MS", port_names[i], relay_config.stall_threshold_ms[i]);
+                }
+            }
+        } else {
+            print_info("FAILED TO START WATCHDOG: %i", errno);
+        }
+    }
+
+    if (relay_config.metrics_port) {
+        metrics_listener = metrics_listen(relay_config.metrics_address, relay_config.metrics_port);
+        if (metrics_listener != -1) {
+            add_to_epoll(metrics_listener, RELAY_TAG_METRICS_LISTEN);
+            print_info("SERVING METRICS ON %s:%u", inet_ntoa(relay_config.metrics_address), relay_config.metrics_port);
+        }
+    }
+
+    relay_slot_count = 0;
+    for (int i = 0; i < interface_count; i++) {
+        if (open_slot(&relay_slots[i], i, wireless_interfaces[i], interface_count > 1, use_uring && i == 0) != VANILLA_SUCCESS) {
+            goto close_sockets;
+        }
+        relay_slot_count++;
+    }
+
+    if (relay_config.low_latency) {
+        print_info("RELAY SOCKETS AT PRIORITY %i, DSCP %i, RECEIVE BUFFER %i BYTES",
+                   relay_socket_tuning.priority, relay_socket_tuning.dscp, relay_socket_tuning.rcvbuf);
+    }
+
+    add_to_epoll(quit_fd, RELAY_TAG_QUIT);
+
+    pprint("READY\n");
+    if (relay_config.ready_callback) {
+        relay_config.ready_callback();
+    }
+
+    struct epoll_event events[RELAY_SLOT_TAG_COUNT * VANILLA_PIPE_MAX_SLOTS + RELAY_TAG_SLOTS];
+    while (!is_interrupted()) {
+        int n = epoll_wait(epoll_fd, events, sizeof(events) / sizeof(events[0]), -1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            print_info("EPOLL WAIT FAILED: %i", errno);
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            uint32_t tag = events[i].data.u32;
+            if (tag == RELAY_TAG_QUIT) {
+                continue;
+            } else if (tag == RELAY_TAG_URING) {
+#ifdef VANILLA_PIPE_IO_URING
+                relay_uring_process(uring_fallback);
+#endif
+            } else if (tag == RELAY_TAG_SHM_LISTEN) {
+                int conn = shm_ring_accept(shm_listener);
+                if (conn != -1) {
+                    add_to_epoll(conn, RELAY_TAG_SHM_CONNECTION);
+                }
+            } else if (tag == RELAY_TAG_SHM_CONNECTION) {
+                shm_ring_read_connection();
+            } else if (tag == RELAY_TAG_FRAME_LISTEN) {
+                framer_accept(frame_listener, epoll_fd, RELAY_TAG_FRAME_CONNECTION);
+            } else if (tag == RELAY_TAG_FRAME_CONNECTION) {
+                framer_handle_connection(events[i].events);
+            } else if (tag == RELAY_TAG_BUNDLE) {
+                bundler_read(deliver_from_bundle);
+            } else if (tag == RELAY_TAG_BUNDLE_TIMER) {
+                bundler_handle_timer();
+            } else if (tag == RELAY_TAG_HID_TIMER) {
+                send_built_input();
+            } else if (tag == RELAY_TAG_RADIO_TIMER) {
+                uint64_t expirations;
+                read(radio_timer, &expirations, sizeof(expirations));
+                for (int j = 0; j < relay_slot_count; j++) {
+                    radio_request_stats(&relay_slots[j].radio);
+                }
+            } else if (tag == RELAY_TAG_WATCHDOG_TIMER) {
+                handle_watchdog_timer();
+            } else if (tag == RELAY_TAG_METRICS_LISTEN) {
+                metrics_accept(metrics_listener, epoll_fd, RELAY_TAG_METRICS_CONNECTION);
+            } else if (tag < RELAY_TAG_SLOTS) {
+                metrics_handle_connection(tag - RELAY_TAG_METRICS_CONNECTION, events[i].events, render_metrics);
+            } else {
+                relay_slot *s = &relay_slots[(tag - RELAY_TAG_SLOTS) / RELAY_SLOT_TAG_COUNT];
+                uint32_t local_tag = (tag - RELAY_TAG_SLOTS) % RELAY_SLOT_TAG_COUNT;
+                if (local_tag == RELAY_SLOT_TAG_CONTROL) {
+                    read_client_control(s);
+                } else if (local_tag == RELAY_SLOT_TAG_RADIO) {
+                    if (radio_read(&s->radio)) {
+                        record_link_sample(s);
+                    }
+                } else if (local_tag < RELAY_SLOT_TAG_FRONTEND) {
+                    forward_from_console(&s->ports[local_tag - RELAY_SLOT_TAG_CONSOLE]);
+                } else {
+                    forward_to_console(&s->ports[local_tag - RELAY_SLOT_TAG_FRONTEND]);
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < relay_slot_count; i++) {
+        relay_slot *s = &relay_slots[i];
+        if (s->client_address.s_addr != 0) {
+            print_info("STOPPED RELAYS ON %s", s->interface);
+            s->client_address.s_addr = 0;
+        }
+
+        while (s->spectator_count > 0) {
+            remove_spectator(s, s->spectator_count - 1, "DISCONNECTED");
+        }
+    }
+
+    shm_ring_destroy();
+    framer_close();
+    bundler_close();
+    hidgen_stop();
+    nat_remove();
+    for (int i = 0; i < relay_slot_count; i++) {
+        print_relay_stats(&relay_slots[i]);
+    }
+
+    ret = VANILLA_SUCCESS;
+
+close_sockets:
+#ifdef VANILLA_PIPE_IO_URING
+    if (use_uring) {
+        relay_uring_exit();
+    }
+#endif
+    for (int i = 0; i < relay_slot_count; i++) {
+        close_slot(&relay_slots[i]);
+    }
+    relay_slot_count = 0;
+    if (shm_listener != -1) {
+        close(shm_listener);
+    }
+    if (frame_listener != -1) {
+        close(frame_listener);
+        frame_listener = -1;
+    }
+    if (bundle_socket != -1) {
+        bundler_exit();
+        bundle_socket = -1;
+    }
+    if (hid_timer != -1) {
+        hidgen_exit();
+        hid_timer = -1;
+    }
+    if (radio_timer != -1) {
+        close(radio_timer);
+        radio_timer = -1;
+    }
+    if (watchdog_timer != -1) {
+        close(watchdog_timer);
+        watchdog_timer = -1;
+    }
+    if (metrics_listener != -1) {
+        metrics_close();
+        close(metrics_listener);
+        metrics_listener = -1;
+    }
+
+    if (restore_thread) {
+        pthread_t self = pthread_self();
+        pthread_setschedparam(self, old_policy, &old_param);
+        pthread_setaffinity_np(self, sizeof(old_affinity), &old_affinity);
+    }
+
+    close(epoll_fd);
+    epoll_fd = -1;
+
+    return ret;
+}
+
+void relay_quit()
+{
+    int fd = quit_fd;
+    if (fd != -1) {
+        uint64_t one = 1;
+        write(fd, &one, sizeof(one));
+    }
+}
@@ -0,0 +1,99 @@
+#ifndef VANILLA_PIPE_RELAY_H
+#define VANILLA_PIPE_RELAY_H
+
+#include <netinet/in.h>
+#include <stdint.h>
+
+#include "def.h"
+
+// The console's ports in the order the relay keeps them: vid, aud, msg, cmd and hid
+#define RELAY_PORT_COUNT 5
+
+// How long each step of connecting a slot took, in milliseconds
+typedef struct {
+    // Starting wpa_supplicant and attaching to it
+    uint32_t supplicant_ms;
+
+    uint32_t association_ms;
+
+    // Until the address and route were set up
+    uint32_t dhcp_ms;
+
+    // How long the last sync with this console took and how many scans it needed, 0 if unknown
+    uint32_t sync_ms;
+    uint32_t sync_scans;
+} relay_connect_timings;
+
+typedef struct {
+    // Forward console traffic with io_uring if it's available, falls back to epoll if it isn't
+    int use_io_uring;
+
+    // Forward in the kernel with nftables rules while a frontend is bound, the userspace relay is
+    // only used if they can't be installed
+    int use_nftables;
+
+    // Log each slot's link quality once a second, next to how many datagrams were relayed and
+    // dropped in that second. It's sampled either way for VANILLA_PIPE_CC_LINK_STATS.
+    int log_link_stats;
+
+    // Turn Wi-Fi power save off on each interface, and give the relay's sockets a higher priority,
+    // DSCP and receive buffer. Power save is turned back on when the relay stops.
+    int low_latency;
+
+    // Run the relay thread on SCHED_FIFO, pinned to `cpu` if it's not negative. The thread's
+    // scheduling is put back when the relay stops.
+    int realtime;
+    int cpu;
+
+    // Serve OpenMetrics on this address and port if the port isn't 0
+    struct in_addr metrics_address;
+    in_port_t metrics_port;
+
+    // Reported by the metrics endpoint, for each interface given to relay_run()
+    relay_connect_timings connect_timings[VANILLA_PIPE_MAX_SLOTS];
+
+    // Watch for ports the console stops sending on while a frontend is bound. A stalled slot is
+    // asked for an IDR, then has the stalled ports' sockets reopened, then reassociates with the
+    // console, each step once the port has been quiet for twice as long as the last.
+    int watchdog;
+
+    // How long each port (see relay_find_port()) may be quiet before it counts as stalled, 0 to not
+    // watch it. Ports nftables or io_uring forward aren't watched.
+    uint32_t stall_threshold_ms[RELAY_PORT_COUNT];
+
+    // Called on relay_run()'s thread to have `slot` reassociate with its console
+    void (*reassociate)(int slot);
+
+    // Called on relay_run()'s thread once every port is open and the relay is ready for frontends
+    void (*ready_callback)();
+} relay_options;
+
+/**
+ * Options for the next call to relay_run()
+ */
+extern relay_options relay_config;
+
+/**
+ * Relay traffic between the console and the frontend until relay_quit() is called
+ *
+ * Each of `wireless_interfaces` is a slot with a console of its own, up to VANILLA_PIPE_MAX_SLOTS.
+ * The frontend ports of slot n are moved up by n * VANILLA_PIPE_SLOT_PORT_STRIDE. Shared memory,
+ * frames, bundles, input deltas, io_uring and nftables are only offered on slot 0.
+ *
+ * All sockets are owned by the calling thread, so nothing here needs to be locked.
+ */
+int relay_run(const char **wireless_interfaces, int interface_count);
+
+/**
+ * Index of the port named `name` ("vid", "aud", "msg", "cmd" or "hid"), or -1 if there isn't one
+ */
+int relay_find_port(const char *name);
+
+/**
+ * Wake up the relay and make relay_run() return
+ *
+ * This is async-signal-safe and can be called from any thread.
+ */
+void relay_quit();
+
+#endif // VANILLA_PIPE_RELAY_H
@@ -0,0 +1,304 @@
+#include "relay_uring.h"
+
+#include <errno.h>
+#include <liburing.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "status.h"
+
+#define URING_ENTRIES 256
+#define URING_MAX_SOCKETS 8
+#define URING_BUFFER_GROUP 0
+#define URING_BUFFER_COUNT 256
+#define URING_BUFFER_SIZE (2048 + sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in))
+
+enum UringOp
+{
+    URING_OP_RECV = 1,
+    URING_OP_SEND = 2
+};
+
+typedef struct {
+    int from_socket;
+    int to_socket;
+    const struct sockaddr_in *to_address;
+
+    // Template for the multishot receive, must stay valid while it's armed
+    struct msghdr recv_msg;
+
+    int received;
+    int disabled;
+} uring_socket;
+
+typedef struct {
+    struct msghdr msg;
+    struct iovec iov;
+    struct sockaddr_in address;
+} uring_send;
+
+static struct io_uring ring;
+static struct io_uring_buf_ring *buf_ring = NULL;
+static unsigned char *buffers = NULL;
+static uring_send sends[URING_BUFFER_COUNT];
+static uring_socket sockets[URING_MAX_SOCKETS];
+static int event_fd = -1;
+static int buffers_returned = 0;
+
+static uint64_t datagrams_forwarded = 0;
+static uint64_t submit_calls = 0;
+
+static uint64_t make_user_data(int op, int index, int bid)
+{
+    return ((uint64_t) op << 32) | ((uint64_t) index << 16) | (uint64_t) bid;
+}
+
+static struct io_uring_sqe *get_sqe()
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+    if (!sqe) {
+        // Submission queue is full, flush it and try again
+        io_uring_submit(&ring);
+        submit_calls++;
+        sqe = io_uring_get_sqe(&ring);
+    }
+    return sqe;
+}
+
+static void recycle_buffer(int bid)
+{
+    io_uring_buf_ring_add(buf_ring, buffers + (size_t) bid * URING_BUFFER_SIZE, URING_BUFFER_SIZE, bid,
+                          io_uring_buf_ring_mask(URING_BUFFER_COUNT), buffers_returned);
+    buffers_returned++;
+}
+
+static int arm_socket(int index)
+{
+    uring_socket *s = &sockets[index];
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe) {
+        return -1;
+    }
+
+    io_uring_prep_recvmsg_multishot(sqe, s->from_socket, &s->recv_msg, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    io_uring_sqe_set_data64(sqe, make_user_data(URING_OP_RECV, index, 0));
+    return 0;
+}
+
+int relay_uring_init()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+
+    int r = io_uring_queue_init_params(URING_ENTRIES, &ring, &params);
+    if (r < 0) {
+        // Older kernels reject the flags, try again without them
+        memset(&params, 0, sizeof(params));
+        r = io_uring_queue_init_params(URING_ENTRIES, &ring, &params);
+    }
+    if (r < 0) {
+        print_info("IO_URING UNAVAILABLE: %i", -r);
+        return -1;
+    }
+
+    buf_ring = io_uring_setup_buf_ring(&ring, URING_BUFFER_COUNT, URING_BUFFER_GROUP, 0, &r);
+    if (!buf_ring) {
+        print_info("IO_URING BUFFER RINGS UNAVAILABLE: %i", -r);
+        goto exit_queue;
+    }
+
+    buffers = malloc((size_t) URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+    if (!buffers) {
+        goto exit_buf_ring;
+    }
+
+    event_fd = eventfd(0, EFD_NONBLOCK);
+    if (event_fd == -1 || io_uring_register_eventfd(&ring, event_fd) < 0) {
+        print_info("FAILED TO REGISTER IO_URING EVENTFD");
+        goto exit_buffers;
+    }
+
+    buffers_returned = 0;
+    for (int i = 0; i < URING_BUFFER_COUNT; i++) {
+        recycle_buffer(i);
+    }
+    io_uring_buf_ring_advance(buf_ring, buffers_returned);
+    buffers_returned = 0;
+
+    memset(sockets, 0, sizeof(sockets));
+    datagrams_forwarded = 0;
+    submit_calls = 0;
+
+    return 0;
+
+exit_buffers:
+    if (event_fd != -1) {
+        close(event_fd);
+        event_fd = -1;
+    }
+    free(buffers);
+    buffers = NULL;
+
+exit_buf_ring:
+    io_uring_free_buf_ring(&ring, buf_ring, URING_BUFFER_COUNT, URING_BUFFER_GROUP);
+    buf_ring = NULL;
+
+exit_queue:
+    io_uring_queue_exit(&ring);
+    return -1;
+}
+
+void relay_uring_exit()
+{
+    print_info("IO_URING RELAY FORWARDED %llu DATAGRAMS IN %llu SUBMITS", (unsigned long long) datagrams_forwarded, (unsigned long long) submit_calls);
+
+    io_uring_unregister_eventfd(&ring);
+    close(event_fd);
+    event_fd = -1;
+
+    io_uring_free_buf_ring(&ring, buf_ring, URING_BUFFER_COUNT, URING_BUFFER_GROUP);
+    buf_ring = NULL;
+
+    io_uring_queue_exit(&ring);
+
+    free(buffers);
+    buffers = NULL;
+}
+
+int relay_uring_get_fd()
+{
+    return event_fd;
+}
+
+int relay_uring_add_socket(int index, int from_socket, int to_socket, const struct sockaddr_in *to_address)
+{
+    if (index >= URING_MAX_SOCKETS) {
+        return -1;
+    }
+
+    uring_socket *s = &sockets[index];
+    memset(s, 0, sizeof(*s));
+    s->from_socket = from_socket;
+    s->to_socket = to_socket;
+    s->to_address = to_address;
+    s->recv_msg.msg_namelen = sizeof(struct sockaddr_in);
+
+    if (arm_socket(index) != 0) {
+        return -1;
+    }
+
+    io_uring_submit(&ring);
+    submit_calls++;
+    return 0;
+}
+
+static void handle_recv(struct io_uring_cqe *cqe, int index, uint64_t *rearm, relay_uring_fallback_t fallback)
+{
+    uring_socket *s = &sockets[index];
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        // Multishot receive has stopped (errors, or ran out of buffers), it'll need arming again
+        *rearm |= (1ULL << index);
+    }
+
+    if (cqe->res < 0) {
+        if (cqe->res == -EINVAL && !s->received) {
+            // Kernel doesn't know about multishot recvmsg
+            print_info("IO_URING MULTISHOT RECEIVE UNSUPPORTED, FALLING BACK");
+            s->disabled = 1;
+            *rearm &= ~(1ULL << index);
+            fallback(index);
+        }
+        return;
+    }
+
+    s->received = 1;
+
+    if (!(cqe->flags & IORING_CQE_F_BUFFER)) {
+        return;
+    }
+
+    int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    unsigned char *buf = buffers + (size_t) bid * URING_BUFFER_SIZE;
+
+    struct io_uring_recvmsg_out *out = io_uring_recvmsg_validate(buf, cqe->res, &s->recv_msg);
+    if (!out || (out->flags & MSG_TRUNC) || s->to_address->sin_addr.s_addr == 0) {
+        // Nowhere to send this (or it's damaged), give the buffer straight back
+        recycle_buffer(bid);
+        return;
+    }
+
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe) {
+        recycle_buffer(bid);
+        return;
+    }
+
+    // Send straight out of the receive buffer, it goes back to the ring when the send completes
+    uring_send *send = &sends[bid];
+    send->address = *s->to_address;
+    send->iov.iov_base = io_uring_recvmsg_payload(out, &s->recv_msg);
+    send->iov.iov_len = io_uring_recvmsg_payload_length(out, cqe->res, &s->recv_msg);
+    memset(&send->msg, 0, sizeof(send->msg));
+    send->msg.msg_name = &send->address;
+    send->msg.msg_namelen = sizeof(send->address);
+    send->msg.msg_iov = &send->iov;
+    send->msg.msg_iovlen = 1;
+
+    io_uring_prep_sendmsg(sqe, s->to_socket, &send->msg, 0);
+    io_uring_sqe_set_data64(sqe, make_user_data(URING_OP_SEND, index, bid));
+}
+
+void relay_uring_process(relay_uring_fallback_t fallback)
+{
+    uint64_t count;
+    read(event_fd, &count, sizeof(count));
+
+    uint64_t rearm = 0;
+    unsigned head;
+    unsigned seen = 0;
+    struct io_uring_cqe *cqe;
+
+    io_uring_for_each_cqe(&ring, head, cqe) {
+        uint64_t data = io_uring_cqe_get_data64(cqe);
+        int op = (int) (data >> 32);
+        int index = (int) ((data >> 16) & 0xFFFF);
+        int bid = (int) (data & 0xFFFF);
+
+        if (op == URING_OP_RECV) {
+            handle_recv(cqe, index, &rearm, fallback);
+        } else if (op == URING_OP_SEND) {
+            if (cqe->res >= 0) {
+                datagrams_forwarded++;
+            }
+            recycle_buffer(bid);
+        }
+
+        seen++;
+    }
+    io_uring_cq_advance(&ring, seen);
+
+    // Return buffers before re-arming, otherwise a receive that stopped with ENOBUFS would stop again
+    if (buffers_returned) {
+        io_uring_buf_ring_advance(buf_ring, buffers_returned);
+        buffers_returned = 0;
+    }
+
+    for (int i = 0; i < URING_MAX_SOCKETS; i++) {
+        if ((rearm & (1ULL << i)) && !sockets[i].disabled) {
+            arm_socket(i);
+        }
+    }
+
+    if (io_uring_sq_ready(&ring)) {
+        io_uring_submit(&ring);
+        submit_calls++;
+    }
+}
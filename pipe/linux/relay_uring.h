@@ -0,0 +1,32 @@
+#ifndef VANILLA_PIPE_RELAY_URING_H
+#define VANILLA_PIPE_RELAY_URING_H
+
+#include <netinet/in.h>
+
+/**
+ * io_uring backend for console-to-frontend forwarding
+ *
+ * Console sockets are read with multishot recvmsg into a provided buffer ring and forwarded with
+ * sendmsg straight out of the same buffer, so a burst of datagrams costs one submit rather than a
+ * recv/sendto pair each. Completions are signalled through an eventfd that the relay's epoll loop
+ * waits on, so everything still runs on the relay thread.
+ */
+
+typedef void (*relay_uring_fallback_t)(int index);
+
+// Returns 0 on success, or -1 if io_uring (or buffer rings) aren't available on this kernel
+int relay_uring_init();
+void relay_uring_exit();
+
+// Eventfd that becomes readable when completions are waiting
+int relay_uring_get_fd();
+
+// Forward everything received on `from_socket` to `*to_address` through `to_socket`. `to_address`
+// is read every time a datagram is forwarded, a zero address drops the datagram.
+int relay_uring_add_socket(int index, int from_socket, int to_socket, const struct sockaddr_in *to_address);
+
+// Handle pending completions. If the kernel turns out not to support multishot receives for a
+// socket, `fallback` is called with its index so it can be handled some other way.
+void relay_uring_process(relay_uring_fallback_t fallback);
+
+#endif // VANILLA_PIPE_RELAY_URING_H
@@ -0,0 +1,109 @@
+#ifndef VANILLA_PIPE_RING_H
+#define VANILLA_PIPE_RING_H
+
+#include <stdint.h>
+
+/**
+ * Shared-memory transport between vanilla-pipe and a frontend on the same host
+ *
+ * The pipe places datagrams from the console straight into a memfd-backed ring per channel and
+ * signals the frontend through an eventfd, instead of sending them over UDP loopback. Each ring has
+ * exactly one producer (the pipe's relay thread) and one consumer (the frontend thread listening
+ * on that channel), so head and tail are each only written by one side.
+ *
+ * Frontend to console traffic still goes over UDP.
+ */
+
+// Abstract unix socket the frontend connects to for the memfd and eventfds
+#define VANILLA_PIPE_SHM_SOCKET "vanilla-pipe-shm"
+
+#define VANILLA_RING_MAGIC 0x5652494E
+#define VANILLA_RING_SLOT_COUNT 512 // Must be a power of 2
+#define VANILLA_RING_SLOT_SIZE 2048
+
+enum VanillaRingChannel
+{
+    VANILLA_RING_VID,
+    VANILLA_RING_AUD,
+    VANILLA_RING_CMD,
+    VANILLA_RING_CHANNEL_COUNT
+};
+
+typedef struct
+{
+    uint32_t size;
+    uint8_t data[VANILLA_RING_SLOT_SIZE];
+} vanilla_ring_slot;
+
+typedef struct
+{
+    // Next slot the pipe will fill, only written by the pipe
+    _Alignas(64) uint32_t head;
+
+    // Next slot the frontend will read, only written by the frontend
+    _Alignas(64) uint32_t tail;
+
+    // Set by the frontend before it sleeps on the eventfd, so the pipe only signals when needed
+    uint32_t waiting;
+
+    // Datagrams the pipe couldn't fit, written by the pipe
+    _Alignas(64) uint32_t dropped;
+
+    vanilla_ring_slot slots[VANILLA_RING_SLOT_COUNT];
+} vanilla_ring;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t channel_count;
+    vanilla_ring rings[VANILLA_RING_CHANNEL_COUNT];
+} vanilla_ring_shm;
+
+static inline vanilla_ring_slot *vanilla_ring_slot_at(vanilla_ring *r, uint32_t index)
+{
+    return &r->slots[index & (VANILLA_RING_SLOT_COUNT - 1)];
+}
+
+// Producer: number of slots that can be filled starting at `head`
+static inline uint32_t vanilla_ring_free(vanilla_ring *r)
+{
+    return VANILLA_RING_SLOT_COUNT - (r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE));
+}
+
+// Producer: make `count` filled slots visible, returns non-zero if the consumer needs waking up
+static inline int vanilla_ring_publish(vanilla_ring *r, uint32_t count)
+{
+    __atomic_store_n(&r->head, r->head + count, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&r->waiting, __ATOMIC_SEQ_CST);
+}
+
+// Consumer: number of slots waiting to be read starting at `tail`
+static inline uint32_t vanilla_ring_pending(vanilla_ring *r)
+{
+    return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - r->tail;
+}
+
+// Consumer: hand the slot at `tail` back to the producer
+static inline void vanilla_ring_release(vanilla_ring *r)
+{
+    __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+}
+
+// Consumer: announce that we're about to sleep, returns non-zero if something arrived in the
+// meantime and we shouldn't. Pairs with the load in vanilla_ring_publish() so no wakeup is lost.
+static inline int vanilla_ring_prepare_wait(vanilla_ring *r)
+{
+    __atomic_store_n(&r->waiting, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->head, __ATOMIC_SEQ_CST) != r->tail) {
+        __atomic_store_n(&r->waiting, 0, __ATOMIC_RELAXED);
+        return 1;
+    }
+    return 0;
+}
+
+static inline void vanilla_ring_finish_wait(vanilla_ring *r)
+{
+    __atomic_store_n(&r->waiting, 0, __ATOMIC_RELAXED);
+}
+
+#endif // VANILLA_PIPE_RING_H
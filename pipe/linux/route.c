@@ -0,0 +1,161 @@
+#include "route.h"
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netlink/netlink.h>
+#include <netlink/route/addr.h>
+#include <netlink/route/route.h>
+#include <linux/if_addr.h>
+
+#include "status.h"
+#include "vanilla.h"
+
+static const char *CONSOLE_ADDRESS = "192.168.1.10";
+
+static int prefix_length(struct in_addr netmask)
+{
+    return __builtin_popcount(netmask.s_addr);
+}
+
+static struct rtnl_addr *make_address(int ifindex, const dhcp_lease *lease)
+{
+    struct rtnl_addr *addr = rtnl_addr_alloc();
+    struct nl_addr *local = nl_addr_build(AF_INET, &lease->address, sizeof(lease->address));
+    if (!addr || !local) {
+        goto fail;
+    }
+    nl_addr_set_prefixlen(local, prefix_length(lease->netmask));
+
+    struct in_addr broadcast = {lease->address.s_addr | ~lease->netmask.s_addr};
+    struct nl_addr *brd = nl_addr_build(AF_INET, &broadcast, sizeof(broadcast));
+
+    rtnl_addr_set_ifindex(addr, ifindex);
+    rtnl_addr_set_local(addr, local);
+    if (brd) {
+        rtnl_addr_set_broadcast(addr, brd);
+        nl_addr_put(brd);
+    }
+
+    // No route to the whole subnet, just to the console
+    rtnl_addr_set_flags(addr, IFA_F_NOPREFIXROUTE);
+
+    nl_addr_put(local);
+    return addr;
+
+fail:
+    if (local) nl_addr_put(local);
+    if (addr) rtnl_addr_put(addr);
+    return NULL;
+}
+
+static struct rtnl_route *make_console_route(int ifindex, const dhcp_lease *lease, uint32_t metric)
+{
+    struct in_addr console;
+    inet_pton(AF_INET, CONSOLE_ADDRESS, &console);
+
+    struct rtnl_route *route = rtnl_route_alloc();
+    struct rtnl_nexthop *nh = rtnl_route_nh_alloc();
+    struct nl_addr *dst = nl_addr_build(AF_INET, &console, sizeof(console));
+    struct nl_addr *src = nl_addr_build(AF_INET, &lease->address, sizeof(lease->address));
+    if (!route || !nh || !dst || !src) {
+        goto fail;
+    }
+    nl_addr_set_prefixlen(dst, 32);
+
+    rtnl_route_set_family(route, AF_INET);
+    rtnl_route_set_table(route, RT_TABLE_MAIN);
+    rtnl_route_set_protocol(route, RTPROT_BOOT);
+    rtnl_route_set_scope(route, RT_SCOPE_LINK);
+    rtnl_route_set_type(route, RTN_UNICAST);
+    rtnl_route_set_dst(route, dst);
+    rtnl_route_set_pref_src(route, src);
+    rtnl_route_set_priority(route, metric);
+
+    rtnl_route_nh_set_ifindex(nh, ifindex);
+    rtnl_route_add_nexthop(route, nh);
+
+    nl_addr_put(dst);
+    nl_addr_put(src);
+    return route;
+
+fail:
+    if (src) nl_addr_put(src);
+    if (dst) nl_addr_put(dst);
+    if (nh) rtnl_route_nh_free(nh);
+    if (route) rtnl_route_put(route);
+    return NULL;
+}
+
+int route_configure(route_config *config, const char *wireless_interface, const dhcp_lease *lease, uint32_t metric)
+{
+    route_unconfigure(config);
+
+    int ifindex = if_nametoindex(wireless_interface);
+    if (ifindex == 0) {
+        print_info("UNKNOWN INTERFACE %s", wireless_interface);
+        return VANILLA_ERROR;
+    }
+
+    config->socket = nl_socket_alloc();
+    if (!config->socket) {
+        return VANILLA_ERROR;
+    }
+
+    int err = nl_connect(config->socket, NETLINK_ROUTE);
+    if (err < 0) {
+        print_info("FAILED TO OPEN NETLINK SOCKET: %s", nl_geterror(err));
+        goto fail;
+    }
+
+    config->address = make_address(ifindex, lease);
+    if (!config->address) {
+        goto fail;
+    }
+
+    err = rtnl_addr_add(config->socket, config->address, NLM_F_REPLACE);
+    if (err < 0) {
+        print_info("FAILED TO ADD ADDRESS TO %s: %s", wireless_interface, nl_geterror(err));
+        rtnl_addr_put(config->address);
+        config->address = NULL;
+        goto fail;
+    }
+
+    config->route = make_console_route(ifindex, lease, metric);
+    if (!config->route) {
+        goto fail;
+    }
+
+    err = rtnl_route_add(config->socket, config->route, NLM_F_REPLACE);
+    if (err < 0) {
+        print_info("FAILED TO ADD CONSOLE ROUTE: %s", nl_geterror(err));
+        rtnl_route_put(config->route);
+        config->route = NULL;
+        goto fail;
+    }
+
+    return VANILLA_SUCCESS;
+
+fail:
+    route_unconfigure(config);
+    return VANILLA_ERROR;
+}
+
+void route_unconfigure(route_config *config)
+{
+    if (config->route) {
+        rtnl_route_delete(config->socket, config->route, 0);
+        rtnl_route_put(config->route);
+        config->route = NULL;
+    }
+
+    if (config->address) {
+        rtnl_addr_delete(config->socket, config->address, 0);
+        rtnl_addr_put(config->address);
+        config->address = NULL;
+    }
+
+    if (config->socket) {
+        nl_socket_free(config->socket);
+        config->socket = NULL;
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef VANILLA_PIPE_ROUTE_H
+#define VANILLA_PIPE_ROUTE_H
+
+#include <stdint.h>
+
+#include "dhcp.h"
+
+/**
+ * Address and route setup on the console's network, over netlink with libnl
+ *
+ * The leased address is added without its subnet route, and the only route added is a host route to
+ * the console, so the rest of the host's traffic never ends up on the console's network.
+ */
+
+struct nl_sock;
+struct rtnl_addr;
+struct rtnl_route;
+
+// What route_configure() added to one interface, zero it before it's first used
+typedef struct
+{
+    struct nl_sock *socket;
+    struct rtnl_addr *address;
+    struct rtnl_route *route;
+} route_config;
+
+// Add the lease's address to `wireless_interface` along with a route to the console. Every
+// interface's console is at the same address, so each needs its own `metric` for the routes to
+// coexist, the relay picks between them by binding to the interface.
+int route_configure(route_config *config, const char *wireless_interface, const dhcp_lease *lease, uint32_t metric);
+
+// Remove whatever route_configure() added
+void route_unconfigure(route_config *config);
+
+#endif // VANILLA_PIPE_ROUTE_H
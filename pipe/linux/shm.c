@@ -0,0 +1,198 @@
+#define _GNU_SOURCE
+#include "shm.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "status.h"
+#include "vanilla.h"
+
+static int memory_fd = -1;
+static vanilla_ring_shm *memory = NULL;
+static int event_fds[VANILLA_RING_CHANNEL_COUNT] = {-1, -1, -1};
+static int connection = -1;
+static int active = 0;
+
+int shm_ring_listen()
+{
+    int skt = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (skt == -1) {
+        return -1;
+    }
+
+    // Abstract namespace, so there's no socket file to clean up
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path + 1, VANILLA_PIPE_SHM_SOCKET, strlen(VANILLA_PIPE_SHM_SOCKET));
+    socklen_t addr_len = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(VANILLA_PIPE_SHM_SOCKET);
+
+    if (bind(skt, (const struct sockaddr *) &addr, addr_len) == -1 || listen(skt, 1) == -1) {
+        print_info("FAILED TO OPEN SHARED MEMORY SOCKET: %i", errno);
+        close(skt);
+        return -1;
+    }
+
+    return skt;
+}
+
+int shm_ring_prepare()
+{
+    shm_ring_destroy();
+
+    memory_fd = memfd_create("vanilla-pipe-ring", MFD_CLOEXEC);
+    if (memory_fd == -1) {
+        print_info("FAILED TO CREATE SHARED MEMORY: %i", errno);
+        return VANILLA_ERROR;
+    }
+
+    if (ftruncate(memory_fd, sizeof(vanilla_ring_shm)) == -1) {
+        goto fail;
+    }
+
+    memory = mmap(NULL, sizeof(vanilla_ring_shm), PROT_READ | PROT_WRITE, MAP_SHARED, memory_fd, 0);
+    if (memory == MAP_FAILED) {
+        memory = NULL;
+        goto fail;
+    }
+
+    // ftruncate gives us zeroed memory, so only the header needs filling in
+    memory->magic = VANILLA_RING_MAGIC;
+    memory->channel_count = VANILLA_RING_CHANNEL_COUNT;
+
+    for (int i = 0; i < VANILLA_RING_CHANNEL_COUNT; i++) {
+        event_fds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (event_fds[i] == -1) {
+            goto fail;
+        }
+    }
+
+    return VANILLA_SUCCESS;
+
+fail:
+    print_info("FAILED TO SET UP SHARED MEMORY: %i", errno);
+    shm_ring_destroy();
+    return VANILLA_ERROR;
+}
+
+int shm_ring_is_prepared()
+{
+    return memory != NULL;
+}
+
+int shm_ring_accept(int listener)
+{
+    int conn = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (conn == -1) {
+        return -1;
+    }
+
+    if (!memory || connection != -1) {
+        // Nobody asked for this (or someone already has it)
+        close(conn);
+        return -1;
+    }
+
+    int fds[1 + VANILLA_RING_CHANNEL_COUNT];
+    fds[0] = memory_fd;
+    memcpy(fds + 1, event_fds, sizeof(event_fds));
+
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    uint32_t size = sizeof(vanilla_ring_shm);
+    struct iovec iov = {&size, sizeof(size)};
+
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(conn, &msg, MSG_NOSIGNAL) == -1) {
+        print_info("FAILED TO SEND SHARED MEMORY: %i", errno);
+        close(conn);
+        return -1;
+    }
+
+    connection = conn;
+    active = 1;
+    print_info("FRONTEND CONNECTED OVER SHARED MEMORY");
+
+    return conn;
+}
+
+void shm_ring_read_connection()
+{
+    if (connection == -1) {
+        return;
+    }
+
+    char buf[16];
+    ssize_t r = recv(connection, buf, sizeof(buf), MSG_DONTWAIT);
+    if (r == 0 || (r < 0 && errno != EAGAIN)) {
+        // Frontend closed its end (or died), go back to sending it UDP
+        shm_ring_destroy();
+    }
+}
+
+void shm_ring_destroy()
+{
+    if (active) {
+        for (int i = 0; i < VANILLA_RING_CHANNEL_COUNT; i++) {
+            if (memory->rings[i].dropped) {
+                print_info("SHARED MEMORY CHANNEL %i DROPPED %u DATAGRAMS", i, memory->rings[i].dropped);
+            }
+        }
+        print_info("FRONTEND DISCONNECTED FROM SHARED MEMORY");
+    }
+    active = 0;
+
+    if (connection != -1) {
+        close(connection);
+        connection = -1;
+    }
+
+    for (int i = 0; i < VANILLA_RING_CHANNEL_COUNT; i++) {
+        if (event_fds[i] != -1) {
+            close(event_fds[i]);
+            event_fds[i] = -1;
+        }
+    }
+
+    if (memory) {
+        munmap(memory, sizeof(vanilla_ring_shm));
+        memory = NULL;
+    }
+
+    if (memory_fd != -1) {
+        close(memory_fd);
+        memory_fd = -1;
+    }
+}
+
+vanilla_ring *shm_ring_get(int channel)
+{
+    return active ? &memory->rings[channel] : NULL;
+}
+
+void shm_ring_notify(int channel)
+{
+    uint64_t one = 1;
+    write(event_fds[channel], &one, sizeof(one));
+}
@@ -0,0 +1,30 @@
+#ifndef VANILLA_PIPE_SHM_H
+#define VANILLA_PIPE_SHM_H
+
+#include "ring.h"
+
+// Open the abstract unix socket local frontends connect to for the shared rings
+int shm_ring_listen();
+
+// Create the memfd and eventfds for a frontend that asked for them in its bind
+int shm_ring_prepare();
+int shm_ring_is_prepared();
+
+// Accept a connection and hand it the memfd and eventfds. Returns the connection, which should be
+// watched for hangup, or -1 if nothing was prepared for it.
+int shm_ring_accept(int listener);
+
+// Handle activity on the connection returned by shm_ring_accept(), tears everything down if the
+// frontend has gone away
+void shm_ring_read_connection();
+
+// Tear down the rings and drop the connection, traffic goes back to UDP
+void shm_ring_destroy();
+
+// Returns the ring for `channel` once a frontend has received it, NULL otherwise
+vanilla_ring *shm_ring_get(int channel);
+
+// Wake up the frontend waiting on `channel`
+void shm_ring_notify(int channel);
+
+#endif // VANILLA_PIPE_SHM_H
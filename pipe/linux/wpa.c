@@ -1,24 +1,32 @@
+#define _GNU_SOURCE
 #include "wpa.h"
 
 #include <arpa/inet.h>
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <libgen.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/eventfd.h>
 #include <sys/prctl.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 #include <wpa_ctrl.h>
 
 #include "def.h"
-#include "ports.h"
+#include "dhcp.h"
+#include "relay.h"
+#include "route.h"
 #include "status.h"
 #include "util.h"
 #include "vanilla.h"
@@ -28,20 +36,16 @@
 
 const char *wpa_ctrl_interface = "/var/run/wpa_supplicant_drc";
 
-pthread_mutex_t running_mutex;
-int running = 0;
+int running = 1;
 
-typedef struct {
-    int from_socket;
-    in_port_t from_port;
-    int to_socket;
-    in_addr_t to_address;
-    in_port_t to_port;
-} relay_ports;
+// Written by quit_loop() so anything waiting on wpa_supplicant wakes up straight away. Like the
+// relay's, it stays open for the life of the process since quit_loop() can come from any thread.
+static int quit_event = -1;
+
+// Set once SIGINT or SIGTERM has been received
+static volatile sig_atomic_t terminating = 0;
 
-struct in_addr client_address = {0};
-pthread_mutex_t client_address_mutex;
-pthread_cond_t client_address_waitcond;
+int wpa_read_stdin = 1;
 
 void lpprint(const char *fmt, va_list args)
 {
@@ -77,6 +81,13 @@ void clear_interrupt()
     running = 1;
 }
 
+static uint64_t monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 void wpa_msg(char *msg, size_t len)
 {
     print_info("%.*s", len, msg);
@@ -87,6 +98,65 @@ void wpa_ctrl_command(struct wpa_ctrl *ctrl, const char *cmd, char *buf, size_t
     wpa_ctrl_request(ctrl, cmd, strlen(cmd), buf, buf_len, NULL /*wpa_msg*/);
 }
 
+int wait_for_wpa_event(struct wpa_ctrl *ctrl, int timeout_ms)
+{
+    uint64_t deadline = monotonic_ms() + timeout_ms;
+
+    struct pollfd fds[2];
+    fds[0].fd = wpa_ctrl_get_fd(ctrl);
+    fds[0].events = POLLIN;
+    fds[1].fd = quit_event;
+    fds[1].events = POLLIN;
+
+    while (1) {
+        if (is_interrupted()) {
+            return -1;
+        }
+        if (wpa_ctrl_pending(ctrl) > 0) {
+            return 1;
+        }
+
+        uint64_t now = monotonic_ms();
+        if (now >= deadline) {
+            return 0;
+        }
+
+        int r = poll(fds, quit_event == -1 ? 1 : 2, (int) (deadline - now));
+        if (r < 0 && errno != EINTR) {
+            print_info("FAILED TO POLL WPA CONTROL INTERFACE: %i", errno);
+            return -1;
+        }
+    }
+}
+
+int wait_for_wpa_message(struct wpa_ctrl *ctrl, const char *prefix, int timeout_ms, char *buf, size_t *buf_len)
+{
+    uint64_t deadline = monotonic_ms() + timeout_ms;
+    size_t prefix_len = strlen(prefix);
+    size_t buf_size = *buf_len;
+
+    while (1) {
+        uint64_t now = monotonic_ms();
+        int r = wait_for_wpa_event(ctrl, now < deadline ? (int) (deadline - now) : 0);
+        if (r != 1) {
+            return r;
+        }
+
+        size_t len = buf_size - 1;
+        if (wpa_ctrl_recv(ctrl, buf, &len) < 0) {
+            continue;
+        }
+        buf[len] = 0;
+
+        if (len >= prefix_len && !memcmp(buf, prefix, prefix_len)) {
+            *buf_len = len;
+            return 1;
+        }
+
+        print_info("WPA EVENT: %.*s", (int) len, buf);
+    }
+}
+
 int get_binary_in_working_directory(const char *bin_name, char *buf, size_t buf_size)
 {
     size_t path_size = get_max_path_length();
@@ -237,18 +307,78 @@ int start_process(const char **argv, pid_t *pid_out, int *stdout_pipe, int *stde
     }
 }
 
+static const char *wpa_supplicant_drc = "wpa_supplicant_drc";
+
+// Whether a NUL-separated command line is wpa_supplicant_drc running on `wireless_interface`
+static int is_supplicant_for(char *cmdline, size_t size, const char *wireless_interface)
+{
+    char *end = cmdline + size;
+    if (strcmp(basename(cmdline), wpa_supplicant_drc)) {
+        return 0;
+    }
+
+    for (char *arg = cmdline; arg < end; arg += strlen(arg) + 1) {
+        char *next = arg + strlen(arg) + 1;
+        if (!strcmp(arg, "-i") && next < end && !strcmp(next, wireless_interface)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Kill a supplicant left on this interface by a vanilla-pipe that didn't exit cleanly. Any others
+// belong to other slots or other daemons, and are left alone.
+void kill_orphaned_supplicant(const char *wireless_interface)
+{
+    DIR *proc = opendir("/proc");
+    if (!proc) {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(proc))) {
+        char *end;
+        long pid = strtol(entry->d_name, &end, 10);
+        if (*end || pid <= 0) {
+            continue;
+        }
+
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%ld/cmdline", pid);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            continue;
+        }
+
+        char cmdline[1024];
+        ssize_t r = read(fd, cmdline, sizeof(cmdline) - 1);
+        close(fd);
+        if (r <= 0) {
+            continue;
+        }
+        cmdline[r] = 0;
+
+        if (!is_supplicant_for(cmdline, r, wireless_interface)) {
+            continue;
+        }
+
+        print_info("KILLING ORPHANED SUPPLICANT %ld ON %s", pid, wireless_interface);
+        kill(pid, SIGKILL);
+
+        // It has to let go of the interface and control socket before the new one can have them
+        for (int i = 0; i < 100 && kill(pid, 0) == 0; i++) {
+            usleep(10000);
+        }
+    }
+
+    closedir(proc);
+}
+
 int start_wpa_supplicant(const char *wireless_interface, const char *config_file, pid_t *pid)
 {
     // TODO: drc-sim has `rfkill unblock wlan`, should we do that too?
 
-    // Kill any potentially orphaned wpa_supplicant_drcs
-    const char *wpa_supplicant_drc = "wpa_supplicant_drc";
-    const char *kill_argv[] = {"killall", "-9", wpa_supplicant_drc, NULL};
-    pid_t kill_pid;
-    int kill_pipe;
-    int r = start_process(kill_argv, &kill_pid, &kill_pipe, NULL);
-    int status;
-    waitpid(kill_pid, &status, 0);
+    kill_orphaned_supplicant(wireless_interface);
 
     size_t path_size = get_max_path_length();
     char *wpa_buf = malloc(path_size);
@@ -259,7 +389,7 @@ int start_wpa_supplicant(const char *wireless_interface, const char *config_file
     print_info("USING WPA CONFIG: %s", config_file);
     int pipe;
 
-    r = start_process(argv, pid, &pipe, NULL);
+    int r = start_process(argv, pid, &pipe, NULL);
     free(wpa_buf);
 
     if (r != VANILLA_SUCCESS) {
@@ -283,20 +413,29 @@ give_up:
 
 void quit_loop()
 {
-    pthread_mutex_lock(&running_mutex);
-    pthread_mutex_lock(&client_address_mutex);
     running = 0;
-    pthread_cond_broadcast(&client_address_waitcond);
-    pthread_mutex_unlock(&client_address_mutex);
-    pthread_mutex_unlock(&running_mutex);
+
+    // Only async-signal-safe calls in here
+    if (quit_event != -1) {
+        uint64_t one = 1;
+        write(quit_event, &one, sizeof(one));
+    }
+
+    relay_quit();
 }
 
 void sigint_handler(int signum)
 {
+    terminating = 1;
     quit_loop();
     signal(signum, SIG_DFL);
 }
 
+int is_terminating()
+{
+    return terminating;
+}
+
 void *read_stdin(void *)
 {
     char *line = NULL;
@@ -317,18 +456,50 @@ void *read_stdin(void *)
     return NULL;
 }
 
-int wpa_setup_environment(const char *wireless_interface, const char *wireless_conf_file, ready_callback_t callback, void *callback_data)
-{
-    int ret = VANILLA_ERROR;
+static pthread_t stdin_thread;
 
+void wpa_reset_interrupt()
+{
     clear_interrupt();
 
+    if (quit_event != -1) {
+        uint64_t count;
+        read(quit_event, &count, sizeof(count));
+    }
+}
+
+// Set up what a sync or connection needs once, however many interfaces it uses
+static void begin_session()
+{
+    if (quit_event == -1) {
+        quit_event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    }
+
     signal(SIGINT, sigint_handler);
     signal(SIGTERM, sigint_handler);
     //install_interrupt_handler();
 
-    pthread_t stdin_thread;
-    pthread_create(&stdin_thread, NULL, read_stdin, NULL);
+    if (wpa_read_stdin) {
+        pthread_create(&stdin_thread, NULL, read_stdin, NULL);
+    }
+}
+
+static void end_session()
+{
+    // Interrupt our stdin thread
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    if (wpa_read_stdin) {
+        pthread_kill(stdin_thread, SIGINT);
+    }
+
+    // Remove our custom sigint signal handler
+    //uninstall_interrupt_handler();
+}
+
+int wpa_setup_environment(const char *wireless_interface, const char *wireless_conf_file, ready_callback_t callback, void *callback_data)
+{
+    int ret = VANILLA_ERROR;
 
     // Check status of interface with NetworkManager
     int is_managed = 0;
@@ -347,22 +518,29 @@ int wpa_setup_environment(const char *wireless_interface, const char *wireless_c
     }
 
     // Start modified WPA supplicant
+    uint64_t phase_start = monotonic_ms();
     pid_t pid;
     int err = start_wpa_supplicant(wireless_interface, wireless_conf_file, &pid);
     if (err != VANILLA_SUCCESS || is_interrupted()) {
         print_info("FAILED TO START WPA SUPPLICANT");
         goto die_and_reenable_managed;
     }
+    print_info("WPA SUPPLICANT STARTED IN %llu MS", (unsigned long long) (monotonic_ms() - phase_start));
 
     // Get control interface
     const size_t buf_len = 1048576;
     char *buf = malloc(buf_len);
     snprintf(buf, buf_len, "%s/%s", wpa_ctrl_interface, wireless_interface);
     struct wpa_ctrl *ctrl;
+    int ctrl_attempts = 0;
     while (!(ctrl = wpa_ctrl_open(buf))) {
         if (is_interrupted()) goto die_and_kill;
-        print_info("WAITING FOR CTRL INTERFACE");
-        sleep(1);
+
+        // The socket normally appears within a few milliseconds of the supplicant initializing
+        if (++ctrl_attempts % 10 == 0) {
+            print_info("WAITING FOR CTRL INTERFACE");
+        }
+        usleep(100000);
     }
 
     if (is_interrupted() || wpa_ctrl_attach(ctrl) < 0) {
@@ -389,15 +567,6 @@ die_and_reenable_managed:
         enable_networkmanager_on_device(wireless_interface);
     }
 
-die:
-    // Interrupt our stdin thread
-    signal(SIGINT, SIG_DFL);
-    signal(SIGTERM, SIG_DFL);
-    pthread_kill(stdin_thread, SIGINT);
-
-    // Remove our custom sigint signal handler
-    //uninstall_interrupt_handler();
-
     return ret;
 }
 
@@ -514,263 +683,214 @@ int enable_networkmanager_on_device(const char *wireless_interface)
     return set_networkmanager_on_device(wireless_interface, 1);
 }
 
-void* do_relay(void *data)
+int call_ip(const char **argv)
 {
-    relay_ports *ports = (relay_ports *) data;
-    char buf[2048];
-    ssize_t read_size;
-    while (running && client_address.s_addr != 0) {
-        read_size = recv(ports->from_socket, buf, sizeof(buf), 0);
-        if (read_size <= 0) {
-            continue;
-        }
-
-        struct sockaddr_in forward = {0};
-        forward.sin_family = AF_INET;
-        forward.sin_addr.s_addr = ports->to_address;
-        forward.sin_port = htons(ports->to_port);
-
-        char ip[20];
-        inet_ntop(AF_INET, &forward.sin_addr, ip, sizeof(ip));
-        // printf("received packet on port %i, forwarding to address %s:%i\n", ports->from_port, ip, ports->to_port);
-        sendto(ports->to_socket, buf, read_size, 0, (const struct sockaddr *) &forward, sizeof(forward));
+    // Destroy default route that dhclient will have created
+    pid_t ip_pid;
+    int r = start_process(argv, &ip_pid, NULL, NULL);
+    if (r != VANILLA_SUCCESS) {
+        print_info("FAILED TO REMOVE CONSOLE ROUTE FROM SYSTEM");
+        return r;
     }
-    return NULL;
-}
-
-relay_ports create_ports(int from_socket, in_port_t from_port, int to_socket, in_addr_t to_addr, in_port_t to_port)
-{
-    relay_ports ports;
-    ports.from_socket = from_socket;
-    ports.from_port = from_port;
-    ports.to_socket = to_socket;
-    ports.to_address = to_addr;
-    ports.to_port = to_port;
-    return ports;
-}
 
-int open_socket(in_port_t port)
-{
-    struct sockaddr_in in = {0};
-    in.sin_family = AF_INET;
-    in.sin_addr.s_addr = INADDR_ANY;
-    in.sin_port = htons(port);
-    
-    int skt = socket(AF_INET, SOCK_DGRAM, 0);
-    if (skt == -1) {
-        return -1;
-    }
+    int ip_status;
+    waitpid(ip_pid, &ip_status, 0);
 
-    struct timeval tv = {0};
-    tv.tv_usec = 250000;
-    setsockopt(skt, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-    
-    if (bind(skt, (const struct sockaddr *) &in, sizeof(in)) == -1) {
-        print_info("FAILED TO BIND PORT %u: %i\n", port, errno);
-        close(skt);
-        return -1;
+    if (!WIFEXITED(ip_status)) {
+        print_info("FAILED TO REMOVE CONSOLE ROUTE FROM SYSTEM");
+        return VANILLA_ERROR;
     }
 
-    return skt;
+    return VANILLA_SUCCESS;
 }
 
-void *open_relay(void *data)
+static const char *get_lease_filename(int slot);
+
+// One console on one wireless interface
+typedef struct
 {
-    in_port_t port = (in_port_t) data;
-    int ret = -1;
+    int index;
+    const char *wireless_interface;
 
-    // Open an incoming port from the console
-    int from_console = open_socket(port);
-    if (from_console == -1) {
-        goto close;
-    }
+    // What we're connected to and the lease applied to it, for the renewal thread
+    char bssid[18];
+    dhcp_lease applied_lease;
+    dhcp_renewal renewal;
+    route_config route;
 
-    // Open an incoming port from the frontend
-    int from_frontend = open_socket(port + 100);
-    if (from_frontend == -1) {
-        goto close_console_connection;
-    }
+    pthread_t thread;
+    int state;
 
-    // print_info("ENTERING MAIN LOOP");
-    pthread_mutex_lock(&running_mutex);
-    while (running) {
-        pthread_mutex_unlock(&running_mutex);
+    uint64_t connect_start;
+    relay_connect_timings timings;
 
-        // print_info("CHECKING CLIENT ADDRESS STATUS");
-        pthread_mutex_lock(&client_address_mutex);
-        struct in_addr addr = {0};
-        while (client_address.s_addr == 0 && running) {
-            pthread_cond_wait(&client_address_waitcond, &client_address_mutex);
-        }
-        // print_info("READ CLIENT ADDRESS");
-        addr = client_address;
-        pthread_mutex_unlock(&client_address_mutex);
-
-        if (addr.s_addr != 0) {
-            print_info("STARTED RELAYS");
-            relay_ports console_to_frontend = create_ports(from_console, port, from_frontend, addr.s_addr, port + 200);
-            relay_ports frontend_to_console = create_ports(from_frontend, port + 100, from_console, inet_addr("192.168.1.10"), port - 100);
-            // here we register mdns
-            pthread_t a_thread, b_thread;
-            pthread_create(&a_thread, NULL, do_relay, &console_to_frontend);
-            pthread_create(&b_thread, NULL, do_relay, &frontend_to_console);
-
-            pthread_join(a_thread, NULL);
-            pthread_join(b_thread, NULL);
-
-            print_info("STOPPED RELAYS");
-        }
+    // Set by the relay when the console has stopped sending, the slot's thread asks wpa_supplicant
+    // to reassociate while it waits for the relay
+    int reassociate;
+} console_slot;
 
-        // print_info("RELAY EXITED");
-        pthread_mutex_lock(&running_mutex);
-    }
-    pthread_mutex_unlock(&running_mutex);
+enum SlotState
+{
+    SLOT_CONNECTING,
+    SLOT_READY,
+    SLOT_FAILED
+};
 
-    ret = 0;
+static console_slot slots[VANILLA_PIPE_MAX_SLOTS];
 
-close_frontend_connection:
-    close(from_frontend);
+// The relay waits here for every slot to be ready, and ready slots wait for the relay to finish
+static pthread_mutex_t slots_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t slots_cond = PTHREAD_COND_INITIALIZER;
+static int relay_finished = 0;
 
-close_console_connection:
-    close(from_console);
+void lease_updated(const dhcp_lease *lease, void *context)
+{
+    console_slot *slot = (console_slot *) context;
+    if (lease->address.s_addr != slot->applied_lease.address.s_addr) {
+        print_info("DHCP ADDRESS CHANGED ON %s", slot->wireless_interface);
+        if (route_configure(&slot->route, slot->wireless_interface, lease, slot->index) != VANILLA_SUCCESS) {
+            return;
+        }
+    }
 
-close:
-    return (void *) ret;
+    slot->applied_lease = *lease;
+    dhcp_save_lease(get_lease_filename(slot->index), lease, slot->bssid);
 }
 
-void create_all_relays()
+// Called on the relay's thread
+void request_reassociation(int index)
 {
-    pthread_t vid_thread, aud_thread, msg_thread, cmd_thread, hid_thread;
-
-    pthread_create(&vid_thread, NULL, open_relay, (void *) PORT_VID);
-    pthread_create(&aud_thread, NULL, open_relay, (void *) PORT_AUD);
-    pthread_create(&msg_thread, NULL, open_relay, (void *) PORT_MSG);
-    pthread_create(&cmd_thread, NULL, open_relay, (void *) PORT_CMD);
-    pthread_create(&hid_thread, NULL, open_relay, (void *) PORT_HID);
-
-    pprint("READY\n");
-
-    pthread_join(vid_thread, NULL);
-    pthread_join(aud_thread, NULL);
-    pthread_join(msg_thread, NULL);
-    pthread_join(cmd_thread, NULL);
-    pthread_join(hid_thread, NULL);
+    pthread_mutex_lock(&slots_mutex);
+    slots[index].reassociate = 1;
+    pthread_cond_broadcast(&slots_cond);
+    pthread_mutex_unlock(&slots_mutex);
 }
 
-int call_ip(const char **argv)
+void reassociate(struct wpa_ctrl *ctrl, console_slot *slot)
 {
-    // Destroy default route that dhclient will have created
-    pid_t ip_pid;
-    int r = start_process(argv, &ip_pid, NULL, NULL);
-    if (r != VANILLA_SUCCESS) {
-        print_info("FAILED TO REMOVE CONSOLE ROUTE FROM SYSTEM");
-        return r;
+    char buf[1024];
+    size_t actual_buf_len = sizeof(buf);
+    uint64_t start = monotonic_ms();
+    wpa_ctrl_command(ctrl, "REASSOCIATE", buf, &actual_buf_len);
+    if (actual_buf_len < 2 || memcmp(buf, "OK", 2)) {
+        print_info("WPA_SUPPLICANT WOULDN'T REASSOCIATE ON %s", slot->wireless_interface);
+        return;
     }
 
-    int ip_status;
-    waitpid(ip_pid, &ip_status, 0);
-
-    if (!WIFEXITED(ip_status)) {
-        print_info("FAILED TO REMOVE CONSOLE ROUTE FROM SYSTEM");
-        return VANILLA_ERROR;
+    // The address and route don't change, the console hands out the same lease every time
+    actual_buf_len = sizeof(buf);
+    int r = wait_for_wpa_message(ctrl, "<3>CTRL-EVENT-CONNECTED", 5000, buf, &actual_buf_len);
+    if (r == 1) {
+        print_info("REASSOCIATED ON %s IN %llu MS", slot->wireless_interface, (unsigned long long) (monotonic_ms() - start));
+    } else if (r == 0) {
+        print_info("STILL REASSOCIATING ON %s AFTER %llu MS", slot->wireless_interface, (unsigned long long) (monotonic_ms() - start));
     }
-
-    return VANILLA_SUCCESS;
 }
 
-void *read_client_control(void *data)
+// Tell the relay this slot can be used, and wait until it's done with it
+void wait_for_relay(struct wpa_ctrl *ctrl, console_slot *slot)
 {
-    int skt = open_socket(VANILLA_PIPE_CMD_SERVER_PORT);
-    uint32_t control_code;
-
-    struct sockaddr_in addr = {0};
-    socklen_t addr_size = sizeof(addr);
-
-    while (running) {
-        ssize_t r = recvfrom(skt, &control_code, sizeof(control_code), 0, (struct sockaddr *) &addr, &addr_size);
-        if (r <= 0) {
+    pthread_mutex_lock(&slots_mutex);
+    slot->state = SLOT_READY;
+    pthread_cond_broadcast(&slots_cond);
+    while (!relay_finished) {
+        if (slot->reassociate) {
+            slot->reassociate = 0;
+
+            // Don't hold the relay up while wpa_supplicant gets on with it
+            pthread_mutex_unlock(&slots_mutex);
+            reassociate(ctrl, slot);
+            pthread_mutex_lock(&slots_mutex);
             continue;
         }
-
-        control_code = ntohl(control_code);
-        switch (control_code) {
-        case VANILLA_PIPE_CC_BIND:
-            print_info("RECEIVED BIND SIGNAL");
-            pthread_mutex_lock(&client_address_mutex);
-            client_address = addr.sin_addr;
-            pthread_cond_broadcast(&client_address_waitcond);
-            pthread_mutex_unlock(&client_address_mutex);
-
-            control_code = htonl(VANILLA_PIPE_CC_BIND_ACK);
-            sendto(skt, &control_code, sizeof(control_code), 0, (struct sockaddr *) &addr, sizeof(addr));
-            break;
-        case VANILLA_PIPE_CC_UNBIND:
-            print_info("RECEIVED UNBIND SIGNAL");
-            pthread_mutex_lock(&client_address_mutex);
-            client_address.s_addr = 0;
-            pthread_cond_broadcast(&client_address_waitcond);
-            pthread_mutex_unlock(&client_address_mutex);
-            break;
-        }
+        pthread_cond_wait(&slots_cond, &slots_mutex);
     }
-    return NULL;
+    pthread_mutex_unlock(&slots_mutex);
 }
 
-int do_connect(struct wpa_ctrl *ctrl, const char *wireless_interface)
+int do_connect(struct wpa_ctrl *ctrl, console_slot *slot)
 {
+    const char *wireless_interface = slot->wireless_interface;
+    uint64_t association_start = monotonic_ms();
+    slot->timings.supplicant_ms = association_start - slot->connect_start;
+    char buf[1024];
+    size_t actual_buf_len;
     while (1) {
-        while (!wpa_ctrl_pending(ctrl)) {
-            sleep(2);
-            print_info("WAITING FOR CONNECTION");
-
-            if (is_interrupted()) return VANILLA_ERROR;
-        }
-
-        char buf[1024];
-        size_t actual_buf_len = sizeof(buf);
-        wpa_ctrl_recv(ctrl, buf, &actual_buf_len);
-        print_info("CONN RECV: %.*s", actual_buf_len, buf);
-
-        if (memcmp(buf, "<3>CTRL-EVENT-CONNECTED", 23) == 0) {
+        actual_buf_len = sizeof(buf);
+        int r = wait_for_wpa_message(ctrl, "<3>CTRL-EVENT-CONNECTED", 2000, buf, &actual_buf_len);
+        if (r == -1) {
+            return VANILLA_ERROR;
+        } else if (r == 1) {
             break;
         }
+        print_info("WAITING FOR CONNECTION ON %s", wireless_interface);
+    }
 
-        if (is_interrupted()) return VANILLA_ERROR;
+    print_info("CONN RECV: %.*s", actual_buf_len, buf);
+
+    // "<3>CTRL-EVENT-CONNECTED - Connection to xx:xx:xx:xx:xx:xx completed ..."
+    const char *to = memmem(buf, actual_buf_len, "Connection to ", 14);
+    slot->bssid[0] = 0;
+    if (to && to + 14 + 17 <= buf + actual_buf_len) {
+        memcpy(slot->bssid, to + 14, 17);
+        slot->bssid[17] = 0;
     }
 
-    print_info("CONNECTED TO CONSOLE");
+    print_info("CONNECTED TO CONSOLE ON %s IN %llu MS", wireless_interface, (unsigned long long) (monotonic_ms() - association_start));
+    uint64_t connected_time = monotonic_ms();
+    slot->timings.association_ms = connected_time - association_start;
 
-    // Use DHCP on interface
-    pid_t dhclient_pid;
-    int r = call_dhcp(wireless_interface, &dhclient_pid);
-    if (r != VANILLA_SUCCESS) {
-        print_info("FAILED TO RUN DHCP ON %s", wireless_interface);
-        return r;
-    } else {
-        print_info("DHCP ESTABLISHED");
+    // The console hands out the same lease every time, so use the one from last time straight away
+    // and confirm it in the background
+    dhcp_lease lease;
+    int saved = slot->bssid[0] && dhcp_load_lease(get_lease_filename(slot->index), &lease, slot->bssid) == VANILLA_SUCCESS;
+    if (saved) {
+        print_info("USING SAVED DHCP LEASE");
     }
 
-    call_ip((const char *[]){"ip", "route", "del", "default", "via", "192.168.1.1", "dev", wireless_interface, NULL});
-    call_ip((const char *[]){"ip", "route", "del", "192.168.1.0/24", "dev", wireless_interface, NULL});
-    call_ip((const char *[]){"route", "add", "-host", "192.168.1.10", "dev", wireless_interface, NULL});
+    // Otherwise, try our own DHCP client first, it's much quicker than starting dhclient and the
+    // route tools. Every console is at the same address, so each slot's route gets its own metric.
+    pid_t dhclient_pid = 0;
+    if ((saved || dhcp_request_lease(wireless_interface, &lease) == VANILLA_SUCCESS)
+        && route_configure(&slot->route, wireless_interface, &lease, slot->index) == VANILLA_SUCCESS) {
+        slot->applied_lease = lease;
+        if (!saved && slot->bssid[0]) {
+            dhcp_save_lease(get_lease_filename(slot->index), &lease, slot->bssid);
+        }
+        dhcp_start_renewal(&slot->renewal, wireless_interface, &lease, saved, lease_updated, slot);
+        print_info("DHCP ESTABLISHED %llu MS AFTER CONNECTING", (unsigned long long) (monotonic_ms() - connected_time));
+    } else {
+        if (is_interrupted()) return VANILLA_ERROR;
 
-    pthread_mutex_init(&running_mutex, NULL);
-    pthread_mutex_init(&client_address_mutex, NULL);
-    pthread_cond_init(&client_address_waitcond, NULL);
-    
-    pthread_t client_control_thread;
-    pthread_create(&client_control_thread, NULL, read_client_control, NULL);
+        print_info("FALLING BACK TO DHCLIENT");
 
-    create_all_relays();
+        int r = call_dhcp(wireless_interface, &dhclient_pid);
+        if (r != VANILLA_SUCCESS) {
+            print_info("FAILED TO RUN DHCP ON %s", wireless_interface);
+            return r;
+        } else {
+            print_info("DHCP ESTABLISHED");
+        }
 
-    pthread_join(client_control_thread, NULL);
-    
-    pthread_cond_destroy(&client_address_waitcond);
-    pthread_mutex_destroy(&client_address_mutex);
-    pthread_mutex_destroy(&running_mutex);
+        char metric[16];
+        snprintf(metric, sizeof(metric), "%i", slot->index);
+        call_ip((const char *[]){"ip", "route", "del", "default", "via", "192.168.1.1", "dev", wireless_interface, NULL});
+        call_ip((const char *[]){"ip", "route", "del", "192.168.1.0/24", "dev", wireless_interface, NULL});
+        call_ip((const char *[]){"route", "add", "-host", "192.168.1.10", "metric", metric, "dev", wireless_interface, NULL});
+    }
+    slot->timings.dhcp_ms = monotonic_ms() - connected_time;
+
+    wait_for_relay(ctrl, slot);
+
+    if (dhclient_pid) {
+        kill(dhclient_pid, SIGTERM);
+        print_info("KILLING DHCLIENT %i", dhclient_pid);
+    } else {
+        dhcp_stop_renewal(&slot->renewal);
+        route_unconfigure(&slot->route);
+    }
 
-    int kill_ret = kill(dhclient_pid, SIGTERM);
-    print_info("KILLING DHCLIENT %i", dhclient_pid);
+    return VANILLA_SUCCESS;
 }
 
 size_t read_line_from_fd(int pipe, char *output, size_t max_output_size)
@@ -818,36 +938,53 @@ size_t get_max_path_length()
     return pathconf(".", _PC_PATH_MAX);
 }
 
-char wireless_authenticate_config_filename[1024] = {0};
-char wireless_connect_config_filename[1024] = {0};
+char wireless_authenticate_config_filenames[VANILLA_PIPE_MAX_SLOTS][1024] = {0};
+char wireless_connect_config_filenames[VANILLA_PIPE_MAX_SLOTS][1024] = {0};
+char lease_filenames[VANILLA_PIPE_MAX_SLOTS][1024] = {0};
+char channel_filenames[VANILLA_PIPE_MAX_SLOTS][1024] = {0};
 
-const char *get_wireless_connect_config_filename()
+// Every slot remembers its own console, slot 0 keeps the names from before there were slots
+static const char *get_slot_filename(char *buf, size_t buf_size, const char *name, int slot)
 {
-    if (wireless_connect_config_filename[0] == 0) {
+    if (buf[0] == 0) {
         // Not initialized yet, do this now
-        get_home_directory_file("vanilla_wpa_connect.conf", wireless_connect_config_filename, sizeof(wireless_connect_config_filename));
+        char filename[64];
+        if (slot == 0) {
+            snprintf(filename, sizeof(filename), "vanilla_%s.conf", name);
+        } else {
+            snprintf(filename, sizeof(filename), "vanilla_%s_%i.conf", name, slot);
+        }
+        get_home_directory_file(filename, buf, buf_size);
     }
-    return wireless_connect_config_filename;
+    return buf;
 }
 
-const char *get_wireless_authenticate_config_filename()
+const char *get_wireless_connect_config_filename(int slot)
 {
-    if (wireless_authenticate_config_filename[0] == 0) {
-        // Not initialized yet, do this now
-        get_home_directory_file("vanilla_wpa_key.conf", wireless_authenticate_config_filename, sizeof(wireless_authenticate_config_filename));
-    }
-    return wireless_authenticate_config_filename;
+    return get_slot_filename(wireless_connect_config_filenames[slot], sizeof(wireless_connect_config_filenames[slot]), "wpa_connect", slot);
+}
+
+const char *get_wireless_authenticate_config_filename(int slot)
+{
+    return get_slot_filename(wireless_authenticate_config_filenames[slot], sizeof(wireless_authenticate_config_filenames[slot]), "wpa_key", slot);
+}
+
+static const char *get_lease_filename(int slot)
+{
+    return get_slot_filename(lease_filenames[slot], sizeof(lease_filenames[slot]), "lease", slot);
+}
+
+static const char *get_channel_filename(int slot)
+{
+    return get_slot_filename(channel_filenames[slot], sizeof(channel_filenames[slot]), "channel", slot);
 }
 
 struct sync_args {
     uint16_t code;
+    int slot;
 };
 
-struct connect_args {
-    const char *wireless_interface;
-};
-
-int create_connect_config(const char *input_config, const char *bssid)
+int create_connect_config(const char *input_config, const char *bssid, int slot)
 {
     FILE *in_file = fopen(input_config, "r");
     if (!in_file) {
@@ -855,7 +992,7 @@ int create_connect_config(const char *input_config, const char *bssid)
         return VANILLA_ERROR;
     }
     
-    FILE *out_file = fopen(get_wireless_connect_config_filename(), "w");
+    FILE *out_file = fopen(get_wireless_connect_config_filename(slot), "w");
     if (!out_file) {
         print_info("FAILED TO OPEN OUTPUT CONFIG FILE");
         return VANILLA_ERROR;
@@ -879,104 +1016,237 @@ int create_connect_config(const char *input_config, const char *bssid)
     fclose(in_file);
     fclose(out_file);
 
+    // Any lease we remember is from whatever we were synced with before
+    unlink(get_lease_filename(slot));
+
     return VANILLA_SUCCESS;
 }
 
-int sync_with_console_internal(struct wpa_ctrl *ctrl, uint16_t code)
+// The 5GHz channels the console's access point uses (36, 40, 44 and 48)
+static const char *CONSOLE_SCAN_FREQS = "5180,5200,5220,5240";
+
+// Every this many scans without finding a console, scan every channel in case it's somewhere else
+#define SYNC_FULL_SCAN_INTERVAL 4
+
+#define SYNC_MAX_CANDIDATES 8
+
+typedef struct {
+    char bssid[18];
+    int freq;
+    int signal;
+} sync_candidate;
+
+int load_sync_freq(int slot)
+{
+    int freq = 0;
+    FILE *file = fopen(get_channel_filename(slot), "r");
+    if (file) {
+        if (fscanf(file, "freq=%d", &freq) != 1) {
+            freq = 0;
+        }
+        fclose(file);
+    }
+    return freq;
+}
+
+// The channel comes first, so caches written before the sync time was kept still load
+void save_sync_result(int slot, int freq, uint32_t sync_ms, uint32_t scans)
+{
+    FILE *file = fopen(get_channel_filename(slot), "w");
+    if (file) {
+        fprintf(file, "freq=%d\nsync_ms=%u\nscans=%u\n", freq, sync_ms, scans);
+        fclose(file);
+    }
+}
+
+int load_sync_time(int slot, uint32_t *sync_ms, uint32_t *scans)
+{
+    int freq;
+    int found = 0;
+    FILE *file = fopen(get_channel_filename(slot), "r");
+    if (file) {
+        found = fscanf(file, "freq=%d sync_ms=%u scans=%u", &freq, sync_ms, scans) == 3;
+        fclose(file);
+    }
+    return found;
+}
+
+// Collect every console in SCAN_RESULTS ("bssid / frequency / signal level / flags / ssid" lines),
+// strongest first
+int find_sync_candidates(char *results, sync_candidate *candidates, int max_candidates)
+{
+    int count = 0;
+    char *save_line;
+    for (char *line = strtok_r(results, "\n", &save_line); line; line = strtok_r(NULL, "\n", &save_line)) {
+        char *fields[5];
+        int field_count = 0;
+        char *save_field;
+        for (char *f = strtok_r(line, "\t", &save_field); f && field_count < 5; f = strtok_r(NULL, "\t", &save_field)) {
+            fields[field_count++] = f;
+        }
+        if (field_count < 5 || strncmp(fields[4], "WiiU", 4) != 0 || strlen(fields[0]) != 17) {
+            continue;
+        }
+
+        sync_candidate c;
+        memcpy(c.bssid, fields[0], sizeof(c.bssid));
+        c.freq = atoi(fields[1]);
+        c.signal = atoi(fields[2]);
+
+        if (count == max_candidates) {
+            if (c.signal <= candidates[count - 1].signal) {
+                continue;
+            }
+            // Make room by dropping the weakest
+            count--;
+        }
+
+        int i = count++;
+        while (i > 0 && candidates[i - 1].signal < c.signal) {
+            candidates[i] = candidates[i - 1];
+            i--;
+        }
+        candidates[i] = c;
+    }
+    return count;
+}
+
+// Try our PIN with one console, returns 1 if it sent us credentials, 0 if it didn't and -1 if we're
+// quitting
+int try_wps_pin(struct wpa_ctrl *ctrl, const sync_candidate *candidate, uint16_t code)
+{
+    char buf[1024];
+    size_t buf_len = sizeof(buf);
+
+    print_info("TESTING WPS PIN WITH %s ON %d MHZ", candidate->bssid, candidate->freq);
+
+    char wps_buf[100];
+    snprintf(wps_buf, sizeof(wps_buf), "WPS_PIN %s %04d5678", candidate->bssid, code);
+    wpa_ctrl_command(ctrl, wps_buf, buf, &buf_len);
+
+    static const int max_wait_ms = 20000;
+    uint64_t wps_start = monotonic_ms();
+    int ret = 0;
+
+    while (1) {
+        uint64_t elapsed = monotonic_ms() - wps_start;
+        if (elapsed >= max_wait_ms) {
+            print_info("GIVING UP ON %s", candidate->bssid);
+            break;
+        }
+
+        buf_len = sizeof(buf);
+        int r = wait_for_wpa_message(ctrl, "<3>WPS-", max_wait_ms - elapsed, buf, &buf_len);
+        if (r == -1) {
+            ret = -1;
+            break;
+        } else if (r == 0) {
+            continue;
+        }
+
+        print_info("CRED RECV: %.*s", buf_len, buf);
+
+        if (!memcmp("<3>WPS-CRED-RECEIVED", buf, 20)) {
+            print_info("RECEIVED AUTHENTICATION FROM CONSOLE IN %llu MS", (unsigned long long) (monotonic_ms() - wps_start));
+            return 1;
+        }
+
+        // A wrong PIN or a console that isn't listening, no point waiting out the rest
+        if (!memcmp("<3>WPS-FAIL", buf, 11) || !memcmp("<3>WPS-TIMEOUT", buf, 14)) {
+            print_info("WPS FAILED WITH %s", candidate->bssid);
+            break;
+        }
+    }
+
+    buf_len = sizeof(buf);
+    wpa_ctrl_command(ctrl, "WPS_CANCEL", buf, &buf_len);
+    return ret;
+}
+
+int sync_with_console_internal(struct wpa_ctrl *ctrl, uint16_t code, int slot)
 {
     char buf[16384];
     const size_t buf_len = sizeof(buf);
 
+    char event[1024];
+    size_t event_len;
+
+    uint64_t sync_start = monotonic_ms();
+    int scan_count = 0;
     int found_console = 0;
-    char bssid[18];
-    do {
+
+    // Look where we last found a console first, it doesn't usually move
+    int cached_freq = load_sync_freq(slot);
+
+    while (!found_console) {
         size_t actual_buf_len;
 
         if (is_interrupted()) goto exit_loop;
 
+        char scan_cmd[64];
+        if (scan_count == 0 && cached_freq) {
+            snprintf(scan_cmd, sizeof(scan_cmd), "SCAN freq=%d", cached_freq);
+        } else if (scan_count % SYNC_FULL_SCAN_INTERVAL == SYNC_FULL_SCAN_INTERVAL - 1) {
+            snprintf(scan_cmd, sizeof(scan_cmd), "SCAN");
+        } else {
+            snprintf(scan_cmd, sizeof(scan_cmd), "SCAN freq=%s", CONSOLE_SCAN_FREQS);
+        }
+        scan_count++;
+
         // Request scan from hardware
+        uint64_t scan_start = monotonic_ms();
         while (1) {
             if (is_interrupted()) goto exit_loop;
 
-            // print_info("SCANNING");
             actual_buf_len = buf_len;
-            wpa_ctrl_command(ctrl, "SCAN", buf, &actual_buf_len);
+            wpa_ctrl_command(ctrl, scan_cmd, buf, &actual_buf_len);
 
-            if (!memcmp(buf, "FAIL-BUSY", 9)) {
-                //print_info("DEVICE BUSY, RETRYING");
-                sleep(5);
-            } else if (!memcmp(buf, "OK", 2)) {
+            if (!memcmp(buf, "OK", 2)) {
                 break;
-            } else {
+            }
+
+            if (memcmp(buf, "FAIL-BUSY", 9)) {
                 print_info("UNKNOWN SCAN RESPONSE: %.*s (RETRYING)", actual_buf_len, buf);
-                sleep(5);
             }
+
+            // Try again as soon as whatever is keeping the device busy has finished
+            event_len = sizeof(event);
+            if (wait_for_wpa_message(ctrl, "<3>CTRL-EVENT-SCAN-RESULTS", 5000, event, &event_len) == -1) goto exit_loop;
         }
 
-        //print_info("WAITING FOR SCAN RESULTS");
-        actual_buf_len = buf_len;
+        // Wait for this scan to finish, otherwise we'd only get whatever was left from the last one
+        event_len = sizeof(event);
+        int r = wait_for_wpa_message(ctrl, "<3>CTRL-EVENT-SCAN-RESULTS", 10000, event, &event_len);
+        if (r == -1) goto exit_loop;
+        if (r == 0) print_info("SCAN DIDN'T FINISH, USING PREVIOUS RESULTS");
+
+        actual_buf_len = buf_len - 1;
         wpa_ctrl_command(ctrl, "SCAN_RESULTS", buf, &actual_buf_len);
-        print_info("RECEIVED SCAN RESULTS");
+        buf[actual_buf_len] = 0;
 
-        const char *line = strtok(buf, "\n");
-        while (line) {
-            if (is_interrupted()) goto exit_loop;
+        sync_candidate candidates[SYNC_MAX_CANDIDATES];
+        int candidate_count = find_sync_candidates(buf, candidates, SYNC_MAX_CANDIDATES);
+        print_info("%s FOUND %i CONSOLES IN %llu MS", scan_cmd, candidate_count, (unsigned long long) (monotonic_ms() - scan_start));
 
-            if (strstr(line, "WiiU")) {
-                print_info("FOUND WII U, TESTING WPS PIN");
-
-                // Make copy of bssid for later
-                strncpy(bssid, line, sizeof(bssid));
-                bssid[17] = '\0';
-
-                char wps_buf[100];
-                snprintf(wps_buf, sizeof(wps_buf), "WPS_PIN %.*s %04d5678", 17, bssid, code);
-
-                size_t actual_buf_len = buf_len;
-                wpa_ctrl_command(ctrl, wps_buf, buf, &actual_buf_len);
-
-                static const int max_wait = 20;
-                int wait_count = 0;
-                int cred_received = 0;
-
-                while (!is_interrupted()) {
-                    while (wait_count < max_wait && !wpa_ctrl_pending(ctrl)) {
-                        if (is_interrupted()) goto exit_loop;
-                        sleep(1);
-                        wait_count++;
-                    }
-
-                    if (wait_count == max_wait) {
-                        print_info("GIVING UP, RETURNING TO SCANNING");
-                        break;
-                    }
-
-                    actual_buf_len = buf_len;
-                    wpa_ctrl_recv(ctrl, buf, &actual_buf_len);
-                    print_info("CRED RECV: %.*s", buf_len, buf);
-
-                    if (!memcmp("<3>WPS-CRED-RECEIVED", buf, 20)) {
-                        print_info("RECEIVED AUTHENTICATION FROM CONSOLE");
-                        cred_received = 1;
-                        break;
-                    }
-                }
-
-                if (cred_received) {
-                    // Tell wpa_supplicant to save config
-                    actual_buf_len = buf_len;
-                    print_info("SAVING CONFIG", actual_buf_len, buf);
-                    wpa_ctrl_command(ctrl, "SAVE_CONFIG", buf, &actual_buf_len);
-
-                    // Create connect config which needs a couple more parameters
-                    create_connect_config(get_wireless_authenticate_config_filename(), bssid);
-
-                    found_console = 1;
-                }
-            }
-            line = strtok(NULL, "\n");
+        for (int i = 0; i < candidate_count && !found_console; i++) {
+            r = try_wps_pin(ctrl, &candidates[i], code);
+            if (r == -1) goto exit_loop;
+            if (r == 0) continue;
+
+            // Tell wpa_supplicant to save config
+            actual_buf_len = buf_len;
+            print_info("SAVING CONFIG");
+            wpa_ctrl_command(ctrl, "SAVE_CONFIG", buf, &actual_buf_len);
+
+            // Create connect config which needs a couple more parameters
+            create_connect_config(get_wireless_authenticate_config_filename(slot), candidates[i].bssid, slot);
+            save_sync_result(slot, candidates[i].freq, monotonic_ms() - sync_start, scan_count);
+
+            found_console = 1;
         }
-    } while (!found_console);
+    }
+
+    print_info("SYNCED WITH CONSOLE IN %llu MS AFTER %i SCANS", (unsigned long long) (monotonic_ms() - sync_start), scan_count);
 
 exit_loop:
     return found_console ? VANILLA_SUCCESS : VANILLA_ERROR;
@@ -985,21 +1255,41 @@ exit_loop:
 int thunk_to_sync(struct wpa_ctrl *ctrl, void *data)
 {
     struct sync_args *args = (struct sync_args *) data;
-    return sync_with_console_internal(ctrl, args->code);
+    return sync_with_console_internal(ctrl, args->code, args->slot);
 }
 
 int thunk_to_connect(struct wpa_ctrl *ctrl, void *data)
 {
-    struct connect_args *args = (struct connect_args *) data;
-    return do_connect(ctrl, args->wireless_interface);
+    return do_connect(ctrl, (console_slot *) data);
 }
 
-int vanilla_sync_with_console(const char *wireless_interface, uint16_t code)
+void *connect_slot(void *arg)
 {
+    console_slot *slot = (console_slot *) arg;
+    slot->connect_start = monotonic_ms();
+    wpa_setup_environment(slot->wireless_interface, get_wireless_connect_config_filename(slot->index), thunk_to_connect, slot);
+
+    pthread_mutex_lock(&slots_mutex);
+    if (slot->state == SLOT_CONNECTING) {
+        slot->state = SLOT_FAILED;
+        pthread_cond_broadcast(&slots_cond);
+    }
+    pthread_mutex_unlock(&slots_mutex);
+
+    return NULL;
+}
+
+int vanilla_sync_with_console(const char *wireless_interface, int slot, uint16_t code)
+{
+    if (slot < 0 || slot >= VANILLA_PIPE_MAX_SLOTS) {
+        print_info("INVALID SLOT %i", slot);
+        return VANILLA_ERROR;
+    }
+
     const char *wireless_conf_file;
 
     FILE *config;
-    wireless_conf_file = get_wireless_authenticate_config_filename();
+    wireless_conf_file = get_wireless_authenticate_config_filename(slot);
     config = fopen(wireless_conf_file, "w");
     if (!config) {
         print_info("FAILED TO WRITE TEMP CONFIG: %s", wireless_conf_file);
@@ -1011,19 +1301,93 @@ int vanilla_sync_with_console(const char *wireless_interface, uint16_t code)
 
     struct sync_args args;
     args.code = code;
+    args.slot = slot;
 
-    return wpa_setup_environment(wireless_interface, wireless_conf_file, thunk_to_sync, &args);
+    begin_session();
+    int ret = wpa_setup_environment(wireless_interface, wireless_conf_file, thunk_to_sync, &args);
+    end_session();
+
+    return ret;
 }
 
-int vanilla_connect_to_console(const char *wireless_interface)
+int vanilla_connect_to_consoles(const char **wireless_interfaces, int interface_count)
 {
-    struct connect_args args;
-    args.wireless_interface = wireless_interface;
+    if (interface_count < 1 || interface_count > VANILLA_PIPE_MAX_SLOTS) {
+        print_info("CAN'T CONNECT WITH %i INTERFACES, AT MOST %i ARE SUPPORTED", interface_count, VANILLA_PIPE_MAX_SLOTS);
+        return VANILLA_ERROR;
+    }
+
+    begin_session();
+
+    relay_finished = 0;
 
-    return wpa_setup_environment(wireless_interface, get_wireless_connect_config_filename(), thunk_to_connect, &args);
+    // Each slot associates and gets its address on its own thread, so they don't wait on each other
+    int started = 0;
+    for (; started < interface_count; started++) {
+        console_slot *slot = &slots[started];
+        memset(slot, 0, sizeof(*slot));
+        slot->index = started;
+        slot->wireless_interface = wireless_interfaces[started];
+        slot->state = SLOT_CONNECTING;
+        if (pthread_create(&slot->thread, NULL, connect_slot, slot) != 0) {
+            break;
+        }
+    }
+
+    // Only relay once every console is there, a slot's ports are tied to its place in the list
+    int ready;
+    pthread_mutex_lock(&slots_mutex);
+    while (1) {
+        int failed = (started < interface_count);
+        ready = 0;
+        for (int i = 0; i < started; i++) {
+            if (slots[i].state == SLOT_READY) {
+                ready++;
+            } else if (slots[i].state == SLOT_FAILED) {
+                failed = 1;
+            }
+        }
+        if (failed || ready == interface_count) {
+            break;
+        }
+        pthread_cond_wait(&slots_cond, &slots_mutex);
+    }
+    pthread_mutex_unlock(&slots_mutex);
+
+    int ret = VANILLA_ERROR;
+    if (ready == interface_count) {
+        // Every slot is waiting for the relay now, so their timings won't change under us
+        for (int i = 0; i < interface_count; i++) {
+            relay_config.connect_timings[i] = slots[i].timings;
+            load_sync_time(i, &relay_config.connect_timings[i].sync_ms, &relay_config.connect_timings[i].sync_scans);
+        }
+        relay_config.reassociate = request_reassociation;
+        ret = relay_run(wireless_interfaces, interface_count);
+    } else {
+        // Don't leave the other slots trying to connect for a relay that won't start
+        quit_loop();
+    }
+
+    pthread_mutex_lock(&slots_mutex);
+    relay_finished = 1;
+    pthread_cond_broadcast(&slots_cond);
+    pthread_mutex_unlock(&slots_mutex);
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(slots[i].thread, NULL);
+    }
+
+    end_session();
+
+    return ret;
+}
+
+int vanilla_connect_to_console(const char *wireless_interface)
+{
+    return vanilla_connect_to_consoles(&wireless_interface, 1);
 }
 
-int vanilla_has_config()
+int vanilla_has_config(int slot)
 {
-    return (access(get_wireless_connect_config_filename(), F_OK) == 0);
+    return (access(get_wireless_connect_config_filename(slot), F_OK) == 0);
 }
\ No newline at end of file
@@ -10,9 +10,32 @@ extern const char *wpa_ctrl_interface;
 
 typedef int (*ready_callback_t)(struct wpa_ctrl *, void *);
 
+// Quit when "quit" is read from stdin, on by default
+extern int wpa_read_stdin;
+
+// Whether SIGINT or SIGTERM has been received
+int is_terminating();
+
+// Stop whatever wpa_setup_environment() is doing, this can be called from any thread
+void quit_loop();
+
+// Forget any earlier quit_loop() before starting another sync or connection in the same process.
+// Syncing and connecting don't do this themselves, so a stop asked for after this isn't lost.
+void wpa_reset_interrupt();
+
 int wpa_setup_environment(const char *wireless_interface, const char *wireless_conf_file, ready_callback_t callback, void *callback_data);
 
 void wpa_ctrl_command(struct wpa_ctrl *ctrl, const char *cmd, char *buf, size_t *buf_len);
+
+// Wait up to `timeout_ms` for an event from wpa_supplicant, returns 1 if one is waiting, 0 if
+// nothing came and -1 if we're quitting
+int wait_for_wpa_event(struct wpa_ctrl *ctrl, int timeout_ms);
+
+// Wait up to `timeout_ms` for an event starting with `prefix` (e.g. "<3>CTRL-EVENT-CONNECTED"),
+// logging and skipping any others. Returns like wait_for_wpa_event(), with the event in `buf`.
+int wait_for_wpa_message(struct wpa_ctrl *ctrl, const char *prefix, int timeout_ms, char *buf, size_t *buf_len);
+int start_process(const char **argv, pid_t *pid_out, int *stdout_pipe, int *stderr_pipe);
+void kill_orphaned_supplicant(const char *wireless_interface);
 int start_wpa_supplicant(const char *wireless_interface, const char *config_file, pid_t *pid);
 
 int call_dhcp(const char *network_interface, pid_t *dhclient_pid);
@@ -21,9 +44,18 @@ int is_networkmanager_managing_device(const char *wireless_interface, int *is_ma
 int disable_networkmanager_on_device(const char *wireless_interface);
 int enable_networkmanager_on_device(const char *wireless_interface);
 
-int vanilla_sync_with_console(const char *wireless_interface, uint16_t code);
+// Sync with a console for `slot`, each slot remembers its own console
+int vanilla_sync_with_console(const char *wireless_interface, int slot, uint16_t code);
+
+// How long the last successful sync for `slot` took and how many scans it needed, returns 0 if
+// that isn't known
+int load_sync_time(int slot, uint32_t *sync_ms, uint32_t *scans);
+
+// Connect to the console synced with each slot, one interface per slot, and relay for all of them
+// once every one is connected (see relay_run())
+int vanilla_connect_to_consoles(const char **wireless_interfaces, int interface_count);
 int vanilla_connect_to_console(const char *wireless_interface);
-int vanilla_has_config();
+int vanilla_has_config(int slot);
 
 void pprint(const char *fmt, ...);
 